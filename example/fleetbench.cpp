@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <iostream>
+#include <vector>
+
+#include "Roomba.h"
+#include "RoombaFleet.h"
+#include "SimulatedRobot.h"
+
+using namespace net::ysuga;
+using namespace net::ysuga::roomba;
+
+void usage() {
+  std::cout << "USAGE: fleetbench [direct|fleet] [maxRobots]" << std::endl;
+  std::cout << "  direct: decode, odometry and control of all robots on one thread with the virtual clock." << std::endl;
+  std::cout << "  fleet : RoombaFleet with the robots advanced in real time." << std::endl;
+}
+
+static double cpuSeconds() {
+  return (double)clock() / CLOCKS_PER_SEC;
+}
+
+/**
+ * All robots are processed on this thread. The virtual clock advances one stream period per loop.
+ */
+static void benchDirect(uint32_t numRobots, uint32_t numFrames) {
+  std::vector<SimulatedRobot*> robots;
+  std::vector<Roomba*> roombas;
+  for(uint32_t i = 0;i < numRobots;i++) {
+    SimulatedRobot* robot = new SimulatedRobot(Roomba::VERSION_500_SERIES);
+    Roomba* roomba = new Roomba(Roomba::MODEL_500SERIES, "sim", 115200, robot);
+    roomba->safeControl();
+    roomba->runAsync(false);
+    robots.push_back(robot);
+    roombas.push_back(roomba);
+  }
+
+  double start = cpuSeconds();
+  uint32_t processed = 0;
+  for(uint32_t frame = 0;frame < numFrames;frame++) {
+    for(uint32_t i = 0;i < numRobots;i++) {
+      robots[i]->advance(STREAM_PERIOD * 1000);
+      if(roombas[i]->pollSensorData()) {
+        processed++;
+      }
+      if(frame % 10 == 0) {
+        roombas[i]->move(0.2, (i % 3) * 0.1);
+      }
+    }
+  }
+  double elapsed = cpuSeconds() - start;
+
+  printf("direct %6u robots: %8u frames, %8.2f usec CPU per robot frame, %7.4f%% of one core per robot at 66 Hz\n",
+    numRobots, processed, elapsed * 1000000 / processed,
+    elapsed * 1000000 / processed / (STREAM_PERIOD * 1000) * 100);
+
+  for(uint32_t i = 0;i < numRobots;i++) {
+    delete roombas[i];
+  }
+}
+
+struct FleetBenchContext {
+  std::vector<SimulatedRobot*> robots;
+  volatile bool running;
+};
+
+class SimulationThread : public Thread {
+private:
+  FleetBenchContext* m_pContext;
+public:
+  SimulationThread(FleetBenchContext* context) : m_pContext(context) {}
+  void Run() {
+    while(m_pContext->running) {
+      for(uint32_t i = 0;i < m_pContext->robots.size();i++) {
+        m_pContext->robots[i]->advance(STREAM_PERIOD * 1000);
+      }
+      Thread::Sleep(STREAM_PERIOD);
+    }
+  }
+};
+
+static void control(Roomba* roomba, uint32_t index, void* context) {
+  roomba->move(0.2, (index % 3) * 0.1);
+}
+
+/**
+ * RoombaFleet with the simulated robots advanced in real time.
+ */
+static void benchFleet(uint32_t numRobots, uint32_t seconds) {
+  FleetBenchContext context;
+  RoombaFleet* fleet = new RoombaFleet(2, 4);
+  for(uint32_t i = 0;i < numRobots;i++) {
+    SimulatedRobot* robot = new SimulatedRobot(Roomba::VERSION_500_SERIES);
+    fleet->add(new Roomba(Roomba::MODEL_500SERIES, "sim", 115200, robot));
+    fleet->get(i)->safeControl();
+    context.robots.push_back(robot);
+  }
+  fleet->setControlCallback(control, NULL);
+
+  context.running = true;
+  SimulationThread simulation(&context);
+  double start = cpuSeconds();
+  fleet->start();
+  simulation.Start();
+  Thread::Sleep(seconds * 1000);
+  context.running = false;
+  simulation.Join();
+  fleet->stop();
+  double elapsed = cpuSeconds() - start;
+
+  uint32_t frames = 0, callbacks = 0, skipped = 0, maxLatency = 0;
+  double latency = 0;
+  for(uint32_t i = 0;i < numRobots;i++) {
+    RoombaFleetStatistics statistics;
+    fleet->getStatistics(i, &statistics);
+    frames += statistics.frameCount;
+    callbacks += statistics.callbackCount;
+    skipped += statistics.skippedCount;
+    latency += statistics.lastLatency;
+    if(statistics.maxLatency > maxLatency) {
+      maxLatency = statistics.maxLatency;
+    }
+  }
+  printf("fleet  %6u robots: %8u frames, %8u callbacks, %6u skipped, %8.2f usec CPU per robot frame, latency last avg %8.1f usec max %8u usec\n",
+    numRobots, frames, callbacks, skipped, frames ? elapsed * 1000000 / frames : 0.0,
+    latency / numRobots, maxLatency);
+
+  delete fleet;
+}
+
+int main(const int argc, const char* argv[]) {
+  if(argc < 2) {
+    usage();
+    return 0;
+  }
+  uint32_t maxRobots = argc >= 3 ? atoi(argv[2]) : 256;
+
+  for(uint32_t numRobots = 1;numRobots <= maxRobots;numRobots *= 4) {
+    if(strcmp(argv[1], "direct") == 0) {
+      benchDirect(numRobots, 1000);
+    } else if(strcmp(argv[1], "fleet") == 0) {
+      benchFleet(numRobots, 3);
+    } else {
+      usage();
+      return 0;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <vector>
+
+#include "Roomba.h"
+#include "SimulatedRobot.h"
+#include "LinkStatistics.h"
+
+using namespace net::ysuga;
+using namespace net::ysuga::roomba;
+
+void usage() {
+  std::cout << "USAGE: jitterbench [seconds] [loadThreads] [cpu]" << std::endl;
+  std::cout << "  Measures the frame interval of the stream thread with loadThreads busy threads," << std::endl;
+  std::cout << "  with the default scheduling and with SCHED_FIFO, the affinity to cpu and mlockall." << std::endl;
+  std::cout << "  The real-time options need the privilege (root or CAP_SYS_NICE)." << std::endl;
+}
+
+/**
+ * Busy thread like logging and planning: formats strings and allocates memory.
+ */
+class LoadThread : public Thread {
+private:
+  volatile bool* m_pRunning;
+public:
+  volatile uint32_t loops;
+  LoadThread(volatile bool* running) : m_pRunning(running), loops(0) {}
+  void Run() {
+    char line[256];
+    while(*m_pRunning) {
+      std::vector<char*> blocks;
+      for(int i = 0;i < 64;i++) {
+        blocks.push_back(new char[1024]);
+        sprintf(line, "planning step %d of %u", i, loops);
+        memcpy(blocks.back(), line, strlen(line) + 1);
+      }
+      for(int i = 0;i < 64;i++) {
+        delete[] blocks[i];
+      }
+      loops++;
+    }
+  }
+};
+
+static void bench(const char* name, const ThreadAttributes& attributes, uint32_t seconds, uint32_t numLoadThreads) {
+  SimulatedRobot* robot = new SimulatedRobot(Roomba::VERSION_500_SERIES);
+  robot->followClock();
+  Roomba* roomba = new Roomba(Roomba::MODEL_500SERIES, "sim", 115200, robot, false);
+  roomba->SetAttributes(attributes);
+  roomba->connect(Roomba::MODE_SAFE, 1000);
+
+  volatile bool running = true;
+  std::vector<LoadThread*> loads;
+  for(uint32_t i = 0;i < numLoadThreads;i++) {
+    loads.push_back(new LoadThread(&running));
+    loads[i]->Start();
+  }
+
+  roomba->resetLinkStats();
+  Thread::Sleep(seconds * 1000);
+  RoombaLinkStats stats;
+  roomba->getLinkStats(&stats);
+  const LatencyHistogram& jitter = roomba->getLinkStatistics().getFrameJitter();
+
+  running = false;
+  for(uint32_t i = 0;i < numLoadThreads;i++) {
+    loads[i]->Join();
+    delete loads[i];
+  }
+
+  printf("%-9s %s: %6u frames, jitter p50 %6u p99 %6u p99.9 %6u max %6u usec\n",
+    name, roomba->AreAttributesApplied() ? "applied    " : "not applied",
+    stats.frameCount, stats.jitterMedian, stats.jitter99, jitter.getPercentile(99.9), stats.jitterMax);
+  delete roomba;
+}
+
+int main(int argc, char* argv[]) {
+  if(argc > 1 && atoi(argv[1]) <= 0) {
+    usage();
+    return -1;
+  }
+  uint32_t seconds = argc > 1 ? atoi(argv[1]) : 10;
+  uint32_t numLoadThreads = argc > 2 ? atoi(argv[2]) : 8;
+  uint32_t cpu = argc > 3 ? atoi(argv[3]) : 0;
+
+  ThreadAttributes defaultAttributes;
+  bench("default", defaultAttributes, seconds, numLoadThreads);
+
+  ThreadAttributes realtimeAttributes;
+  realtimeAttributes.policy = ThreadAttributes::POLICY_FIFO;
+  realtimeAttributes.priority = 80;
+  realtimeAttributes.affinityMask = 1UL << cpu;
+  realtimeAttributes.prefaultStack = true;
+  if(!Thread::LockMemory()) {
+    std::cout << "mlockall is not permitted." << std::endl;
+  }
+  bench("realtime", realtimeAttributes, seconds, numLoadThreads);
+  return 0;
+}
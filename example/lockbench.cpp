@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <vector>
+#include <map>
+
+#include "Thread.h"
+#include "Clock.h"
+
+using namespace net::ysuga;
+
+void usage() {
+  std::cout << "USAGE: lockbench [operationsPerThread] [maxThreads]" << std::endl;
+  std::cout << "  Measures the locks with short critical sections like the sensor cache of Roomba:" << std::endl;
+  std::cout << "  a counter increment, and a lookup of a map read by many threads." << std::endl;
+}
+
+/**
+ * Lock under the measurement
+ */
+class Lock {
+public:
+  virtual ~Lock() {}
+  virtual void lock(bool write) = 0;
+  virtual void unlock(bool write) = 0;
+};
+
+class MutexLock : public Lock {
+  Mutex m_Mutex;
+public:
+  void lock(bool write) { m_Mutex.Lock(); }
+  void unlock(bool write) { m_Mutex.Unlock(); }
+};
+
+class RWLock : public Lock {
+  ReadWriteLock m_Lock;
+public:
+  void lock(bool write) { if(write) m_Lock.WriteLock(); else m_Lock.ReadLock(); }
+  void unlock(bool write) { if(write) m_Lock.WriteUnlock(); else m_Lock.ReadUnlock(); }
+};
+
+#ifndef WIN32
+class PthreadLock : public Lock {
+  pthread_mutex_t m_Mutex;
+public:
+  explicit PthreadLock(int type = PTHREAD_MUTEX_DEFAULT) {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, type);
+    pthread_mutex_init(&m_Mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+  }
+  ~PthreadLock() { pthread_mutex_destroy(&m_Mutex); }
+  void lock(bool write) { pthread_mutex_lock(&m_Mutex); }
+  void unlock(bool write) { pthread_mutex_unlock(&m_Mutex); }
+};
+#endif
+
+struct Shared {
+  Lock* lock;
+  std::map<int, int> cache;
+  volatile uint32_t counter;
+};
+
+/**
+ * Increments the counter (write), or looks up the cache with one write in 64 (read mostly).
+ */
+class Worker : public Thread {
+private:
+  Shared* m_pShared;
+  uint32_t m_Operations;
+  bool m_ReadMostly;
+public:
+  int sum;
+  Worker(Shared* shared, uint32_t operations, bool readMostly) : m_pShared(shared), m_Operations(operations), m_ReadMostly(readMostly), sum(0) {}
+  void Run() {
+    for(uint32_t i = 0;i < m_Operations;i++) {
+      bool write = !m_ReadMostly || (i % 64) == 0;
+      m_pShared->lock->lock(write);
+      if(write) {
+        m_pShared->counter++;
+        m_pShared->cache[i % 32] = i;
+      } else {
+        std::map<int, int>::const_iterator it = m_pShared->cache.find(i % 32);
+        if(it != m_pShared->cache.end()) {
+          sum += (*it).second;
+        }
+      }
+      m_pShared->lock->unlock(write);
+    }
+  }
+};
+
+static void bench(const char* name, Lock* lock, bool readMostly, uint32_t operations, uint32_t maxThreads) {
+  printf("%-8s %-11s", name, readMostly ? "read-mostly" : "write");
+  for(uint32_t numThreads = 1;numThreads <= maxThreads;numThreads *= 2) {
+    Shared shared;
+    shared.lock = lock;
+    shared.counter = 0;
+    for(int i = 0;i < 32;i++) {
+      shared.cache[i] = i;
+    }
+    std::vector<Worker*> workers;
+    for(uint32_t i = 0;i < numThreads;i++) {
+      workers.push_back(new Worker(&shared, operations, readMostly));
+    }
+    uint64_t begin = Clock::getInstance()->now();
+    for(uint32_t i = 0;i < numThreads;i++) {
+      workers[i]->Start();
+    }
+    for(uint32_t i = 0;i < numThreads;i++) {
+      workers[i]->Join();
+      delete workers[i];
+    }
+    uint64_t time = Clock::getInstance()->now() - begin;
+    if(!readMostly && shared.counter != operations * numThreads) {
+      printf(" LOST UPDATES");
+    }
+    printf(" %2u thr %7.1f ns/op", numThreads, time * 1000.0 / ((double)operations * numThreads));
+  }
+  printf("\n");
+}
+
+int main(int argc, char* argv[]) {
+  if(argc > 1 && atoi(argv[1]) <= 0) {
+    usage();
+    return -1;
+  }
+  uint32_t operations = argc > 1 ? atoi(argv[1]) : 1000000;
+  uint32_t maxThreads = argc > 2 ? atoi(argv[2]) : 8;
+
+  MutexLock mutex;
+  RWLock rwlock;
+  bench("Mutex", &mutex, false, operations, maxThreads);
+#ifndef WIN32
+  PthreadLock pthread;
+  bench("pthread", &pthread, false, operations, maxThreads);
+#ifdef __GLIBC__
+  PthreadLock adaptive(PTHREAD_MUTEX_ADAPTIVE_NP);
+  bench("adaptive", &adaptive, false, operations, maxThreads);
+#endif
+#endif
+  bench("Mutex", &mutex, true, operations, maxThreads);
+  bench("RWLock", &rwlock, true, operations, maxThreads);
+#ifndef WIN32
+  bench("pthread", &pthread, true, operations, maxThreads);
+#endif
+  return 0;
+}
@@ -0,0 +1,96 @@
+/********************************************************
+ * Atomic.h
+ *
+ * Portable atomic operations for Windows and Unix.
+ * @author ysuga@ysuga.net
+ ********************************************************/
+
+#ifndef ATOMIC_HEADER_INCLUDED
+#define ATOMIC_HEADER_INCLUDED
+
+#include "type.h"
+
+#ifdef WIN32
+#include <windows.h>
+#endif
+
+namespace net {
+	namespace ysuga {
+
+		/**
+		 * @brief Read the value written by another thread (acquire)
+		 */
+		inline uint32_t atomicLoad(volatile uint32_t* value) {
+#ifdef WIN32
+			return (uint32_t)::InterlockedCompareExchange((volatile LONG*)value, 0, 0);
+#else
+			uint32_t result = *value;
+			__sync_synchronize();
+			return result;
+#endif
+		}
+
+		/**
+		 * @brief Order the memory accesses before the fence with those after it (full barrier)
+		 */
+		inline void atomicFence() {
+#ifdef WIN32
+			::MemoryBarrier();
+#else
+			__sync_synchronize();
+#endif
+		}
+
+		/**
+		 * @brief Publish the value to the other threads (release)
+		 */
+		inline void atomicStore(volatile uint32_t* value, uint32_t newValue) {
+#ifdef WIN32
+			::InterlockedExchange((volatile LONG*)value, (LONG)newValue);
+#else
+			__sync_synchronize();
+			*value = newValue;
+#endif
+		}
+
+		/**
+		 * @brief Add to the value and return the result
+		 */
+		inline uint32_t atomicAdd(volatile uint32_t* value, uint32_t delta) {
+#ifdef WIN32
+			return (uint32_t)::InterlockedExchangeAdd((volatile LONG*)value, (LONG)delta) + delta;
+#else
+			return __sync_add_and_fetch(value, delta);
+#endif
+		}
+
+		/**
+		 * @brief Replace the value with newValue if it equals to expected
+		 *
+		 * @return The value before the operation. The replacement is done if it equals to expected.
+		 */
+		inline uint32_t atomicCompareExchange(volatile uint32_t* value, uint32_t expected, uint32_t newValue) {
+#ifdef WIN32
+			return (uint32_t)::InterlockedCompareExchange((volatile LONG*)value, (LONG)newValue, (LONG)expected);
+#else
+			return __sync_val_compare_and_swap(value, expected, newValue);
+#endif
+		}
+
+		/**
+		 * @brief Replace the value and return the previous value
+		 */
+		inline uint32_t atomicExchange(volatile uint32_t* value, uint32_t newValue) {
+#ifdef WIN32
+			return (uint32_t)::InterlockedExchange((volatile LONG*)value, (LONG)newValue);
+#else
+			// __sync_lock_test_and_set is only an acquire barrier.
+			__sync_synchronize();
+			return __sync_lock_test_and_set(value, newValue);
+#endif
+		}
+
+	};
+};
+
+#endif
@@ -0,0 +1,377 @@
+/********************************************************
+ * Behavior.h
+ *
+ * Cooperative behaviors of many robots on one thread.
+ * @author ysuga@ysuga.net
+ ********************************************************/
+
+#ifndef BEHAVIOR_HEADER_INCLUDED
+#define BEHAVIOR_HEADER_INCLUDED
+
+#include "common.h"
+#include "type.h"
+#include "Timer.h"
+#include "SensorQuery.h"
+#include "Thread.h"
+
+#include <vector>
+
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#include <exception>
+#endif
+
+namespace net {
+	namespace ysuga {
+		namespace roomba {
+
+			class Roomba;
+
+			/**
+			 * @brief Resumable Behavior of a Robot
+			 *
+			 * A behavior is a state machine which never blocks. resume is called by
+			 * BehaviorExecutor, and returns after requesting what to wait for
+			 * (nextFrame, sleep, query, drive) or finish. The executor calls resume again
+			 * when the awaited event occurs. The sensor accessors of Roomba (isLeftBump etc.)
+			 * may wait for the stream, so read the sensors by query.
+			 * With the C++20 coroutines, CoBehavior writes the same as a coroutine.
+			 *
+			 * @code
+			 * class Bounce : public Behavior {
+			 *   int m_State;
+			 *   SensorQuery m_Query;
+			 * public:
+			 *   Bounce(Roomba* roomba) : Behavior(roomba), m_State(0) {}
+			 *   void resume() {
+			 *     static const uint8_t bumps = BUMPS_AND_WHEEL_DROPS;
+			 *     switch(m_State) {
+			 *     case 0: m_State = 1; drive(200, 200); break;
+			 *     case 1: m_State = 2; query(&bumps, 1, &m_Query); break;
+			 *     case 2:
+			 *       if(m_Query.getValue(BUMPS_AND_WHEEL_DROPS) & 0x02) { m_State = 3; drive(0, 0); } // left bumper
+			 *       else { m_State = 1; nextFrame(); }
+			 *       break;
+			 *     case 3: finish(); break;
+			 *     }
+			 *   }
+			 * };
+			 * @endcode
+			 */
+			class Behavior {
+				friend class BehaviorExecutor;
+			public:
+				enum Await {
+					AWAIT_NONE,
+					AWAIT_FRAME,
+					AWAIT_TIME,
+					AWAIT_SUBMIT,
+					AWAIT_QUERY,
+					AWAIT_SEND,
+					AWAIT_FINISHED,
+				};
+
+			private:
+				Roomba* m_pRoomba;
+				Await m_Await;
+				uint32_t m_Frame;
+				uint32_t m_WaitTime;
+				pcwrapper::Timer m_Timer;
+				SensorQuery* m_pQuery;
+				std::vector<uint8_t> m_QueryIds; // retried while the request is busy
+
+				bool isResumable();
+				uint32_t getWaitTime();
+
+			public:
+				/**
+				 * @brief Constructor
+				 *
+				 * @param roomba Robot controlled by this behavior
+				 */
+				LIBROOMBA_API Behavior(Roomba* roomba);
+
+				/**
+				 * @brief Destructor
+				 */
+				LIBROOMBA_API virtual ~Behavior();
+
+			protected:
+				/**
+				 * @brief Robot controlled by this behavior
+				 */
+				Roomba& roomba() { return *m_pRoomba; }
+
+				/**
+				 * @brief Resume after the next sensor frame (requires Roomba::runAsync)
+				 */
+				LIBROOMBA_API void nextFrame();
+
+				/**
+				 * @brief Resume after the time
+				 *
+				 * @param msec Time [msec]
+				 */
+				LIBROOMBA_API void sleep(uint32_t msec);
+
+				/**
+				 * @brief Request Sensors and resume when the response is received.
+				 *
+				 * While the request is busy (see Roomba::tryRequestSensorAsync), it is sent again
+				 * when the behavior is checked, without blocking the other behaviors.
+				 * @param sensorIds Sensor IDs or sensor group ids
+				 * @param count Number of sensor IDs
+				 * @param query [OUT] Handle of the query. Values are available in the next resume.
+				 * @throw PreconditionNotMetError
+				 * @see Roomba::requestSensorAsync
+				 */
+				LIBROOMBA_API void query(const uint8_t* sensorIds, const uint32_t count, SensorQuery* query);
+
+				/**
+				 * @brief Send Drive Direct and resume when the commands are written to the port.
+				 *
+				 * @param rightWheel Velocity of the right wheel [mm/sec]
+				 * @param leftWheel Velocity of the left wheel [mm/sec]
+				 * @throw PreconditionNotMetError
+				 * @see Roomba::driveDirect
+				 */
+				LIBROOMBA_API void drive(int16_t rightWheel, int16_t leftWheel);
+
+				/**
+				 * @brief Finish the behavior
+				 */
+				LIBROOMBA_API void finish();
+
+			public:
+				/**
+				 * @brief Run the behavior until the next wait.
+				 */
+				virtual void resume() = 0;
+
+				/**
+				 * @brief Is the behavior finished?
+				 */
+				LIBROOMBA_API bool isFinished() const { return m_Await == AWAIT_FINISHED; }
+			};
+
+#if defined(__cpp_impl_coroutine)
+			/**
+			 * @brief Coroutine of a CoBehavior (C++20). Returned by CoBehavior::run.
+			 */
+			class BehaviorTask {
+			public:
+				struct promise_type {
+					std::exception_ptr m_Exception;
+
+					BehaviorTask get_return_object() { return BehaviorTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+					std::suspend_always initial_suspend() noexcept { return std::suspend_always(); }
+					std::suspend_always final_suspend() noexcept { return std::suspend_always(); }
+					void return_void() {}
+					void unhandled_exception() { m_Exception = std::current_exception(); }
+				};
+
+			private:
+				std::coroutine_handle<promise_type> m_Handle;
+
+				BehaviorTask(const BehaviorTask&);
+				BehaviorTask& operator=(const BehaviorTask&);
+
+			public:
+				BehaviorTask() : m_Handle() {}
+				explicit BehaviorTask(std::coroutine_handle<promise_type> handle) : m_Handle(handle) {}
+				BehaviorTask(BehaviorTask&& task) noexcept : m_Handle(task.m_Handle) { task.m_Handle = std::coroutine_handle<promise_type>(); }
+				BehaviorTask& operator=(BehaviorTask&& task) noexcept {
+					if(this != &task) {
+						if(m_Handle) {
+							m_Handle.destroy();
+						}
+						m_Handle = task.m_Handle;
+						task.m_Handle = std::coroutine_handle<promise_type>();
+					}
+					return *this;
+				}
+				~BehaviorTask() {
+					if(m_Handle) {
+						m_Handle.destroy();
+					}
+				}
+
+			public:
+				bool isValid() const { return (bool)m_Handle; }
+				bool isDone() const { return !m_Handle || m_Handle.done(); }
+
+				/**
+				 * @brief Run until the next co_await. Rethrows the exception thrown by the coroutine.
+				 */
+				void resume() {
+					m_Handle.resume();
+					if(m_Handle.promise().m_Exception) {
+						std::exception_ptr e = m_Handle.promise().m_Exception;
+						m_Handle.promise().m_Exception = std::exception_ptr();
+						std::rethrow_exception(e);
+					}
+				}
+			};
+
+			/**
+			 * @brief Awaitable returned by the requests of CoBehavior.
+			 *
+			 * The request is made before the co_await, so the coroutine only suspends
+			 * here, and BehaviorExecutor resumes it when the awaited event occurs.
+			 */
+			struct BehaviorAwaiter {
+				bool await_ready() const noexcept { return false; }
+				void await_suspend(std::coroutine_handle<>) const noexcept {}
+				void await_resume() const noexcept {}
+			};
+
+			/**
+			 * @brief Behavior written as a C++20 coroutine
+			 *
+			 * The coroutine returned by run is resumed by BehaviorExecutor like the state
+			 * machine of Behavior. The requests return awaitables, and the behavior
+			 * finishes when run returns. Only built by the compilers with the coroutines
+			 * (__cpp_impl_coroutine); the library itself does not require them.
+			 *
+			 * @code
+			 * class Bounce : public CoBehavior {
+			 *   SensorQuery m_Query;
+			 * public:
+			 *   Bounce(Roomba* roomba) : CoBehavior(roomba) {}
+			 *   BehaviorTask run() {
+			 *     static const uint8_t bumps = BUMPS_AND_WHEEL_DROPS;
+			 *     co_await drive(200, 200);
+			 *     while(1) {
+			 *       co_await query(&bumps, 1, &m_Query);
+			 *       if(m_Query.getValue(BUMPS_AND_WHEEL_DROPS) & 0x02) break; // left bumper
+			 *       co_await nextFrame();
+			 *     }
+			 *     co_await drive(0, 0);
+			 *   }
+			 * };
+			 * @endcode
+			 */
+			class CoBehavior : public Behavior {
+			private:
+				BehaviorTask m_Task;
+
+			public:
+				/**
+				 * @brief Constructor
+				 *
+				 * @param roomba Robot controlled by this behavior
+				 */
+				CoBehavior(Roomba* roomba) : Behavior(roomba) {}
+
+			protected:
+				/**
+				 * @brief Coroutine of the behavior. Called at the first resume.
+				 */
+				virtual BehaviorTask run() = 0;
+
+				/**
+				 * @brief co_await for the next sensor frame (see Behavior::nextFrame)
+				 */
+				BehaviorAwaiter nextFrame() { Behavior::nextFrame(); return BehaviorAwaiter(); }
+
+				/**
+				 * @brief co_await for the time [msec] (see Behavior::sleep)
+				 */
+				BehaviorAwaiter sleep(uint32_t msec) { Behavior::sleep(msec); return BehaviorAwaiter(); }
+
+				/**
+				 * @brief co_await for the response of the query (see Behavior::query)
+				 */
+				BehaviorAwaiter query(const uint8_t* sensorIds, const uint32_t count, SensorQuery* query) {
+					Behavior::query(sensorIds, count, query);
+					return BehaviorAwaiter();
+				}
+
+				/**
+				 * @brief co_await until Drive Direct is written to the port (see Behavior::drive)
+				 */
+				BehaviorAwaiter drive(int16_t rightWheel, int16_t leftWheel) {
+					Behavior::drive(rightWheel, leftWheel);
+					return BehaviorAwaiter();
+				}
+
+			public:
+				virtual void resume() {
+					if(!m_Task.isValid()) {
+						m_Task = run();
+					}
+					if(!m_Task.isDone()) {
+						m_Task.resume();
+					}
+					if(m_Task.isDone()) {
+						finish();
+					}
+				}
+			};
+#endif
+
+			/**
+			 * @brief Single-threaded Executor of Behaviors
+			 *
+			 * Resumes the behaviors of many robots on the calling thread. The waits are
+			 * checked without blocking, so a slow robot does not delay the others.
+			 * run sleeps until a frame of the robots (Roomba::setNotifyEvent), a response
+			 * of the queries, the written commands, the earliest sleep or stop.
+			 * A robot is served by one executor at a time.
+			 */
+			class BehaviorExecutor {
+			private:
+				std::vector<Behavior*> m_Behaviors;
+				std::vector<Roomba*> m_Roombas; // notify m_Wakeup
+				Event m_Wakeup;
+				StopToken m_StopToken;
+
+				void wait();
+
+			public:
+				/**
+				 * @brief Constructor
+				 */
+				LIBROOMBA_API BehaviorExecutor();
+
+				/**
+				 * @brief Destructor
+				 */
+				LIBROOMBA_API ~BehaviorExecutor();
+
+			public:
+				/**
+				 * @brief Add Behavior. The behavior is resumed in the next runOnce.
+				 *
+				 * @param behavior Behavior (not owned by the executor)
+				 */
+				LIBROOMBA_API void add(Behavior* behavior);
+
+				/**
+				 * @brief Resume the behaviors whose waits are satisfied.
+				 *
+				 * @return Number of resumed behaviors
+				 */
+				LIBROOMBA_API uint32_t runOnce();
+
+				/**
+				 * @brief Run until all behaviors finish or stop is called.
+				 */
+				LIBROOMBA_API void run();
+
+				/**
+				 * @brief Make run return. Can be called from any thread.
+				 */
+				LIBROOMBA_API void stop();
+
+				/**
+				 * @brief Number of behaviors which are not finished.
+				 */
+				LIBROOMBA_API uint32_t getNumRunning() const;
+			};
+
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,140 @@
+/********************************************************
+ * Clock.h
+ *
+ * Clock used by Thread::Sleep and Timer.
+ * @author ysuga@ysuga.net
+ ********************************************************/
+
+#ifndef CLOCK_HEADER_INCLUDED
+#define CLOCK_HEADER_INCLUDED
+
+#include "type.h"
+#include "Thread.h"
+
+#include <set>
+
+namespace net {
+	namespace ysuga {
+
+		/**
+		 * @brief Clock Interface
+		 *
+		 * All the waits (Thread::Sleep) and the time measurements (pcwrapper::Timer)
+		 * of the library use the clock returned by getInstance. Replace it with
+		 * SimulatedClock to run the tests faster than real time.
+		 */
+		class LIBTHREAD_API Clock {
+		public:
+			virtual ~Clock() {}
+
+		public:
+			/**
+			 * @brief Current Time [usec]. The origin is not specified.
+			 */
+			virtual uint64_t now() = 0;
+
+			/**
+			 * @brief Sleep the calling thread [msec]
+			 */
+			virtual void sleep(uint32_t milliSeconds) = 0;
+
+			/**
+			 * @brief Sleep the calling thread until the time or the stop request [msec]
+			 *
+			 * The default implementation sleeps in slices of 5 ms to check the token.
+			 * @return true if the stop is requested.
+			 */
+			virtual bool sleepUnlessStopped(uint32_t milliSeconds, const StopToken& stopToken);
+
+			/**
+			 * @brief Called before a Thread starts.
+			 */
+			virtual void attachThread() {}
+
+			/**
+			 * @brief Called when a Thread exits.
+			 */
+			virtual void detachThread() {}
+
+		public:
+			/**
+			 * @brief Get Clock used by the library
+			 */
+			static Clock* getInstance();
+
+			/**
+			 * @brief Set Clock used by the library
+			 *
+			 * Call before any Thread is started. The clock is not owned by the library.
+			 *
+			 * @param clock Clock. NULL restores the system clock.
+			 */
+			static void setInstance(Clock* clock);
+		};
+
+		/**
+		 * @brief Wall Clock of the Operating System
+		 */
+		class LIBTHREAD_API SystemClock : public Clock {
+		public:
+			virtual uint64_t now();
+			virtual void sleep(uint32_t milliSeconds);
+
+			/**
+			 * @brief Waits on the token (StopToken::Wait) instead of polling it.
+			 */
+			virtual bool sleepUnlessStopped(uint32_t milliSeconds, const StopToken& stopToken);
+		};
+
+		/**
+		 * @brief Virtual Clock for Tests
+		 *
+		 * The time advances only when all the threads (the thread which creates the
+		 * clock and the Threads started after setInstance) are sleeping, and it jumps
+		 * to the earliest wake up time. So the scenario runs as fast as the CPU allows
+		 * and the order of the wake ups is deterministic.
+		 * Threads blocked on a Mutex or a device are not regarded as sleeping. A thread
+		 * which blocks for long (e.g. on a device) must detachThread while it blocks
+		 * (Thread::Join does). If the time does not advance within the stall timeout of
+		 * real time, the process is aborted rather than advancing the time by the real time.
+		 */
+		class LIBTHREAD_API SimulatedClock : public Clock {
+		private:
+			Mutex m_Mutex;
+			uint64_t m_Now;
+			uint32_t m_NumThreads;
+			std::multiset<uint64_t> m_WakeTimes;
+			uint32_t m_StallTimeout;
+			SystemClock m_SystemClock;
+
+			void advanceIfAllSleeping();
+			bool waitFor(uint32_t milliSeconds, const StopToken* stopToken);
+
+		public:
+			/**
+			 * @brief Constructor
+			 *
+			 * @param stallTimeout Real time without any advance after which the stall is reported [msec].
+			 * 0 waits forever.
+			 */
+			SimulatedClock(uint32_t stallTimeout = 10);
+
+			virtual ~SimulatedClock();
+
+		public:
+			virtual uint64_t now();
+			virtual void sleep(uint32_t milliSeconds);
+			virtual bool sleepUnlessStopped(uint32_t milliSeconds, const StopToken& stopToken);
+			virtual void attachThread();
+			virtual void detachThread();
+
+			/**
+			 * @brief Advance the time manually [usec]
+			 */
+			void advance(uint64_t usec);
+		};
+
+	};
+};
+
+#endif
@@ -0,0 +1,232 @@
+/********************************************************
+ * LinkStatistics.h
+ *
+ * Latency histograms and health counters of the serial link.
+ * @author ysuga@ysuga.net
+ ********************************************************/
+
+#ifndef LINK_STATISTICS_HEADER_INCLUDED
+#define LINK_STATISTICS_HEADER_INCLUDED
+
+#include "common.h"
+#include "type.h"
+
+/**
+ * Each power of 2 range of the histogram is divided into 2^HISTOGRAM_SUB_BUCKET_BITS buckets.
+ * The error of the recorded values is less than 1/16 (6.25%).
+ */
+#define HISTOGRAM_SUB_BUCKET_BITS 4
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BUCKET_BITS)
+
+/**
+ * Number of the buckets to cover all values of uint32_t.
+ */
+#define HISTOGRAM_BUCKETS ((32 - HISTOGRAM_SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+namespace net {
+	namespace ysuga {
+		namespace roomba {
+
+			/**
+			 * @brief Histogram of Latencies in Fixed Memory (HDR histogram style)
+			 *
+			 * The values below HISTOGRAM_SUB_BUCKETS are counted exactly. The larger values
+			 * are counted in log-linear buckets. Recording takes no lock and never allocates.
+			 * One thread records at a time. Any thread can read the histogram while recording.
+			 */
+			class LatencyHistogram {
+			private:
+				volatile uint32_t m_Counts[HISTOGRAM_BUCKETS];
+				volatile uint32_t m_Count;
+				volatile uint32_t m_Max;
+				volatile uint32_t m_TotalCount; // not cleared by reset
+				volatile uint64_t m_TotalSum; // not cleared by reset
+
+			public:
+				/**
+				 * @brief Constructor
+				 */
+				LIBROOMBA_API LatencyHistogram();
+
+				/**
+				 * @brief Destructor
+				 */
+				LIBROOMBA_API ~LatencyHistogram();
+
+			public:
+				/**
+				 * @brief Record a value
+				 */
+				LIBROOMBA_API void record(const uint32_t value);
+
+				/**
+				 * @brief Clear the recorded values
+				 */
+				LIBROOMBA_API void reset();
+
+				/**
+				 * @brief Number of the recorded values
+				 */
+				LIBROOMBA_API uint32_t getCount() const { return m_Count; }
+
+				/**
+				 * @brief Maximum of the recorded values
+				 */
+				LIBROOMBA_API uint32_t getMax() const { return m_Max; }
+
+				/**
+				 * @brief Number of the values recorded since the construction (not cleared by reset)
+				 */
+				LIBROOMBA_API uint32_t getTotalCount() const { return m_TotalCount; }
+
+				/**
+				 * @brief Sum of the values recorded since the construction (not cleared by reset)
+				 */
+				LIBROOMBA_API uint64_t getTotalSum() const { return m_TotalSum; }
+
+				/**
+				 * @brief Get Percentile
+				 *
+				 * @param percentile 0.0 - 100.0
+				 * @return Upper bound of the bucket which includes the percentile. 0 if nothing is recorded.
+				 */
+				LIBROOMBA_API uint32_t getPercentile(const double percentile) const;
+
+			private:
+				static uint32_t getBucketIndex(const uint32_t value);
+				static uint32_t getBucketUpperBound(const uint32_t index);
+			};
+
+			/**
+			 * @brief Counters of the Serial Link since the Start
+			 *
+			 * Unlike RoombaLinkStats, they are not restarted by LinkStatistics::reset,
+			 * so they only go up (until they wrap around).
+			 */
+			struct LinkTotals {
+				uint32_t txBytes;
+				uint32_t rxBytes;
+				uint32_t txPackets;
+				uint32_t checksumErrors;
+				uint32_t badFrames;
+				uint32_t resyncCount;
+				uint32_t resyncBytes;
+				uint32_t txPartialWrites;
+				uint32_t txReplaced;
+				uint32_t txRejected;
+				uint32_t requestsRejected;
+				uint32_t requestCount;
+				uint64_t roundTripSum; //!< [usec]
+				uint32_t frameCount;
+				uint64_t frameIntervalSum; //!< [usec]
+				uint64_t jitterSum; //!< [usec]
+			};
+
+			/**
+			 * @brief Health of the Serial Link of a Roomba
+			 *
+			 * Updated by Transport (bytes, transmit queue and round trip times of the requests) and by the
+			 * stream decoder of Roomba (frames, checksum errors and resyncs).
+			 * The counters are updated atomically, so they can be read at any time.
+			 * They count from the construction. reset only moves the start of the window.
+			 *
+			 * @see Roomba::getLinkStats
+			 */
+			class LinkStatistics {
+			private:
+				LatencyHistogram m_RoundTripTime; // [usec]
+				LatencyHistogram m_FrameInterval; // [usec]
+				LatencyHistogram m_FrameJitter; // deviation of the interval from the period [usec]
+				volatile uint32_t m_TxBytes;
+				volatile uint32_t m_RxBytes;
+				volatile uint32_t m_TxPackets;
+				volatile uint32_t m_ChecksumErrors;
+				volatile uint32_t m_BadFrames;
+				volatile uint32_t m_ResyncCount;
+				volatile uint32_t m_ResyncBytes;
+				volatile uint32_t m_TxQueueDepth;
+				volatile uint32_t m_TxQueueHighWater;
+				volatile uint32_t m_TxPartialWrites;
+				volatile uint32_t m_TxReplaced;
+				volatile uint32_t m_TxRejected;
+				volatile uint32_t m_RequestsRejected;
+				LinkTotals m_WindowBase; // totals at the last reset
+				uint64_t m_WindowStart;
+				uint64_t m_LastFrameTime;
+
+			public:
+				LIBROOMBA_API LinkStatistics();
+
+				LIBROOMBA_API ~LinkStatistics();
+
+			public:
+				void addTxBytes(const uint32_t bytes);
+
+				void countTxPacket();
+
+				/**
+				 * @brief Record the bytes waiting in the transmit queue. Called by one thread at a time.
+				 */
+				void setTxQueueDepth(const uint32_t bytes);
+
+				void countTxPartialWrite();
+
+				void countTxReplaced();
+
+				void countTxRejected();
+
+				void countRequestRejected();
+
+				void addRxBytes(const uint32_t bytes);
+
+				void recordRoundTrip(const uint32_t time);
+
+				/**
+				 * @brief Record the arrival of a frame
+				 *
+				 * @param period Expected interval of the frames [usec]
+				 */
+				void recordFrame(const uint32_t period);
+
+				/**
+				 * @brief Do not take the interval to the next frame (e.g. the stream was paused)
+				 */
+				void restartFrames() { m_LastFrameTime = 0; }
+
+				void countChecksumError();
+
+				void countBadFrame();
+
+				/**
+				 * @brief Record bytes skipped to find the header of a frame
+				 */
+				void countResync(const uint32_t skippedBytes);
+
+			public:
+				/**
+				 * @brief Start a new measurement window
+				 */
+				LIBROOMBA_API void reset();
+
+				/**
+				 * @brief Get the statistics since the last reset
+				 */
+				LIBROOMBA_API void get(RoombaLinkStats* stats) const;
+
+				/**
+				 * @brief Get the counters since the construction, for the monitors which need monotonic counters
+				 */
+				LIBROOMBA_API void getTotals(LinkTotals* totals) const;
+
+				LIBROOMBA_API const LatencyHistogram& getRoundTripTime() const { return m_RoundTripTime; }
+
+				LIBROOMBA_API const LatencyHistogram& getFrameInterval() const { return m_FrameInterval; }
+
+				LIBROOMBA_API const LatencyHistogram& getFrameJitter() const { return m_FrameJitter; }
+			};
+
+		}
+	}
+}
+
+#endif
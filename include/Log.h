@@ -0,0 +1,199 @@
+/********************************************************
+ * Log.h
+ *
+ * Asynchronous logging of the library.
+ * @author ysuga@ysuga.net
+ ********************************************************/
+
+#ifndef LOG_HEADER_INCLUDED
+#define LOG_HEADER_INCLUDED
+
+#include "common.h"
+#include "type.h"
+
+#include <stddef.h>
+
+/**
+ * Levels of the log records
+ */
+#define ROOMBA_LOG_LEVEL_DEBUG 0
+#define ROOMBA_LOG_LEVEL_INFO 1
+#define ROOMBA_LOG_LEVEL_WARN 2
+#define ROOMBA_LOG_LEVEL_ERROR 3
+#define ROOMBA_LOG_LEVEL_OFF 4
+
+/**
+ * The records below this level are removed at the compile time.
+ * Define it (e.g. -DROOMBA_LOG_LEVEL=0) to compile the debug records in.
+ */
+#ifndef ROOMBA_LOG_LEVEL
+#define ROOMBA_LOG_LEVEL ROOMBA_LOG_LEVEL_INFO
+#endif
+
+/**
+ * Maximum number of the arguments of a record
+ */
+#define LOG_MAX_ARGS 4
+
+/**
+ * Bytes in a record to copy the string arguments. Longer strings are truncated.
+ */
+#define LOG_TEXT_SIZE 96
+
+/**
+ * Maximum number of the records in the buffer of a thread (Logger::setCapacity)
+ */
+#define LOG_MAX_CAPACITY 0x100000
+
+/**
+ * Interval of the background thread writing the records to the sink [msec]
+ */
+#define LOG_FLUSH_PERIOD 20
+
+/**
+ * Record a log. The format is printf style and is formatted by the background thread.
+ *
+ * @code
+ * ROOMBA_LOG_INFO("Sensor stream recovered in %u ms.", time / 1000);
+ * @endcode
+ */
+#define ROOMBA_LOG(level, ...) \
+	do { \
+		if((level) >= ROOMBA_LOG_LEVEL && net::ysuga::roomba::Logger::isEnabled(level)) { \
+			net::ysuga::roomba::Logger::record(level, __VA_ARGS__); \
+		} \
+	} while(0)
+
+#define ROOMBA_LOG_DEBUG(...) ROOMBA_LOG(ROOMBA_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define ROOMBA_LOG_INFO(...) ROOMBA_LOG(ROOMBA_LOG_LEVEL_INFO, __VA_ARGS__)
+#define ROOMBA_LOG_WARN(...) ROOMBA_LOG(ROOMBA_LOG_LEVEL_WARN, __VA_ARGS__)
+#define ROOMBA_LOG_ERROR(...) ROOMBA_LOG(ROOMBA_LOG_LEVEL_ERROR, __VA_ARGS__)
+
+namespace net {
+	namespace ysuga {
+		namespace roomba {
+
+			/**
+			 * @brief Argument of a Log Record
+			 *
+			 * Keeps the value without formatting it. The strings are copied into the record.
+			 */
+			class LogArg {
+			public:
+				enum Type {
+					TYPE_INT,
+					TYPE_UINT,
+					TYPE_DOUBLE,
+					TYPE_STRING
+				};
+
+				Type type;
+				union {
+					int64_t i;
+					uint64_t u;
+					double d;
+					const char* s;
+				} value;
+
+			public:
+				LogArg(const int32_t v) : type(TYPE_INT) { value.i = v; }
+				LogArg(const uint32_t v) : type(TYPE_UINT) { value.u = v; }
+				LogArg(const int64_t v) : type(TYPE_INT) { value.i = v; }
+				LogArg(const uint64_t v) : type(TYPE_UINT) { value.u = v; }
+				LogArg(const double v) : type(TYPE_DOUBLE) { value.d = v; }
+				LogArg(const char* v) : type(TYPE_STRING) { value.s = v ? v : "(null)"; }
+			};
+
+			/**
+			 * @brief Destination of the Log
+			 *
+			 * Called only by the background thread of Logger (or by Logger::flush).
+			 */
+			class LogSink {
+			public:
+				virtual ~LogSink() {}
+
+				/**
+				 * @brief Write a record
+				 *
+				 * @param level ROOMBA_LOG_LEVEL_*
+				 * @param timestamp [usec] of net::ysuga::Clock
+				 * @param threadId Number of the thread in the order of the first record (1, 2, ...)
+				 * @param message Formatted message without the new line
+				 */
+				virtual void write(const uint32_t level, const uint64_t timestamp, const uint32_t threadId, const char* message) = 0;
+			};
+
+			/**
+			 * @brief Asynchronous Logger of the Library
+			 *
+			 * The records are put into the ring buffer of the calling thread without any
+			 * lock or formatting. A background thread (started at the first record) formats
+			 * them and writes them to the sink every LOG_FLUSH_PERIOD ms in the order of the
+			 * timestamps. If a buffer is full, the records are dropped and counted.
+			 * The default sink writes INFO and DEBUG to stdout, and WARN and ERROR to stderr.
+			 * The buffer of a thread is released after the thread exits and its records are written.
+			 * The records not written yet are written at the exit of the process.
+			 */
+			class Logger {
+			public:
+				/**
+				 * @brief Is the level written? (the runtime threshold)
+				 */
+				LIBROOMBA_API static bool isEnabled(const uint32_t level);
+
+				/**
+				 * @brief Set the runtime threshold. ROOMBA_LOG_LEVEL_INFO by default.
+				 *
+				 * The records below ROOMBA_LOG_LEVEL are not compiled in, whatever the threshold is.
+				 */
+				LIBROOMBA_API static void setLevel(const uint32_t level);
+
+				/**
+				 * @brief Set the destination
+				 *
+				 * @param sink Not owned by the logger. NULL restores the default sink.
+				 * The sink must live until it is replaced or the process exits.
+				 */
+				LIBROOMBA_API static void setSink(LogSink* sink);
+
+				/**
+				 * @brief Set the capacity of the ring buffer of each thread
+				 *
+				 * Used for the buffers allocated after the call. 1024 by default.
+				 * Rounded up to a power of 2, and limited to LOG_MAX_CAPACITY.
+				 */
+				LIBROOMBA_API static void setCapacity(const uint32_t recordsPerThread);
+
+				/**
+				 * @brief Write all the records recorded before the call to the sink
+				 */
+				LIBROOMBA_API static void flush();
+
+				/**
+				 * @brief Number of the records dropped because the buffer was full
+				 */
+				LIBROOMBA_API static uint32_t getDroppedCount();
+
+				/**
+				 * @brief Record a log. Use the ROOMBA_LOG_* macros.
+				 *
+				 * @param format printf style format. Must be a string literal (the pointer is recorded).
+				 */
+				LIBROOMBA_API static void record(const uint32_t level, const char* format);
+				LIBROOMBA_API static void record(const uint32_t level, const char* format, const LogArg& a0);
+				LIBROOMBA_API static void record(const uint32_t level, const char* format, const LogArg& a0, const LogArg& a1);
+				LIBROOMBA_API static void record(const uint32_t level, const char* format, const LogArg& a0, const LogArg& a1,
+					const LogArg& a2);
+				LIBROOMBA_API static void record(const uint32_t level, const char* format, const LogArg& a0, const LogArg& a1,
+					const LogArg& a2, const LogArg& a3);
+
+			private:
+				static void recordArgs(const uint32_t level, const char* format, const LogArg** args, const uint32_t count);
+			};
+
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,132 @@
+/********************************************************
+ * MetricsExporter.h
+ *
+ * Prometheus metrics endpoint of the robots.
+ * @author ysuga@ysuga.net
+ ********************************************************/
+
+#ifndef METRICS_EXPORTER_HEADER_INCLUDED
+#define METRICS_EXPORTER_HEADER_INCLUDED
+
+#include "common.h"
+#include "type.h"
+#include "Thread.h"
+
+#include <stddef.h>
+#include <vector>
+#include <string>
+
+namespace net {
+	namespace ysuga {
+		namespace roomba {
+
+			class Roomba;
+			class RoombaFleet;
+
+			/**
+			 * @brief HTTP Endpoint of the Metrics in Prometheus Text Format
+			 *
+			 * Serves GET /metrics in its own thread. The metrics are read from the data
+			 * which the driver already has (Roomba::peekSensorValue, Roomba::getLinkStats),
+			 * without any lock of the stream or the command threads and without any
+			 * communication with the robots. Scraping does not resume a suspended stream.
+			 * The *_total counters come from LinkStatistics::getTotals, so
+			 * Roomba::resetLinkStats does not make them go backwards. The latencies are
+			 * summaries: the quantiles are of the current window of the link statistics.
+			 *
+			 * @code
+			 * MetricsExporter exporter(9464);
+			 * exporter.add(&fleet);
+			 * exporter.start();
+			 * // curl http://127.0.0.1:9464/metrics
+			 * @endcode
+			 */
+			class MetricsExporter : public Thread {
+			private:
+				struct Target {
+					Roomba* roomba;
+					std::string label;
+				};
+
+				std::vector<Target> m_Targets;
+				Mutex m_TargetsMutex; // guards m_Targets. Never taken by the robots.
+				std::string m_Address;
+				uint16_t m_Port;
+				intptr_t m_Socket;
+				volatile bool m_Running;
+				uint32_t m_ScrapeCount;
+
+			public:
+				/**
+				 * @brief Constructor
+				 *
+				 * @param port TCP port. 0 lets the system choose it (see getPort).
+				 * @param address Address to listen. Only the local host by default.
+				 */
+				LIBROOMBA_API MetricsExporter(const uint16_t port = 9464, const char* address = "127.0.0.1");
+
+				/**
+				 * @brief Destructor. Stops the server.
+				 */
+				LIBROOMBA_API virtual ~MetricsExporter();
+
+			public:
+				/**
+				 * @brief Publish the metrics of the robot
+				 *
+				 * @param roomba Robot. Must be alive until removed or the exporter is stopped.
+				 * @param label Value of the "robot" label
+				 */
+				LIBROOMBA_API void add(Roomba* roomba, const char* label);
+
+				/**
+				 * @brief Publish the metrics of all robots in the fleet
+				 *
+				 * @param labelPrefix The robots are labeled with the prefix and the index in the fleet.
+				 */
+				LIBROOMBA_API void add(RoombaFleet* fleet, const char* labelPrefix = "roomba");
+
+				/**
+				 * @brief Stop publishing the metrics of the robot
+				 */
+				LIBROOMBA_API void remove(Roomba* roomba);
+
+				/**
+				 * @brief Listen the port and start serving
+				 *
+				 * @throw ListenError
+				 */
+				LIBROOMBA_API void start();
+
+				/**
+				 * @brief Stop serving and close the port
+				 */
+				LIBROOMBA_API void stop();
+
+				/**
+				 * @brief Port which is listened
+				 */
+				LIBROOMBA_API uint16_t getPort() const { return m_Port; }
+
+				/**
+				 * @brief Number of the served scrapes
+				 */
+				LIBROOMBA_API uint32_t getScrapeCount() const { return m_ScrapeCount; }
+
+				/**
+				 * @brief Render the metrics in Prometheus text format
+				 */
+				LIBROOMBA_API void writeMetrics(std::string& text);
+
+			public:
+				virtual void Run();
+
+			private:
+				void serve(intptr_t client);
+			};
+
+		}
+	}
+}
+
+#endif
@@ -19,13 +19,96 @@
 
 #include "type.h"
 #include "Odometry.h"
+#include "Timer.h"
+#include "Script.h"
+#include "SensorGroup.h"
+#include "SensorQuery.h"
 
 #include <map>
+#include <vector>
+
+/**
+ * Capacity of the trajectory buffer used in executeTrajectory
+ */
+#define MAX_TRAJECTORY_SAMPLES 1024
+
+/**
+ * Period of the sensor stream in milliseconds
+ */
+#define STREAM_PERIOD 15
+
+/**
+ * Maximum velocity of each wheel accepted by the OI [m/sec]
+ */
+#define MAX_WHEEL_VELOCITY 0.5
+
+/**
+ * Base period of the sensor poll scheduler (ROI) in milliseconds
+ */
+#define POLL_PERIOD 20
+
+/**
+ * Period in milliseconds at which the background thread of the idle robot checks the demand
+ */
+#define IDLE_STREAM_PERIOD 50
+
+/**
+ * Flag of m_PublishedSensorValues which indicates that the value has been received.
+ */
+#define PUBLISHED_VALUE_VALID 0x10000
+
+/**
+ * Time to wait for the response of a sensor query in milliseconds
+ */
+#define REQUEST_TIMEOUT 1000
+
+/**
+ * Silence in milliseconds which connect waits for before the probe, so that a stream
+ * left running by the previous session is not taken for the answer.
+ */
+#define CONNECT_QUIET_TIME (STREAM_PERIOD * 2)
+
+/**
+ * Default number of the missing frame periods to detect the stall of the stream.
+ */
+#define DEFAULT_WATCHDOG_PERIODS 20
+
+/**
+ * Default number of the recovery attempts before reopening the serial port.
+ */
+#define DEFAULT_WATCHDOG_REOPEN_ATTEMPTS 3
 
 namespace net {
 	namespace ysuga {
 		namespace roomba {
 
+			/**
+			 * @brief Activity of the Sensor Stream Processing
+			 * @see Roomba::getStreamActivityStatistics
+			 */
+			struct StreamActivityStatistics {
+				bool suspended; //!< The stream is suspended now because nobody reads the data
+				uint32_t suspendCount; //!< Number of idle suspensions
+				uint32_t wakeupCount; //!< Number of wake ups to check the sensor data
+				uint32_t idleWakeupCount; //!< Wake ups while suspended
+				uint64_t cpuTime; //!< CPU time of the sensor processing [usec]
+				uint64_t idleCpuTime; //!< CPU time while suspended [usec]
+			};
+
+			/**
+			 * @brief Recoveries of the Stalled Sensor Stream
+			 * @see Roomba::getStreamRecoveryStatistics
+			 */
+			struct StreamRecoveryStatistics {
+				bool recovering; //!< The stream is stalled now
+				uint32_t stallCount; //!< Number of the detected stalls
+				uint32_t recoveryCount; //!< Number of the stalls recovered
+				uint32_t attemptCount; //!< Number of the recovery attempts (commands sent again)
+				uint32_t reopenCount; //!< Number of the reopens of the serial port
+				uint32_t lastRecoveryTime; //!< Time from the detection to the first frame of the last recovery [usec]
+				uint32_t maxRecoveryTime; //!< Maximum of the recovery time [usec]
+			};
+
 			/**
 			 * @brief Roomba Control Library main class.
 			 * @see http://www.irobot.lv/uploaded_files/File/iRobot_Roomba_500_Open_Interface_Spec.pdf
@@ -59,6 +142,8 @@ namespace net {
 					MODEL_500SERIES,
 				};
 
+				Version getVersion() const {return (Version)m_Version;}
+
 				double getX() const {return m_X;}
 				double getY() const {return m_Y;}
 				double getTh() const { return m_Th;}
@@ -67,6 +152,35 @@ namespace net {
 				
 				void getSensorGroup2(uint8_t *remoteOpcode, uint8_t *buttons, int16_t *distance, int16_t *angle);
 
+				/**
+				 * @brief Get Sensor Group Packet
+				 *
+				 * Queries the whole group with one OP_SENSORS command, and updates the sensor values.
+				 * Groups 100 - 107 are only available on 500 series. 500 series can not
+				 * query the sensors while the sensor stream is running.
+				 *
+				 * @param groupId Sensor Group ID (SENSOR_GROUP_*)
+				 * @param values [OUT] Buffer indexed by sensor id (MAX_SENSOR_ID+1 elements). Can be NULL.
+				 * @throw PreconditionNotMetError
+				 */
+				LIBROOMBA_API void getSensorGroup(uint8_t groupId, uint16_t* values = NULL);
+
+				/**
+				 * @brief Request Sensors without waiting for the response
+				 *
+				 * Sends OP_QUERY_LIST and returns immediately, so that the next data can be
+				 * requested while the current data is processed. The received values also
+				 * update the values returned by the accessors.
+				 * 500 series can not query the sensors while the sensor stream is running.
+				 *
+				 * @param sensorIds Sensor IDs or sensor group ids
+				 * @param count Number of sensor IDs
+				 * @param query [OUT] Handle of the query. Must be alive until the response is received.
+				 * @throw PreconditionNotMetError, RequestBusyError (see tryRequestSensorAsync)
+				 * @see SensorQuery
+				 */
+				LIBROOMBA_API void requestSensorAsync(const uint8_t* sensorIds, const uint32_t count, SensorQuery* query);
+
 				/*
 				 * THESE ENUMS MUST BE SAME AS THE ENUMS DEFINED IN COMMON.H FILE.
 				 */
@@ -112,9 +226,65 @@ namespace net {
 				 * Functions Return Code
 				 */
 				enum ReturnCode {
+					REQUEST_BUSY = -6, //!< Request is not sent because the late responses of the failed requests are arriving. Retry later
+					CONNECTION_TIMEOUT = -5, //!< Robot did not respond in time, or the response is not an OI mode
+					TX_QUEUE_FULL = -4, //!< Request is rejected because the commands are waiting for the serial port
+					SENSOR_UNAVAILABLE = -3, //!< Sensor value did not arrive in time
+					COM_ACCESS_FAILED = -2, //!< Serial port can not be read or written
 					PRECONDITION_NOT_MET = -1, //!< Precondition is not fine
 					ROOMBA_OK = 0, //!< Return Code OK.
 				};
+
+				/**
+				 * @brief Throw the exception of the return code. Does nothing for ROOMBA_OK.
+				 *
+				 * @throw PreconditionNotMetError, ComAccessException, SensorUnavailableError,
+				 * TxQueueFullError, ConnectionTimeoutError, RequestBusyError
+				 */
+				LIBROOMBA_API static void throwError(const ReturnCode error);
+
+				/**
+				 * @brief Value or error returned by the try* queries
+				 *
+				 * The try* functions never throw, for the control loops in which the
+				 * errors are common. The throwing functions are built on them.
+				 *
+				 * @code
+				 * Roomba::Result<uint16_t> voltage = roomba.tryGetSensorValue(VOLTAGE);
+				 * if(voltage.isOk()) {
+				 *   use(voltage.getValue());
+				 * }
+				 * @endcode
+				 */
+				template<typename T>
+				class Result {
+				private:
+					ReturnCode m_Error;
+					T m_Value;
+
+				public:
+					Result(const T& value) : m_Error(ROOMBA_OK), m_Value(value) {}
+
+					static Result failure(const ReturnCode error) {
+						Result result((T()));
+						result.m_Error = error;
+						return result;
+					}
+
+					bool isOk() const { return m_Error == ROOMBA_OK; }
+
+					ReturnCode getError() const { return m_Error; }
+
+					/**
+					 * @throw The exception of the error (see throwError)
+					 */
+					const T& getValue() const {
+						throwError(m_Error);
+						return m_Value;
+					}
+
+					T getValueOr(const T& defaultValue) const { return isOk() ? m_Value : defaultValue; }
+				};
 				/**
 				 * @brief Motor Identifier
 				 * 
@@ -182,6 +352,7 @@ namespace net {
 
 			private:
 				Mode m_CurrentMode;
+				uint32_t m_ModeSettleTime; // wait after mode change [msec]
 
 			private:
 				Transport *m_pTransport;
@@ -194,8 +365,11 @@ namespace net {
 				 * @param model    Model Number of Roomba. (MODEL_CREATE or MODEL_500)
 				 * @param portName Port Name that Roomba is connected (e.g., "\\\\.\\COM4", "/dev/ttyUSB0")
 				 * @param baudrate Baud Rate. Default 115200.
+				 * @param port Opened port used instead of portName (e.g. SimulatedRobot). Roomba takes the ownership.
+				 *             Mode changes do not wait for the robot with this port.
+				 * @param sendStart false leaves the start command to connect.
 				 */
-				LIBROOMBA_API Roomba(const uint32_t model, const char *portName, const uint32_t baudrate = 115200);
+				LIBROOMBA_API Roomba(const uint32_t model, const char *portName, const uint32_t baudrate = 115200, SerialPort* port = NULL, const bool sendStart = true);
 
 				/**
 				 * @brief Destructor
@@ -204,15 +378,52 @@ namespace net {
 
 
 			private:
-				void getSensorValue(unsigned char sensorId, uint16_t* value);
-				void getSensorValue(unsigned char sensorId, int16_t* value);
-				void getSensorValue(unsigned char sensorId, uint8_t* value);
-				void getSensorValue(unsigned char sensorId, int8_t* value);
+				/**
+				 * @brief Result of receiving a frame
+				 */
+				enum FrameState {
+					FRAME_RECEIVED,
+					FRAME_PENDING, // only a part of the frame is received (pollSensorData)
+					FRAME_FAILED // not received in the watchdog timeout
+				};
 
-				
-				void handleBasicData();
-				void handleStreamData();
-				unsigned char* buffer;
+				/**
+				 * @brief Stream frame being received. Kept between the calls of pollSensorData.
+				 */
+				struct StreamParser {
+					enum State {
+						HEADER,
+						LENGTH,
+						DATA,
+						CHECKSUM
+					};
+					State state;
+					uint8_t byte; // header, length or checksum
+					uint8_t length; // of the data
+					uint32_t received; // bytes of the data
+					uint32_t skippedBytes; // before the header
+					uint8_t data[255];
+				};
+
+				StreamParser m_StreamParser;
+				std::vector<uint8_t> m_PolledSensors; // of the poll submitted by pollSensorData (ROI)
+				uint8_t m_PollResponse[256];
+				Transport::PendingRequest m_PollRequest;
+				bool m_PollSubmitted;
+
+				bool handlePolledData();
+				bool handleStreamData();
+				FrameState receiveStreamFrame(const bool wait);
+				void decodeStreamFrame();
+				uint32_t schedulePolledSensors(std::vector<uint8_t>& sensors);
+				void decodePolledData(const std::vector<uint8_t>& sensors, const uint8_t* data);
+				FrameState progressPolledData();
+				uint32_t getPollWaitTime();
+				void resetStreamParser();
+				void decodeSensorPacket(uint8_t packetId, const uint8_t* data);
+
+				friend class SensorQuery;
+				void storeSensorValues(const uint16_t* values, const bool* contained);
 	
 
 			public:
@@ -230,9 +441,17 @@ namespace net {
 				 *  -- DOCK Start seeking dock station (In this mode, Roomba is in PASSIVE mode.)<br />
 				 *
 				 * @param mode Mode Definition
+				 * @throw ComAccessException
 				 */
 				LIBROOMBA_API void setMode(Mode mode);
 
+				/**
+				 * @brief Set Roomba's mode without throwing
+				 *
+				 * @return ROOMBA_OK or COM_ACCESS_FAILED
+				 */
+				LIBROOMBA_API ReturnCode trySetMode(Mode mode);
+
 				/** 
 				 * @brief Get Roomba's mode 
 				 *
@@ -261,6 +480,13 @@ namespace net {
 					setMode(this->MODE_START);
 				}
 
+				/**
+				 * @brief start without throwing
+				 */
+				LIBROOMBA_API ReturnCode tryStart() {
+					return trySetMode(this->MODE_START);
+				}
+
 				/**
 				 * @brief Start Normal Clean Mode
 				 */
@@ -268,6 +494,13 @@ namespace net {
 					setMode(Roomba::MODE_NORMAL_CLEAN);
 				}
 
+				/**
+				 * @brief clean without throwing
+				 */
+				LIBROOMBA_API ReturnCode tryClean() {
+					return trySetMode(Roomba::MODE_NORMAL_CLEAN);
+				}
+
 				/**
 				 * @brief Start Spot Clean
 				 */
@@ -275,6 +508,13 @@ namespace net {
 					setMode(Roomba::MODE_SPOT_CLEAN);
 				}
 
+				/**
+				 * @brief spotClean without throwing
+				 */
+				LIBROOMBA_API ReturnCode trySpotClean() {
+					return trySetMode(Roomba::MODE_SPOT_CLEAN);
+				}
+
 				/**
 				 * @brief Start Maximum Time Clean Mode
 				 */
@@ -282,6 +522,13 @@ namespace net {
 					setMode(Roomba::MODE_MAX_TIME_CLEAN);
 				}
 
+				/**
+				 * @brief maxClean without throwing
+				 */
+				LIBROOMBA_API ReturnCode tryMaxClean() {
+					return trySetMode(Roomba::MODE_MAX_TIME_CLEAN);
+				}
+
 				/**
 				 * @brief Start to search Dock station
 				 */
@@ -289,6 +536,13 @@ namespace net {
 					setMode(Roomba::MODE_DOCK);
 				}
 
+				/**
+				 * @brief dock without throwing
+				 */
+				LIBROOMBA_API ReturnCode tryDock() {
+					return trySetMode(Roomba::MODE_DOCK);
+				}
+
 				/**
 				 * @brief Power Down
 				 */
@@ -296,6 +550,13 @@ namespace net {
 					setMode(Roomba::MODE_POWER_DOWN);
 				}
 
+				/**
+				 * @brief powerDown without throwing
+				 */
+				LIBROOMBA_API ReturnCode tryPowerDown() {
+					return trySetMode(Roomba::MODE_POWER_DOWN);
+				}
+
 				/**
 				 * @brief Safe Control Mode
 				 */
@@ -303,6 +564,13 @@ namespace net {
 					setMode(Roomba::MODE_SAFE);
 				}
 
+				/**
+				 * @brief safeControl without throwing
+				 */
+				LIBROOMBA_API ReturnCode trySafeControl() {
+					return trySetMode(Roomba::MODE_SAFE);
+				}
+
 				/**
 				 * @brief Full Control Mode
 				 */
@@ -310,6 +578,13 @@ namespace net {
 					setMode(Roomba::MODE_FULL);
 				}
 
+				/**
+				 * @brief fullControl without throwing
+				 */
+				LIBROOMBA_API ReturnCode tryFullControl() {
+					return trySetMode(Roomba::MODE_FULL);
+				}
+
 
 			public:
 
@@ -319,29 +594,50 @@ namespace net {
 				 *
 				 * @param translation Translation Velcoity (-500 – 500 mm/s)  
 				 * @param turnRadius Radius (-2000 – 2000 mm) (negative => CCW)
-				 * @throw PreconditionNotMetError
+				 * @throw PreconditionNotMetError, ComAccessException
 				 */
 				LIBROOMBA_API void drive(uint16_t translation, uint16_t turnRadius);
 
+				/**
+				 * @brief drive without throwing
+				 *
+				 * @return ROOMBA_OK, PRECONDITION_NOT_MET (not in SAFE or FULL mode) or COM_ACCESS_FAILED
+				 */
+				LIBROOMBA_API ReturnCode tryDrive(uint16_t translation, uint16_t turnRadius);
+
 
 				/**
 				 * @brief Drive Each Wheel Directly
 				 *
 				 * @param rightWheel Translation Velocity (-500 - 500 mm/s)
 				 * @param leftWheel  Translation Velocity (-500 - 500 mm/s)
-				 * @throw PreconditionNotMetError
+				 * @throw PreconditionNotMetError, ComAccessException
 				 */
 				LIBROOMBA_API void driveDirect(int16_t rightWheel, int16_t leftWheel);
 
+				/**
+				 * @brief driveDirect without throwing
+				 *
+				 * @return ROOMBA_OK, PRECONDITION_NOT_MET (not in SAFE or FULL mode) or COM_ACCESS_FAILED
+				 */
+				LIBROOMBA_API ReturnCode tryDriveDirect(int16_t rightWheel, int16_t leftWheel);
+
 				/**
 				 * @brief Drive Each Wheel with PWM
 				 *
 				 * @param rightWheel Translation Velocity (-255 - +255)
 				 * @param leftWheel  Translation Velocity (-255 - +255)
-				 * @throw PreconditionNotMetError
+				 * @throw PreconditionNotMetError, ComAccessException
 				 */
 				LIBROOMBA_API void drivePWM(int16_t rightWheel, int16_t leftWheel);
 
+				/**
+				 * @brief drivePWM without throwing
+				 *
+				 * @return ROOMBA_OK, PRECONDITION_NOT_MET (not in SAFE or FULL mode) or COM_ACCESS_FAILED
+				 */
+				LIBROOMBA_API ReturnCode tryDrivePWM(int16_t rightWheel, int16_t leftWheel);
+
 				
 				/**
 				 * @brief Drive Motors of Brush, SideBrush, and Vacuum.
@@ -349,10 +645,17 @@ namespace net {
 				 * @param mainBrush  This parameter can be MOTOR_CW, MOTOR_CCW, or MOTOR_OFF.
 				 * @param sideBrush  This parameter can be MOTOR_CW, MOTOR_CCW, or MOTOR_OFF,
 				 * @param vacuum     This parameter can be MOTOR_ON or MOTOR_OFF.
-				 * @throw PreconditionNotMetError
+				 * @throw PreconditionNotMetError, ComAccessException
 				 */
 				LIBROOMBA_API void driveMotors(Motors mainBrush, Motors sideBrush, Motors vacuum);
 
+				/**
+				 * @brief driveMotors without throwing
+				 *
+				 * @return ROOMBA_OK, PRECONDITION_NOT_MET (not in SAFE or FULL mode) or COM_ACCESS_FAILED
+				 */
+				LIBROOMBA_API ReturnCode tryDriveMotors(Motors mainBrush, Motors sideBrush, Motors vacuum);
+
 
 			private:
 				Motors m_MainBrushFlag;
@@ -365,33 +668,69 @@ namespace net {
 				 * @brief Drive Motors of MainBrush.
 				 *
 				 * @param flag  This parameter can be MOTOR_CW, MOTOR_CCW, or MOTOR_OFF.
-				 * @throw PreconditionNotMetError
+				 * @throw PreconditionNotMetError, ComAccessException
 				 */
 				void driveMainBrush(Motors flag) {
-					driveMotors(flag, m_SideBrushFlag, m_VacuumFlag);
-					m_MainBrushFlag = flag;
+					throwError(tryDriveMainBrush(flag));
+				}
+
+				/**
+				 * @brief driveMainBrush without throwing
+				 *
+				 * @return ROOMBA_OK, PRECONDITION_NOT_MET (not in SAFE or FULL mode) or COM_ACCESS_FAILED
+				 */
+				ReturnCode tryDriveMainBrush(Motors flag) {
+					ReturnCode result = tryDriveMotors(flag, m_SideBrushFlag, m_VacuumFlag);
+					if(result == ROOMBA_OK) {
+						m_MainBrushFlag = flag;
+					}
+					return result;
 				}
 
 				/**
 				 * @brief Drive Motors of SideBrush.
 				 *
 				 * @param flag  This parameter can be MOTOR_CW, MOTOR_CCW, or MOTOR_OFF.
-				 * @throw PreconditionNotMetError
+				 * @throw PreconditionNotMetError, ComAccessException
 				 */
 				void driveSideBrush(Motors flag) {
-					driveMotors(m_MainBrushFlag, flag, m_VacuumFlag);
-					m_SideBrushFlag = flag;
+					throwError(tryDriveSideBrush(flag));
+				}
+
+				/**
+				 * @brief driveSideBrush without throwing
+				 *
+				 * @return ROOMBA_OK, PRECONDITION_NOT_MET (not in SAFE or FULL mode) or COM_ACCESS_FAILED
+				 */
+				ReturnCode tryDriveSideBrush(Motors flag) {
+					ReturnCode result = tryDriveMotors(m_MainBrushFlag, flag, m_VacuumFlag);
+					if(result == ROOMBA_OK) {
+						m_SideBrushFlag = flag;
+					}
+					return result;
 				}
 
 				/**
 				 * @brief Drive Motors of Vacuum.
 				 *
 				 * @param flag  This parameter can be MOTOR_ON, or MOTOR_OFF.
-				 * @throw PreconditionNotMetError
+				 * @throw PreconditionNotMetError, ComAccessException
 				 */
 				void driveVacuum(Motors flag) {
-					driveMotors(m_MainBrushFlag, m_SideBrushFlag, flag);
-					m_VacuumFlag = flag;
+					throwError(tryDriveVacuum(flag));
+				}
+
+				/**
+				 * @brief driveVacuum without throwing
+				 *
+				 * @return ROOMBA_OK, PRECONDITION_NOT_MET (not in SAFE or FULL mode) or COM_ACCESS_FAILED
+				 */
+				ReturnCode tryDriveVacuum(Motors flag) {
+					ReturnCode result = tryDriveMotors(m_MainBrushFlag, m_SideBrushFlag, flag);
+					if(result == ROOMBA_OK) {
+						m_VacuumFlag = flag;
+					}
+					return result;
 				}
 
 			private:
@@ -414,183 +753,863 @@ namespace net {
 				 * @param leds flags that indicates leds. (0-255)
 				 * @param intensity intensity of the leds. (0-255)
 				 * @param color color of the CLEAN/POWER button (0-green, 255-red).
+				 * @throw ComAccessException
 				 */
 				LIBROOMBA_API void setLED(uint8_t leds, uint8_t intensity, uint8_t color = 127);
 
+				/**
+				 * @brief setLED without throwing
+				 *
+				 * @return ROOMBA_OK or COM_ACCESS_FAILED
+				 */
+				LIBROOMBA_API ReturnCode trySetLED(uint8_t leds, uint8_t intensity, uint8_t color = 127);
+
 				LIBROOMBA_API void setDockLED(uint8_t flag) {
+					throwError(trySetDockLED(flag));
+				}
+
+				LIBROOMBA_API ReturnCode trySetDockLED(uint8_t flag) {
 					if(flag) {
 						m_ledFlag |= LED_DOCK;
 					} else {
 						m_ledFlag &= (~LED_DOCK);
 					}
-					setLED(m_ledFlag, m_intensity, m_color);
+					return trySetLED(m_ledFlag, m_intensity, m_color);
 				}
 
 				LIBROOMBA_API void setSpotLED(uint8_t flag) {
+					throwError(trySetSpotLED(flag));
+				}
+
+				LIBROOMBA_API ReturnCode trySetSpotLED(uint8_t flag) {
 					if(flag) {
 						m_ledFlag |= LED_SPOT;
 					} else {
 						m_ledFlag &= (~LED_SPOT);
 					}
-					setLED(m_ledFlag, m_intensity, m_color);
+					return trySetLED(m_ledFlag, m_intensity, m_color);
 				}
 
 				LIBROOMBA_API void setDebrisLED(uint8_t flag) {
+					throwError(trySetDebrisLED(flag));
+				}
+
+				LIBROOMBA_API ReturnCode trySetDebrisLED(uint8_t flag) {
 					if(flag) {
 						m_ledFlag |= LED_DEBRIS;
 					} else {
 						m_ledFlag &= (~LED_DEBRIS);
 					}
-					setLED(m_ledFlag, m_intensity, m_color);
+					return trySetLED(m_ledFlag, m_intensity, m_color);
 				}
 
 				LIBROOMBA_API void setRobotLED(uint8_t flag) {
+					throwError(trySetRobotLED(flag));
+				}
+
+				LIBROOMBA_API ReturnCode trySetRobotLED(uint8_t flag) {
 					if(flag) {
 						m_ledFlag |= LED_CHECK_ROBOT;
 					} else {
 						m_ledFlag &= (~LED_CHECK_ROBOT);
 					}
-					setLED(m_ledFlag, m_intensity, m_color);
+					return trySetLED(m_ledFlag, m_intensity, m_color);
 				}
 
 
 				LIBROOMBA_API void setCleanLEDIntensity(uint8_t intensity) {
+					throwError(trySetCleanLEDIntensity(intensity));
+				}
+
+				LIBROOMBA_API ReturnCode trySetCleanLEDIntensity(uint8_t intensity) {
 					m_intensity = intensity;
-					setLED(m_ledFlag, m_intensity, m_color);
+					return trySetLED(m_ledFlag, m_intensity, m_color);
 				}
 
 				LIBROOMBA_API void setCleanLEDColor(uint8_t color) {
+					throwError(trySetCleanLEDColor(color));
+				}
+
+				LIBROOMBA_API ReturnCode trySetCleanLEDColor(uint8_t color) {
 					m_color = color;
-					setLED(m_ledFlag, m_intensity, m_color);
+					return trySetLED(m_ledFlag, m_intensity, m_color);
 				}
 
 
 			private:
-				Mutex m_AsyncThreadMutex;
-
-				bool m_isStreamMode;
-
-				std::map<SensorID, uint16_t> m_SensorDataMap;
-
-				uint32_t m_AsyncThreadReceiveCounter;
-
+				Mutex m_ScriptMutex; // guards m_ScriptLoaded and m_ScriptHash
+				bool m_ScriptLoaded;
+				uint32_t m_ScriptHash;
 
-				void waitPacketReceived();
+				void forgetScript();
 
-				void processOdometry(void);
 			public:
 				/**
-				 * @brief Start Sensor Data Stream Receiving.
+				 * @brief Upload Script to Roomba
 				 *
-				 * This function starts sensor stream from Roomba. The sensor data will be received
-				 * in every 15 ms.
+				 * The script is cached by its content hash, and not re-sent
+				 * if the same script is already stored on Roomba. The cache is cleared by
+				 * connect, the recovery of the sensor stream and MODE_POWER_DOWN.
+				 * This function is only available for Create (VERSION_ROI).
 				 *
-				 * @param requestingSensors array that includes sensorIds
-				 * @param numSensors The numbers of sensors which are listed in the previous argument.
+				 * @param script Script to upload
+				 * @throw PreconditionNotMetError, ComAccessException
 				 */
-				void startSensorStream(uint8_t* requestingSensors, uint32_t numSensors);
+				LIBROOMBA_API void uploadScript(const Script& script);
 
 				/**
-				 * @brief Resume Sensor Data Stream
+				 * @brief uploadScript without throwing
+				 *
+				 * @return ROOMBA_OK, PRECONDITION_NOT_MET (not Create) or COM_ACCESS_FAILED
 				 */
-				LIBROOMBA_API void resumeSensorStream();
+				LIBROOMBA_API ReturnCode tryUploadScript(const Script& script);
 
 				/**
-				 * @brief Suspend Sensor Data Stream
+				 * @brief Play Script
+				 *
+				 * Uploads the script if it is not stored on Roomba yet, and plays it with a single byte.
+				 * Roomba does not respond to the other commands until the script finishes.
+				 * This function is only available for Create (VERSION_ROI).
+				 *
+				 * @param script Script to play
+				 * @throw PreconditionNotMetError, ComAccessException
 				 */
-				LIBROOMBA_API void suspendSensorStream();
+				LIBROOMBA_API void playScript(const Script& script);
 
-				void Run();
+				/**
+				 * @brief playScript without throwing
+				 *
+				 * @return ROOMBA_OK, PRECONDITION_NOT_MET (not Create) or COM_ACCESS_FAILED
+				 */
+				LIBROOMBA_API ReturnCode tryPlayScript(const Script& script);
 
+			public:
 				/**
-				 * @brief Starts background job for parameter updates
-				 * This function starts background thread which automatically receive
-				 * packet stream from roomba. This function also sends command to 
-				 * your roomba to start the packet stream.
+				 * @brief Safety Reflex Trigger Identifier
+				 * These values are used in setSafetyReflex.
+				 *
+				 * @see setSafetyReflex
+				 */
+				enum ReflexTrigger {
+					REFLEX_BUMP = 0x01, //!< Left or Right Bumper
+					REFLEX_WHEEL_DROP = 0x02, //!< Left or Right Wheel Dropped
+					REFLEX_CLIFF = 0x04, //!< Any of Cliff Sensors
+					REFLEX_WHEEL_OVERCURRENT = 0x08, //!< Left or Right Wheel Over Current
+					REFLEX_ALL = 0x0F, //!< All of above
+				};
+
+				/**
+				 * @brief Safety Reflex Action
+				 *
+				 * @see setSafetyReflex
 				 */
-				LIBROOMBA_API void runAsync();
+				enum ReflexAction {
+					REFLEX_ACTION_STOP, //!< Stop both wheels
+					REFLEX_ACTION_BACK_OFF, //!< Back off while bumped or cliff, then stop
+				};
 
 			private:
-				void RequestSensor(uint8_t sensorId, int16_t *value)  ;
-				void RequestSensor(uint8_t sensorId, uint16_t *value);
-				void RequestSensor(uint8_t sensorId, int8_t *value);
-				void RequestSensor(uint8_t sensorId, uint8_t *value);
+				uint32_t m_ReflexTriggers;
+				ReflexAction m_ReflexAction;
+				int16_t m_ReflexBackOffVelocity;
+				uint32_t m_ReflexActiveTriggers;
 
-			public:
+				uint32_t m_ReflexCount;
+				uint32_t m_ReflexLastReactionTime;
+				uint32_t m_ReflexMaxReactionTime;
+
+				pcwrapper::Timer m_FrameTimer;
 
+				void processSafetyReflex();
+
+			public:
 				/**
-				 * @brief Is Right Wheel Dropped ?
+				 * @brief Set Safety Reflex
 				 *
-				 * @return true if dropped. false if not dropped.
+				 * The safety reflex is checked in the sensor stream thread on every
+				 * received frame, and stops (or backs off) the wheels without waiting
+				 * for the application. Wheel drops and over currents always stop the wheels.
+				 * Call this function before runAsync so that the required sensors are
+				 * added to the stream.
+				 *
+				 * @param triggers OR of REFLEX_BUMP, REFLEX_WHEEL_DROP, REFLEX_CLIFF, REFLEX_WHEEL_OVERCURRENT. 0 disables reflex.
+				 * @param action REFLEX_ACTION_STOP or REFLEX_ACTION_BACK_OFF
+				 * @param backOffVelocity Velocity of back off (0 - 500 mm/s)
+				 * @throw PreconditionNotMetError Unknown action or velocity out of range.
 				 */
-				LIBROOMBA_API bool isRightWheelDropped();
+				LIBROOMBA_API void setSafetyReflex(uint32_t triggers, ReflexAction action = REFLEX_ACTION_STOP, int16_t backOffVelocity = 100);
 
 				/**
-				 * @brief Is Left Wheel Dropped ?
+				 * @brief setSafetyReflex without throwing
 				 *
-				 * @return true if dropped. false if not dropped.
+				 * @return ROOMBA_OK or PRECONDITION_NOT_MET
 				 */
-				LIBROOMBA_API bool isLeftWheelDropped();
+				LIBROOMBA_API ReturnCode trySetSafetyReflex(uint32_t triggers, ReflexAction action = REFLEX_ACTION_STOP, int16_t backOffVelocity = 100);
 
 				/**
-				 * @brief Is Right Bump ?
+				 * @brief Get Safety Reflex Statistics
 				 *
-				 * @return true if bumped. false if not bumped.
+				 * Reaction time is measured from the arrival of the frame to
+				 * the completion of writing the stop (or back off) command.
+				 *
+				 * @param count Number of reflex reactions
+				 * @param lastReactionTime Reaction time of the last reflex (usec)
+				 * @param maxReactionTime Maximum reaction time (usec)
 				 */
-				LIBROOMBA_API bool isRightBump();
+				LIBROOMBA_API void getSafetyReflexStatistics(uint32_t* count, uint32_t* lastReactionTime, uint32_t* maxReactionTime);
+
+			private:
+				ReadWriteLock m_AsyncThreadLock; // guards the sensor cache, the subscription and the poll schedule
+
+				bool m_isStreamMode;
+
+				std::map<SensorID, uint16_t> m_SensorDataMap;
+
+				// copy of m_SensorDataMap readable without the lock (value | PUBLISHED_VALUE_VALID).
+				volatile uint32_t m_PublishedSensorValues[MAX_SENSOR_ID + 1];
+
+				void storeSensorValue(SensorID sensorId, uint16_t value);
+
+				uint32_t m_AsyncThreadReceiveCounter;
+
+				bool m_StreamThreadStarted;
+
+				Event* m_pNotifyEvent; // set after each frame. guarded by m_AsyncThreadLock
+
+				bool processFrame();
+				void completeFrame();
+				uint32_t getFrameElapsedTime();
+
+
+				bool waitPacketReceived();
+
+				void processOdometry(void);
+
+			private:
+				struct StreamSubscription {
+					volatile uint32_t lastRead; // frame counter when the sensor was read last time. Written with the read lock.
+					bool pinned; // requested in startSensorStream (never dropped)
+					StreamSubscription() : lastRead(0), pinned(false) {}
+				};
+
+				std::map<SensorID, StreamSubscription> m_StreamSubscription;
+				std::vector<uint8_t> m_StreamList; // packet ids sent by the last OP_STREAM
+				uint32_t m_Baudrate;
+				bool m_ResubscribeRequested;
+				uint32_t m_LastResubscribeFrame;
+				uint32_t m_ResubscribeIntervalFrames;
+				uint32_t m_SubscriptionIdleFrames;
 
+				ReturnCode sendStreamSubscription();
+				void processStreamSubscription();
+				ReturnCode getStreamSensorValue(uint8_t sensorId, uint16_t* value);
+				bool isStreamed(uint8_t sensorId);
+
+			private:
+				struct PollEntry {
+					uint32_t period; // in POLL_PERIOD ticks
+					uint32_t nextTick; // tick when the sensor is due
+					volatile uint32_t lastRead; // tick when the sensor was read last time. Written with the read lock.
+					bool pinned; // set by setPollRate or required internally (never dropped)
+					PollEntry() : period(1), nextTick(0), lastRead(0), pinned(false) {}
+				};
+
+				std::map<SensorID, PollEntry> m_PollSchedule;
+				uint32_t m_DefaultPollPeriod;
+				uint32_t m_PollIdleTicks;
+
+				void schedulePoll(uint8_t sensorId, uint32_t period, bool pinned);
+				bool isPolledByGroup(uint8_t sensorId);
+
+			private:
+				uint32_t m_StreamIdleTimeout; // [msec] 0 never suspends
+				uint32_t m_StreamInterest; // acquireSensorStream - releaseSensorStream
+				volatile uint32_t m_LastDemandFrame; // frame counter when the data was demanded last time. Written with the read lock.
+				bool m_StreamIdle;
+				StreamActivityStatistics m_StreamActivity;
+
+				void processStreamDemand();
+				ReturnCode demandSensorStream(bool waitFreshFrame);
+
+			private:
+				uint32_t m_WatchdogPeriods; // 0 disables the watchdog
+				uint32_t m_WatchdogReopenAttempts; // 0 never reopens
+				uint64_t m_StallTime; // [usec] of net::ysuga::Clock
+				StreamRecoveryStatistics m_StreamRecovery;
+
+				uint32_t getWatchdogTimeout();
+				void recoverSensorStream();
+				void completeStreamRecovery();
+
+			private:
+				StopToken m_StopToken; // wakes up the stream thread from the waits
+
+				void sleepUnlessStopped(const uint32_t milliSeconds);
+
+			public:
 				/**
-				 * @brief Is Left Bump ?
+				 * @brief Start Sensor Data Stream Receiving.
 				 *
-				 * @return true if bumped. false if not bumped.
+				 * This function starts sensor stream from Roomba. The sensor data will be received
+				 * in every 15 ms.
+				 * The listed sensors are always streamed. Reading other sensors adds them to
+				 * the stream automatically (500 series only).
+				 * ROI does not stream the sensors. The listed sensors are polled every 100 ms instead.
+				 * The scheduling of the background thread (e.g. SCHED_FIFO, affinity) is set
+				 * by Thread::SetAttributes before the call.
+				 * @see setPollRate
+				 *
+				 * @param requestingSensors array that includes sensorIds or sensor group ids (SENSOR_GROUP_*)
+				 * @param numSensors The numbers of sensors which are listed in the previous argument.
+				 * @param startThread false if the data is processed by pollSensorData in another thread.
+				 * @throw ComAccessException
 				 */
-				LIBROOMBA_API bool isLeftBump();
+				void startSensorStream(uint8_t* requestingSensors, uint32_t numSensors, bool startThread = true);
 
 				/**
-				 * @brief Is Left Cliff ?
+				 * @brief startSensorStream without throwing
 				 *
-				 * @return true if cliff. false if not cliff.
+				 * @return ROOMBA_OK, COM_ACCESS_FAILED or TX_QUEUE_FULL
 				 */
-				LIBROOMBA_API bool isCliffLeft();
+				ReturnCode tryStartSensorStream(uint8_t* requestingSensors, uint32_t numSensors, bool startThread = true);
 
 				/**
-				 * @brief Is Front Left Cliff ?
+				 * @brief Stop the Sensor Stream and its Background Thread
 				 *
-				 * @return true if cliff. false if not cliff.
+				 * Wakes up the background thread from the wait for the data, joins it,
+				 * and then suspends the stream of the robot. The thread is stopped within
+				 * a few milliseconds even if the robot does not send anything.
+				 * The stream can be started again by connect or runAsync.
+				 *
+				 * @return Time to stop [usec]. 0 if the stream is not started.
+				 * @throw ComAccessException The thread is stopped, but the robot may keep streaming.
 				 */
-				LIBROOMBA_API bool isCliffFrontLeft();
+				LIBROOMBA_API uint32_t stopSensorStream();
 
 				/**
-				 * @brief Is Front Right Cliff ?
+				 * @brief stopSensorStream without throwing
 				 *
-				 * @return true if cliff. false if not cliff.
+				 * @return Time to stop [usec], or COM_ACCESS_FAILED or TX_QUEUE_FULL
+				 * if the suspension of the stream is not sent. The thread is stopped anyway.
 				 */
-				LIBROOMBA_API bool isCliffFrontRight();
+				LIBROOMBA_API Result<uint32_t> tryStopSensorStream();
 
 				/**
-				 * @brief Is Right Cliff ?
-				 *
-				 * @return true if cliff. false if not cliff.
+				 * @brief Resume Sensor Data Stream
+				 * @throw ComAccessException
 				 */
-				LIBROOMBA_API bool isCliffRight();
+				LIBROOMBA_API void resumeSensorStream();
 
 				/**
-				 * @brief Is Virtual Wall deteceted?
+				 * @brief resumeSensorStream without throwing
 				 *
-				 * @return true if virtual wall detected.
+				 * @return ROOMBA_OK, COM_ACCESS_FAILED or TX_QUEUE_FULL
 				 */
-				LIBROOMBA_API bool isVirtualWall();
+				LIBROOMBA_API ReturnCode tryResumeSensorStream();
 
-				/** 
-				 * @brief Wheel OverCurrent?
-				 *
-				 * Return value can be or-combination of following values:
-				 *  RightWheel, LeftWheel, MainBrush, SideBrush
+				/**
+				 * @brief Suspend Sensor Data Stream
+				 * @throw ComAccessException
+				 */
+				LIBROOMBA_API void suspendSensorStream();
+
+				/**
+				 * @brief suspendSensorStream without throwing
+				 *
+				 * @return ROOMBA_OK, COM_ACCESS_FAILED or TX_QUEUE_FULL
+				 */
+				LIBROOMBA_API ReturnCode trySuspendSensorStream();
+
+				/**
+				 * @brief Set Policy of Stream Subscription
+				 *
+				 * Reading a sensor which is not in the stream re-sends the stream request
+				 * with the union of active sensors. The request is sent at most once per resubscribeInterval.
+				 * Sensors not read for idleTimeout are dropped from the stream (except for
+				 * the sensors listed in startSensorStream). If the frame exceeds the bytes
+				 * which can be sent in 15 ms at the current baud rate, the least recently read
+				 * sensors are dropped.
+				 *
+				 * @param resubscribeInterval Minimum interval of stream request [msec]. Default 200.
+				 * @param idleTimeout Idle time to drop the sensor [msec]. Default 10000.
+				 */
+				LIBROOMBA_API void setStreamSubscriptionPolicy(const uint32_t resubscribeInterval, const uint32_t idleTimeout);
+
+				/**
+				 * @brief Get Sensors in the Stream
+				 *
+				 * Single sensors may be replaced by a group packet if the group is smaller in bytes.
+				 *
+				 * @param sensorIds Buffer for sensor ids or sensor group ids
+				 * @param maxCount Size of the buffer
+				 * @return Number of sensors in the stream
+				 */
+				LIBROOMBA_API uint32_t getStreamSubscription(uint8_t* sensorIds, const uint32_t maxCount);
+
+				/**
+				 * @brief Get Number of Received Sensor Frames
+				 *
+				 * Counts the stream frames (500 series) or the poll ticks (ROI) since runAsync.
+				 */
+				LIBROOMBA_API uint32_t getFrameCount() const { return m_AsyncThreadReceiveCounter; }
+
+				/**
+				 * @brief Suspend Sensor Stream of Idle Robot
+				 *
+				 * If no sensor is read for idleTimeout and nobody holds acquireSensorStream,
+				 * the stream is suspended (suspendSensorStream for 500 series, no poll for ROI)
+				 * and the background thread wakes up only every IDLE_STREAM_PERIOD ms.
+				 * The next read of a sensor resumes the stream and waits for the first fresh
+				 * frame. The stream is never suspended while the safety reflex, the velocity
+				 * control or a trajectory needs it.
+				 * The pose (getX, getY, getTh) is not a read of the sensors. Hold
+				 * acquireSensorStream to keep the odometry running.
+				 *
+				 * @param idleTimeout Idle time to suspend [msec]. 0 (default) never suspends.
+				 */
+				LIBROOMBA_API void setStreamIdleTimeout(const uint32_t idleTimeout);
+
+				/**
+				 * @brief Set Watchdog of the Sensor Stream
+				 *
+				 * If no frame arrives for the periods (a brownout, the mode reset by the dock,
+				 * a hiccup of the USB adapter), the stream is recovered in place: START, the
+				 * current mode and the current stream subscription (500 series) are sent again
+				 * until the frames come back. Every reopenAttempts attempts, the serial port
+				 * is closed and opened again. The sensor queries of the user are waited for
+				 * REQUEST_TIMEOUT instead. The polls of ROI are part of the stream.
+				 * Enabled with DEFAULT_WATCHDOG_PERIODS by default.
+				 *
+				 * @param periods Missing frame periods to detect the stall. 0 disables the watchdog.
+				 * @param reopenAttempts Recovery attempts before reopening the port. 0 never reopens.
+				 * @see getStreamRecoveryStatistics
+				 */
+				LIBROOMBA_API void setStreamWatchdog(const uint32_t periods, const uint32_t reopenAttempts = DEFAULT_WATCHDOG_REOPEN_ATTEMPTS);
+
+				/**
+				 * @brief Get Recoveries of the Stalled Sensor Stream
+				 */
+				LIBROOMBA_API void getStreamRecoveryStatistics(StreamRecoveryStatistics* statistics);
+
+				/**
+				 * @brief Declare Interest in the Sensor Stream
+				 *
+				 * The stream is not suspended until the same number of releaseSensorStream.
+				 * Resumes the suspended stream without waiting for the frame.
+				 * @throw ComAccessException
+				 */
+				LIBROOMBA_API void acquireSensorStream();
+
+				/**
+				 * @brief acquireSensorStream without throwing
+				 *
+				 * The interest is held even if the resume is not sent.
+				 * @return ROOMBA_OK, COM_ACCESS_FAILED or TX_QUEUE_FULL
+				 */
+				LIBROOMBA_API ReturnCode tryAcquireSensorStream();
+
+				/**
+				 * @brief Withdraw Interest in the Sensor Stream
+				 * @see acquireSensorStream
+				 */
+				LIBROOMBA_API void releaseSensorStream();
+
+				/**
+				 * @brief Notify that the data will be used soon
+				 *
+				 * Counts as a read of the sensors. Resumes the suspended stream without
+				 * waiting for the frame.
+				 * @throw ComAccessException
+				 */
+				LIBROOMBA_API void touchSensorStream();
+
+				/**
+				 * @brief touchSensorStream without throwing
+				 *
+				 * @return ROOMBA_OK, COM_ACCESS_FAILED or TX_QUEUE_FULL
+				 */
+				LIBROOMBA_API ReturnCode tryTouchSensorStream();
+
+				/**
+				 * @brief Get Activity of the Sensor Stream Processing
+				 *
+				 * Wake ups are the returns from the sleeps of the background thread (or the
+				 * calls of pollSensorData) and the receive loop of the transport.
+				 * CPU time is measured in the thread which processes the frames.
+				 */
+				LIBROOMBA_API void getStreamActivityStatistics(StreamActivityStatistics* statistics);
+
+				/**
+				 * @brief Get Health of the Serial Link
+				 *
+				 * Round trip times of the requests, intervals of the sensor frames, bytes per
+				 * second and the errors of the stream since the last resetLinkStats.
+				 * Never blocks the threads which send or receive the data.
+				 *
+				 * @see getLinkStatistics for the histograms
+				 */
+				LIBROOMBA_API void getLinkStats(RoombaLinkStats* stats);
+
+				/**
+				 * @brief Start a new measurement window of the link statistics
+				 */
+				LIBROOMBA_API void resetLinkStats();
+
+				/**
+				 * @brief Get Histograms and Counters of the Serial Link
+				 */
+				LIBROOMBA_API const LinkStatistics& getLinkStatistics() const { return m_pTransport->GetLinkStatistics(); }
+
+				/**
+				 * @brief Set Poll Rate of Sensor (ROI only)
+				 *
+				 * Create does not stream the sensors. The background thread polls the sensors
+				 * with OP_QUERY_LIST every POLL_PERIOD ms, and packs the sensors due in the tick
+				 * into one query within the bytes which can be received in POLL_PERIOD.
+				 * The accessors (isXxx, getXxx) return the latest polled value.
+				 * Sensors read without the rate are polled every 500 ms, and dropped
+				 * after 10 seconds without reading.
+				 *
+				 * @param sensorId Sensor ID or sensor group id (SENSOR_GROUP_0 - SENSOR_GROUP_6)
+				 * @param period Poll period [msec]. Rounded up to POLL_PERIOD. 0 removes the sensor.
+				 * @throw PreconditionNotMetError
+				 */
+				LIBROOMBA_API void setPollRate(uint8_t sensorId, uint32_t period);
+
+				/**
+				 * @brief setPollRate without throwing
+				 *
+				 * @return ROOMBA_OK or PRECONDITION_NOT_MET
+				 */
+				LIBROOMBA_API ReturnCode trySetPollRate(uint8_t sensorId, uint32_t period);
+
+				void Run();
+
+				/**
+				 * @brief Starts background job for parameter updates
+				 * This function starts background thread which automatically receive
+				 * packet stream from roomba. This function also sends command to 
+				 * your roomba to start the packet stream.
+				 *
+				 * @param startThread false if the data is processed by pollSensorData in another thread (e.g. RoombaFleet).
+				 * @throw ComAccessException
+				 */
+				LIBROOMBA_API void runAsync(bool startThread = true);
+
+				/**
+				 * @brief runAsync without throwing
+				 *
+				 * @return ROOMBA_OK, COM_ACCESS_FAILED or TX_QUEUE_FULL
+				 */
+				LIBROOMBA_API ReturnCode tryRunAsync(bool startThread = true);
+
+				/**
+				 * @brief Bring up the Robot and start the sensor stream
+				 *
+				 * Sends START with the query of OI mode to probe the link, and then the mode
+				 * change and the stream request in one write without the settle time of
+				 * setMode. Returns when the first valid frame (500 series) or poll (ROI)
+				 * is processed. Construct the object with sendStart = false.
+				 * If the robot does not respond, delete the object before the retry.
+				 *
+				 * @param mode MODE_PASSIVE, MODE_SAFE or MODE_FULL
+				 * @param timeout Timeout [msec]
+				 * @param requestingSensors Sensors passed to startSensorStream. NULL uses the sensors of runAsync.
+				 * @param numSensors Number of the sensors
+				 * @param startThread false if the data is processed by pollSensorData in another thread.
+				 * @return Time from the call to the first frame [usec]
+				 * @throw ConnectionTimeoutError
+				 * @throw PreconditionNotMetError if the stream is already started.
+				 * @throw ComAccessException
+				 */
+				LIBROOMBA_API uint32_t connect(const Mode mode, const uint32_t timeout, uint8_t* requestingSensors = NULL,
+					const uint32_t numSensors = 0, bool startThread = true);
+
+				/**
+				 * @brief connect without throwing
+				 *
+				 * @return Time from the call to the first frame [usec], or CONNECTION_TIMEOUT,
+				 * PRECONDITION_NOT_MET, COM_ACCESS_FAILED or TX_QUEUE_FULL
+				 */
+				LIBROOMBA_API Result<uint32_t> tryConnect(const Mode mode, const uint32_t timeout, uint8_t* requestingSensors = NULL,
+					const uint32_t numSensors = 0, bool startThread = true);
+
+				/**
+				 * @brief Is the sensor stream (or the poll scheduler of ROI) started?
+				 */
+				LIBROOMBA_API bool isSensorStreamStarted() const { return m_isStreamMode; }
+
+				/**
+				 * @brief Process the received sensor data without blocking
+				 *
+				 * Used instead of the background thread when runAsync(false) is called.
+				 * Reads only the bytes already received. A part of a stream frame (500 series)
+				 * is kept for the next call. The poll of the sensors (ROI) is sent when
+				 * POLL_PERIOD passed since the last poll, and its response is processed by a
+				 * later call after it arrives.
+				 *
+				 * @return true if the data is processed.
+				 */
+				LIBROOMBA_API bool pollSensorData();
+
+				/**
+				 * @brief Wait until pollSensorData of any of the robots has something to do
+				 *
+				 * Waits for the ports of the robots together, and returns by the next poll (ROI)
+				 * or the watchdog timeout of the stream, so that one thread can serve many
+				 * robots without checking them periodically (e.g. RoombaFleet).
+				 *
+				 * @param roombas Robots processed by pollSensorData
+				 * @param count Number of the robots
+				 * @param timeout Longest wait [msec]
+				 * @param stopToken Wakes up the wait. Can be NULL.
+				 */
+				LIBROOMBA_API static void waitSensorData(Roomba* const* roombas, const uint32_t count, const uint32_t timeout,
+					const StopToken* stopToken);
+
+				/**
+				 * @brief Wait until any of the robots receives some data, the event is set or the timeout
+				 *
+				 * Unlike waitSensorData, the schedule of pollSensorData is not waited.
+				 * Used for the responses of the queries (e.g. BehaviorExecutor).
+				 *
+				 * @param roombas Robots
+				 * @param count Number of the robots
+				 * @param timeout Longest wait [msec]
+				 * @param event Wakes up the wait (e.g. the event of setNotifyEvent). Can be NULL.
+				 */
+				LIBROOMBA_API static void waitReceived(Roomba* const* roombas, const uint32_t count, const uint32_t timeout,
+					Event* event);
+
+				/**
+				 * @brief Set Event which is set after each sensor frame and when the queued commands are written
+				 *
+				 * Lets one thread wait for the frames of many robots (e.g. BehaviorExecutor).
+				 *
+				 * @param event Event (not owned). NULL to clear.
+				 */
+				LIBROOMBA_API void setNotifyEvent(Event* event);
+
+				/**
+				 * @brief Bytes of the commands waiting to be written to the port
+				 */
+				LIBROOMBA_API uint32_t getTxQueueDepth() { return m_pTransport->GetTxQueueDepth(); }
+
+				/**
+				 * @brief Get the last received value without any communication
+				 *
+				 * @param sensorId Sensor ID
+				 * @param value [OUT] Raw value
+				 * @return false if the sensor has not been received.
+				 */
+				LIBROOMBA_API bool getCachedSensorValue(uint8_t sensorId, uint16_t* value);
+
+				/**
+				 * @brief Get the last received value for monitoring
+				 *
+				 * Unlike getCachedSensorValue, takes no lock and does not count as a demand
+				 * of the sensor stream, so a suspended stream stays suspended.
+				 *
+				 * @param sensorId Sensor ID (0 - MAX_SENSOR_ID)
+				 * @param value [OUT] Raw value
+				 * @return false if the sensor has never been received.
+				 */
+				LIBROOMBA_API bool peekSensorValue(uint8_t sensorId, uint16_t* value) const;
+
+				/**
+				 * @brief Get a sensor value without throwing
+				 *
+				 * Reads the sensor stream (or the poll scheduler for ROI) if it is started,
+				 * or queries the sensor with OP_SENSORS. The accessors below (isRightBump etc.)
+				 * are built on this, and read 0 for SENSOR_UNAVAILABLE.
+				 *
+				 * @param sensorId Sensor ID (not a group)
+				 * @return Raw value. Cast it to int8_t or int16_t for the signed sensors.
+				 * PRECONDITION_NOT_MET for the unknown sensor, COM_ACCESS_FAILED,
+				 * SENSOR_UNAVAILABLE if the value does not arrive in time, or
+				 * TX_QUEUE_FULL if the query is not sent because the serial port is congested.
+				 */
+				LIBROOMBA_API Result<uint16_t> tryGetSensorValue(uint8_t sensorId);
+
+				/**
+				 * @brief Get Sensor Group Packet without throwing
+				 *
+				 * @return ROOMBA_OK, PRECONDITION_NOT_MET, COM_ACCESS_FAILED, SENSOR_UNAVAILABLE or TX_QUEUE_FULL
+				 * @see getSensorGroup
+				 */
+				LIBROOMBA_API ReturnCode tryGetSensorGroup(uint8_t groupId, uint16_t* values = NULL);
+
+				/**
+				 * @brief Request Sensors without waiting for the response and without throwing
+				 *
+				 * Never blocks. While the late responses of a failed request are arriving, the query
+				 * is not sent and REQUEST_BUSY is returned.
+				 * @return ROOMBA_OK, PRECONDITION_NOT_MET, COM_ACCESS_FAILED, TX_QUEUE_FULL or REQUEST_BUSY
+				 * @see requestSensorAsync
+				 */
+				LIBROOMBA_API ReturnCode tryRequestSensorAsync(const uint8_t* sensorIds, const uint32_t count, SensorQuery* query);
+
+			private:
+				/**
+				 * Value for the accessors. An unavailable value (also for the congested port) reads defaultValue.
+				 */
+				template<typename T>
+				static T valueOf(const Result<T>& result, const T& defaultValue = T()) {
+					if(result.getError() != SENSOR_UNAVAILABLE && result.getError() != TX_QUEUE_FULL) {
+						throwError(result.getError());
+					}
+					return result.getValueOr(defaultValue);
+				}
+
+				/**
+				 * tryGetSensorValue converted to the type of the accessor.
+				 */
+				template<typename T>
+				Result<T> trySensorValue(uint8_t sensorId) {
+					Result<uint16_t> value = tryGetSensorValue(sensorId);
+					if(!value.isOk()) {
+						return Result<T>::failure(value.getError());
+					}
+					return Result<T>((T)value.getValueOr(0));
+				}
+
+				Result<bool> trySensorFlag(uint8_t sensorId, uint8_t mask);
+
+			public:
+
+				/**
+				 * @brief Is Right Wheel Dropped ?
+				 *
+				 * @return true if dropped. false if not dropped.
+				 */
+				LIBROOMBA_API bool isRightWheelDropped();
+
+				/**
+				 * @brief isRightWheelDropped without throwing
+				 * @see tryGetSensorValue
+				 */
+				LIBROOMBA_API Result<bool> tryIsRightWheelDropped();
+
+				/**
+				 * @brief Is Left Wheel Dropped ?
+				 *
+				 * @return true if dropped. false if not dropped.
+				 */
+				LIBROOMBA_API bool isLeftWheelDropped();
+
+				/**
+				 * @brief isLeftWheelDropped without throwing
+				 * @see tryGetSensorValue
+				 */
+				LIBROOMBA_API Result<bool> tryIsLeftWheelDropped();
+
+				/**
+				 * @brief Is Right Bump ?
+				 *
+				 * @return true if bumped. false if not bumped.
+				 */
+				LIBROOMBA_API bool isRightBump();
+
+				/**
+				 * @brief isRightBump without throwing
+				 * @see tryGetSensorValue
+				 */
+				LIBROOMBA_API Result<bool> tryIsRightBump();
+
+				/**
+				 * @brief Is Left Bump ?
+				 *
+				 * @return true if bumped. false if not bumped.
+				 */
+				LIBROOMBA_API bool isLeftBump();
+
+				/**
+				 * @brief isLeftBump without throwing
+				 * @see tryGetSensorValue
+				 */
+				LIBROOMBA_API Result<bool> tryIsLeftBump();
+
+				/**
+				 * @brief Is Left Cliff ?
+				 *
+				 * @return true if cliff. false if not cliff.
+				 */
+				LIBROOMBA_API bool isCliffLeft();
+
+				/**
+				 * @brief isCliffLeft without throwing
+				 * @see tryGetSensorValue
+				 */
+				LIBROOMBA_API Result<bool> tryIsCliffLeft();
+
+				/**
+				 * @brief Is Front Left Cliff ?
+				 *
+				 * @return true if cliff. false if not cliff.
+				 */
+				LIBROOMBA_API bool isCliffFrontLeft();
+
+				/**
+				 * @brief isCliffFrontLeft without throwing
+				 * @see tryGetSensorValue
+				 */
+				LIBROOMBA_API Result<bool> tryIsCliffFrontLeft();
+
+				/**
+				 * @brief Is Front Right Cliff ?
+				 *
+				 * @return true if cliff. false if not cliff.
+				 */
+				LIBROOMBA_API bool isCliffFrontRight();
+
+				/**
+				 * @brief isCliffFrontRight without throwing
+				 * @see tryGetSensorValue
+				 */
+				LIBROOMBA_API Result<bool> tryIsCliffFrontRight();
+
+				/**
+				 * @brief Is Right Cliff ?
+				 *
+				 * @return true if cliff. false if not cliff.
+				 */
+				LIBROOMBA_API bool isCliffRight();
+
+				/**
+				 * @brief isCliffRight without throwing
+				 * @see tryGetSensorValue
+				 */
+				LIBROOMBA_API Result<bool> tryIsCliffRight();
+
+				/**
+				 * @brief Is Virtual Wall deteceted?
+				 *
+				 * @return true if virtual wall detected.
+				 */
+				LIBROOMBA_API bool isVirtualWall();
+
+				/**
+				 * @brief isVirtualWall without throwing
+				 * @see tryGetSensorValue
+				 */
+				LIBROOMBA_API Result<bool> tryIsVirtualWall();
+
+				/** 
+				 * @brief Wheel OverCurrent?
+				 *
+				 * Return value can be or-combination of following values:
+				 *  RightWheel, LeftWheel, MainBrush, SideBrush
 				 *
 				 * @return MotorFlag data. 
 				 */
 				LIBROOMBA_API Roomba::MotorFlag isWheelOvercurrents();
 
+				/**
+				 * @brief isWheelOvercurrents without throwing
+				 * @see tryGetSensorValue
+				 */
+				LIBROOMBA_API Result<MotorFlag> tryIsWheelOvercurrents();
+
 				/**
 				 * @brief Is Right Wheel Over Current?
 				 *
@@ -598,6 +1617,12 @@ namespace net {
 				 */
 				LIBROOMBA_API bool isRightWheelOvercurrent();
 
+				/**
+				 * @brief isRightWheelOvercurrent without throwing
+				 * @see tryGetSensorValue
+				 */
+				LIBROOMBA_API Result<bool> tryIsRightWheelOvercurrent();
+
 				/**
 				 * @brief Is Left Wheel Over Current?
 				 *
@@ -605,6 +1630,12 @@ namespace net {
 				 */
 				LIBROOMBA_API bool isLeftWheelOvercurrent();
 
+				/**
+				 * @brief isLeftWheelOvercurrent without throwing
+				 * @see tryGetSensorValue
+				 */
+				LIBROOMBA_API Result<bool> tryIsLeftWheelOvercurrent();
+
 				/**
 				 * @brief Is Main Brush Over Current?
 				 *
@@ -612,6 +1643,12 @@ namespace net {
 				 */
 				LIBROOMBA_API bool isMainBrushOvercurrent();
 
+				/**
+				 * @brief isMainBrushOvercurrent without throwing
+				 * @see tryGetSensorValue
+				 */
+				LIBROOMBA_API Result<bool> tryIsMainBrushOvercurrent();
+
 				/**
 				 * @brief Is Side Brush Over Current?
 				 *
@@ -619,6 +1656,12 @@ namespace net {
 				 */
 				LIBROOMBA_API bool isSideBrushOvercurrent();
 
+				/**
+				 * @brief isSideBrushOvercurrent without throwing
+				 * @see tryGetSensorValue
+				 */
+				LIBROOMBA_API Result<bool> tryIsSideBrushOvercurrent();
+
 				/**
 				 * @brief Detect Dirt
 				 *
@@ -626,6 +1669,12 @@ namespace net {
 				 */
 				LIBROOMBA_API bool dirtDetect();
 
+				/**
+				 * @brief dirtDetect without throwing
+				 * @see tryGetSensorValue
+				 */
+				LIBROOMBA_API Result<bool> tryDirtDetect();
+
 				/**
 				 * @brief Get 8-bit IR character received by Roomba's omnidirectional IR receiver.
 				 *
@@ -634,6 +1683,12 @@ namespace net {
 				 */
 				LIBROOMBA_API int8_t getInfraredCharacterOmni();
 
+				/**
+				 * @brief getInfraredCharacterOmni without throwing
+				 * @see tryGetSensorValue
+				 */
+				LIBROOMBA_API Result<int8_t> tryGetInfraredCharacterOmni();
+
 				/**
 				 * @brief Get 8-bit IR character received by Roomba's right IR receiver.
 				 *
@@ -642,6 +1697,12 @@ namespace net {
 				 */
 				LIBROOMBA_API int8_t getInfraredCharacterRight();
 
+				/**
+				 * @brief getInfraredCharacterRight without throwing
+				 * @see tryGetSensorValue
+				 */
+				LIBROOMBA_API Result<int8_t> tryGetInfraredCharacterRight();
+
 				/**
 				 * @brief Get 8-bit IR character received by Roomba's left IR receiver.
 				 *
@@ -650,6 +1711,12 @@ namespace net {
 				 */
 				LIBROOMBA_API int8_t getInfraredCharacterLeft();
 
+				/**
+				 * @brief getInfraredCharacterLeft without throwing
+				 * @see tryGetSensorValue
+				 */
+				LIBROOMBA_API Result<int8_t> tryGetInfraredCharacterLeft();
+
 
 				/**
 				 * @brief Get Button State
@@ -661,6 +1728,12 @@ namespace net {
 				 */
 				LIBROOMBA_API Roomba::ButtonFlag getButtons();
 
+				/**
+				 * @brief getButtons without throwing
+				 * @see tryGetSensorValue
+				 */
+				LIBROOMBA_API Result<ButtonFlag> tryGetButtons();
+
 				/**
 				 * @brief Get Traveled Distance since this function previously called.
 				 *
@@ -668,6 +1741,12 @@ namespace net {
 				 */
 				LIBROOMBA_API int16_t getDistance();
 
+				/**
+				 * @brief getDistance without throwing
+				 * @see tryGetSensorValue
+				 */
+				LIBROOMBA_API Result<int16_t> tryGetDistance();
+
 				/**
 				 * @brief Get Traveled Angle since this function previously called.
 				 *
@@ -675,6 +1754,12 @@ namespace net {
 				 */
 				LIBROOMBA_API int16_t getAngle();
 
+				/**
+				 * @brief getAngle without throwing
+				 * @see tryGetSensorValue
+				 */
+				LIBROOMBA_API Result<int16_t> tryGetAngle();
+
 				/**
 				 * @brief Get Charging State
 				 *
@@ -685,6 +1770,12 @@ namespace net {
 				 */
 				LIBROOMBA_API Roomba::ChargingState getChargingState();
 
+				/**
+				 * @brief getChargingState without throwing
+				 * @see tryGetSensorValue
+				 */
+				LIBROOMBA_API Result<ChargingState> tryGetChargingState();
+
 				/**
 				 * @brief Get Voltage of Battery
 				 *
@@ -692,6 +1783,12 @@ namespace net {
 				 */
 				LIBROOMBA_API uint16_t getVoltage();
 
+				/**
+				 * @brief getVoltage without throwing
+				 * @see tryGetSensorValue
+				 */
+				LIBROOMBA_API Result<uint16_t> tryGetVoltage();
+
 				/**
 				 * @brief Get Current
 				 *
@@ -699,6 +1796,12 @@ namespace net {
 				 */
 				LIBROOMBA_API uint16_t getCurrent();
 
+				/**
+				 * @brief getCurrent without throwing
+				 * @see tryGetSensorValue
+				 */
+				LIBROOMBA_API Result<uint16_t> tryGetCurrent();
+
 				/** 
 				 * @brief Get Temperature of Roomba
 				 *
@@ -706,6 +1809,12 @@ namespace net {
 				 */
 				LIBROOMBA_API int8_t getTemperature();
 
+				/**
+				 * @brief getTemperature without throwing
+				 * @see tryGetSensorValue
+				 */
+				LIBROOMBA_API Result<int8_t> tryGetTemperature();
+
 
 
 
@@ -732,6 +1841,12 @@ namespace net {
 				 */
 				LIBROOMBA_API Mode getOIMode();
 
+				/**
+				 * @brief getOIMode without throwing
+				 * @see tryGetSensorValue
+				 */
+				LIBROOMBA_API Result<Mode> tryGetOIMode();
+
 				/**
 				 * @brief Get Requested Translational Velocity
 				 *
@@ -739,6 +1854,12 @@ namespace net {
 				 */
 				LIBROOMBA_API int16_t getRequestedVelocity();
 
+				/**
+				 * @brief getRequestedVelocity without throwing
+				 * @see tryGetSensorValue
+				 */
+				LIBROOMBA_API Result<int16_t> tryGetRequestedVelocity();
+
 				/**
 				 * @brief Get Requested Translational Radius
 				 *
@@ -746,6 +1867,12 @@ namespace net {
 				 */
 				LIBROOMBA_API int16_t getRequestedRadius();
 
+				/**
+				 * @brief getRequestedRadius without throwing
+				 * @see tryGetSensorValue
+				 */
+				LIBROOMBA_API Result<int16_t> tryGetRequestedRadius();
+
 
 				/**
 				 * @brief Get Right Wheel's Encoder Count
@@ -754,6 +1881,12 @@ namespace net {
 				 */
 				LIBROOMBA_API uint16_t getRightEncoderCounts();
 
+				/**
+				 * @brief getRightEncoderCounts without throwing
+				 * @see tryGetSensorValue
+				 */
+				LIBROOMBA_API Result<uint16_t> tryGetRightEncoderCounts();
+
 				/**
 				 * @brief Get Left Wheel's Encoder Count
 				 *
@@ -761,6 +1894,12 @@ namespace net {
 				 */
 				LIBROOMBA_API uint16_t getLeftEncoderCounts();
 
+				/**
+				 * @brief getLeftEncoderCounts without throwing
+				 * @see tryGetSensorValue
+				 */
+				LIBROOMBA_API Result<uint16_t> tryGetLeftEncoderCounts();
+
 
 			private:
 
@@ -771,11 +1910,151 @@ namespace net {
 				 *
 				 * @param trans Translational speed [mm/sec] (front positive / back negative)
 				 * @param rotate Rotational speed [mm/sec] (turn left positive / turn right negative)
+				 * @throw PreconditionNotMetError, ComAccessException
 				 */
 				LIBROOMBA_API void move(const double trans, const double rotate);
 
+				/**
+				 * @brief move without throwing
+				 *
+				 * @return ROOMBA_OK, PRECONDITION_NOT_MET (not in SAFE or FULL mode) or COM_ACCESS_FAILED
+				 */
+				LIBROOMBA_API ReturnCode tryMove(const double trans, const double rotate);
+
 				LIBROOMBA_API void getCurrentVelocity(double* x, double* th);
 				LIBROOMBA_API void getCurrentPosition(double* x, double* y, double* th);
+
+			public:
+				/**
+				 * @brief Output Command of Velocity Controller
+				 *
+				 * @see setVelocityControl
+				 */
+				enum ControlOutput {
+					CONTROL_OUTPUT_DIRECT, //!< Output with driveDirect
+					CONTROL_OUTPUT_PWM, //!< Output with drivePWM
+				};
+
+			private:
+				bool m_VelocityControlEnabled;
+				ControlOutput m_ControlOutput;
+				double m_ControlGainP;
+				double m_ControlGainI;
+
+				Mutex m_ControlMutex;
+				double m_TargetVelocityRight;
+				double m_TargetVelocityLeft;
+
+				bool m_ControlInitFlag;
+				uint16_t m_ControlEncoderRightOld;
+				uint16_t m_ControlEncoderLeftOld;
+				double m_ControlIntegralRight;
+				double m_ControlIntegralLeft;
+				double m_MeasuredVelocityRight;
+				double m_MeasuredVelocityLeft;
+				uint32_t m_ControlFrame; // frame count of the last control step
+
+				void processVelocityControl();
+				void dropControlBaseline();
+				void overrideVelocityControl(const double velocity);
+
+			public:
+				/**
+				 * @brief Enable/Disable Closed-loop Wheel Velocity Control
+				 *
+				 * When enabled, move() only sets the target wheel velocities, and
+				 * the sensor stream thread tracks them on every frame from encoder
+				 * counts with PI control plus feedforward. If one of the wheels
+				 * saturates, both commands are scaled so that the curvature is kept.
+				 * This function is only available for 500 series (VERSION_500_SERIES).
+				 * Call this function before runAsync so that the encoder counts are
+				 * added to the stream.
+				 *
+				 * @param enable true to enable controller.
+				 * @param kp Proportional gain [(m/sec) / (m/sec)]
+				 * @param ki Integral gain [(m/sec) / m]
+				 * @param output CONTROL_OUTPUT_DIRECT or CONTROL_OUTPUT_PWM
+				 */
+				LIBROOMBA_API void setVelocityControl(bool enable, double kp = 0.5, double ki = 2.0, ControlOutput output = CONTROL_OUTPUT_DIRECT);
+
+				/**
+				 * @brief Get Wheel Velocity measured by Velocity Controller
+				 *
+				 * @param right Right wheel velocity [m/sec]
+				 * @param left Left wheel velocity [m/sec]
+				 */
+				LIBROOMBA_API void getWheelVelocity(double* right, double* left);
+
+			public:
+				/**
+				 * @brief Sample of Velocity Profile
+				 *
+				 * @see executeTrajectory
+				 */
+				struct TrajectorySample {
+					double time; //!< Deadline relative to the start of the trajectory [sec]
+					double velocity; //!< Translational speed [m/sec]
+					double angularVelocity; //!< Rotational speed [rad/sec]
+				};
+
+			private:
+				Mutex m_TrajectoryMutex;
+				TrajectorySample* m_TrajectoryBuffer;
+				int32_t* m_TrajectoryTimingError;
+				uint32_t m_TrajectoryCapacity; // samples allocated in m_TrajectoryBuffer
+				uint32_t m_TrajectoryCount;
+				uint32_t m_TrajectoryIndex;
+				bool m_TrajectoryRunning;
+				pcwrapper::Timer m_TrajectoryTimer;
+
+				void processTrajectory();
+
+			public:
+				/**
+				 * @brief Execute Time-parameterised Trajectory
+				 *
+				 * The samples are copied into a buffer which is allocated here (not by the stream
+				 * thread) when it is too small, and each setpoint is passed to move() from the
+				 * sensor stream thread at the frame nearest to its deadline.
+				 * If a trajectory is already running, it is preempted.
+				 * The last setpoint is kept after the trajectory finishes.
+				 *
+				 * @param samples Velocity profile sorted by time.
+				 * @param count Number of samples (up to MAX_TRAJECTORY_SAMPLES)
+				 * @throw PreconditionNotMetError Sensor stream is not running or too many samples.
+				 */
+				LIBROOMBA_API void executeTrajectory(const TrajectorySample* samples, const uint32_t count);
+
+				/**
+				 * @brief executeTrajectory without throwing
+				 *
+				 * @return ROOMBA_OK or PRECONDITION_NOT_MET
+				 */
+				LIBROOMBA_API ReturnCode tryExecuteTrajectory(const TrajectorySample* samples, const uint32_t count);
+
+				/**
+				 * @brief Cancel Running Trajectory
+				 */
+				LIBROOMBA_API void cancelTrajectory();
+
+				/**
+				 * @brief Is Trajectory Running?
+				 *
+				 * @return true if running.
+				 */
+				LIBROOMBA_API bool isTrajectoryRunning();
+
+				/**
+				 * @brief Get Timing Error of the Emitted Samples
+				 *
+				 * Timing error is the difference between the time the sample was emitted
+				 * and its deadline (positive means late).
+				 *
+				 * @param errors Buffer for timing errors [usec]
+				 * @param maxCount Size of the buffer
+				 * @return Number of samples emitted so far.
+				 */
+				LIBROOMBA_API uint32_t getTrajectoryTimingError(int32_t* errors, const uint32_t maxCount);
 			};
 
 		}
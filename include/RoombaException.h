@@ -45,6 +45,82 @@ namespace net {
 			};
 
 
+			/**
+			 * @brief Script exceeds the maximum length.
+			 */
+			class ScriptOverflowError : public RoombaException {
+			public:
+				ScriptOverflowError() : RoombaException("Script Overflow") {
+				}
+
+		    ~ScriptOverflowError() throw() {
+				}
+			};
+
+
+			/**
+			 * @brief Robot does not respond in time.
+			 */
+			class ConnectionTimeoutError : public RoombaException {
+			public:
+				ConnectionTimeoutError() : RoombaException("Connection Timeout") {
+				}
+
+		    ~ConnectionTimeoutError() throw() {
+				}
+			};
+
+
+			/**
+			 * @brief Port can not be opened to listen.
+			 */
+			class ListenError : public RoombaException {
+			public:
+				ListenError() : RoombaException("Can Not Listen the Port") {
+				}
+
+		    ~ListenError() throw() {
+				}
+			};
+
+
+			/**
+			 * @brief Sensor value does not arrive in time.
+			 */
+			class SensorUnavailableError : public RoombaException {
+			public:
+				SensorUnavailableError() : RoombaException("Sensor Value Unavailable") {
+				}
+
+		    ~SensorUnavailableError() throw() {
+				}
+			};
+
+			/**
+			 * @brief Request is rejected because the commands are waiting for the serial port.
+			 */
+			class TxQueueFullError : public RoombaException {
+			public:
+				TxQueueFullError() : RoombaException("Transmit Queue Full") {
+				}
+
+		    ~TxQueueFullError() throw() {
+				}
+			};
+
+			/**
+			 * @brief Request is not sent because the late responses of a failed request are arriving.
+			 */
+			class RequestBusyError : public RoombaException {
+			public:
+				RequestBusyError() : RoombaException("Request Busy") {
+				}
+
+		    ~RequestBusyError() throw() {
+				}
+			};
+
+
 	
 		}
 	}
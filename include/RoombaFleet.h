@@ -0,0 +1,227 @@
+/********************************************************
+ * RoombaFleet.h
+ *
+ * Runtime for many robots.
+ * @author ysuga@ysuga.net
+ ********************************************************/
+
+#ifndef ROOMBA_FLEET_HEADER_INCLUDED
+#define ROOMBA_FLEET_HEADER_INCLUDED
+
+#include "common.h"
+#include "type.h"
+#include "Thread.h"
+#include "ThreadPool.h"
+#include "Timer.h"
+
+#include <vector>
+#include <string>
+
+namespace net {
+	namespace ysuga {
+		namespace roomba {
+
+			class Roomba;
+			class RoombaFleet;
+
+			/**
+			 * @brief Control Callback of RoombaFleet. Called after each frame of the robot.
+			 */
+			typedef void (*RoombaControlCallback)(Roomba* roomba, uint32_t index, void* context);
+
+			/**
+			 * @brief State of a robot in RoombaFleet::getSnapshot
+			 */
+			struct RoombaSnapshot {
+				double x; //!< [m]
+				double y; //!< [m]
+				double th; //!< [rad]
+				uint16_t voltage; //!< [mV]
+				uint16_t batteryCharge; //!< [mAh]
+				uint16_t batteryCapacity; //!< [mAh]
+				uint32_t frameCount; //!< Number of processed frames
+			};
+
+			/**
+			 * @brief Statistics of a robot in RoombaFleet
+			 */
+			struct RoombaFleetStatistics {
+				uint32_t frameCount; //!< Number of processed frames
+				uint32_t callbackCount; //!< Number of control callbacks
+				uint32_t skippedCount; //!< Frames whose callback is skipped because the previous one is running
+				uint32_t maxLatency; //!< Maximum time from the frame to the start of the callback [usec]
+				uint32_t lastLatency; //!< Last time from the frame to the start of the callback [usec]
+				uint64_t callbackTime; //!< Total time spent in the callbacks [usec]
+				uint32_t connectTime; //!< Time from the connect to the first frame [usec]. 0 if not added by connectAll
+			};
+
+			/**
+			 * @brief I/O thread of RoombaFleet
+			 */
+			class FleetIOThread : public Thread {
+			private:
+				RoombaFleet* m_pFleet;
+				uint32_t m_Index;
+
+			public:
+				FleetIOThread(RoombaFleet* fleet, uint32_t index) : m_pFleet(fleet), m_Index(index) {}
+				virtual ~FleetIOThread() {}
+
+				void Run();
+			};
+
+			/**
+			 * @brief Runtime for Many Robots
+			 *
+			 * The fleet owns the robots. Instead of one thread per robot, a small number of
+			 * I/O threads process the received frames of the robots (Roomba::pollSensorData),
+			 * and the control callbacks run on a work-stealing thread pool.
+			 * An I/O thread never blocks on one robot. It waits for the ports of all its
+			 * robots together (Roomba::waitSensorData) when none of them has data.
+			 * The callback of a robot never runs concurrently with itself. If the previous
+			 * callback is still running when the next frame arrives, the callback is skipped.
+			 */
+			class RoombaFleet {
+				friend class FleetIOThread;
+			private:
+				struct Member {
+					RoombaFleet* fleet;
+					Roomba* roomba;
+					uint32_t index;
+					Mutex mutex;
+					bool callbackPending;
+					pcwrapper::Timer frameTimer;
+					RoombaFleetStatistics statistics;
+				};
+
+				std::vector<Member*> m_Members;
+				std::vector<FleetIOThread*> m_IOThreads;
+				WorkStealingPool* m_pPool;
+				uint32_t m_NumIOThreads;
+				uint32_t m_NumWorkerThreads;
+				volatile bool m_Running;
+				StopToken m_StopToken; // wakes up the I/O threads waiting for the data
+				ThreadAttributes m_IOThreadAttributes;
+
+				RoombaControlCallback m_Callback;
+				void* m_CallbackContext;
+
+				void processIO(uint32_t ioIndex);
+				static void runCallback(void* argument);
+
+			public:
+				/**
+				 * @brief Constructor
+				 *
+				 * @param numIOThreads Number of threads which process the received data
+				 * @param numWorkerThreads Number of threads which run the control callbacks
+				 */
+				LIBROOMBA_API RoombaFleet(uint32_t numIOThreads = 2, uint32_t numWorkerThreads = 4);
+
+				/**
+				 * @brief Destructor. Stops the fleet and deletes the robots.
+				 */
+				LIBROOMBA_API ~RoombaFleet();
+
+			public:
+				/**
+				 * @brief Connect a Robot
+				 *
+				 * @return Index of the robot
+				 * @throw PreconditionNotMetError if the fleet is running.
+				 */
+				LIBROOMBA_API uint32_t add(const uint32_t model, const char* portName, const uint32_t baudrate);
+
+				/**
+				 * @brief Add a Robot. The fleet takes the ownership.
+				 *
+				 * @return Index of the robot
+				 * @throw PreconditionNotMetError if the fleet is running.
+				 */
+				LIBROOMBA_API uint32_t add(Roomba* roomba);
+
+				/**
+				 * @brief Connect Robots in Parallel
+				 *
+				 * Brings up all the ports at the same time by Roomba::connect (safe mode).
+				 * The ports which can not be opened or do not respond within the timeout
+				 * are skipped. The robots are added in the order of the ports, and
+				 * RoombaFleetStatistics::connectTime reports the bring-up time of each robot.
+				 *
+				 * @param portNames Port names (e.g. by scanPorts)
+				 * @param model Model Number of the robots
+				 * @param baudrate Baud Rate
+				 * @param timeout Timeout of each robot [msec]
+				 * @return Number of the added robots
+				 * @throw PreconditionNotMetError if the fleet is running.
+				 */
+				LIBROOMBA_API uint32_t connectAll(const std::vector<std::string>& portNames, const uint32_t model,
+					const uint32_t baudrate = 115200, const uint32_t timeout = 1000);
+
+				/**
+				 * @brief List the Serial Ports where the robots may be connected
+				 *
+				 * /dev/ttyUSB* and /dev/ttyACM* on Unix, COM1 - COM256 on Windows.
+				 *
+				 * @param portNames [OUT] Port names
+				 * @return Number of the ports
+				 */
+				LIBROOMBA_API static uint32_t scanPorts(std::vector<std::string>& portNames);
+
+				/**
+				 * @brief Get Robot
+				 */
+				LIBROOMBA_API Roomba* get(uint32_t index) { return m_Members[index]->roomba; }
+
+				/**
+				 * @brief Number of Robots
+				 */
+				LIBROOMBA_API uint32_t size() const { return m_Members.size(); }
+
+				/**
+				 * @brief Set Control Callback
+				 *
+				 * @param callback Callback called after each frame of each robot. NULL disables.
+				 * @param context Argument passed to the callback.
+				 */
+				LIBROOMBA_API void setControlCallback(RoombaControlCallback callback, void* context);
+
+				/**
+				 * @brief Set Scheduling Attributes of the I/O threads (e.g. SCHED_FIFO, affinity)
+				 *
+				 * Used by the next start.
+				 */
+				LIBROOMBA_API void setIOThreadAttributes(const ThreadAttributes& attributes) { m_IOThreadAttributes = attributes; }
+
+				/**
+				 * @brief Start sensor processing of all robots
+				 *
+				 * The streams of the robots brought up by connectAll are already started.
+				 */
+				LIBROOMBA_API void start();
+
+				/**
+				 * @brief Stop sensor processing of all robots
+				 */
+				LIBROOMBA_API void stop();
+
+				/**
+				 * @brief Get State of All Robots from the cache without any communication
+				 *
+				 * @param snapshots [OUT] Buffer indexed by the robot index
+				 * @param maxCount Size of the buffer
+				 * @return Number of robots
+				 */
+				LIBROOMBA_API uint32_t getSnapshot(RoombaSnapshot* snapshots, const uint32_t maxCount);
+
+				/**
+				 * @brief Get Statistics of a Robot
+				 */
+				LIBROOMBA_API void getStatistics(uint32_t index, RoombaFleetStatistics* statistics);
+			};
+
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,139 @@
+/********************************************************
+ * Script.h
+ *
+ * OI Script (Create / ROI only) builder.
+ * @author ysuga@ysuga.net
+ ********************************************************/
+
+#ifndef SCRIPT_HEADER_INCLUDED
+#define SCRIPT_HEADER_INCLUDED
+
+#include "common.h"
+#include "type.h"
+
+/**
+ * Maximum length of a script defined in the Open Interface Specification
+ */
+#define MAX_SCRIPT_LENGTH 100
+
+namespace net {
+	namespace ysuga {
+		namespace roomba {
+
+			/**
+			 * @brief Command Sequence stored on Roomba (Script command, opcode 152)
+			 *
+			 * The commands are compiled into bytes of the Open Interface, which are
+			 * uploaded and played by Roomba::playScript. While the script is running,
+			 * Roomba does not respond to the other commands until the script finishes.
+			 *
+			 * @see Roomba::playScript
+			 */
+			class Script {
+			private:
+				uint8_t m_Buffer[MAX_SCRIPT_LENGTH];
+				uint32_t m_Length;
+
+			public:
+				/**
+				 * @brief Constructor
+				 */
+				LIBROOMBA_API Script();
+
+				/**
+				 * @brief Destructor
+				 */
+				LIBROOMBA_API ~Script();
+
+			private:
+				void append(const uint8_t* data, const uint32_t size);
+				void append16(uint8_t opcode, int16_t value);
+
+			public:
+				/**
+				 * @brief Clear all commands
+				 */
+				LIBROOMBA_API void clear() { m_Length = 0; }
+
+				/**
+				 * @brief Drive with Translation Velocity and Turn Radius.
+				 *
+				 * @param translation Translation Velocity (-500 - 500 mm/s)
+				 * @param turnRadius Radius (-2000 - 2000 mm)
+				 * @throw ScriptOverflowError
+				 */
+				LIBROOMBA_API void drive(int16_t translation, int16_t turnRadius);
+
+				/**
+				 * @brief Drive Each Wheel Directly
+				 *
+				 * @param rightWheel Translation Velocity (-500 - 500 mm/s)
+				 * @param leftWheel  Translation Velocity (-500 - 500 mm/s)
+				 * @throw ScriptOverflowError
+				 */
+				LIBROOMBA_API void driveDirect(int16_t rightWheel, int16_t leftWheel);
+
+				/**
+				 * @brief Set LEDs
+				 *
+				 * @param leds flags that indicates leds. (0-255)
+				 * @param intensity intensity of the leds. (0-255)
+				 * @param color color of the CLEAN/POWER button (0-green, 255-red).
+				 * @throw ScriptOverflowError
+				 */
+				LIBROOMBA_API void setLED(uint8_t leds, uint8_t intensity, uint8_t color = 127);
+
+				/**
+				 * @brief Wait Time
+				 *
+				 * @param time Time in 100 ms unit (0 - 255)
+				 * @throw ScriptOverflowError
+				 */
+				LIBROOMBA_API void waitTime(uint8_t time);
+
+				/**
+				 * @brief Wait until Roomba travels the specified distance
+				 *
+				 * @param distance Distance in mm (negative value means backward)
+				 * @throw ScriptOverflowError
+				 */
+				LIBROOMBA_API void waitDistance(int16_t distance);
+
+				/**
+				 * @brief Wait until Roomba turns the specified angle
+				 *
+				 * @param angle Angle in degrees (positive is CCW)
+				 * @throw ScriptOverflowError
+				 */
+				LIBROOMBA_API void waitAngle(int16_t angle);
+
+				/**
+				 * @brief Wait until the event occurs
+				 *
+				 * @param event Event number (1 - 20). Negative value waits for the inverse of the event.
+				 * @throw ScriptOverflowError
+				 */
+				LIBROOMBA_API void waitEvent(int8_t event);
+
+			public:
+				/**
+				 * @brief Get compiled bytes
+				 */
+				LIBROOMBA_API const uint8_t* getBytes() const { return m_Buffer; }
+
+				/**
+				 * @brief Get length of compiled bytes
+				 */
+				LIBROOMBA_API uint32_t getLength() const { return m_Length; }
+
+				/**
+				 * @brief Get hash value of the content (FNV-1a)
+				 */
+				LIBROOMBA_API uint32_t getHash() const;
+			};
+
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,67 @@
+/********************************************************
+ * SensorGroup.h
+ *
+ * Layout of sensor packets and sensor group packets.
+ * @author ysuga@ysuga.net
+ ********************************************************/
+
+#ifndef SENSOR_GROUP_HEADER_INCLUDED
+#define SENSOR_GROUP_HEADER_INCLUDED
+
+#include "common.h"
+#include "type.h"
+#include "op_code.h"
+
+/**
+ * Maximum ID of single sensor packets
+ */
+#define MAX_SENSOR_ID 58
+
+/**
+ * Maximum ID of sensor packets including group packets
+ */
+#define MAX_SENSOR_PACKET_ID 107
+
+/**
+ * Size of the largest group packet (SENSOR_GROUP_100)
+ */
+#define MAX_SENSOR_GROUP_SIZE 80
+
+namespace net {
+	namespace ysuga {
+		namespace roomba {
+
+			/**
+			 * @brief Get Data Size of Sensor Packet
+			 *
+			 * @param packetId Sensor ID or Sensor Group ID
+			 * @return Size in bytes. 0 if unknown.
+			 */
+			LIBROOMBA_API uint32_t getSensorDataSize(const uint8_t packetId);
+
+			/**
+			 * @brief Get Range of Sensor Group
+			 *
+			 * @param groupId Sensor Group ID
+			 * @param firstId [OUT] first sensor id in the group
+			 * @param lastId [OUT] last sensor id in the group
+			 * @return false if packetId is not a group.
+			 */
+			LIBROOMBA_API bool getSensorGroupRange(const uint8_t groupId, uint8_t* firstId, uint8_t* lastId);
+
+			/**
+			 * @brief Decode Sensor Group Packet
+			 *
+			 * Each sensor is decoded at its fixed offset computed from the layout table.
+			 *
+			 * @param groupId Sensor Group ID
+			 * @param data Received data (getSensorDataSize(groupId) bytes)
+			 * @param values [OUT] Decoded values indexed by sensor id (MAX_SENSOR_ID+1 elements)
+			 */
+			LIBROOMBA_API void decodeSensorGroup(const uint8_t groupId, const uint8_t* data, uint16_t* values);
+
+		}
+	}
+}
+
+#endif
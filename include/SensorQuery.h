@@ -0,0 +1,129 @@
+/********************************************************
+ * SensorQuery.h
+ *
+ * Handle of asynchronous sensor query.
+ * @author ysuga@ysuga.net
+ ********************************************************/
+
+#ifndef SENSOR_QUERY_HEADER_INCLUDED
+#define SENSOR_QUERY_HEADER_INCLUDED
+
+#include "common.h"
+#include "type.h"
+#include "Transport.h"
+#include "SensorGroup.h"
+
+/**
+ * Maximum bytes of the response of one sensor query
+ */
+#define MAX_SENSOR_QUERY_SIZE 255
+
+namespace net {
+	namespace ysuga {
+		namespace roomba {
+
+			class Roomba;
+			class SensorQuery;
+
+			/**
+			 * @brief Callback of SensorQuery. Called in the thread which receives the response.
+			 */
+			typedef void (*SensorQueryCallback)(SensorQuery* query, void* context);
+
+			/**
+			 * @brief Handle of Asynchronous Sensor Query
+			 *
+			 * Roomba::requestSensorAsync sends OP_QUERY_LIST and returns without waiting
+			 * for the response. Several queries can be in flight on the wire, and the
+			 * responses are matched in the order of the queries. The response is received
+			 * by wait, or by any later query which is waited.
+			 * The destructor waits for the response if the query is in flight.
+			 *
+			 * @see Roomba::requestSensorAsync
+			 */
+			class SensorQuery {
+				friend class Roomba;
+			private:
+				Roomba* m_pRoomba;
+				Transport* m_pTransport;
+				Transport::PendingRequest m_Request;
+				bool m_InFlight;
+				bool m_Received;
+
+				uint8_t m_PacketIds[MAX_SENSOR_QUERY_SIZE];
+				uint32_t m_NumPackets;
+				uint8_t m_Data[MAX_SENSOR_QUERY_SIZE];
+
+				uint16_t m_Values[MAX_SENSOR_ID + 1];
+				bool m_Contained[MAX_SENSOR_ID + 1];
+
+				SensorQueryCallback m_Callback;
+				void* m_CallbackContext;
+
+				static void onComplete(void* context);
+
+			public:
+				/**
+				 * @brief Constructor
+				 */
+				LIBROOMBA_API SensorQuery();
+
+				/**
+				 * @brief Destructor
+				 */
+				LIBROOMBA_API ~SensorQuery();
+
+			public:
+				/**
+				 * @brief Set Callback called when the response is received.
+				 *
+				 * The values are available in the callback. Do not call wait in the callback.
+				 *
+				 * @param callback Callback function. NULL disables the callback.
+				 * @param context Argument passed to the callback.
+				 */
+				LIBROOMBA_API void setCallback(SensorQueryCallback callback, void* context);
+
+				/**
+				 * @brief Is the response received?
+				 *
+				 * Receives the responses which are already arrived without blocking.
+				 */
+				LIBROOMBA_API bool isReady();
+
+				/**
+				 * @brief Wait for the response.
+				 */
+				LIBROOMBA_API void wait();
+
+				/**
+				 * @brief Time until the query times out [msec]
+				 *
+				 * @return 0 if the query is not in flight, 0xFFFFFFFF if it waits forever.
+				 */
+				LIBROOMBA_API uint32_t getRemainingTime() const;
+
+				/**
+				 * @brief Is the sensor included in the query?
+				 *
+				 * @param sensorId Sensor ID
+				 */
+				LIBROOMBA_API bool contains(uint8_t sensorId) const;
+
+				/**
+				 * @brief Get Sensor Value
+				 *
+				 * Call after wait (or isReady returns true), or in the callback.
+				 *
+				 * @param sensorId Sensor ID. Sensors in the group packets are also available.
+				 * @return Raw value. Cast to the signed type for the signed sensors.
+				 * @throw PreconditionNotMetError
+				 */
+				LIBROOMBA_API uint16_t getValue(uint8_t sensorId);
+			};
+
+		}
+	}
+}
+
+#endif
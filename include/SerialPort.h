@@ -10,6 +10,7 @@
 #define SERIAL_PORT_HEADER_INCLUDED
 
 #include <exception>
+#include <string>
 #include "ComAccessException.h"
 #include "ComOpenException.h"
 #include "ComStateException.h"
@@ -22,6 +23,9 @@
 namespace net {
 	namespace ysuga {
 
+		class StopToken;
+		class Event;
+
 		/***************************************************
 		 * SerialPort
 		 *
@@ -41,6 +45,11 @@ namespace net {
 			int m_Fd;
 #endif
 
+			std::string m_Filename;
+			int m_Baudrate;
+
+			void Open();
+			void Close();
 
 
 		public:
@@ -55,39 +64,113 @@ namespace net {
 			/**
 			 * @brief Destructor
 			 */
-			~SerialPort();
+			virtual ~SerialPort();
+
+		protected:
+			/**
+			 * @brief Constructor for the ports without any device (e.g. SimulatedRobot)
+			 */
+			SerialPort();
 
 		public:
 			/**
 			 * @brief flush receive buffer.
 			 * @return zero if success.
 			 */
-			void FlushRxBuffer();
+			virtual void FlushRxBuffer();
 
 			/**
 			 * @brief flush transmit buffer.
 			 * @return zero if success.
 			 */
-			void FlushTxBuffer();
+			virtual void FlushTxBuffer();
+
+			/**
+			 * @brief Close and open the port again (e.g. after the USB adapter is replugged).
+			 *
+			 * Does nothing for the ports without any device.
+			 * @throw ComOpenException, ComStateException
+			 */
+			virtual void Reopen();
 
 		public:
 			/**
 			 * @brief Get stored datasize of in Rx Buffer
 			 * @return Stored Data Size of Rx Buffer;
+			 * @throw ComAccessException
 			 */
 			int GetSizeInRxBuffer();
 
+			/**
+			 * @brief Get stored datasize of in Rx Buffer without throwing
+			 *
+			 * The Try* functions access the device, and Transport uses them. The throwing
+			 * functions (GetSizeInRxBuffer, Write, Read) call them and throw for -1.
+			 * The simulated ports override the Try* functions.
+			 * @return Stored Data Size of Rx Buffer, or -1 if the port can not be accessed.
+			 */
+			virtual int TryGetSizeInRxBuffer();
+
+			/**
+			 * @brief Wait until some data is received, the timeout or the stop request.
+			 *
+			 * The ports without any device wait 1 ms with Thread::Sleep (the Clock).
+			 * @param timeout [msec]
+			 * @param stopToken Wakes up the wait by StopToken::RequestStop. Can be NULL.
+			 */
+			virtual void WaitReadable(const unsigned int timeout, const StopToken* stopToken);
+
+			/**
+			 * @brief Wait until some data can be written, the timeout or the event.
+			 *
+			 * The ports without any device wait 1 ms with Thread::Sleep (the Clock).
+			 * @param timeout [msec]
+			 * @param event Wakes up the wait by Event::Set, and is cleared then. Can be NULL.
+			 */
+			virtual void WaitWritable(const unsigned int timeout, Event* event);
+
+			/**
+			 * @brief Wait until any of the ports receives some data, the timeout or the stop request.
+			 *
+			 * The ports are waited together (select on Unix). Like WaitReadable, the ports
+			 * which have some data already, and the ports without any device, wait 1 ms.
+			 * Only the Clock (or only the event if given) is waited if none of the ports has a device.
+			 * @param ports Ports
+			 * @param count Number of the ports
+			 * @param timeout [msec]
+			 * @param stopToken Wakes up the wait by StopToken::RequestStop. Can be NULL.
+			 * @param event Wakes up the wait by Event::Set, and is cleared then. Can be NULL.
+			 */
+			static void WaitReadable(SerialPort* const* ports, const unsigned int count, const unsigned int timeout,
+				const StopToken* stopToken, Event* event = NULL);
+
 			/**
 			 * @brief write data to Tx Buffer of Serial Port.
 			 *
+			 * Never blocks on Unix. The written bytes can be less than the size
+			 * (0 if the Tx Buffer is full). WriteFile of Windows writes all of them.
+			 * @throw ComAccessException
 			 */
 			int Write(const void* src, const unsigned int size);
 
 			/**
 			 * @brief read data from RxBuffer of Serial Port 
-			 			 */
+			 * @throw ComAccessException
+			 */
 			int Read(void *dst, const unsigned int size);
 
+			/**
+			 * @brief write data to Tx Buffer of Serial Port without throwing
+			 * @return Written bytes (0 if the Tx Buffer is full), or -1 if the port can not be accessed.
+			 */
+			virtual int TryWrite(const void* src, const unsigned int size);
+
+			/**
+			 * @brief read data from RxBuffer of Serial Port without throwing
+			 * @return Read bytes, or -1 if the port can not be accessed.
+			 */
+			virtual int TryRead(void *dst, const unsigned int size);
+
 		};
 
 	};//namespace ysuga
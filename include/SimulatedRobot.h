@@ -0,0 +1,162 @@
+/********************************************************
+ * SimulatedRobot.h
+ *
+ * In-memory model of Roomba Open Interface device.
+ * @author ysuga@ysuga.net
+ ********************************************************/
+
+#ifndef SIMULATED_ROBOT_HEADER_INCLUDED
+#define SIMULATED_ROBOT_HEADER_INCLUDED
+
+#include "common.h"
+#include "type.h"
+#include "SerialPort.h"
+#include "Thread.h"
+#include "SensorGroup.h"
+
+#include <deque>
+#include <vector>
+
+namespace net {
+	namespace ysuga {
+		namespace roomba {
+
+			/**
+			 * @brief In-memory Roomba for Tests and Benchmarks
+			 *
+			 * Behaves as the serial port connected to a robot. Commands written by
+			 * Roomba are consumed by the model, and sensor responses and stream frames
+			 * are read from an in-memory buffer without any system call.
+			 * The model has its own virtual clock. The wheels move and the stream frames
+			 * (every 15 ms) are produced only when advance is called (or, after followClock,
+			 * as the library clock goes), so the simulation is deterministic. Queries (OP_SENSORS, OP_QUERY_LIST) are answered immediately.
+			 *
+			 * @code
+			 * SimulatedRobot* robot = new SimulatedRobot(Roomba::VERSION_500_SERIES);
+			 * Roomba roomba(Roomba::MODEL_500SERIES, "sim", 115200, robot); // roomba owns robot
+			 * roomba.runAsync(false);
+			 * robot->advance(15000);
+			 * roomba.pollSensorData();
+			 * @endcode
+			 */
+			class SimulatedRobot : public SerialPort {
+			private:
+				uint32_t m_Version;
+				Mutex m_Mutex;
+
+				std::deque<uint8_t> m_RxBuffer; // robot to host
+				std::vector<uint8_t> m_Command; // host to robot (incomplete command)
+
+				uint64_t m_Time; // virtual time [usec]
+				uint64_t m_NextFrameTime;
+
+				uint16_t m_Values[MAX_SENSOR_ID + 1];
+				double m_VelocityRight; // [mm/s]
+				double m_VelocityLeft; // [mm/s]
+				double m_EncoderRight; // [counts]
+				double m_EncoderLeft; // [counts]
+				double m_Distance; // [mm] since the last read
+				double m_Angle; // [deg] since the last read
+
+				std::vector<uint8_t> m_StreamList;
+				bool m_Streaming;
+
+				uint32_t m_CommandCount;
+				uint32_t m_FrameCount;
+
+				bool m_FollowClock;
+				uint64_t m_ClockOffset; // Clock::now() - m_Time [usec]
+
+				uint32_t getCommandLength(const std::vector<uint8_t>& command);
+				void execute(const std::vector<uint8_t>& command);
+				void setWheelVelocity(double right, double left);
+				void integrate(const double dt);
+				void updateValues();
+				void encode(uint8_t packetId, std::vector<uint8_t>& data);
+				void emitFrame();
+				void advanceTo(const uint64_t end);
+				void catchUpClock();
+
+			public:
+				/**
+				 * @brief Constructor
+				 *
+				 * @param version Roomba::VERSION_ROI or Roomba::VERSION_500_SERIES
+				 */
+				LIBROOMBA_API SimulatedRobot(const uint32_t version);
+
+				/**
+				 * @brief Destructor
+				 */
+				LIBROOMBA_API virtual ~SimulatedRobot();
+
+			public:
+				LIBROOMBA_API virtual void FlushRxBuffer();
+				LIBROOMBA_API virtual void FlushTxBuffer();
+				LIBROOMBA_API virtual int TryGetSizeInRxBuffer();
+				LIBROOMBA_API virtual int TryWrite(const void* src, const unsigned int size);
+				LIBROOMBA_API virtual int TryRead(void *dst, const unsigned int size);
+
+			public:
+				/**
+				 * @brief Advance the virtual clock
+				 *
+				 * Moves the wheels and produces the stream frames due in the time.
+				 *
+				 * @param usec Time [usec]
+				 */
+				LIBROOMBA_API void advance(const uint32_t usec);
+
+				/**
+				 * @brief Advance the virtual clock along with net::ysuga::Clock
+				 *
+				 * After the call, the model catches up with Clock::getInstance()
+				 * whenever the host checks the receive buffer. Combined with
+				 * SimulatedClock, the stream frames arrive on the (virtual) 15 ms period
+				 * without calling advance.
+				 */
+				LIBROOMBA_API void followClock();
+
+				/**
+				 * @brief Get Virtual Time [usec]
+				 */
+				LIBROOMBA_API uint64_t getTime();
+
+				/**
+				 * @brief Set Sensor Value (e.g. BUMPS_AND_WHEEL_DROPS, CLIFF_LEFT)
+				 *
+				 * Values computed by the model (encoders, distance, angle, mode, requested velocities) are overwritten.
+				 *
+				 * @param sensorId Sensor ID
+				 * @param value Raw value
+				 */
+				LIBROOMBA_API void setSensorValue(const uint8_t sensorId, const uint16_t value);
+
+				/**
+				 * @brief Get Wheel Velocity commanded to the robot [mm/s]
+				 */
+				LIBROOMBA_API void getWheelVelocity(double* right, double* left);
+
+				/**
+				 * @brief Number of commands consumed
+				 */
+				LIBROOMBA_API uint32_t getCommandCount();
+
+				/**
+				 * @brief Number of stream frames produced
+				 */
+				LIBROOMBA_API uint32_t getFrameCount();
+
+				/**
+				 * @brief Reset the Open Interface as a brownout does
+				 *
+				 * The stream stops, the mode becomes off and the bytes on the way are lost.
+				 */
+				LIBROOMBA_API void resetInterface();
+			};
+
+		}
+	}
+}
+
+#endif
@@ -37,31 +37,60 @@
 #define THREAD_ROUTINE void*
 #endif
 
+#include <stddef.h>
+
+/**
+ * Spin count of the critical section of a Mutex on Windows.
+ */
+#define MUTEX_MAX_SPIN_COUNT 100
+
+/**
+ * Bytes of the stack touched before Run when ThreadAttributes::prefaultStack is set
+ * and the stack size is not specified.
+ */
+#define DEFAULT_PREFAULT_STACK_SIZE (64 * 1024)
+
 
 namespace net {
 	namespace ysuga {
 
+		/**
+		 * @brief Mutual Exclusion Lock (not recursive)
+		 *
+		 * On glibc, the pthread mutex is adaptive: a contended Lock spins for a while
+		 * (tuned by the recent contended locks) before sleeping on the futex. Windows uses a critical section with the spin count.
+		 * Use MutexGuard so that the exceptions do not leave it locked.
+		 */
 		class Mutex {
 		private:
 #ifdef WIN32
-			HANDLE m_Handle;
+			CRITICAL_SECTION m_CriticalSection;
 #else
 			pthread_mutex_t m_Handle;
 #endif
 
+		private:
+			Mutex(const Mutex&);
+			Mutex& operator=(const Mutex&);
 
 		public:
 			Mutex() {
 #ifdef WIN32
-				m_Handle = ::CreateMutex(NULL, 0, NULL);
+				::InitializeCriticalSectionAndSpinCount(&m_CriticalSection, MUTEX_MAX_SPIN_COUNT);
 #else
-				pthread_mutex_init(&m_Handle, NULL);
+				pthread_mutexattr_t attr;
+				pthread_mutexattr_init(&attr);
+#ifdef __GLIBC__
+				pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ADAPTIVE_NP);
+#endif
+				pthread_mutex_init(&m_Handle, &attr);
+				pthread_mutexattr_destroy(&attr);
 #endif
 			}
 
 			virtual ~Mutex() {
 #ifdef WIN32
-				::CloseHandle(m_Handle);
+				::DeleteCriticalSection(&m_CriticalSection);
 #else
 			  pthread_mutex_destroy(&m_Handle);
 #endif
@@ -70,22 +99,304 @@ namespace net {
 		public:
 			void Lock() {
 #ifdef WIN32
-				::WaitForSingleObject(m_Handle, INFINITE);
+				::EnterCriticalSection(&m_CriticalSection);
 #else
-			  
 			  pthread_mutex_lock(&m_Handle);
 #endif
 			}
 
+			bool TryLock() {
+#ifdef WIN32
+				return ::TryEnterCriticalSection(&m_CriticalSection) != 0;
+#else
+				return pthread_mutex_trylock(&m_Handle) == 0;
+#endif
+			}
+
 			void Unlock() {
 #ifdef WIN32
-				::ReleaseMutex(m_Handle);
+				::LeaveCriticalSection(&m_CriticalSection);
 #else
 			  pthread_mutex_unlock(&m_Handle);
 #endif
 			}
 		};
 
+		/**
+		 * @brief Reader-Writer Lock
+		 *
+		 * Any number of readers, or one writer. SRWLOCK on Windows, pthread_rwlock
+		 * elsewhere. The waiting writer is preferred to the new readers on glibc as
+		 * well, so that the writer is never starved by the readers.
+		 * Not recursive. Use ReadGuard and WriteGuard.
+		 */
+		class ReadWriteLock {
+		private:
+#ifdef WIN32
+			SRWLOCK m_Lock;
+#else
+			pthread_rwlock_t m_Lock;
+#endif
+
+		private:
+			ReadWriteLock(const ReadWriteLock&);
+			ReadWriteLock& operator=(const ReadWriteLock&);
+
+		public:
+			LIBTHREAD_API ReadWriteLock();
+			LIBTHREAD_API ~ReadWriteLock();
+
+		public:
+			void ReadLock() {
+#ifdef WIN32
+				::AcquireSRWLockShared(&m_Lock);
+#else
+				pthread_rwlock_rdlock(&m_Lock);
+#endif
+			}
+
+			void ReadUnlock() {
+#ifdef WIN32
+				::ReleaseSRWLockShared(&m_Lock);
+#else
+				pthread_rwlock_unlock(&m_Lock);
+#endif
+			}
+
+			void WriteLock() {
+#ifdef WIN32
+				::AcquireSRWLockExclusive(&m_Lock);
+#else
+				pthread_rwlock_wrlock(&m_Lock);
+#endif
+			}
+
+			void WriteUnlock() {
+#ifdef WIN32
+				::ReleaseSRWLockExclusive(&m_Lock);
+#else
+				pthread_rwlock_unlock(&m_Lock);
+#endif
+			}
+		};
+
+		/**
+		 * @brief Lock the Mutex in the scope
+		 */
+		class MutexGuard {
+		private:
+			Mutex& m_Mutex;
+
+			MutexGuard(const MutexGuard&);
+			MutexGuard& operator=(const MutexGuard&);
+
+		public:
+			explicit MutexGuard(Mutex& mutex) : m_Mutex(mutex) { m_Mutex.Lock(); }
+			~MutexGuard() { m_Mutex.Unlock(); }
+		};
+
+		/**
+		 * @brief Lock the ReadWriteLock for reading in the scope
+		 */
+		class ReadGuard {
+		private:
+			ReadWriteLock& m_Lock;
+
+			ReadGuard(const ReadGuard&);
+			ReadGuard& operator=(const ReadGuard&);
+
+		public:
+			explicit ReadGuard(ReadWriteLock& lock) : m_Lock(lock) { m_Lock.ReadLock(); }
+			~ReadGuard() { m_Lock.ReadUnlock(); }
+		};
+
+		/**
+		 * @brief Lock the ReadWriteLock for writing in the scope
+		 */
+		class WriteGuard {
+		private:
+			ReadWriteLock& m_Lock;
+
+			WriteGuard(const WriteGuard&);
+			WriteGuard& operator=(const WriteGuard&);
+
+		public:
+			explicit WriteGuard(ReadWriteLock& lock) : m_Lock(lock) { m_Lock.WriteLock(); }
+			~WriteGuard() { m_Lock.WriteUnlock(); }
+		};
+
+		/**
+		 * @brief Scheduling Attributes of a Thread (applied by Thread::Start)
+		 *
+		 * Real-time policies usually need the privilege (root or CAP_SYS_NICE on Linux).
+		 * If the system refuses them, the thread is started with the default policy.
+		 */
+		struct ThreadAttributes {
+			/**
+			 * @brief Scheduling Policy
+			 */
+			enum Policy {
+				POLICY_DEFAULT, //!< Time sharing (SCHED_OTHER)
+				POLICY_FIFO, //!< SCHED_FIFO. THREAD_PRIORITY_TIME_CRITICAL on Windows
+				POLICY_RR, //!< SCHED_RR. THREAD_PRIORITY_HIGHEST on Windows
+			};
+
+			Policy policy;
+			int priority; //!< Real-time priority (1 - 99 on Linux). Ignored for POLICY_DEFAULT
+			unsigned long affinityMask; //!< Bit i allows CPU i. 0 allows all CPUs
+			size_t stackSize; //!< Stack size [bytes]. 0 for the default
+			bool prefaultStack; //!< Touch the stack before Run so that it never page faults later
+
+			ThreadAttributes() : policy(POLICY_DEFAULT), priority(0), affinityMask(0), stackSize(0), prefaultStack(false) {}
+		};
+
+		/**
+		 * @brief Request to Stop a Thread Cooperatively
+		 *
+		 * The thread checks IsStopRequested in its loop. The blocking waits which
+		 * take the token (SerialPort::WaitReadable) wake up as soon as the stop is
+		 * requested, because the token is also a file descriptor (eventfd on Linux,
+		 * a self-pipe on the other Unix) or an event object (Windows).
+		 */
+		class StopToken {
+		private:
+#ifdef WIN32
+			HANDLE m_Event;
+#else
+			int m_ReadFd;
+			int m_WriteFd; // same as m_ReadFd for eventfd
+#endif
+			volatile bool m_StopRequested;
+
+		public:
+			LIBTHREAD_API StopToken();
+			LIBTHREAD_API ~StopToken();
+
+		public:
+			/**
+			 * @brief Request the stop and wake up the waiting thread
+			 */
+			LIBTHREAD_API void RequestStop();
+
+			/**
+			 * @brief Is the stop requested?
+			 */
+			LIBTHREAD_API bool IsStopRequested() const { return m_StopRequested; }
+
+			/**
+			 * @brief Clear the request to use the token again
+			 */
+			LIBTHREAD_API void Reset();
+
+			/**
+			 * @brief Wait until the stop is requested or the timeout (in real time)
+			 *
+			 * @param timeout [msec]
+			 * @return true if the stop is requested.
+			 */
+			LIBTHREAD_API bool Wait(const unsigned int timeout) const;
+
+#ifdef WIN32
+			/**
+			 * @brief Event object which is signaled by RequestStop
+			 */
+			LIBTHREAD_API HANDLE GetHandle() const { return m_Event; }
+#else
+			/**
+			 * @brief File descriptor which becomes readable by RequestStop
+			 */
+			LIBTHREAD_API int GetFd() const { return m_ReadFd; }
+#endif
+		};
+
+		/**
+		 * @brief Event to Wake Up a Waiting Thread
+		 *
+		 * Set wakes up the thread in Wait. If no thread waits, the next Wait returns at once.
+		 * Wait consumes the event (auto reset). Like StopToken, the event is also a file
+		 * descriptor (eventfd on Linux, a self-pipe on the other Unix) or an event object
+		 * (Windows), so that it can be waited with the ports.
+		 */
+		class Event {
+		private:
+#ifdef WIN32
+			HANDLE m_Event;
+#else
+			int m_ReadFd;
+			int m_WriteFd; // same as m_ReadFd for eventfd
+#endif
+
+		private:
+			Event(const Event&);
+			Event& operator=(const Event&);
+
+		public:
+			LIBTHREAD_API Event();
+			LIBTHREAD_API ~Event();
+
+		public:
+			/**
+			 * @brief Wake up the waiting thread
+			 */
+			LIBTHREAD_API void Set();
+
+			/**
+			 * @brief Wait until the event is set or the timeout (in real time)
+			 *
+			 * @param timeout [msec]
+			 * @return true if the event is set.
+			 */
+			LIBTHREAD_API bool Wait(const unsigned int timeout);
+
+#ifdef WIN32
+			/**
+			 * @brief Event object which is signaled by Set
+			 */
+			LIBTHREAD_API HANDLE GetHandle() const { return m_Event; }
+#else
+			/**
+			 * @brief File descriptor which becomes readable by Set
+			 */
+			LIBTHREAD_API int GetFd() const { return m_ReadFd; }
+#endif
+		};
+
+		/**
+		 * @brief Thread Local Pointer which is Passed to a Function at the Thread Exit
+		 *
+		 * The function is called in the exiting thread if the value of the thread is
+		 * not NULL (a pthread key, or a fiber local storage index on Windows).
+		 * The key is never released, because the threads may exit after the static objects.
+		 */
+		class ThreadLocalKey {
+		public:
+#ifdef WIN32
+			typedef void (WINAPI *Destructor)(void* value);
+#else
+			typedef void (*Destructor)(void* value);
+#endif
+
+		private:
+#ifdef WIN32
+			DWORD m_Index;
+#else
+			pthread_key_t m_Key;
+#endif
+
+		private:
+			ThreadLocalKey(const ThreadLocalKey&);
+			ThreadLocalKey& operator=(const ThreadLocalKey&);
+
+		public:
+			LIBTHREAD_API explicit ThreadLocalKey(Destructor destructor);
+
+		public:
+			/**
+			 * @brief Set the value of the calling thread
+			 */
+			LIBTHREAD_API void Set(void* value);
+		};
+
 		class Thread
 		{
 		private:
@@ -95,6 +406,9 @@ namespace net {
 #else
 			pthread_t m_Handle;
 #endif
+			ThreadAttributes m_Attributes;
+			bool m_AttributesApplied;
+
 		public:
 			LIBTHREAD_API Thread(void);
 			LIBTHREAD_API virtual ~Thread(void);
@@ -106,10 +420,40 @@ namespace net {
 
 			LIBTHREAD_API void Join();
 
+			/**
+			 * @brief Terminate the calling thread immediately. The stack is not unwound.
+			 *
+			 * Return from Run to stop the thread cleanly.
+			 */
 			LIBTHREAD_API void Exit(unsigned long exitCode);
 
+			/**
+			 * @brief Set the attributes used by the next Start
+			 */
+			LIBTHREAD_API void SetAttributes(const ThreadAttributes& attributes) { m_Attributes = attributes; }
+
+			/**
+			 * @brief Get the attributes
+			 */
+			LIBTHREAD_API const ThreadAttributes& GetAttributes() const { return m_Attributes; }
+
+			/**
+			 * @brief Were the scheduling policy and the affinity accepted by the system at the last Start?
+			 */
+			LIBTHREAD_API bool AreAttributesApplied() const { return m_AttributesApplied; }
+
 		public:
 			LIBTHREAD_API static void Sleep(unsigned long milliSeconds);
+
+			/**
+			 * @brief Lock the current and future pages of the process in the memory (mlockall)
+			 *
+			 * Avoids the page faults in the real-time threads. Needs the privilege
+			 * (or RLIMIT_MEMLOCK). Not supported on Windows.
+			 *
+			 * @return false if the system refuses.
+			 */
+			LIBTHREAD_API static bool LockMemory();
 		};
 
 	};
@@ -0,0 +1,94 @@
+/********************************************************
+ * ThreadPool.h
+ *
+ * Work-stealing thread pool.
+ * @author ysuga@ysuga.net
+ ********************************************************/
+
+#ifndef THREAD_POOL_HEADER_INCLUDED
+#define THREAD_POOL_HEADER_INCLUDED
+
+#include "type.h"
+#include "Thread.h"
+
+#include <deque>
+#include <vector>
+
+/**
+ * Longest sleep of an idle worker [msec]. The workers are woken up by submit.
+ */
+#define WORKER_IDLE_TIMEOUT 1000
+
+namespace net {
+	namespace ysuga {
+
+		/**
+		 * @brief Task executed by WorkStealingPool
+		 */
+		struct Task {
+			void (*function)(void* argument);
+			void* argument;
+		};
+
+		class WorkStealingPool;
+
+		/**
+		 * @brief Worker thread of WorkStealingPool
+		 */
+		class Worker : public Thread {
+			friend class WorkStealingPool;
+		private:
+			WorkStealingPool* m_pPool;
+			uint32_t m_Index;
+			Mutex m_QueueMutex;
+			std::deque<Task> m_Queue;
+			Event m_Wakeup; // set when a task is submitted while the worker is idle
+			volatile uint32_t m_Idle; // the worker found no task and is going to wait
+
+			bool pop(Task* task);
+			bool steal(Task* task);
+
+		public:
+			Worker(WorkStealingPool* pool, uint32_t index);
+			virtual ~Worker();
+
+			void Run();
+		};
+
+		/**
+		 * @brief Work-stealing Thread Pool
+		 *
+		 * Each worker has its own queue. The owner takes the newest task (LIFO) and the
+		 * idle workers steal the oldest task (FIFO) of the others, so the tasks of the
+		 * same key stay on the same worker unless the worker is busy.
+		 * The idle workers sleep until a task is submitted.
+		 */
+		class WorkStealingPool {
+			friend class Worker;
+		private:
+			std::vector<Worker*> m_Workers;
+			volatile bool m_Running;
+
+		public:
+			WorkStealingPool(uint32_t numThreads);
+			~WorkStealingPool();
+
+		public:
+			/**
+			 * @brief Submit a Task
+			 *
+			 * @param task Task
+			 * @param key The task is queued to the worker (key % number of threads).
+			 */
+			void submit(const Task& task, uint32_t key);
+
+			/**
+			 * @brief Number of Worker Threads
+			 */
+			uint32_t getNumThreads() const { return m_Workers.size(); }
+		};
+
+	};
+};
+
+#endif
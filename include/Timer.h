@@ -12,6 +12,8 @@
 
 #ifdef WIN32
 #include <windows.h>
+#else
+#include <time.h>
 #endif
 
 /**
@@ -35,11 +37,8 @@ namespace pcwrapper {
 	class DLL_API Timer
 	{
 	private:
-#ifdef WIN32
-		LARGE_INTEGER m_Frequency;
-		LARGE_INTEGER m_Before;
-		LARGE_INTEGER m_After;
-#endif
+		uint64_t m_Before; // [usec] of net::ysuga::Clock
+		uint64_t m_After;
 
 	public:
 
@@ -0,0 +1,132 @@
+/********************************************************
+ * Trace.h
+ *
+ * In-process trace of the I/O paths.
+ * @author ysuga@ysuga.net
+ ********************************************************/
+
+#ifndef TRACE_HEADER_INCLUDED
+#define TRACE_HEADER_INCLUDED
+
+#include "common.h"
+#include "type.h"
+
+#include <stddef.h>
+
+/**
+ * Maximum capacity of the ring buffer of a thread (Tracer::enable)
+ */
+#define TRACE_MAX_EVENTS_PER_THREAD 0x1000000
+
+namespace net {
+	namespace ysuga {
+		namespace roomba {
+
+			/**
+			 * @brief In-process Tracer
+			 *
+			 * The trace points of the library (Transport::SendPacket, Transport::ReceiveData,
+			 * the frame processing of Roomba and the accessors) record their begin and end
+			 * into the ring buffer of the calling thread. Recording takes no lock. Each
+			 * thread owns its buffer, and the oldest events are overwritten when it is full.
+			 * The buffer is released with its events when the thread exits.
+			 * Nothing is recorded until enable is called.
+			 * The timestamps are of net::ysuga::Clock.
+			 *
+			 * @code
+			 * Tracer::enable();
+			 * // ... run the robot
+			 * Tracer::writeChromeTrace("roomba.json"); // open in chrome://tracing or ui.perfetto.dev
+			 * @endcode
+			 */
+			class Tracer {
+			public:
+				/**
+				 * @brief Phase of Event (same as Chrome trace event format)
+				 */
+				enum Phase {
+					PHASE_BEGIN = 'B',
+					PHASE_END = 'E',
+					PHASE_INSTANT = 'i',
+				};
+
+				/**
+				 * @brief Start Recording
+				 *
+				 * @param eventsPerThread Capacity of the ring buffer of each thread. Rounded up to a power of 2,
+				 *                        and limited to TRACE_MAX_EVENTS_PER_THREAD.
+				 *                        Used for the buffers allocated after the call.
+				 */
+				LIBROOMBA_API static void enable(const uint32_t eventsPerThread = 16384);
+
+				/**
+				 * @brief Stop Recording. The recorded events are kept.
+				 */
+				LIBROOMBA_API static void disable();
+
+				/**
+				 * @brief Is Recording?
+				 */
+				LIBROOMBA_API static bool isEnabled();
+
+				/**
+				 * @brief Discard the recorded events. Call while disabled.
+				 */
+				LIBROOMBA_API static void clear();
+
+				/**
+				 * @brief Record an event in the buffer of the calling thread
+				 *
+				 * @param phase PHASE_BEGIN, PHASE_END or PHASE_INSTANT
+				 * @param name Name of the event. Must be a string literal (the pointer is recorded).
+				 * @param arg Argument shown with the event
+				 */
+				LIBROOMBA_API static void record(const Phase phase, const char* name, const uint32_t arg = 0);
+
+				/**
+				 * @brief Name the calling thread in the exported trace
+				 *
+				 * @param name Name of the thread. Must be a string literal.
+				 */
+				LIBROOMBA_API static void setThreadName(const char* name);
+
+				/**
+				 * @brief Export the recorded events in Chrome trace JSON
+				 *
+				 * Can be called while recording. The events being overwritten are skipped.
+				 * The events of the threads which have exited are not included.
+				 *
+				 * @return false if the file can not be written.
+				 */
+				LIBROOMBA_API static bool writeChromeTrace(const char* filename);
+			};
+
+			/**
+			 * @brief Trace Point of a Scope
+			 *
+			 * Records the begin at the construction and the end at the destruction.
+			 */
+			class TraceScope {
+			private:
+				const char* m_Name;
+
+			public:
+				TraceScope(const char* name, const uint32_t arg = 0) : m_Name(NULL) {
+					if(Tracer::isEnabled()) {
+						m_Name = name;
+						Tracer::record(Tracer::PHASE_BEGIN, name, arg);
+					}
+				}
+
+				~TraceScope() {
+					if(m_Name) {
+						Tracer::record(Tracer::PHASE_END, m_Name);
+					}
+				}
+			};
+
+		}
+	}
+}
+
+#endif
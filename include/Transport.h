@@ -3,25 +3,367 @@
 #include "type.h"
 
 #include "SerialPort.h"
+#include "LinkStatistics.h"
+#include "Thread.h"
+
+#include <deque>
+#include <vector>
+
+/**
+ * Return values of Transport::ReceiveData
+ */
+#define RECEIVE_TIMEOUT -1
+#define RECEIVE_STOPPED -2
+
+/**
+ * Return value of the Try* functions of Transport: the serial port can not be read or written.
+ */
+#define TRANSPORT_ACCESS_FAILED -3
+
+/**
+ * Return value of the Try* functions of Transport: the command of TX_POLICY_REJECT is
+ * rejected because the transmit queue is full.
+ */
+#define TRANSPORT_TX_FULL -4
+
+/**
+ * Return value of Transport::TrySubmit without waiting: the late responses of the failed
+ * requests are still to be discarded. Submit it again later.
+ */
+#define TRANSPORT_BUSY -5
+
+/**
+ * Time to wait for the responses of the failed requests before the next request is sent [msec].
+ * They are discarded, so that they are never taken as the response of another request.
+ */
+#define LATE_RESPONSE_TIMEOUT 100
+
+/**
+ * Bytes in the transmit queue above which the commands of TX_POLICY_REJECT are rejected
+ */
+#define DEFAULT_TX_QUEUE_LIMIT 64
+
+/**
+ * Time for the queued bytes to be written when the transport is deleted [msec]
+ */
+#define TX_CLOSE_TIMEOUT 500
 
 namespace net {
 	namespace ysuga {
 		namespace roomba {
 
+			class TxFlusher;
+
 
 			class Transport
 			{
+				friend class TxFlusher;
+
+			public:
+				/**
+				 * @brief What to do with a command while older bytes are waiting in the transmit queue
+				 *
+				 * The port is non-blocking. The bytes it does not take are queued and written
+				 * in the order of the commands by a background thread when the port becomes
+				 * writable, so the senders never block on a full port.
+				 */
+				enum TxPolicy {
+					TX_POLICY_QUEUE, //!< Always queued (e.g. the mode and the scripts). The default.
+					TX_POLICY_LATEST, //!< Replaces the unsent command of the same op code at the end of the queue (e.g. drive)
+					TX_POLICY_REJECT //!< Rejected with TRANSPORT_TX_FULL above the queue limit (e.g. sensor requests)
+				};
+
+				/**
+				 * @brief Request waiting for its response
+				 */
+				struct PendingRequest {
+					uint8_t* response;
+					uint32_t responseSize;
+					uint32_t readBytes;
+					uint32_t timeout; // [msec] to wait for the response. 0 waits forever.
+					const StopToken* stopToken; // stops the wait for the response. Can be NULL.
+					bool done;
+					int32_t result; // of TryReceiveData for the response
+					void (*onComplete)(void* context); // called in the thread which receives the response
+					void* context;
+					uint64_t submitTime; // [usec] of net::ysuga::Clock
+				};
+
+			private:
+				/**
+				 * @brief Packet waiting in the transmit queue
+				 */
+				struct TxPacket {
+					std::vector<uint8_t> bytes;
+					uint32_t written; // bytes already on the wire
+					uint8_t opCode;
+					uint8_t policy;
+				};
+
 			private:
 				SerialPort* m_pSerialPort;
 
+				void Complete(PendingRequest* request);
+				void Fail(PendingRequest* request, const int32_t result);
+				void Finish(PendingRequest* request);
+				void SettleLateResponses(const bool wait);
+
+				int32_t WriteTxPacket(const uint8_t* bytes, const uint32_t size, const uint8_t opCode, const TxPolicy policy);
+				int32_t WriteTxQueue();
+				void UpdateTxQueueDepth(const int32_t delta);
+				void RunTxFlusher();
+
+				Mutex m_TxMutex; // serializes the packets on the wire
+				Mutex m_QueueMutex; // guards m_PendingRequests and m_LateBytes
+				Mutex m_RxMutex; // held by the thread reading the responses
+				std::deque<PendingRequest*> m_PendingRequests; // in the order of the requests on the wire
+				uint32_t m_ReceiveWaitCount;
+				uint32_t m_LateBytes; // bytes of the responses of the failed requests still to be discarded
+				uint64_t m_LateDeadline; // [usec] of net::ysuga::Clock until which they are waited
+				bool m_RequestsRejecting; // the last request is rejected by TX_POLICY_REJECT. guarded by m_QueueMutex
+				bool m_Batching; // SendPacket appends to m_Batch instead of writing
+				std::vector<uint8_t> m_Batch;
+				std::deque<TxPacket> m_TxQueue; // guarded by m_TxMutex
+				uint32_t m_TxQueueDepth; // bytes not written in m_TxQueue
+				uint32_t m_TxQueueLimit;
+				uint8_t m_TxPolicies[256]; // TxPolicy of each op code
+				TxFlusher* m_pTxFlusher; // started when the bytes are queued first
+				Event m_TxWakeup; // wakes up the flusher for the queued bytes
+				Event* m_pTxEvent; // set when the queue becomes empty. guarded by m_TxMutex
+				bool m_TxFlusherStopped;
+				LinkStatistics m_LinkStatistics;
+
 			public:
 				Transport(const char* portName, const uint16_t baudrate);
 
+				/**
+				 * @brief Constructor with an opened port. The transport takes the ownership.
+				 */
+				Transport(SerialPort* pSerialPort);
+
 				~Transport(void);
 
+				/**
+				 * @brief Send a command. Never waits for the responses of the other requests.
+				 *
+				 * @throw ComAccessException
+				 */
 				int32_t SendPacket(uint8_t opCode, const uint8_t *dataBytes = NULL, const uint32_t dataSize = 0);
 
-				int32_t ReceiveData(uint8_t *buffer, uint32_t maxBufferSize, uint32_t* readByte);
+				/**
+				 * @brief Send a command without throwing
+				 *
+				 * Never blocks on a full port. See TxPolicy.
+				 * @return 0 (written or queued), TRANSPORT_ACCESS_FAILED if the port can not be
+				 * written, or TRANSPORT_TX_FULL if the command is rejected by TX_POLICY_REJECT.
+				 */
+				int32_t TrySendPacket(uint8_t opCode, const uint8_t *dataBytes = NULL, const uint32_t dataSize = 0);
+
+				/**
+				 * @brief Set the policy of the commands of the op code. TX_POLICY_QUEUE by default.
+				 */
+				void SetTxPolicy(const uint8_t opCode, const TxPolicy policy);
+
+				/**
+				 * @brief Set the bytes in the transmit queue above which the commands of TX_POLICY_REJECT are rejected
+				 */
+				void SetTxQueueLimit(const uint32_t bytes) { m_TxQueueLimit = bytes; }
+
+				/**
+				 * @brief Bytes waiting in the transmit queue
+				 */
+				uint32_t GetTxQueueDepth();
+
+				/**
+				 * @brief Set the event which is set when the bytes in the transmit queue are written.
+				 *
+				 * @param event Event (not owned). NULL to clear.
+				 */
+				void SetTxEvent(Event* event);
+
+				/**
+				 * @brief Wait until the transmit queue is written to the port.
+				 *
+				 * @param timeout [msec]
+				 * @return true if the queue is empty.
+				 */
+				bool FlushTxQueue(const uint32_t timeout);
+
+				/**
+				 * @brief Collect the following packets to send them in one write by EndBatch.
+				 */
+				void BeginBatch();
+
+				/**
+				 * @brief Write the packets collected since BeginBatch. The batch is queued like TX_POLICY_QUEUE.
+				 *
+				 * @throw ComAccessException
+				 */
+				void EndBatch();
+
+				/**
+				 * @brief Write the packets collected since BeginBatch without throwing
+				 *
+				 * @return 0 (written or queued) or TRANSPORT_ACCESS_FAILED
+				 */
+				int32_t TryEndBatch();
+
+				/**
+				 * @brief Receive raw data. Do not call this while Request is used by another thread.
+				 *
+				 * @param timeout [msec] to wait for the data. 0 waits forever.
+				 * @param stopToken Stops the wait by StopToken::RequestStop. Can be NULL.
+				 * @return RECEIVE_TIMEOUT if the data does not arrive in the timeout,
+				 * RECEIVE_STOPPED if the stop is requested to the token. Nothing is read then.
+				 * @throw ComAccessException
+				 */
+				int32_t ReceiveData(uint8_t *buffer, uint32_t maxBufferSize, uint32_t* readByte, const uint32_t timeout = 0,
+					const StopToken* stopToken = NULL);
+
+				/**
+				 * @brief Receive raw data without throwing
+				 *
+				 * @return Same as ReceiveData, or TRANSPORT_ACCESS_FAILED if the port can not be read.
+				 */
+				int32_t TryReceiveData(uint8_t *buffer, uint32_t maxBufferSize, uint32_t* readByte, const uint32_t timeout = 0,
+					const StopToken* stopToken = NULL);
+
+				/**
+				 * @brief Close and open the serial port again. The transmit queue is discarded.
+				 *
+				 * @throw ComOpenException, ComStateException
+				 */
+				void Reopen();
+
+				/**
+				 * @brief Serial port of the transport
+				 */
+				SerialPort* GetSerialPort() { return m_pSerialPort; }
+
+				/**
+				 * @brief Bytes which can be received without blocking.
+				 */
+				uint32_t GetSizeInRxBuffer() { return m_pSerialPort->GetSizeInRxBuffer(); }
+
+				/**
+				 * @brief Discard the received bytes. Do not call this while requests are pending.
+				 */
+				void FlushRxBuffer() { m_pSerialPort->FlushRxBuffer(); }
+
+				/**
+				 * @brief Number of sleeps in ReceiveData waiting for the bytes.
+				 */
+				uint32_t GetReceiveWaitCount() const { return m_ReceiveWaitCount; }
+
+				/**
+				 * @brief Statistics of the link. The decoder of the received data adds its counts to it.
+				 */
+				LinkStatistics& GetLinkStatistics() { return m_LinkStatistics; }
+
+				/**
+				 * @brief Send a command and receive its response.
+				 *
+				 * Requests from multiple threads are queued in the order they are sent.
+				 * One of the waiting threads reads the responses in that order, and hands
+				 * each of them to its requester. If a request fails, the requests behind it
+				 * fail too, because their responses can not be told from its late response.
+				 * @param timeout [msec] to wait for the response. 0 waits forever.
+				 * @param stopToken Stops the wait for this response. Can be NULL.
+				 * @return 0, RECEIVE_TIMEOUT, RECEIVE_STOPPED or TRANSPORT_TX_FULL
+				 * @throw ComAccessException
+				 */
+				int32_t Request(uint8_t opCode, const uint8_t *dataBytes, const uint32_t dataSize,
+					uint8_t *response, const uint32_t responseSize, uint32_t* readBytes, const uint32_t timeout = 0,
+					const StopToken* stopToken = NULL);
+
+				/**
+				 * @brief Send a command and receive its response without throwing
+				 *
+				 * @return Same as Request, or TRANSPORT_ACCESS_FAILED if the port can not be accessed.
+				 */
+				int32_t TryRequest(uint8_t opCode, const uint8_t *dataBytes, const uint32_t dataSize,
+					uint8_t *response, const uint32_t responseSize, uint32_t* readBytes, const uint32_t timeout = 0,
+					const StopToken* stopToken = NULL);
+
+				/**
+				 * @brief Send a command and queue the request without waiting for its response.
+				 *
+				 * The response is received by Wait, or by the other requests which are waited later.
+				 * The request must be alive until it is done. Set PendingRequest::timeout and stopToken before.
+				 * The result of the receive is set to PendingRequest::result.
+				 * @throw ComAccessException (also if the command is rejected by TX_POLICY_REJECT)
+				 */
+				void Submit(uint8_t opCode, const uint8_t *dataBytes, const uint32_t dataSize, PendingRequest* request);
+
+				/**
+				 * @brief Submit without throwing
+				 *
+				 * @param wait Wait for the late responses (up to LATE_RESPONSE_TIMEOUT). If false,
+				 * the arrived ones are discarded and TRANSPORT_BUSY is returned while some are left.
+				 * @return Same as TrySendPacket, or TRANSPORT_BUSY. The request is not queued if it is not 0.
+				 */
+				int32_t TrySubmit(uint8_t opCode, const uint8_t *dataBytes, const uint32_t dataSize, PendingRequest* request, const bool wait = true);
+
+				/**
+				 * @brief Wait until the submitted request is done.
+				 */
+				void Wait(PendingRequest* request);
+
+				/**
+				 * @brief Is the submitted request done?
+				 */
+				bool IsDone(PendingRequest* request);
+
+				/**
+				 * @brief Receive the responses which are already arrived without blocking.
+				 *
+				 * The requests whose timeout (from the submit) has passed, or whose stop is
+				 * requested, fail like in Wait. The late responses of the failed requests which
+				 * are already arrived are discarded.
+				 * @return true if any request is done.
+				 */
+				bool Progress();
+
+				/**
+				 * @brief Are the late responses of the failed requests still to be discarded?
+				 *
+				 * Submit waits for them (up to LATE_RESPONSE_TIMEOUT). Progress and TrySubmit without
+				 * waiting discard them without waiting.
+				 */
+				bool HasLateResponses();
+			};
+
+			/**
+			 * @brief Batch of the packets sent in the scope
+			 *
+			 * The destructor writes the batch if End is not called, so that an exception
+			 * does not leave the transport collecting the packets.
+			 */
+			class BatchGuard {
+			private:
+				Transport& m_Transport;
+				bool m_Ended;
+
+				BatchGuard(const BatchGuard&);
+				BatchGuard& operator=(const BatchGuard&);
+
+			public:
+				explicit BatchGuard(Transport& transport) : m_Transport(transport), m_Ended(false) { m_Transport.BeginBatch(); }
+				~BatchGuard() { if(!m_Ended) m_Transport.TryEndBatch(); }
+
+				/**
+				 * @brief Write the batch
+				 *
+				 * @throw ComAccessException
+				 */
+				void End() { m_Ended = true; m_Transport.EndBatch(); }
+
+				/**
+				 * @brief Write the batch without throwing
+				 *
+				 * @return 0 (written or queued) or TRANSPORT_ACCESS_FAILED
+				 */
+				int32_t TryEnd() { m_Ended = true; return m_Transport.TryEndBatch(); }
 			};
 		}
 	}
@@ -85,6 +85,11 @@ enum LED {
  * Functions Return Code
  */
 enum ReturnCode {
+	REQUEST_BUSY = -6, //!< Request is not sent because the late responses of the failed requests are arriving. Retry later
+	CONNECTION_TIMEOUT = -5, //!< Robot did not respond in time, or the response is not an OI mode
+	TX_QUEUE_FULL = -4, //!< Request is rejected because the commands are waiting for the serial port
+	SENSOR_UNAVAILABLE = -3, //!< Sensor value did not arrive in time
+	COM_ACCESS_FAILED = -2, //!< Serial port can not be read or written
 	PRECONDITION_NOT_MET = -1, //!< Precondition is not fine
 	ROOMBA_OK = 0, //!< Return Code OK.
 };
@@ -152,5 +157,42 @@ enum ChargingState {
 };
 
 
+/**
+ * @brief Health of the Serial Link
+ * Counted since the last reset of the statistics. Times are in usec.
+ *
+ * @see Roomba_getLinkStats
+ */
+typedef struct RoombaLinkStats {
+	unsigned int windowTime; //!< Time since the last reset [msec]
+	unsigned int txBytes; //!< Bytes sent to Roomba
+	unsigned int rxBytes; //!< Bytes received from Roomba
+	unsigned int txBytesPerSecond; //!< Average of the window
+	unsigned int rxBytesPerSecond; //!< Average of the window
+	unsigned int txPackets; //!< Commands (including the requests) sent to Roomba
+	unsigned int requestCount; //!< Number of the requests answered by Roomba
+	unsigned int roundTripMedian; //!< Round trip time from sending the request to receiving its response
+	unsigned int roundTrip99; //!< 99th percentile of the round trip time
+	unsigned int roundTripMax; //!< Maximum of the round trip time
+	unsigned int frameCount; //!< Number of the intervals between the sensor frames
+	unsigned int frameIntervalMedian; //!< Interval between the arrivals of the sensor frames
+	unsigned int frameInterval99; //!< 99th percentile of the frame interval
+	unsigned int frameIntervalMax; //!< Maximum of the frame interval
+	unsigned int jitterMedian; //!< Deviation of the frame interval from the stream period
+	unsigned int jitter99; //!< 99th percentile of the jitter
+	unsigned int jitterMax; //!< Maximum of the jitter
+	unsigned int checksumErrors; //!< Frames dropped by checksum error
+	unsigned int badFrames; //!< Frames which are truncated or include unknown packets
+	unsigned int resyncCount; //!< Number of searches for the header of the frame
+	unsigned int resyncBytes; //!< Bytes skipped by the searches
+	unsigned int txQueueDepth; //!< Bytes waiting in the transmit queue because the port was full
+	unsigned int txQueueHighWater; //!< Maximum of the transmit queue in the window [bytes]
+	unsigned int txPartialWrites; //!< Writes which did not take all the bytes
+	unsigned int txReplaced; //!< Commands dropped from the transmit queue by a newer one of the same kind
+	unsigned int txRejected; //!< Commands rejected because the transmit queue was full
+	unsigned int requestsRejected; //!< Requests (included in txRejected) not sent because the transmit queue was full
+} RoombaLinkStats;
+
+
 
 #endif // #ifndef COMMON_HEADER_INCLUDED
\ No newline at end of file
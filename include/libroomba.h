@@ -136,7 +136,7 @@ extern "C" {
 	 * @param hRoomba Handle Value of Roomba
 	 * @param translation Translation Velcoity (-500 – 500 mm/s)  
 	 * @param turnRadius Radius (-2000 – 2000 mm) (negative => CCW)
-	 * @throw PreconditionNotMetError
+	 * @return ROOMBA_OK, PRECONDITION_NOT_MET or COM_ACCESS_FAILED
 	 */
 	LIBROOMBA_API int Roomba_drive(const int hRoomba, const short translationVelocity, const short turnRadius);
 
@@ -146,7 +146,7 @@ extern "C" {
 	 * @param hRoomba Handle Value of Roomba
 	 * @param rightWheel Translation Velocity (-500 - 500 mm/s)
 	 * @param leftWheel  Translation Velocity (-500 - 500 mm/s)
-	 * @throw PreconditionNotMetError
+	 * @return ROOMBA_OK, PRECONDITION_NOT_MET or COM_ACCESS_FAILED
 	 */
 	LIBROOMBA_API int Roomba_driveDirect(const int hRoomba, const short rightWheelVelocity, const short leftWheelVelocity);
 
@@ -156,7 +156,7 @@ extern "C" {
 	 * @param hRoomba Handle Value of Roomba
 	 * @param rightWheel Translation Velocity (-255 - +255)
 	 * @param leftWheel  Translation Velocity (-255 - +255)
-	 * @throw PreconditionNotMetError
+	 * @return ROOMBA_OK, PRECONDITION_NOT_MET or COM_ACCESS_FAILED
 	 */
 	LIBROOMBA_API int Roomba_drivePWM(const int hRoomba, const short rightWheel, const short leftWheel);
 
@@ -168,7 +168,7 @@ extern "C" {
 	 * @param mainBrush  This parameter can be CW, CCW, or OFF.
 	 * @param sideBrush  This parameter can be CW, CCW, or OFF,
 	 * @param vacuum     This parameter can be ON or OFF.
-	 * @throw PreconditionNotMetError
+	 * @return ROOMBA_OK, PRECONDITION_NOT_MET or COM_ACCESS_FAILED
 	 */
 	LIBROOMBA_API int Roomba_driveMotors(const int hRoomba, const int mainBrush, const int sideBrush, const int vacuum);
 
@@ -217,6 +217,7 @@ extern "C" {
 	 * @param leds flags that indicates leds. (0-255)
 	 * @param intensity intensity of the leds. (0-255)
 	 * @param color color of the CLEAN/POWER button (0-green, 255-red).
+	 * @return ROOMBA_OK or COM_ACCESS_FAILED
 	 */
 	LIBROOMBA_API int Roomba_setLED(const int hRoomba, unsigned char leds, unsigned char intensity, unsigned char color);
 
@@ -550,6 +551,22 @@ extern "C" {
 	 * @param count [OUT] Encoder Count (0-65535)
 	 */
 	LIBROOMBA_API unsigned short Roomba_getLeftEncoderCounts(const int hRoomba, unsigned short* count);
+
+	/**
+	 * @brief Get Health of the Serial Link
+	 *
+	 * @param hRoomba Handle Value of Roomba
+	 * @param stats [OUT] Statistics since the last Roomba_resetLinkStats
+	 * @param reset Start a new measurement window after getting the statistics if nonzero
+	 */
+	LIBROOMBA_API int Roomba_getLinkStats(const int hRoomba, RoombaLinkStats* stats, const int reset);
+
+	/**
+	 * @brief Start a new measurement window of the link statistics
+	 *
+	 * @param hRoomba Handle Value of Roomba
+	 */
+	LIBROOMBA_API int Roomba_resetLinkStats(const int hRoomba);
 #ifdef __cplusplus
 }
 #endif
@@ -30,6 +30,14 @@ enum OP_CODE{
 	OP_QUERY_LIST,
 	OP_PAUSE_RESUME_STREAM,
 
+	OP_SCRIPT = 152,
+	OP_PLAY_SCRIPT,
+	OP_SHOW_SCRIPT,
+	OP_WAIT_TIME,
+	OP_WAIT_DISTANCE,
+	OP_WAIT_ANGLE,
+	OP_WAIT_EVENT,
+
 };
 
 
@@ -52,6 +60,24 @@ enum Baud {
 };
 
 
+/**
+ * Sensor Group Packets. Each group is a contiguous range of sensor packets.
+ * Groups 100 - 107 are only available on 500 series.
+ */
+enum SensorGroupID {
+	SENSOR_GROUP_0 = 0, // 7 - 26
+	SENSOR_GROUP_1, // 7 - 16
+	SENSOR_GROUP_2, // 17 - 20
+	SENSOR_GROUP_3, // 21 - 26
+	SENSOR_GROUP_4, // 27 - 34
+	SENSOR_GROUP_5, // 35 - 42
+	SENSOR_GROUP_6, // 7 - 42
+	SENSOR_GROUP_100 = 100, // 7 - 58
+	SENSOR_GROUP_101, // 43 - 58
+	SENSOR_GROUP_106 = 106, // 46 - 51
+	SENSOR_GROUP_107, // 54 - 58
+};
+
 enum SensorID {
 	BUMPS_AND_WHEEL_DROPS = 7,
 	WALL,
@@ -97,6 +123,7 @@ enum SensorID {
 	LIGHT_BUMP_CENTER_LEFT_SIGNAL,
 	LIGHT_BUMP_CENTER_RIGHT_SIGNAL,
 	LIGHT_BUMP_FRONT_RIGHT_SIGNAL,
+	LIGHT_BUMP_RIGHT_SIGNAL,
 	INFRARED_CHARACTER_LEFT = 52,
 	INFRARED_CHARACTER_RIGHT = 53,
 	LEFT_MOTOR_CURRENT = 54,
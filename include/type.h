@@ -23,6 +23,12 @@ typedef unsigned long uint64_t;
 #include <stdint.h> // VC2010Linuxp
 #endif
 
+/**
+ * export setting for pcwrapper classes (Timer, TimeSpec)
+ */
+#ifndef DLL_API
+#define DLL_API
+#endif
 
 
 #endif // #ifndef TYPE_HEADER_INCLUDED
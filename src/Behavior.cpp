@@ -0,0 +1,229 @@
+#include "Behavior.h"
+#include "Roomba.h"
+
+#include <algorithm>
+
+using namespace net::ysuga;
+using namespace net::ysuga::roomba;
+
+Behavior::Behavior(Roomba* roomba) :
+m_pRoomba(roomba), m_Await(AWAIT_NONE), m_Frame(0), m_WaitTime(0), m_pQuery(NULL)
+{
+}
+
+Behavior::~Behavior()
+{
+}
+
+void Behavior::nextFrame()
+{
+	m_Await = AWAIT_FRAME;
+	// the frames never come while the idle stream is suspended.
+	m_pRoomba->touchSensorStream();
+	m_Frame = m_pRoomba->getFrameCount();
+}
+
+void Behavior::sleep(uint32_t msec)
+{
+	m_Await = AWAIT_TIME;
+	m_WaitTime = msec;
+	m_Timer.tick();
+}
+
+void Behavior::query(const uint8_t* sensorIds, const uint32_t count, SensorQuery* query)
+{
+	m_pQuery = query;
+	Roomba::ReturnCode result = m_pRoomba->tryRequestSensorAsync(sensorIds, count, query);
+	if(result == Roomba::REQUEST_BUSY) {
+		m_QueryIds.assign(sensorIds, sensorIds + count);
+		m_Await = AWAIT_SUBMIT;
+		return;
+	}
+	Roomba::throwError(result);
+	m_Await = AWAIT_QUERY;
+}
+
+void Behavior::drive(int16_t rightWheel, int16_t leftWheel)
+{
+	m_pRoomba->driveDirect(rightWheel, leftWheel);
+	m_Await = AWAIT_SEND;
+}
+
+void Behavior::finish()
+{
+	m_Await = AWAIT_FINISHED;
+}
+
+bool Behavior::isResumable()
+{
+	switch(m_Await) {
+	case AWAIT_NONE:
+		return true;
+	case AWAIT_FRAME:
+		return m_pRoomba->getFrameCount() != m_Frame;
+	case AWAIT_TIME:
+		{
+			pcwrapper::TimeSpec elapsed;
+			m_Timer.tack(&elapsed);
+			return elapsed.sec * 1000 + elapsed.usec / 1000 >= m_WaitTime;
+		}
+	case AWAIT_SUBMIT:
+		{
+			Roomba::ReturnCode result = m_pRoomba->tryRequestSensorAsync(&m_QueryIds[0], m_QueryIds.size(), m_pQuery);
+			if(result == Roomba::REQUEST_BUSY) {
+				return false;
+			}
+			Roomba::throwError(result);
+			m_Await = AWAIT_QUERY;
+			return false;
+		}
+	case AWAIT_QUERY:
+		if(m_pQuery->isReady()) {
+			m_pQuery->wait();
+			return true;
+		}
+		return false;
+	case AWAIT_SEND:
+		return m_pRoomba->getTxQueueDepth() == 0;
+	default:
+		return false;
+	}
+}
+
+/**
+ * Longest time to wait before isResumable is checked again [msec].
+ * The frames and the written commands are notified by the robot.
+ */
+uint32_t Behavior::getWaitTime()
+{
+	const uint32_t forever = 0xFFFFFFFF;
+	switch(m_Await) {
+	case AWAIT_NONE:
+		return 0;
+	case AWAIT_TIME:
+		{
+			pcwrapper::TimeSpec elapsed;
+			m_Timer.tack(&elapsed);
+			uint32_t msec = elapsed.sec * 1000 + elapsed.usec / 1000;
+			return msec < m_WaitTime ? m_WaitTime - msec : 0;
+		}
+	case AWAIT_SUBMIT:
+		// the late responses wake up the wait when they arrive, but may time out instead.
+		return STREAM_PERIOD;
+	case AWAIT_QUERY:
+		{
+			// the expired query is failed by the next isReady.
+			uint32_t time = m_pQuery->getRemainingTime();
+			return time == forever ? forever : time + 1;
+		}
+	default:
+		return forever;
+	}
+}
+
+BehaviorExecutor::BehaviorExecutor()
+{
+}
+
+BehaviorExecutor::~BehaviorExecutor()
+{
+	for(uint32_t i = 0;i < m_Roombas.size();i++) {
+		m_Roombas[i]->setNotifyEvent(NULL);
+	}
+}
+
+void BehaviorExecutor::add(Behavior* behavior)
+{
+	behavior->m_Await = Behavior::AWAIT_NONE;
+	m_Behaviors.push_back(behavior);
+	if(std::find(m_Roombas.begin(), m_Roombas.end(), behavior->m_pRoomba) == m_Roombas.end()) {
+		behavior->m_pRoomba->setNotifyEvent(&m_Wakeup);
+		m_Roombas.push_back(behavior->m_pRoomba);
+	}
+}
+
+uint32_t BehaviorExecutor::runOnce()
+{
+	uint32_t resumed = 0;
+	bool finished = false;
+	std::vector<Behavior*>::iterator it = m_Behaviors.begin();
+	while(it != m_Behaviors.end()) {
+		Behavior* behavior = *it;
+		if(behavior->isResumable()) {
+			// resume waits for nothing unless the behavior requests.
+			behavior->m_Await = Behavior::AWAIT_NONE;
+			behavior->resume();
+			resumed++;
+		}
+		if(behavior->isFinished()) {
+			it = m_Behaviors.erase(it);
+			finished = true;
+		} else {
+			++it;
+		}
+	}
+
+	if(finished) {
+		// the robots without behaviors do not wake up the executor any more.
+		std::vector<Roomba*>::iterator r = m_Roombas.begin();
+		while(r != m_Roombas.end()) {
+			bool used = false;
+			for(uint32_t i = 0;i < m_Behaviors.size();i++) {
+				if(m_Behaviors[i]->m_pRoomba == *r) {
+					used = true;
+					break;
+				}
+			}
+			if(used) {
+				++r;
+			} else {
+				(*r)->setNotifyEvent(NULL);
+				r = m_Roombas.erase(r);
+			}
+		}
+	}
+	return resumed;
+}
+
+/**
+ * Sleep until any of the behaviors may be resumable.
+ */
+void BehaviorExecutor::wait()
+{
+	uint32_t timeout = 0xFFFFFFFF;
+	std::vector<Roomba*> queried; // the responses arrive on their ports
+	for(uint32_t i = 0;i < m_Behaviors.size();i++) {
+		Behavior* behavior = m_Behaviors[i];
+		uint32_t time = behavior->getWaitTime();
+		timeout = time < timeout ? time : timeout;
+		if((behavior->m_Await == Behavior::AWAIT_QUERY || behavior->m_Await == Behavior::AWAIT_SUBMIT) &&
+			std::find(queried.begin(), queried.end(), behavior->m_pRoomba) == queried.end()) {
+			queried.push_back(behavior->m_pRoomba);
+		}
+	}
+	if(timeout > 0) {
+		Roomba::waitReceived(queried.empty() ? NULL : &queried[0], queried.size(), timeout, &m_Wakeup);
+	}
+}
+
+void BehaviorExecutor::run()
+{
+	while(!m_Behaviors.empty() && !m_StopToken.IsStopRequested()) {
+		if(runOnce() == 0) {
+			wait();
+		}
+	}
+	// the stop is for this run only.
+	m_StopToken.Reset();
+}
+
+void BehaviorExecutor::stop()
+{
+	m_StopToken.RequestStop();
+	m_Wakeup.Set();
+}
+
+uint32_t BehaviorExecutor::getNumRunning() const
+{
+	return m_Behaviors.size();
+}
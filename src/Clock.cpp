@@ -0,0 +1,184 @@
+#include "Clock.h"
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#include <sched.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace net::ysuga;
+
+static SystemClock g_SystemClock;
+static Clock* g_pClock = &g_SystemClock;
+
+Clock* Clock::getInstance()
+{
+	return g_pClock;
+}
+
+void Clock::setInstance(Clock* clock)
+{
+	g_pClock = clock ? clock : &g_SystemClock;
+}
+
+bool Clock::sleepUnlessStopped(uint32_t milliSeconds, const StopToken& stopToken)
+{
+	const uint32_t slice = 5;
+	uint32_t slept = 0;
+	while(slept < milliSeconds && !stopToken.IsStopRequested()) {
+		uint32_t sleepTime = milliSeconds - slept < slice ? milliSeconds - slept : slice;
+		sleep(sleepTime);
+		slept += sleepTime;
+	}
+	return stopToken.IsStopRequested();
+}
+
+uint64_t SystemClock::now()
+{
+#ifdef WIN32
+	LARGE_INTEGER frequency, counter;
+	::QueryPerformanceFrequency(&frequency);
+	::QueryPerformanceCounter(&counter);
+	return (uint64_t)(counter.QuadPart / frequency.QuadPart * 1000000
+		+ counter.QuadPart % frequency.QuadPart * 1000000 / frequency.QuadPart);
+#else
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (uint64_t)time.tv_sec * 1000000 + time.tv_nsec / 1000;
+#endif
+}
+
+void SystemClock::sleep(uint32_t milliSeconds)
+{
+#ifdef WIN32
+	::Sleep(milliSeconds);
+#else
+	struct timespec interval;
+	interval.tv_sec = milliSeconds / 1000;
+	interval.tv_nsec = (milliSeconds % 1000) * 1000000;
+	nanosleep(&interval, NULL);
+#endif
+}
+
+bool SystemClock::sleepUnlessStopped(uint32_t milliSeconds, const StopToken& stopToken)
+{
+	const uint64_t deadline = now() + (uint64_t)milliSeconds * 1000;
+	while(!stopToken.IsStopRequested()) {
+		uint64_t time = now();
+		if(time >= deadline) {
+			return false;
+		}
+		stopToken.Wait((uint32_t)((deadline - time + 999) / 1000));
+	}
+	return true;
+}
+
+SimulatedClock::SimulatedClock(uint32_t stallTimeout /* = 10 */) :
+m_Now(0), m_NumThreads(1), m_StallTimeout(stallTimeout)
+{
+}
+
+SimulatedClock::~SimulatedClock()
+{
+}
+
+uint64_t SimulatedClock::now()
+{
+	m_Mutex.Lock();
+	uint64_t now = m_Now;
+	m_Mutex.Unlock();
+	return now;
+}
+
+/**
+ * m_Mutex must be locked.
+ */
+void SimulatedClock::advanceIfAllSleeping()
+{
+	if(!m_WakeTimes.empty() && m_WakeTimes.size() >= m_NumThreads && *m_WakeTimes.begin() > m_Now) {
+		m_Now = *m_WakeTimes.begin();
+	}
+}
+
+void SimulatedClock::sleep(uint32_t milliSeconds)
+{
+	waitFor(milliSeconds, NULL);
+}
+
+bool SimulatedClock::sleepUnlessStopped(uint32_t milliSeconds, const StopToken& stopToken)
+{
+	return waitFor(milliSeconds, &stopToken);
+}
+
+/**
+ * Sleep in the simulated time. The stop of the token is checked while waiting for the time.
+ *
+ * @return true if the stop is requested.
+ */
+bool SimulatedClock::waitFor(uint32_t milliSeconds, const StopToken* stopToken)
+{
+	m_Mutex.Lock();
+	uint64_t wakeTime = m_Now + (uint64_t)milliSeconds * 1000;
+	std::multiset<uint64_t>::iterator it = m_WakeTimes.insert(wakeTime);
+	advanceIfAllSleeping();
+	m_Mutex.Unlock();
+
+	uint64_t stallStart = m_SystemClock.now();
+	uint64_t lastNow = wakeTime - (uint64_t)milliSeconds * 1000;
+	while(1) {
+		m_Mutex.Lock();
+		if(stopToken && stopToken->IsStopRequested()) {
+			m_WakeTimes.erase(it);
+			m_Mutex.Unlock();
+			return true;
+		}
+		if(m_Now >= wakeTime) {
+			m_WakeTimes.erase(it);
+			m_Mutex.Unlock();
+			return false;
+		}
+		if(m_Now != lastNow) {
+			lastNow = m_Now;
+			stallStart = m_SystemClock.now();
+		} else if(m_StallTimeout && m_SystemClock.now() - stallStart > (uint64_t)m_StallTimeout * 1000) {
+			// some thread is blocked elsewhere. advancing the time now would depend on the real
+			// time, and the scenario would not be repeatable.
+			fprintf(stderr, "SimulatedClock: stalled at %llu usec. %u of %u threads are sleeping.\n",
+				(unsigned long long)m_Now, (unsigned)m_WakeTimes.size(), (unsigned)m_NumThreads);
+			abort();
+		}
+		m_Mutex.Unlock();
+#ifdef WIN32
+		::SwitchToThread();
+#else
+		sched_yield();
+#endif
+	}
+}
+
+void SimulatedClock::attachThread()
+{
+	m_Mutex.Lock();
+	m_NumThreads++;
+	m_Mutex.Unlock();
+}
+
+void SimulatedClock::detachThread()
+{
+	m_Mutex.Lock();
+	if(m_NumThreads > 0) {
+		m_NumThreads--;
+	}
+	advanceIfAllSleeping();
+	m_Mutex.Unlock();
+}
+
+void SimulatedClock::advance(uint64_t usec)
+{
+	m_Mutex.Lock();
+	m_Now += usec;
+	m_Mutex.Unlock();
+}
@@ -0,0 +1,245 @@
+#include "LinkStatistics.h"
+#include "Atomic.h"
+#include "Clock.h"
+
+using namespace net::ysuga;
+using namespace net::ysuga::roomba;
+
+LatencyHistogram::LatencyHistogram() :
+m_TotalCount(0), m_TotalSum(0)
+{
+	reset();
+}
+
+LatencyHistogram::~LatencyHistogram()
+{
+}
+
+uint32_t LatencyHistogram::getBucketIndex(const uint32_t value)
+{
+	if(value < HISTOGRAM_SUB_BUCKETS) {
+		return value;
+	}
+	// shift the value into [HISTOGRAM_SUB_BUCKETS, 2 * HISTOGRAM_SUB_BUCKETS).
+	// The sub bucket is the bits below the top bit.
+	uint32_t shift = 0;
+	while((value >> shift) >= 2 * HISTOGRAM_SUB_BUCKETS) {
+		shift++;
+	}
+	uint32_t subBucket = (value >> shift) - HISTOGRAM_SUB_BUCKETS;
+	return (shift + 1) * HISTOGRAM_SUB_BUCKETS + subBucket;
+}
+
+uint32_t LatencyHistogram::getBucketUpperBound(const uint32_t index)
+{
+	if(index < HISTOGRAM_SUB_BUCKETS) {
+		return index;
+	}
+	uint32_t shift = index / HISTOGRAM_SUB_BUCKETS - 1;
+	uint32_t subBucket = index % HISTOGRAM_SUB_BUCKETS;
+	uint64_t lowerBound = (uint64_t)(HISTOGRAM_SUB_BUCKETS + subBucket) << shift;
+	uint64_t upperBound = lowerBound + ((uint64_t)1 << shift) - 1;
+	return upperBound > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)upperBound;
+}
+
+void LatencyHistogram::record(const uint32_t value)
+{
+	atomicAdd(&m_Counts[getBucketIndex(value)], 1);
+	if(value > m_Max) {
+		atomicStore(&m_Max, value);
+	}
+	atomicAdd(&m_Count, 1);
+	// one thread records at a time.
+	m_TotalSum += value;
+	atomicAdd(&m_TotalCount, 1);
+}
+
+void LatencyHistogram::reset()
+{
+	for(int i = 0;i < HISTOGRAM_BUCKETS;i++) {
+		m_Counts[i] = 0;
+	}
+	m_Max = 0;
+	atomicStore(&m_Count, 0);
+}
+
+uint32_t LatencyHistogram::getPercentile(const double percentile) const
+{
+	// m_Count is incremented after the bucket, so the buckets are never behind it.
+	uint32_t count = m_Count;
+	if(count == 0) {
+		return 0;
+	}
+	uint32_t rank = (uint32_t)(percentile / 100.0 * count + 0.5);
+	if(rank < 1) {
+		rank = 1;
+	}
+	if(rank > count) {
+		rank = count;
+	}
+	uint32_t max = m_Max;
+	uint32_t cumulative = 0;
+	for(uint32_t i = 0;i < HISTOGRAM_BUCKETS;i++) {
+		cumulative += m_Counts[i];
+		if(cumulative >= rank) {
+			uint32_t upperBound = getBucketUpperBound(i);
+			return upperBound < max ? upperBound : max;
+		}
+	}
+	return max;
+}
+
+
+LinkStatistics::LinkStatistics() :
+m_TxBytes(0), m_RxBytes(0), m_TxPackets(0), m_ChecksumErrors(0), m_BadFrames(0), m_ResyncCount(0), m_ResyncBytes(0),
+m_TxQueueDepth(0), m_TxQueueHighWater(0), m_TxPartialWrites(0), m_TxReplaced(0), m_TxRejected(0), m_RequestsRejected(0),
+m_LastFrameTime(0)
+{
+	reset();
+}
+
+LinkStatistics::~LinkStatistics()
+{
+}
+
+void LinkStatistics::addTxBytes(const uint32_t bytes)
+{
+	atomicAdd(&m_TxBytes, bytes);
+}
+
+void LinkStatistics::countTxPacket()
+{
+	atomicAdd(&m_TxPackets, 1);
+}
+
+void LinkStatistics::setTxQueueDepth(const uint32_t bytes)
+{
+	atomicStore(&m_TxQueueDepth, bytes);
+	if(bytes > m_TxQueueHighWater) {
+		atomicStore(&m_TxQueueHighWater, bytes);
+	}
+}
+
+void LinkStatistics::countTxPartialWrite()
+{
+	atomicAdd(&m_TxPartialWrites, 1);
+}
+
+void LinkStatistics::countTxReplaced()
+{
+	atomicAdd(&m_TxReplaced, 1);
+}
+
+void LinkStatistics::countTxRejected()
+{
+	atomicAdd(&m_TxRejected, 1);
+}
+
+void LinkStatistics::countRequestRejected()
+{
+	atomicAdd(&m_RequestsRejected, 1);
+}
+
+void LinkStatistics::addRxBytes(const uint32_t bytes)
+{
+	atomicAdd(&m_RxBytes, bytes);
+}
+
+void LinkStatistics::recordRoundTrip(const uint32_t time)
+{
+	m_RoundTripTime.record(time);
+}
+
+void LinkStatistics::recordFrame(const uint32_t period)
+{
+	uint64_t now = Clock::getInstance()->now();
+	if(m_LastFrameTime != 0) {
+		uint32_t interval = (uint32_t)(now - m_LastFrameTime);
+		m_FrameInterval.record(interval);
+		m_FrameJitter.record(interval > period ? interval - period : period - interval);
+	}
+	m_LastFrameTime = now;
+}
+
+void LinkStatistics::countChecksumError()
+{
+	atomicAdd(&m_ChecksumErrors, 1);
+}
+
+void LinkStatistics::countBadFrame()
+{
+	atomicAdd(&m_BadFrames, 1);
+}
+
+void LinkStatistics::countResync(const uint32_t skippedBytes)
+{
+	atomicAdd(&m_ResyncCount, 1);
+	atomicAdd(&m_ResyncBytes, skippedBytes);
+}
+
+void LinkStatistics::reset()
+{
+	m_RoundTripTime.reset();
+	m_FrameInterval.reset();
+	m_FrameJitter.reset();
+	// the counters keep counting for getTotals. the window starts from their values now.
+	getTotals(&m_WindowBase);
+	// the depth is not of the window. the bytes in the queue are the start of the high water.
+	atomicStore(&m_TxQueueHighWater, m_TxQueueDepth);
+	m_WindowStart = Clock::getInstance()->now();
+}
+
+void LinkStatistics::get(RoombaLinkStats* stats) const
+{
+	uint64_t window = Clock::getInstance()->now() - m_WindowStart;
+	stats->windowTime = (unsigned int)(window / 1000);
+	stats->txBytes = m_TxBytes - m_WindowBase.txBytes;
+	stats->rxBytes = m_RxBytes - m_WindowBase.rxBytes;
+	stats->txBytesPerSecond = window ? (unsigned int)((uint64_t)stats->txBytes * 1000000 / window) : 0;
+	stats->rxBytesPerSecond = window ? (unsigned int)((uint64_t)stats->rxBytes * 1000000 / window) : 0;
+	stats->txPackets = m_TxPackets - m_WindowBase.txPackets;
+
+	stats->requestCount = m_RoundTripTime.getCount();
+	stats->roundTripMedian = m_RoundTripTime.getPercentile(50);
+	stats->roundTrip99 = m_RoundTripTime.getPercentile(99);
+	stats->roundTripMax = m_RoundTripTime.getMax();
+
+	stats->frameCount = m_FrameInterval.getCount();
+	stats->frameIntervalMedian = m_FrameInterval.getPercentile(50);
+	stats->frameInterval99 = m_FrameInterval.getPercentile(99);
+	stats->frameIntervalMax = m_FrameInterval.getMax();
+	stats->jitterMedian = m_FrameJitter.getPercentile(50);
+	stats->jitter99 = m_FrameJitter.getPercentile(99);
+	stats->jitterMax = m_FrameJitter.getMax();
+
+	stats->checksumErrors = m_ChecksumErrors - m_WindowBase.checksumErrors;
+	stats->badFrames = m_BadFrames - m_WindowBase.badFrames;
+	stats->resyncCount = m_ResyncCount - m_WindowBase.resyncCount;
+	stats->resyncBytes = m_ResyncBytes - m_WindowBase.resyncBytes;
+	stats->txQueueDepth = m_TxQueueDepth;
+	stats->txQueueHighWater = m_TxQueueHighWater;
+	stats->txPartialWrites = m_TxPartialWrites - m_WindowBase.txPartialWrites;
+	stats->txReplaced = m_TxReplaced - m_WindowBase.txReplaced;
+	stats->txRejected = m_TxRejected - m_WindowBase.txRejected;
+	stats->requestsRejected = m_RequestsRejected - m_WindowBase.requestsRejected;
+}
+
+void LinkStatistics::getTotals(LinkTotals* totals) const
+{
+	totals->txBytes = m_TxBytes;
+	totals->rxBytes = m_RxBytes;
+	totals->txPackets = m_TxPackets;
+	totals->checksumErrors = m_ChecksumErrors;
+	totals->badFrames = m_BadFrames;
+	totals->resyncCount = m_ResyncCount;
+	totals->resyncBytes = m_ResyncBytes;
+	totals->txPartialWrites = m_TxPartialWrites;
+	totals->txReplaced = m_TxReplaced;
+	totals->txRejected = m_TxRejected;
+	totals->requestsRejected = m_RequestsRejected;
+	totals->requestCount = m_RoundTripTime.getTotalCount();
+	totals->roundTripSum = m_RoundTripTime.getTotalSum();
+	totals->frameCount = m_FrameInterval.getTotalCount();
+	totals->frameIntervalSum = m_FrameInterval.getTotalSum();
+	totals->jitterSum = m_FrameJitter.getTotalSum();
+}
@@ -0,0 +1,414 @@
+#include "Log.h"
+#include "Atomic.h"
+#include "Clock.h"
+#include "Thread.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#ifdef WIN32
+#define LOG_THREAD_LOCAL __declspec(thread)
+#define snprintf _snprintf
+#else
+#define LOG_THREAD_LOCAL __thread
+#endif
+
+using namespace net::ysuga;
+using namespace net::ysuga::roomba;
+
+namespace {
+	struct LogRecord {
+		uint64_t timestamp; // [usec] of net::ysuga::Clock
+		const char* format;
+		uint32_t level;
+		uint32_t threadId;
+		uint32_t argCount;
+		uint8_t argTypes[LOG_MAX_ARGS];
+		union {
+			int64_t i;
+			uint64_t u;
+			double d;
+			uint32_t offset; // of the string in text
+		} args[LOG_MAX_ARGS];
+		char text[LOG_TEXT_SIZE];
+	};
+
+	/**
+	 * Ring buffer written only by its thread and read only by the drain.
+	 * Deleted by the drain after the thread exits.
+	 */
+	struct LogBuffer {
+		uint32_t threadId;
+		LogRecord* records;
+		uint32_t mask; // capacity - 1
+		volatile uint32_t head; // number of the recorded records
+		volatile uint32_t tail; // number of the drained records
+		volatile uint32_t exited; // set after the last record of the thread
+	};
+
+	bool compareLogRecord(const LogRecord& a, const LogRecord& b)
+	{
+		return a.timestamp < b.timestamp;
+	}
+
+	/**
+	 * INFO and DEBUG to stdout, WARN and ERROR to stderr.
+	 */
+	class StandardSink : public LogSink {
+	public:
+		virtual void write(const uint32_t level, const uint64_t timestamp, const uint32_t threadId, const char* message) {
+			static const char* names[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+			FILE* fp = level >= ROOMBA_LOG_LEVEL_WARN ? stderr : stdout;
+			fprintf(fp, "[%s] %s\n", names[level < 4 ? level : 3], message);
+			fflush(fp);
+		}
+	};
+
+	/**
+	 * Writes the records to the sink periodically. Sleeps in real time, so that
+	 * it does not hold the time of SimulatedClock. Runs until the end of the process,
+	 * because the Clock may be gone when the process exits.
+	 */
+	class LogWriter : public Thread {
+	private:
+		SystemClock m_SystemClock;
+	public:
+		void Run();
+	};
+}
+
+static volatile uint32_t g_LogLevel = ROOMBA_LOG_LEVEL_INFO;
+static volatile uint32_t g_LogCapacity = 1024;
+static uint32_t g_LogThreadCount = 0; // guarded by g_LogMutex
+static volatile uint32_t g_LogDropped = 0;
+static volatile bool g_LogClosed = false; // the process is exiting
+static Mutex g_LogMutex; // guards g_pLogBuffers, g_pLogBufferKey and g_pLogWriter
+static Mutex g_LogDrainMutex; // held by the thread draining the buffers
+static std::vector<LogBuffer*>* g_pLogBuffers = NULL; // never deleted. the writer may read them during the exit.
+static ThreadLocalKey* g_pLogBufferKey = NULL; // created with g_pLogBuffers
+static LogWriter* g_pLogWriter = NULL;
+static StandardSink g_StandardSink;
+static LogSink* volatile g_pLogSink = &g_StandardSink;
+static uint32_t g_LogReportedDropped = 0; // guarded by g_LogDrainMutex
+static LOG_THREAD_LOCAL LogBuffer* t_pLogBuffer = NULL;
+
+static void closeLog();
+
+/**
+ * Called at the exit of the thread which has a buffer. The drain deletes the buffer
+ * after writing the rest of its records.
+ */
+#ifdef WIN32
+static void WINAPI releaseLogBuffer(void* value)
+#else
+static void releaseLogBuffer(void* value)
+#endif
+{
+	LogBuffer* buffer = (LogBuffer*)value;
+	atomicStore(&buffer->exited, 1);
+	t_pLogBuffer = NULL;
+}
+
+/**
+ * Buffer of the calling thread. Allocated at the first record, which also starts the writer.
+ */
+static LogBuffer* getLogBuffer()
+{
+	LogBuffer* buffer = t_pLogBuffer;
+	if(!buffer) {
+		uint32_t capacity = 1;
+		while(capacity < g_LogCapacity) {
+			capacity <<= 1;
+		}
+		buffer = new LogBuffer();
+		buffer->records = new LogRecord[capacity];
+		buffer->mask = capacity - 1;
+		buffer->head = 0;
+		buffer->tail = 0;
+		buffer->exited = 0;
+		MutexGuard guard(g_LogMutex);
+		if(!g_pLogBuffers) {
+			g_pLogBuffers = new std::vector<LogBuffer*>();
+			g_pLogBufferKey = new ThreadLocalKey(releaseLogBuffer);
+		}
+		buffer->threadId = ++g_LogThreadCount;
+		g_pLogBuffers->push_back(buffer);
+		g_pLogBufferKey->Set(buffer);
+		if(!g_pLogWriter) {
+			g_pLogWriter = new LogWriter();
+			g_pLogWriter->Start();
+			atexit(closeLog);
+		}
+		t_pLogBuffer = buffer;
+	}
+	return buffer;
+}
+
+/**
+ * Format the record in the style of printf. The length modifiers of the format are
+ * ignored, and the types of the recorded arguments are used instead.
+ */
+static void formatLogRecord(const LogRecord& record, std::string& message)
+{
+	char spec[32];
+	char buf[256];
+	uint32_t argIndex = 0;
+	const char* p = record.format;
+	while(*p) {
+		if(*p != '%') {
+			message += *p++;
+			continue;
+		}
+		if(p[1] == '%') {
+			message += '%';
+			p += 2;
+			continue;
+		}
+		const char* begin = p++;
+		size_t length = 0;
+		spec[length++] = '%';
+		while(*p && strchr("-+ #0123456789.", *p) && length < sizeof(spec) - 4) {
+			spec[length++] = *p++;
+		}
+		while(*p && strchr("hlLqjzt", *p)) {
+			p++;
+		}
+		char conversion = *p ? *p++ : 's';
+		if(argIndex >= record.argCount) {
+			message.append(begin, p - begin);
+			continue;
+		}
+
+		const uint32_t type = record.argTypes[argIndex];
+		bool floating = strchr("fFeEgGaA", conversion) != NULL;
+		if(type == LogArg::TYPE_STRING) {
+			spec[length++] = 's';
+			spec[length] = 0;
+			snprintf(buf, sizeof(buf), spec, record.text + record.args[argIndex].offset);
+		} else if(type == LogArg::TYPE_DOUBLE) {
+			spec[length++] = floating ? conversion : 'g';
+			spec[length] = 0;
+			snprintf(buf, sizeof(buf), spec, record.args[argIndex].d);
+		} else if(floating) {
+			spec[length++] = conversion;
+			spec[length] = 0;
+			snprintf(buf, sizeof(buf), spec, type == LogArg::TYPE_INT ? (double)record.args[argIndex].i : (double)record.args[argIndex].u);
+		} else if(conversion == 'c') {
+			spec[length++] = 'c';
+			spec[length] = 0;
+			snprintf(buf, sizeof(buf), spec, (int)record.args[argIndex].i);
+		} else {
+			if(!strchr("diuxXo", conversion)) {
+				conversion = type == LogArg::TYPE_INT ? 'd' : 'u';
+			}
+			spec[length++] = 'l';
+			spec[length++] = 'l';
+			spec[length++] = conversion;
+			spec[length] = 0;
+			if(conversion == 'd' || conversion == 'i') {
+				snprintf(buf, sizeof(buf), spec, (long long)record.args[argIndex].i);
+			} else {
+				snprintf(buf, sizeof(buf), spec, (unsigned long long)record.args[argIndex].u);
+			}
+		}
+		buf[sizeof(buf) - 1] = 0;
+		message += buf;
+		argIndex++;
+	}
+}
+
+/**
+ * Write the records in all buffers to the sink in the order of the timestamps.
+ */
+static void drainLog()
+{
+	MutexGuard drainGuard(g_LogDrainMutex);
+	if(g_LogClosed) {
+		return;
+	}
+	std::vector<LogBuffer*> buffers;
+	{
+		MutexGuard guard(g_LogMutex);
+		if(g_pLogBuffers) {
+			buffers = *g_pLogBuffers;
+		}
+	}
+
+	std::vector<LogRecord> records;
+	std::vector<LogBuffer*> exited;
+	for(uint32_t i = 0;i < buffers.size();i++) {
+		LogBuffer* buffer = buffers[i];
+		// read before head, so that head includes the last record of an exited thread.
+		if(atomicLoad(&buffer->exited)) {
+			exited.push_back(buffer);
+		}
+		uint32_t head = atomicLoad(&buffer->head);
+		for(uint32_t index = buffer->tail;index != head;index++) {
+			records.push_back(buffer->records[index & buffer->mask]);
+			records.back().threadId = buffer->threadId;
+		}
+		// the slots can be reused by the thread.
+		atomicStore(&buffer->tail, head);
+	}
+	if(!exited.empty()) {
+		MutexGuard guard(g_LogMutex);
+		for(uint32_t i = 0;i < exited.size();i++) {
+			g_pLogBuffers->erase(std::find(g_pLogBuffers->begin(), g_pLogBuffers->end(), exited[i]));
+			delete[] exited[i]->records;
+			delete exited[i];
+		}
+	}
+	// the records of a thread are already in order. keep it for the same timestamps.
+	std::stable_sort(records.begin(), records.end(), compareLogRecord);
+
+	LogSink* sink = g_pLogSink;
+	std::string message;
+	for(uint32_t i = 0;i < records.size();i++) {
+		message.clear();
+		formatLogRecord(records[i], message);
+		sink->write(records[i].level, records[i].timestamp, records[i].threadId, message.c_str());
+	}
+
+	uint32_t dropped = g_LogDropped;
+	if(dropped != g_LogReportedDropped) {
+		char buf[64];
+		snprintf(buf, sizeof(buf), "%u log records are dropped.", dropped - g_LogReportedDropped);
+		sink->write(ROOMBA_LOG_LEVEL_WARN, records.empty() ? 0 : records.back().timestamp, 0, buf);
+		g_LogReportedDropped = dropped;
+	}
+}
+
+void LogWriter::Run()
+{
+	// not a thread of the simulation. see the comment of the class.
+	Clock::getInstance()->detachThread();
+	for(;;) {
+		if(!g_LogClosed) {
+			drainLog();
+		}
+		m_SystemClock.sleep(LOG_FLUSH_PERIOD);
+	}
+}
+
+/**
+ * Write the rest of the records at the exit. The records recorded after it are discarded.
+ */
+static void closeLog()
+{
+	drainLog();
+	MutexGuard drainGuard(g_LogDrainMutex);
+	g_LogClosed = true;
+}
+
+bool Logger::isEnabled(const uint32_t level)
+{
+	return level >= g_LogLevel;
+}
+
+void Logger::setLevel(const uint32_t level)
+{
+	atomicStore(&g_LogLevel, level);
+}
+
+void Logger::setSink(LogSink* sink)
+{
+	// the records recorded before go to the previous sink.
+	flush();
+	MutexGuard guard(g_LogDrainMutex);
+	g_pLogSink = sink ? sink : &g_StandardSink;
+}
+
+void Logger::setCapacity(const uint32_t recordsPerThread)
+{
+	g_LogCapacity = recordsPerThread < 1 ? 1 : recordsPerThread > LOG_MAX_CAPACITY ? LOG_MAX_CAPACITY : recordsPerThread;
+}
+
+void Logger::flush()
+{
+	drainLog();
+}
+
+uint32_t Logger::getDroppedCount()
+{
+	return g_LogDropped;
+}
+
+void Logger::recordArgs(const uint32_t level, const char* format, const LogArg** args, const uint32_t count)
+{
+	LogBuffer* buffer = getLogBuffer();
+	uint32_t head = buffer->head;
+	if(head - atomicLoad(&buffer->tail) > buffer->mask) {
+		atomicAdd(&g_LogDropped, 1);
+		return;
+	}
+	LogRecord& record = buffer->records[head & buffer->mask];
+	record.timestamp = Clock::getInstance()->now();
+	record.format = format;
+	record.level = level;
+	record.argCount = count;
+	uint32_t textUsed = 0;
+	for(uint32_t i = 0;i < count;i++) {
+		record.argTypes[i] = (uint8_t)args[i]->type;
+		switch(args[i]->type) {
+		case LogArg::TYPE_INT:
+			record.args[i].i = args[i]->value.i;
+			break;
+		case LogArg::TYPE_UINT:
+			record.args[i].u = args[i]->value.u;
+			break;
+		case LogArg::TYPE_DOUBLE:
+			record.args[i].d = args[i]->value.d;
+			break;
+		case LogArg::TYPE_STRING:
+			{
+				// copied, because the string may not live until the drain (e.g. exception::what).
+				record.args[i].offset = textUsed;
+				const char* s = args[i]->value.s;
+				while(*s && textUsed < LOG_TEXT_SIZE - 1) {
+					record.text[textUsed++] = *s++;
+				}
+				record.text[textUsed] = 0;
+				if(textUsed < LOG_TEXT_SIZE - 1) {
+					textUsed++;
+				}
+			}
+			break;
+		}
+	}
+	atomicStore(&buffer->head, head + 1);
+}
+
+void Logger::record(const uint32_t level, const char* format)
+{
+	recordArgs(level, format, NULL, 0);
+}
+
+void Logger::record(const uint32_t level, const char* format, const LogArg& a0)
+{
+	const LogArg* args[] = {&a0};
+	recordArgs(level, format, args, 1);
+}
+
+void Logger::record(const uint32_t level, const char* format, const LogArg& a0, const LogArg& a1)
+{
+	const LogArg* args[] = {&a0, &a1};
+	recordArgs(level, format, args, 2);
+}
+
+void Logger::record(const uint32_t level, const char* format, const LogArg& a0, const LogArg& a1,
+					const LogArg& a2)
+{
+	const LogArg* args[] = {&a0, &a1, &a2};
+	recordArgs(level, format, args, 3);
+}
+
+void Logger::record(const uint32_t level, const char* format, const LogArg& a0, const LogArg& a1,
+					const LogArg& a2, const LogArg& a3)
+{
+	const LogArg* args[] = {&a0, &a1, &a2, &a3};
+	recordArgs(level, format, args, 4);
+}
@@ -0,0 +1,445 @@
+#ifdef WIN32
+// winsock2.h must be included before windows.h
+#include <winsock2.h>
+#pragma comment(lib, "ws2_32.lib")
+typedef int socklen_t;
+#define closesocket_ closesocket
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#define closesocket_ close
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#include "MetricsExporter.h"
+#include "Roomba.h"
+#include "RoombaFleet.h"
+#include "RoombaException.h"
+#include "op_code.h"
+
+#include <stdio.h>
+#include <string.h>
+
+using namespace net::ysuga;
+using namespace net::ysuga::roomba;
+
+/**
+ * Interval to check the stop request while waiting for the clients [msec]
+ */
+#define METRICS_ACCEPT_PERIOD 100
+
+/**
+ * Time to wait for the request of a client [msec]
+ */
+#define METRICS_REQUEST_TIMEOUT 1000
+
+/**
+ * Time to wait for a client which does not read the response [msec]
+ */
+#define METRICS_SEND_TIMEOUT 1000
+
+namespace {
+	/**
+	 * Values of a robot read at the beginning of a scrape
+	 */
+	struct Sample {
+		std::string labels;
+		uint32_t frameCount;
+		Roomba::Mode mode;
+		bool suspended;
+		StreamRecoveryStatistics recovery;
+		RoombaLinkStats link;
+		LinkTotals totals;
+		bool hasVoltage, hasCharge, hasCapacity;
+		uint16_t voltage, charge, capacity;
+	};
+
+	const char* getModeName(Roomba::Mode mode) {
+		switch(mode) {
+		case Roomba::MODE_OFF: return "off";
+		case Roomba::MODE_PASSIVE: return "passive";
+		case Roomba::MODE_SAFE: return "safe";
+		case Roomba::MODE_FULL: return "full";
+		case Roomba::MODE_SLEEP: return "sleep";
+		case Roomba::MODE_SPOT_CLEAN: return "spot_clean";
+		case Roomba::MODE_NORMAL_CLEAN: return "normal_clean";
+		case Roomba::MODE_MAX_TIME_CLEAN: return "max_time_clean";
+		case Roomba::MODE_DOCK: return "dock";
+		case Roomba::MODE_POWER_DOWN: return "power_down";
+		default: return "start";
+		}
+	}
+
+	void appendHeader(std::string& text, const char* name, const char* type, const char* help) {
+		text += "# HELP ";
+		text += name;
+		text += " ";
+		text += help;
+		text += "\n# TYPE ";
+		text += name;
+		text += " ";
+		text += type;
+		text += "\n";
+	}
+
+	void appendValue(std::string& text, const char* name, const std::string& labels, const char* extraLabel, double value) {
+		char buf[64];
+		text += name;
+		text += "{";
+		text += labels;
+		if(extraLabel) {
+			text += ",";
+			text += extraLabel;
+		}
+		sprintf(buf, "} %.9g\n", value);
+		text += buf;
+	}
+
+	/**
+	 * Samples of a summary. The quantiles are of the current window of the link statistics,
+	 * the sum and the count are since the start.
+	 */
+	void appendSummary(std::string& text, const char* name, const std::string& labels,
+		uint32_t median, uint32_t p99, uint32_t max, uint64_t sum, uint32_t count) {
+		// [usec] to [sec]
+		appendValue(text, name, labels, "quantile=\"0.5\"", median / 1000000.0);
+		appendValue(text, name, labels, "quantile=\"0.99\"", p99 / 1000000.0);
+		appendValue(text, name, labels, "quantile=\"1\"", max / 1000000.0);
+		appendValue(text, (std::string(name) + "_sum").c_str(), labels, NULL, sum / 1000000.0);
+		appendValue(text, (std::string(name) + "_count").c_str(), labels, NULL, count);
+	}
+
+	void setTimeout(intptr_t client, int option, uint32_t timeout) {
+#ifdef WIN32
+		DWORD value = timeout;
+#else
+		struct timeval value;
+		value.tv_sec = timeout / 1000;
+		value.tv_usec = (timeout % 1000) * 1000;
+#endif
+		::setsockopt((int)client, SOL_SOCKET, option, (const char*)&value, sizeof(value));
+	}
+
+	bool sendAll(intptr_t client, const char* data, size_t size) {
+		while(size > 0) {
+			// a client which closed early must not raise SIGPIPE.
+			int sent = ::send((int)client, data, (int)size, MSG_NOSIGNAL);
+			if(sent <= 0) {
+				return false;
+			}
+			data += sent;
+			size -= sent;
+		}
+		return true;
+	}
+}
+
+MetricsExporter::MetricsExporter(const uint16_t port /* = 9464 */, const char* address /* = "127.0.0.1" */) :
+m_Address(address), m_Port(port), m_Socket(-1), m_Running(false), m_ScrapeCount(0)
+{
+#ifdef WIN32
+	WSADATA wsaData;
+	::WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+}
+
+MetricsExporter::~MetricsExporter()
+{
+	stop();
+#ifdef WIN32
+	::WSACleanup();
+#endif
+}
+
+void MetricsExporter::add(Roomba* roomba, const char* label)
+{
+	Target target;
+	target.roomba = roomba;
+	target.label = label;
+	m_TargetsMutex.Lock();
+	m_Targets.push_back(target);
+	m_TargetsMutex.Unlock();
+}
+
+void MetricsExporter::add(RoombaFleet* fleet, const char* labelPrefix /* = "roomba" */)
+{
+	char index[16];
+	for(uint32_t i = 0;i < fleet->size();i++) {
+		sprintf(index, "%u", i);
+		add(fleet->get(i), (std::string(labelPrefix) + index).c_str());
+	}
+}
+
+void MetricsExporter::remove(Roomba* roomba)
+{
+	m_TargetsMutex.Lock();
+	for(std::vector<Target>::iterator it = m_Targets.begin();it != m_Targets.end();) {
+		if((*it).roomba == roomba) {
+			it = m_Targets.erase(it);
+		} else {
+			++it;
+		}
+	}
+	m_TargetsMutex.Unlock();
+}
+
+void MetricsExporter::start()
+{
+	if(m_Running) {
+		return;
+	}
+	intptr_t s = ::socket(AF_INET, SOCK_STREAM, 0);
+	if(s < 0) {
+		throw ListenError();
+	}
+	int reuse = 1;
+	::setsockopt((int)s, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(m_Port);
+	addr.sin_addr.s_addr = inet_addr(m_Address.c_str());
+	if(::bind((int)s, (struct sockaddr*)&addr, sizeof(addr)) != 0 || ::listen((int)s, 8) != 0) {
+		closesocket_((int)s);
+		throw ListenError();
+	}
+	socklen_t length = sizeof(addr);
+	if(::getsockname((int)s, (struct sockaddr*)&addr, &length) == 0) {
+		m_Port = ntohs(addr.sin_port);
+	}
+
+	m_Socket = s;
+	m_Running = true;
+	Start();
+}
+
+void MetricsExporter::stop()
+{
+	if(!m_Running) {
+		return;
+	}
+	m_Running = false;
+	Join();
+	closesocket_((int)m_Socket);
+	m_Socket = -1;
+}
+
+void MetricsExporter::Run()
+{
+	while(m_Running) {
+		fd_set readFds;
+		FD_ZERO(&readFds);
+		FD_SET((int)m_Socket, &readFds);
+		struct timeval timeout;
+		timeout.tv_sec = 0;
+		timeout.tv_usec = METRICS_ACCEPT_PERIOD * 1000;
+		if(::select((int)m_Socket + 1, &readFds, NULL, NULL, &timeout) <= 0) {
+			continue;
+		}
+		intptr_t client = ::accept((int)m_Socket, NULL, NULL);
+		if(client < 0) {
+			continue;
+		}
+		serve(client);
+		closesocket_((int)client);
+	}
+}
+
+/**
+ * Answer one HTTP request. One client is served at a time.
+ */
+void MetricsExporter::serve(intptr_t client)
+{
+	setTimeout(client, SO_RCVTIMEO, METRICS_REQUEST_TIMEOUT);
+	// a client which stops reading must not block the scrapes of the others.
+	setTimeout(client, SO_SNDTIMEO, METRICS_SEND_TIMEOUT);
+
+	// only the request line and the end of the headers are needed.
+	std::string request;
+	char buf[512];
+	while(request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+		int received = ::recv((int)client, buf, sizeof(buf), 0);
+		if(received <= 0) {
+			break;
+		}
+		request.append(buf, received);
+	}
+
+	std::string response;
+	if(request.compare(0, 12, "GET /metrics") == 0 && request.size() > 12 &&
+		(request[12] == ' ' || request[12] == '?')) {
+		std::string body;
+		writeMetrics(body);
+		sprintf(buf, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %u\r\n\r\n",
+			(uint32_t)body.size());
+		response = buf;
+		response += body;
+		m_ScrapeCount++;
+	} else {
+		response = "HTTP/1.0 404 Not Found\r\nContent-Type: text/plain\r\nContent-Length: 10\r\n\r\nNot Found\n";
+	}
+	sendAll(client, response.data(), response.size());
+}
+
+void MetricsExporter::writeMetrics(std::string& text)
+{
+	std::vector<Sample> samples;
+	m_TargetsMutex.Lock();
+	samples.resize(m_Targets.size());
+	for(uint32_t i = 0;i < m_Targets.size();i++) {
+		Roomba* roomba = m_Targets[i].roomba;
+		Sample& sample = samples[i];
+		sample.labels = "robot=\"";
+		for(std::string::const_iterator c = m_Targets[i].label.begin();c != m_Targets[i].label.end();++c) {
+			if(*c == '\\' || *c == '"') {
+				sample.labels += '\\';
+			}
+			sample.labels += *c;
+		}
+		sample.labels += "\"";
+
+		// never blocks the robot: plain reads of the counters and the published values.
+		sample.frameCount = roomba->getFrameCount();
+		sample.mode = roomba->getMode();
+		StreamActivityStatistics activity;
+		roomba->getStreamActivityStatistics(&activity);
+		sample.suspended = activity.suspended;
+		roomba->getStreamRecoveryStatistics(&sample.recovery);
+		roomba->getLinkStats(&sample.link);
+		roomba->getLinkStatistics().getTotals(&sample.totals);
+		sample.hasVoltage = roomba->peekSensorValue(VOLTAGE, &sample.voltage);
+		sample.hasCharge = roomba->peekSensorValue(BATTERY_CHARGE, &sample.charge);
+		sample.hasCapacity = roomba->peekSensorValue(BATTERY_CAPACITY, &sample.capacity);
+	}
+	m_TargetsMutex.Unlock();
+
+	std::vector<Sample>::const_iterator it;
+	appendHeader(text, "roomba_frames_total", "counter", "Sensor frames processed.");
+	for(it = samples.begin();it != samples.end();++it) {
+		appendValue(text, "roomba_frames_total", (*it).labels, NULL, (*it).frameCount);
+	}
+	appendHeader(text, "roomba_stream_suspended", "gauge", "1 if the sensor stream is suspended because nobody reads it.");
+	for(it = samples.begin();it != samples.end();++it) {
+		appendValue(text, "roomba_stream_suspended", (*it).labels, NULL, (*it).suspended ? 1 : 0);
+	}
+	appendHeader(text, "roomba_stream_stalled", "gauge", "1 if no sensor frame arrives and the stream is being recovered.");
+	for(it = samples.begin();it != samples.end();++it) {
+		appendValue(text, "roomba_stream_stalled", (*it).labels, NULL, (*it).recovery.recovering ? 1 : 0);
+	}
+	appendHeader(text, "roomba_stream_stalls_total", "counter", "Stalls of the sensor stream detected by the watchdog.");
+	for(it = samples.begin();it != samples.end();++it) {
+		appendValue(text, "roomba_stream_stalls_total", (*it).labels, NULL, (*it).recovery.stallCount);
+	}
+	appendHeader(text, "roomba_stream_recoveries_total", "counter", "Stalls of the sensor stream recovered.");
+	for(it = samples.begin();it != samples.end();++it) {
+		appendValue(text, "roomba_stream_recoveries_total", (*it).labels, NULL, (*it).recovery.recoveryCount);
+	}
+	appendHeader(text, "roomba_serial_reopens_total", "counter", "Reopens of the serial port by the watchdog.");
+	for(it = samples.begin();it != samples.end();++it) {
+		appendValue(text, "roomba_serial_reopens_total", (*it).labels, NULL, (*it).recovery.reopenCount);
+	}
+	appendHeader(text, "roomba_stream_last_recovery_seconds", "gauge", "Time from the stall detection to the first frame of the last recovery.");
+	for(it = samples.begin();it != samples.end();++it) {
+		appendValue(text, "roomba_stream_last_recovery_seconds", (*it).labels, NULL, (*it).recovery.lastRecoveryTime / 1000000.0);
+	}
+	appendHeader(text, "roomba_stream_max_recovery_seconds", "gauge", "Maximum time from the stall detection to the first frame.");
+	for(it = samples.begin();it != samples.end();++it) {
+		appendValue(text, "roomba_stream_max_recovery_seconds", (*it).labels, NULL, (*it).recovery.maxRecoveryTime / 1000000.0);
+	}
+	appendHeader(text, "roomba_mode", "gauge", "Operating mode requested by the driver.");
+	for(it = samples.begin();it != samples.end();++it) {
+		std::string mode = std::string("mode=\"") + getModeName((*it).mode) + "\"";
+		appendValue(text, "roomba_mode", (*it).labels, mode.c_str(), 1);
+	}
+
+	// the counters are the totals, which Roomba::resetLinkStats does not restart.
+	appendHeader(text, "roomba_decode_errors_total", "counter", "Sensor frames dropped by the decoder.");
+	for(it = samples.begin();it != samples.end();++it) {
+		appendValue(text, "roomba_decode_errors_total", (*it).labels, "type=\"checksum\"", (*it).totals.checksumErrors);
+		appendValue(text, "roomba_decode_errors_total", (*it).labels, "type=\"bad_frame\"", (*it).totals.badFrames);
+	}
+	appendHeader(text, "roomba_resyncs_total", "counter", "Searches for the header of the sensor frame.");
+	for(it = samples.begin();it != samples.end();++it) {
+		appendValue(text, "roomba_resyncs_total", (*it).labels, NULL, (*it).totals.resyncCount);
+	}
+	appendHeader(text, "roomba_commands_total", "counter", "Commands sent to the robot.");
+	for(it = samples.begin();it != samples.end();++it) {
+		appendValue(text, "roomba_commands_total", (*it).labels, NULL, (*it).totals.txPackets);
+	}
+	appendHeader(text, "roomba_tx_bytes_total", "counter", "Bytes sent to the robot.");
+	for(it = samples.begin();it != samples.end();++it) {
+		appendValue(text, "roomba_tx_bytes_total", (*it).labels, NULL, (*it).totals.txBytes);
+	}
+	appendHeader(text, "roomba_tx_queue_bytes", "gauge", "Bytes waiting in the transmit queue because the port was full.");
+	for(it = samples.begin();it != samples.end();++it) {
+		appendValue(text, "roomba_tx_queue_bytes", (*it).labels, NULL, (*it).link.txQueueDepth);
+	}
+	appendHeader(text, "roomba_tx_queue_high_water_bytes", "gauge", "Maximum of the transmit queue since the reset of the link statistics.");
+	for(it = samples.begin();it != samples.end();++it) {
+		appendValue(text, "roomba_tx_queue_high_water_bytes", (*it).labels, NULL, (*it).link.txQueueHighWater);
+	}
+	appendHeader(text, "roomba_tx_partial_writes_total", "counter", "Writes to the port which did not take all the bytes.");
+	for(it = samples.begin();it != samples.end();++it) {
+		appendValue(text, "roomba_tx_partial_writes_total", (*it).labels, NULL, (*it).totals.txPartialWrites);
+	}
+	appendHeader(text, "roomba_tx_dropped_total", "counter", "Commands not sent because the transmit queue was full.");
+	for(it = samples.begin();it != samples.end();++it) {
+		appendValue(text, "roomba_tx_dropped_total", (*it).labels, "reason=\"replaced\"", (*it).totals.txReplaced);
+		appendValue(text, "roomba_tx_dropped_total", (*it).labels, "reason=\"rejected\"", (*it).totals.txRejected);
+	}
+	appendHeader(text, "roomba_requests_rejected_total", "counter", "Requests not sent because the transmit queue was full.");
+	for(it = samples.begin();it != samples.end();++it) {
+		appendValue(text, "roomba_requests_rejected_total", (*it).labels, NULL, (*it).totals.requestsRejected);
+	}
+	appendHeader(text, "roomba_rx_bytes_total", "counter", "Bytes received from the robot.");
+	for(it = samples.begin();it != samples.end();++it) {
+		appendValue(text, "roomba_rx_bytes_total", (*it).labels, NULL, (*it).totals.rxBytes);
+	}
+	appendHeader(text, "roomba_request_latency_seconds", "summary", "Round trip time of the requests (quantile 1 is the maximum).");
+	for(it = samples.begin();it != samples.end();++it) {
+		appendSummary(text, "roomba_request_latency_seconds", (*it).labels,
+			(*it).link.roundTripMedian, (*it).link.roundTrip99, (*it).link.roundTripMax,
+			(*it).totals.roundTripSum, (*it).totals.requestCount);
+	}
+	appendHeader(text, "roomba_frame_interval_seconds", "summary", "Interval between the sensor frames (quantile 1 is the maximum).");
+	for(it = samples.begin();it != samples.end();++it) {
+		appendSummary(text, "roomba_frame_interval_seconds", (*it).labels,
+			(*it).link.frameIntervalMedian, (*it).link.frameInterval99, (*it).link.frameIntervalMax,
+			(*it).totals.frameIntervalSum, (*it).totals.frameCount);
+	}
+	appendHeader(text, "roomba_frame_jitter_seconds", "summary", "Deviation of the frame interval from the period (quantile 1 is the maximum).");
+	for(it = samples.begin();it != samples.end();++it) {
+		appendSummary(text, "roomba_frame_jitter_seconds", (*it).labels,
+			(*it).link.jitterMedian, (*it).link.jitter99, (*it).link.jitterMax,
+			(*it).totals.jitterSum, (*it).totals.frameCount);
+	}
+
+	// the battery is reported only after it is received.
+	appendHeader(text, "roomba_battery_voltage_volts", "gauge", "Battery voltage.");
+	for(it = samples.begin();it != samples.end();++it) {
+		if((*it).hasVoltage) {
+			appendValue(text, "roomba_battery_voltage_volts", (*it).labels, NULL, (*it).voltage / 1000.0);
+		}
+	}
+	appendHeader(text, "roomba_battery_charge_mah", "gauge", "Battery charge [mAh].");
+	for(it = samples.begin();it != samples.end();++it) {
+		if((*it).hasCharge) {
+			appendValue(text, "roomba_battery_charge_mah", (*it).labels, NULL, (*it).charge);
+		}
+	}
+	appendHeader(text, "roomba_battery_capacity_mah", "gauge", "Battery capacity [mAh].");
+	for(it = samples.begin();it != samples.end();++it) {
+		if((*it).hasCapacity) {
+			appendValue(text, "roomba_battery_capacity_mah", (*it).labels, NULL, (*it).capacity);
+		}
+	}
+}
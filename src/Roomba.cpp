@@ -1,18 +1,57 @@
 
 
 #include "Roomba.h"
-#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <string.h>
+#include <time.h>
 
 
 #include "op_code.h"
+#include "Clock.h"
+#include "Trace.h"
+#include "Atomic.h"
+#include "Log.h"
 
 using namespace net::ysuga::roomba;
 
-Roomba::Roomba(const uint32_t model, const char *portName, const uint32_t baudrate) :
+/**
+ * CPU time of the calling thread [usec]
+ */
+static uint64_t getThreadCpuTime()
+{
+#ifdef WIN32
+	FILETIME creationTime, exitTime, kernelTime, userTime;
+	::GetThreadTimes(::GetCurrentThread(), &creationTime, &exitTime, &kernelTime, &userTime);
+	uint64_t time = (((uint64_t)kernelTime.dwHighDateTime << 32) | kernelTime.dwLowDateTime)
+		+ (((uint64_t)userTime.dwHighDateTime << 32) | userTime.dwLowDateTime);
+	return time / 10; // 100 nsec unit
+#else
+	struct timespec time;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+	return (uint64_t)time.tv_sec * 1000000 + time.tv_nsec / 1000;
+#endif
+}
+
+Roomba::Roomba(const uint32_t model, const char *portName, const uint32_t baudrate, SerialPort* port /* = NULL */,
+			   const bool sendStart /* = true */) :
 m_isStreamMode(0), 
 m_X(0), m_Y(0), m_Th(0), m_EncoderInitFlag(0),
 m_TargetVelocityX(0), m_TargetVelocityTh(0),
-m_MainBrushFlag(MOTOR_OFF), m_SideBrushFlag(MOTOR_OFF), m_VacuumFlag(MOTOR_OFF)
+m_MainBrushFlag(MOTOR_OFF), m_SideBrushFlag(MOTOR_OFF), m_VacuumFlag(MOTOR_OFF),
+m_ScriptLoaded(false), m_ScriptHash(0),
+m_ReflexTriggers(0), m_ReflexAction(REFLEX_ACTION_STOP), m_ReflexBackOffVelocity(100), m_ReflexActiveTriggers(0),
+m_ReflexCount(0), m_ReflexLastReactionTime(0), m_ReflexMaxReactionTime(0),
+m_StreamThreadStarted(false),
+m_Baudrate(baudrate), m_ResubscribeRequested(false), m_LastResubscribeFrame(0),
+m_ResubscribeIntervalFrames(200 / STREAM_PERIOD), m_SubscriptionIdleFrames(10000 / STREAM_PERIOD),
+m_DefaultPollPeriod(500 / POLL_PERIOD), m_PollIdleTicks(10000 / POLL_PERIOD),
+m_StreamIdleTimeout(0), m_StreamInterest(0), m_LastDemandFrame(0), m_StreamIdle(false),
+m_WatchdogPeriods(DEFAULT_WATCHDOG_PERIODS), m_WatchdogReopenAttempts(DEFAULT_WATCHDOG_REOPEN_ATTEMPTS), m_StallTime(0),
+m_VelocityControlEnabled(false), m_ControlOutput(CONTROL_OUTPUT_DIRECT), m_ControlGainP(0), m_ControlGainI(0),
+m_TargetVelocityRight(0), m_TargetVelocityLeft(0), m_ControlInitFlag(false),
+m_ControlIntegralRight(0), m_ControlIntegralLeft(0), m_MeasuredVelocityRight(0), m_MeasuredVelocityLeft(0), m_ControlFrame(0),
+m_TrajectoryCount(0), m_TrajectoryIndex(0), m_TrajectoryRunning(false)
 {
   if(model == MODEL_CREATE) {
 	  m_Version = VERSION_ROI;
@@ -21,79 +60,164 @@ m_MainBrushFlag(MOTOR_OFF), m_SideBrushFlag(MOTOR_OFF), m_VacuumFlag(MOTOR_OFF)
   }
 
   m_ledFlag = m_intensity = m_color = 0;
+  m_AsyncThreadReceiveCounter = 0;
+  m_PollSubmitted = false;
+  m_pNotifyEvent = NULL;
+  memset(&m_StreamActivity, 0, sizeof(m_StreamActivity));
+  memset(&m_StreamRecovery, 0, sizeof(m_StreamRecovery));
+  for(int i = 0;i <= MAX_SENSOR_ID;i++) {
+	  m_PublishedSensorValues[i] = 0;
+  }
   
-  m_pTransport = new Transport(portName, baudrate);
-  start();
-
-  buffer = NULL;
+  // allocated by executeTrajectory, so the robots which never run a trajectory do not pay for it.
+  m_TrajectoryBuffer = NULL;
+  m_TrajectoryTimingError = NULL;
+  m_TrajectoryCapacity = 0;
+
+  if(port) {
+    m_pTransport = new Transport(port);
+    m_ModeSettleTime = 0;
+  } else {
+    m_pTransport = new Transport(portName, baudrate);
+    m_ModeSettleTime = 100;
+  }
+  // only the latest motion matters while the port is congested, and the queries are
+  // refused rather than delaying the control. the mode and the scripts are always queued.
+  m_pTransport->SetTxPolicy(OP_DRIVE, Transport::TX_POLICY_LATEST);
+  m_pTransport->SetTxPolicy(OP_DRIVE_DIRECT, Transport::TX_POLICY_LATEST);
+  m_pTransport->SetTxPolicy(OP_DRIVE_PWM, Transport::TX_POLICY_LATEST);
+  m_pTransport->SetTxPolicy(OP_MOTORS, Transport::TX_POLICY_LATEST);
+  m_pTransport->SetTxPolicy(OP_LEDS, Transport::TX_POLICY_LATEST);
+  m_pTransport->SetTxPolicy(OP_SENSORS, Transport::TX_POLICY_REJECT);
+  m_pTransport->SetTxPolicy(OP_QUERY_LIST, Transport::TX_POLICY_REJECT);
+  resetStreamParser();
+  if(sendStart) {
+    start();
+  }
 }
 
 
 Roomba::~Roomba(void)
 {
-  if(m_isStreamMode) {
-    suspendSensorStream();
-    m_isStreamMode = false;
-    Join();
-  }
-  safeControl();
-  start();
+  // the port may be gone already. nothing can be done for the errors here.
+  tryStopSensorStream();
+  trySafeControl();
+  tryStart();
   delete m_pTransport;
+
+  delete[] m_TrajectoryBuffer;
+  delete[] m_TrajectoryTimingError;
+}
+
+/**
+ * Return code of the result of Transport.
+ */
+static Roomba::ReturnCode toReturnCode(const int32_t transportResult)
+{
+	switch(transportResult) {
+	case 0:
+		return Roomba::ROOMBA_OK;
+	case TRANSPORT_ACCESS_FAILED:
+		return Roomba::COM_ACCESS_FAILED;
+	case TRANSPORT_TX_FULL:
+		return Roomba::TX_QUEUE_FULL;
+	case TRANSPORT_BUSY:
+		return Roomba::REQUEST_BUSY;
+	default:
+		// RECEIVE_TIMEOUT or RECEIVE_STOPPED
+		return Roomba::SENSOR_UNAVAILABLE;
+	}
+}
+
+void Roomba::throwError(const ReturnCode error)
+{
+	switch(error) {
+	case ROOMBA_OK:
+		return;
+	case COM_ACCESS_FAILED:
+		throw ComAccessException();
+	case SENSOR_UNAVAILABLE:
+		throw SensorUnavailableError();
+	case TX_QUEUE_FULL:
+		throw TxQueueFullError();
+	case CONNECTION_TIMEOUT:
+		throw ConnectionTimeoutError();
+	case REQUEST_BUSY:
+		throw RequestBusyError();
+	default:
+		throw PreconditionNotMetError();
+	}
 }
 
 void Roomba::setMode(Mode mode)
 {
+	throwError(trySetMode(mode));
+}
+
+Roomba::ReturnCode Roomba::trySetMode(Mode mode)
+{
+	uint8_t opCode;
+	Mode newMode = MODE_PASSIVE;
 	switch(mode) {
 	case MODE_START:
-		m_pTransport->SendPacket(OP_START);
-		m_CurrentMode = MODE_PASSIVE;
+		opCode = OP_START;
 		break;	
 
 	case MODE_SAFE:
-		m_pTransport->SendPacket(OP_SAFE);
-		m_CurrentMode = MODE_SAFE;
+		opCode = OP_SAFE;
+		newMode = MODE_SAFE;
 		break;
 
 	case MODE_FULL:
-		m_pTransport->SendPacket(OP_FULL);
-		m_CurrentMode = MODE_FULL;
+		opCode = OP_FULL;
+		newMode = MODE_FULL;
 		break;
 		
 	case MODE_SPOT_CLEAN:
-		m_pTransport->SendPacket(OP_SPOT);
-		m_CurrentMode = MODE_PASSIVE;
+		opCode = OP_SPOT;
 		break;
 
 	case MODE_NORMAL_CLEAN:
-		m_pTransport->SendPacket(OP_CLEAN);
-		m_CurrentMode = MODE_PASSIVE;
+		opCode = OP_CLEAN;
 		break;
 
 	case MODE_MAX_TIME_CLEAN:
-		m_pTransport->SendPacket(OP_MAX);
-		m_CurrentMode = MODE_PASSIVE;
+		opCode = OP_MAX;
 		break;
 
 	case MODE_DOCK:
-		m_pTransport->SendPacket(OP_DOCK);
-		m_CurrentMode = MODE_PASSIVE;
+		opCode = OP_DOCK;
 		break;
 
 	case MODE_POWER_DOWN:
-		m_pTransport->SendPacket(OP_POWER);
-		m_CurrentMode = MODE_PASSIVE;
+		opCode = OP_POWER;
 		break;
 
 	default:
-		break;
+		return ROOMBA_OK;
+	}
+
+	if(m_pTransport->TrySendPacket(opCode) != 0) {
+		return COM_ACCESS_FAILED;
+	}
+	if(mode == MODE_POWER_DOWN) {
+		forgetScript();
 	}
+	m_CurrentMode = newMode;
+	if(m_ModeSettleTime) {
+		Thread::Sleep(m_ModeSettleTime);
+	}
+	return ROOMBA_OK;
+}
 
-	Thread::Sleep(100);
+void Roomba::drive(uint16_t translation, uint16_t turnRadius)
+{
+	throwError(tryDrive(translation, turnRadius));
 }
 
-void Roomba::drive(uint16_t translation, uint16_t turnRadius) {
+Roomba::ReturnCode Roomba::tryDrive(uint16_t translation, uint16_t turnRadius) {
 	if(getMode() != MODE_SAFE && getMode() != MODE_FULL) {
-		throw PreconditionNotMetError();
+		return PRECONDITION_NOT_MET;
 	}
 
 	uint8_t data[4];
@@ -108,12 +232,17 @@ void Roomba::drive(uint16_t translation, uint16_t turnRadius) {
 	data[2] = (turnRadius >> 8) & 0xFF;
 	data[3] = turnRadius & 0xFF;
 #endif
-	m_pTransport->SendPacket(OP_DRIVE, data, 4);
+	return toReturnCode(m_pTransport->TrySendPacket(OP_DRIVE, data, 4));
 }
 
-void Roomba::driveDirect(int16_t rightWheel, int16_t leftWheel) {
+void Roomba::driveDirect(int16_t rightWheel, int16_t leftWheel)
+{
+	throwError(tryDriveDirect(rightWheel, leftWheel));
+}
+
+Roomba::ReturnCode Roomba::tryDriveDirect(int16_t rightWheel, int16_t leftWheel) {
 	if(getMode() != MODE_SAFE && getMode() !=MODE_FULL) {
-		throw PreconditionNotMetError();
+		return PRECONDITION_NOT_MET;
 	}
 
 	uint8_t data[4];
@@ -129,12 +258,17 @@ void Roomba::driveDirect(int16_t rightWheel, int16_t leftWheel) {
 	data[2] = (leftWheel >> 8) & 0xFF;
 
 #endif
-	m_pTransport->SendPacket(OP_DRIVE_DIRECT, data, 4);
+	return toReturnCode(m_pTransport->TrySendPacket(OP_DRIVE_DIRECT, data, 4));
 }
 
-void Roomba::drivePWM(int16_t rightWheel, int16_t leftWheel) {
+void Roomba::drivePWM(int16_t rightWheel, int16_t leftWheel)
+{
+	throwError(tryDrivePWM(rightWheel, leftWheel));
+}
+
+Roomba::ReturnCode Roomba::tryDrivePWM(int16_t rightWheel, int16_t leftWheel) {
 	if(getMode() != MODE_SAFE && getMode() != MODE_FULL) {
-		throw PreconditionNotMetError();
+		return PRECONDITION_NOT_MET;
 	}
 
 	uint8_t data[4];
@@ -150,13 +284,18 @@ void Roomba::drivePWM(int16_t rightWheel, int16_t leftWheel) {
 	data[3] = leftWheel & 0xFF;
 
 #endif
-	m_pTransport->SendPacket(OP_DRIVE_PWM, data, 4);
+	return toReturnCode(m_pTransport->TrySendPacket(OP_DRIVE_PWM, data, 4));
 }
 
-LIBROOMBA_API void Roomba::driveMotors(Motors mainBrush, Motors sideBrush, Motors vacuum)
+void Roomba::driveMotors(Motors mainBrush, Motors sideBrush, Motors vacuum)
+{
+	throwError(tryDriveMotors(mainBrush, sideBrush, vacuum));
+}
+
+Roomba::ReturnCode Roomba::tryDriveMotors(Motors mainBrush, Motors sideBrush, Motors vacuum)
 {
 	if(getMode() != MODE_SAFE && getMode() !=MODE_FULL) {
-		throw PreconditionNotMetError();
+		return PRECONDITION_NOT_MET;
 	}
 
 	uint8_t data = 0;
@@ -187,325 +326,1621 @@ LIBROOMBA_API void Roomba::driveMotors(Motors mainBrush, Motors sideBrush, Motor
 	}
 	
 	
-	m_pTransport->SendPacket(OP_MOTORS, &data, 1);
+	return toReturnCode(m_pTransport->TrySendPacket(OP_MOTORS, &data, 1));
 }
 
 
 
-void Roomba::setLED(uint8_t leds, uint8_t intensity, uint8_t color /* = 127*/) 
+void Roomba::setLED(uint8_t leds, uint8_t intensity, uint8_t color /* = 127*/)
+{
+	throwError(trySetLED(leds, intensity, color));
+}
+
+Roomba::ReturnCode Roomba::trySetLED(uint8_t leds, uint8_t intensity, uint8_t color /* = 127*/) 
 {
 	uint8_t buf[3] = {leds, color, intensity};
-	m_pTransport->SendPacket(OP_LEDS, buf, 3);
+	return toReturnCode(m_pTransport->TrySendPacket(OP_LEDS, buf, 3));
+}
+
+
+void Roomba::uploadScript(const Script& script)
+{
+	throwError(tryUploadScript(script));
+}
+
+Roomba::ReturnCode Roomba::tryUploadScript(const Script& script)
+{
+	if(m_Version != Roomba::VERSION_ROI) {
+		return PRECONDITION_NOT_MET;
+	}
+
+	uint32_t hash = script.getHash();
+	MutexGuard guard(m_ScriptMutex);
+	if(m_ScriptLoaded && m_ScriptHash == hash) {
+		return ROOMBA_OK;
+	}
+
+	uint8_t buf[MAX_SCRIPT_LENGTH + 1];
+	buf[0] = script.getLength();
+	for(uint32_t i = 0;i < script.getLength();i++) {
+		buf[i+1] = script.getBytes()[i];
+	}
+	if(m_pTransport->TrySendPacket(OP_SCRIPT, buf, script.getLength() + 1) != 0) {
+		// the robot may have a part of the script.
+		m_ScriptLoaded = false;
+		return COM_ACCESS_FAILED;
+	}
+	m_ScriptLoaded = true;
+	m_ScriptHash = hash;
+	return ROOMBA_OK;
 }
 
+/**
+ * The robot may have lost the uploaded script (a reset, a brownout or another connection).
+ */
+void Roomba::forgetScript()
+{
+	MutexGuard guard(m_ScriptMutex);
+	m_ScriptLoaded = false;
+}
+
+void Roomba::playScript(const Script& script)
+{
+	throwError(tryPlayScript(script));
+}
+
+Roomba::ReturnCode Roomba::tryPlayScript(const Script& script)
+{
+	ReturnCode result = tryUploadScript(script);
+	if(result != ROOMBA_OK) {
+		return result;
+	}
+	return toReturnCode(m_pTransport->TrySendPacket(OP_PLAY_SCRIPT));
+}
 
 				
-void Roomba::startSensorStream(uint8_t* requestingSensors, uint32_t numSensors)
+void Roomba::startSensorStream(uint8_t* requestingSensors, uint32_t numSensors, bool startThread /* = true */)
+{
+	throwError(tryStartSensorStream(requestingSensors, numSensors, startThread));
+}
+
+Roomba::ReturnCode Roomba::tryStartSensorStream(uint8_t* requestingSensors, uint32_t numSensors, bool startThread /* = true */)
 {
 	m_SensorDataMap.clear();
 
 	if(m_Version == Roomba::VERSION_500_SERIES) {
-		uint8_t* buffer = new uint8_t[numSensors + 1];
-		buffer[0] = numSensors;
-		for(unsigned int i = 0;i < numSensors;i++) {
-			m_SensorDataMap[(SensorID)requestingSensors[i]] = 0;
-			buffer[i+1] = requestingSensors[i];
+		uint8_t requiredSensors[8];
+		uint32_t numRequiredSensors = 0;
+		if(m_ReflexTriggers & (REFLEX_BUMP | REFLEX_WHEEL_DROP)) {
+			requiredSensors[numRequiredSensors++] = BUMPS_AND_WHEEL_DROPS;
+		}
+		if(m_ReflexTriggers & REFLEX_CLIFF) {
+			requiredSensors[numRequiredSensors++] = CLIFF_LEFT;
+			requiredSensors[numRequiredSensors++] = CLIFF_FRONT_LEFT;
+			requiredSensors[numRequiredSensors++] = CLIFF_FRONT_RIGHT;
+			requiredSensors[numRequiredSensors++] = CLIFF_RIGHT;
+		}
+		if(m_ReflexTriggers & REFLEX_WHEEL_OVERCURRENT) {
+			requiredSensors[numRequiredSensors++] = WHEEL_OVERCURRENTS;
+		}
+		// odometry and velocity control
+		requiredSensors[numRequiredSensors++] = RIGHT_ENCODER_COUNTS;
+		requiredSensors[numRequiredSensors++] = LEFT_ENCODER_COUNTS;
+
+		ReturnCode result;
+		{
+			WriteGuard guard(m_AsyncThreadLock);
+			m_StreamSubscription.clear();
+			for(unsigned int i = 0;i < numSensors;i++) {
+				m_StreamSubscription[(SensorID)requestingSensors[i]].pinned = true;
+				m_SensorDataMap[(SensorID)requestingSensors[i]] = 0;
+			}
+			for(unsigned int i = 0;i < numRequiredSensors;i++) {
+				m_StreamSubscription[(SensorID)requiredSensors[i]].pinned = true;
+				m_SensorDataMap[(SensorID)requiredSensors[i]] = 0;
+			}
+			result = sendStreamSubscription();
+		}
+		if(result == ROOMBA_OK) {
+			result = tryResumeSensorStream();
+		}
+		if(result != ROOMBA_OK) {
+			return result;
 		}
-		m_pTransport->SendPacket(OP_STREAM, buffer, numSensors+1);
 		
 		m_isStreamMode = true;
-		resumeSensorStream();
-		Start();
-
-		getRightEncoderCounts();
-		getLeftEncoderCounts();
-
-		delete buffer;
+		if(startThread) {
+			m_StreamThreadStarted = true;
+			Start();
+		}
+		return ROOMBA_OK;
 	} else {
+		{
+			WriteGuard guard(m_AsyncThreadLock);
+			// Odometry integrates distance and angle in every tick.
+			schedulePoll(DISTANCE, 1, true);
+			schedulePoll(ANGLE, 1, true);
+			for(unsigned int i = 0;i < numSensors;i++) {
+				if(m_PollSchedule.find((SensorID)requestingSensors[i]) == m_PollSchedule.end()) {
+					schedulePoll(requestingSensors[i], 100 / POLL_PERIOD, true);
+				}
+			}
+		}
+
 		m_isStreamMode = true;
-		Start();
+		if(startThread) {
+			m_StreamThreadStarted = true;
+			Start();
+		}
+		return ROOMBA_OK;
 	}
 }
 
-void Roomba::resumeSensorStream()
+void Roomba::setPollRate(uint8_t sensorId, uint32_t period)
 {
-	if(m_Version == Roomba::VERSION_500_SERIES) {
-		uint8_t buf = 1;
-		m_pTransport->SendPacket(OP_PAUSE_RESUME_STREAM, &buf, 1);
-	}
+	throwError(trySetPollRate(sensorId, period));
 }
 
-void Roomba::suspendSensorStream()
+Roomba::ReturnCode Roomba::trySetPollRate(uint8_t sensorId, uint32_t period)
 {
-	if(m_Version == Roomba::VERSION_500_SERIES) {
-		uint8_t buf = 0;
-		m_pTransport->SendPacket(OP_PAUSE_RESUME_STREAM, &buf, 1);
+	if(m_Version != Roomba::VERSION_ROI || getSensorDataSize(sensorId) == 0 || sensorId > MAX_SENSOR_ID) {
+		return PRECONDITION_NOT_MET;
+	}
+	WriteGuard guard(m_AsyncThreadLock);
+	if(period == 0) {
+		m_PollSchedule.erase((SensorID)sensorId);
+	} else {
+		schedulePoll(sensorId, (period + POLL_PERIOD - 1) / POLL_PERIOD, true);
 	}
+	return ROOMBA_OK;
 }
 
-
-void Roomba::getSensorGroup2(uint8_t *remoteOpcode, uint8_t *buttons, int16_t *distance, int16_t *angle)
+/**
+ * Add the sensor to the poll schedule. The sensor is due in the next tick.
+ * m_AsyncThreadLock must be locked for writing.
+ */
+void Roomba::schedulePoll(uint8_t sensorId, uint32_t period, bool pinned)
 {
-	uint8_t data[6];
-	uint32_t readBytes;
-	uint8_t sensorId = 2;
-	m_AsyncThreadMutex.Lock();
-	m_pTransport->SendPacket(OP_SENSORS, &sensorId, 1);
-	m_pTransport->ReceiveData(data, 6, &readBytes);
-	m_AsyncThreadMutex.Unlock();
-	*remoteOpcode = data[0];
-	*buttons = data[1];
-	*distance = *angle = 0;
-#ifdef __BIG_ENDIAN__
-	*distance = ((uint16_t)data[2] << 8) | (data[3] & 0xFF);
-	*angle    = ((uint16_t)data[4] << 8) | (data[5] & 0xFF);
-#else
-	*distance |= ((uint16_t)data[2] << 8) | ((uint16_t)data[3] & 0xFF);
-	*angle    |= ((uint16_t)data[4] << 8) | ((uint16_t)data[5] & 0xFF);
-#endif
-	std::cout << "D=" << *distance << " A=" << *angle << std::endl;
+	PollEntry& entry = m_PollSchedule[(SensorID)sensorId];
+	entry.period = period > 0 ? period : 1;
+	entry.nextTick = m_AsyncThreadReceiveCounter;
+	entry.lastRead = m_AsyncThreadReceiveCounter;
+	entry.pinned = entry.pinned || pinned;
 }
 
+/**
+ * Is the sensor polled as a part of a scheduled group packet?
+ * m_AsyncThreadLock must be locked for writing.
+ */
+bool Roomba::isPolledByGroup(uint8_t sensorId)
+{
+	uint8_t firstId, lastId;
+	std::map<SensorID, PollEntry>::const_iterator it = m_PollSchedule.begin();
+	for(;it != m_PollSchedule.end();++it) {
+		if(getSensorGroupRange((*it).first, &firstId, &lastId) && firstId <= sensorId && sensorId <= lastId) {
+			return true;
+		}
+	}
+	return false;
+}
 
-
-void Roomba::getSensorValue(uint8_t sensorId, uint16_t *value) {
-	uint8_t data[2];
-	uint32_t readBytes;
-	m_AsyncThreadMutex.Lock();
-	m_pTransport->SendPacket(OP_SENSORS, &sensorId, 1);
-	m_pTransport->ReceiveData(data, 2, &readBytes);
-	m_AsyncThreadMutex.Unlock();
-#ifdef __BIG_ENDIAN__
-	*value = ((uint16_t)data[0] << 8) | (data[1] & 0xFF);
-#else
-	*value = ((uint16_t)data[1] << 8) | (data[0] & 0xFF);
-#endif
+void Roomba::setStreamSubscriptionPolicy(const uint32_t resubscribeInterval, const uint32_t idleTimeout)
+{
+	WriteGuard guard(m_AsyncThreadLock);
+	m_ResubscribeIntervalFrames = resubscribeInterval / STREAM_PERIOD;
+	m_SubscriptionIdleFrames = idleTimeout / STREAM_PERIOD;
 }
 
-void Roomba::getSensorValue(uint8_t sensorId, int16_t *value) {
-	uint8_t data[2];
-	uint32_t readBytes;
-	m_AsyncThreadMutex.Lock();
-	m_pTransport->SendPacket(OP_SENSORS, &sensorId, 1);
-	m_pTransport->ReceiveData(data, 2, &readBytes);
-	m_AsyncThreadMutex.Unlock();
-#ifdef __BIG_ENDIAN__
-	*value = ((int16_t)data[0] << 8) | (data[1] & 0xFF);
-#else
-	*value = ((int16_t)data[1] << 8) | (data[0] & 0xFF);
-#endif
+uint32_t Roomba::getStreamSubscription(uint8_t* sensorIds, const uint32_t maxCount)
+{
+	ReadGuard guard(m_AsyncThreadLock);
+	uint32_t count = m_StreamList.size();
+	for(uint32_t i = 0;i < count && i < maxCount;i++) {
+		sensorIds[i] = m_StreamList[i];
+	}
+	return count;
 }
 
+/**
+ * Is the sensor included in the stream directly or by a group packet?
+ * m_AsyncThreadLock must be locked for writing.
+ */
+bool Roomba::isStreamed(uint8_t sensorId)
+{
+	uint8_t firstId, lastId;
+	for(uint32_t i = 0;i < m_StreamList.size();i++) {
+		if(m_StreamList[i] == sensorId) {
+			return true;
+		}
+		if(getSensorGroupRange(m_StreamList[i], &firstId, &lastId) && firstId <= sensorId && sensorId <= lastId) {
+			return true;
+		}
+	}
+	return false;
+}
 
-void Roomba::getSensorValue(uint8_t sensorId, uint8_t *value) {
-	uint8_t data[2];
-	uint32_t readBytes;
-	m_AsyncThreadMutex.Lock();
-	m_pTransport->SendPacket(OP_SENSORS, &sensorId, 1);
-	m_pTransport->ReceiveData(data, 1, &readBytes);
-	m_AsyncThreadMutex.Unlock();
-	*value = data[0];
+/**
+ * Replace single sensors by a group packet if the group is smaller in bytes.
+ */
+static void compactStreamList(std::vector<uint8_t>& sensors, const uint32_t version)
+{
+	static const uint8_t groups[] = {SENSOR_GROUP_107, SENSOR_GROUP_106, SENSOR_GROUP_2, SENSOR_GROUP_1,
+		SENSOR_GROUP_3, SENSOR_GROUP_5, SENSOR_GROUP_4, SENSOR_GROUP_101};
+	uint8_t firstId, lastId;
+	for(uint32_t g = 0;g < sizeof(groups);g++) {
+		if(version == Roomba::VERSION_ROI && groups[g] > SENSOR_GROUP_6) {
+			continue;
+		}
+		getSensorGroupRange(groups[g], &firstId, &lastId);
+		uint32_t bytes = 0;
+		for(uint32_t i = 0;i < sensors.size();i++) {
+			if(firstId <= sensors[i] && sensors[i] <= lastId) {
+				bytes += 1 + getSensorDataSize(sensors[i]);
+			}
+		}
+		if(bytes < 1 + getSensorDataSize(groups[g])) {
+			continue;
+		}
+		std::vector<uint8_t> compacted;
+		for(uint32_t i = 0;i < sensors.size();i++) {
+			if(sensors[i] < firstId || lastId < sensors[i]) {
+				compacted.push_back(sensors[i]);
+			}
+		}
+		compacted.push_back(groups[g]);
+		sensors.swap(compacted);
+	}
 }
 
-void Roomba::getSensorValue(uint8_t sensorId, int8_t *value) {
-	uint8_t data[2];
-	uint32_t readBytes;
-	m_AsyncThreadMutex.Lock();
-	m_pTransport->SendPacket(OP_SENSORS, &sensorId, 1);
-	m_pTransport->ReceiveData(data, 1, &readBytes);
-	m_AsyncThreadMutex.Unlock();
-	*value = data[0];
+static bool compareLastRead(const std::pair<uint32_t, uint8_t>& a, const std::pair<uint32_t, uint8_t>& b)
+{
+	return a.first > b.first;
 }
 
-void Roomba::handleStreamData() {
+/**
+ * Send OP_STREAM with the union of subscribed sensors.
+ * The new list is taken only if it is sent. Otherwise the resubscription stays requested
+ * and is retried by processStreamSubscription at the next frame.
+ * m_AsyncThreadLock must be locked for writing.
+ */
+Roomba::ReturnCode Roomba::sendStreamSubscription()
+{
+	// bytes per one frame: header, size, checksum and (id + data) of each sensor.
+	const uint32_t budget = m_Baudrate / 10 * STREAM_PERIOD / 1000;
+	uint32_t frameBytes = 3;
+
+	std::vector<std::pair<uint32_t, uint8_t> > candidates;
+	std::vector<uint8_t> sensors;
+	std::map<SensorID, StreamSubscription>::iterator it = m_StreamSubscription.begin();
+	for(;it != m_StreamSubscription.end();++it) {
+		if((*it).second.pinned) {
+			sensors.push_back((*it).first);
+		} else {
+			candidates.push_back(std::pair<uint32_t, uint8_t>((*it).second.lastRead, (*it).first));
+		}
+	}
+	compactStreamList(sensors, m_Version);
+	for(uint32_t i = 0;i < sensors.size();i++) {
+		frameBytes += 1 + getSensorDataSize(sensors[i]);
+	}
 
-	uint32_t readBytes;
-	uint8_t header[2];
-	uint8_t bufSize = 0;
-	uint32_t sum;
+	// The most recently read sensors are kept when the frame exceeds the budget.
+	std::sort(candidates.begin(), candidates.end(), compareLastRead);
+	for(uint32_t i = 0;i < candidates.size();i++) {
+		uint32_t size = 1 + getSensorDataSize(candidates[i].second);
+		if(frameBytes + size > budget || sensors.size() >= 255) {
+			m_StreamSubscription.erase((SensorID)candidates[i].second);
+			continue;
+		}
+		sensors.push_back(candidates[i].second);
+		frameBytes += size;
+	}
+	compactStreamList(sensors, m_Version);
 
-	while(1) {
-		m_pTransport->ReceiveData(header, 1, &readBytes);
-		if(header[0] == 19) break;
+	uint8_t buf[256];
+	buf[0] = sensors.size();
+	for(uint32_t i = 0;i < sensors.size();i++) {
+		buf[i+1] = sensors[i];
 	}
-	m_pTransport->ReceiveData(header+1, 1, &readBytes);
-	if(header[1] > bufSize) {
-		delete buffer;
-		bufSize = header[1];
-		buffer = new uint8_t[bufSize];
+	ReturnCode result = toReturnCode(m_pTransport->TrySendPacket(OP_STREAM, buf, sensors.size() + 1));
+	if(result != ROOMBA_OK) {
+		// the robot still streams the old list.
+		m_ResubscribeRequested = true;
+		return result;
 	}
-	sum = 19 + header[1];
-	m_pTransport->ReceiveData(buffer, header[1], &readBytes);
-	if(readBytes != header[1]) {
-		std::cout << "Received Packet is wrong." << std::endl;
-		delete buffer;
-		buffer = NULL;
-		m_isStreamMode = 0;
-		Exit(-1);
+
+	m_StreamList = sensors;
+	for(std::map<SensorID, uint16_t>::iterator data = m_SensorDataMap.begin();data != m_SensorDataMap.end();) {
+		if(!isStreamed((*data).first)) {
+			m_SensorDataMap.erase(data++);
+		} else {
+			++data;
+		}
 	}
-	uint8_t check_sum;
-	m_pTransport->ReceiveData(&check_sum, 1, &readBytes);
+	m_ResubscribeRequested = false;
+	m_LastResubscribeFrame = m_AsyncThreadReceiveCounter;
+	return ROOMBA_OK;
+}
 
-	for(int i = 0;i < header[1];i++) {
-		sum += buffer[i];
+void Roomba::processStreamSubscription()
+{
+	uint32_t frame = m_AsyncThreadReceiveCounter;
+	WriteGuard guard(m_AsyncThreadLock);
+	bool changed = m_ResubscribeRequested;
+	std::map<SensorID, StreamSubscription>::iterator it = m_StreamSubscription.begin();
+	while(it != m_StreamSubscription.end()) {
+		if(!(*it).second.pinned && frame - (*it).second.lastRead > m_SubscriptionIdleFrames) {
+			m_StreamSubscription.erase(it++);
+			changed = true;
+		} else {
+			++it;
+		}
 	}
-	sum += check_sum;
 
-	if((sum & 0xFF) != 0) {
-		// CheckSumError;
-		return;
+	if(changed && frame - m_LastResubscribeFrame >= m_ResubscribeIntervalFrames) {
+		// a failure is retried at the next frame. nothing is thrown on the stream thread.
+		sendStreamSubscription();
+	} else if(changed) {
+		m_ResubscribeRequested = true;
+	}
+}
+
+/**
+ * Get sensor value from the stream (or the poll scheduler for ROI). If the sensor
+ * is not subscribed yet, the subscription is requested and the value is waited for.
+ * Never throws.
+ * @return ROOMBA_OK, SENSOR_UNAVAILABLE, or the error of resuming the idle stream.
+ */
+Roomba::ReturnCode Roomba::getStreamSensorValue(uint8_t sensorId, uint16_t* value)
+{
+	TraceScope trace("getSensorValue", sensorId);
+	*value = 0;
+	ReturnCode result = demandSensorStream(true);
+	if(result != ROOMBA_OK) {
+		return result;
+	}
+	{
+		// the sensor which is already polled or streamed (the common case) is read by
+		// the readers in parallel. Only lastRead of the entry is written then.
+		ReadGuard guard(m_AsyncThreadLock);
+		std::map<SensorID, uint16_t>::const_iterator it = m_SensorDataMap.find((SensorID)sensorId);
+		if(it != m_SensorDataMap.end()) {
+			volatile uint32_t* lastRead = NULL;
+			if(m_Version != Roomba::VERSION_500_SERIES) {
+				std::map<SensorID, PollEntry>::iterator entry = m_PollSchedule.find((SensorID)sensorId);
+				if(entry != m_PollSchedule.end()) {
+					lastRead = &(*entry).second.lastRead;
+				}
+			} else {
+				std::map<SensorID, StreamSubscription>::iterator subscription = m_StreamSubscription.find((SensorID)sensorId);
+				if(subscription != m_StreamSubscription.end()) {
+					lastRead = &(*subscription).second.lastRead;
+				}
+			}
+			if(lastRead) {
+				atomicStore(lastRead, m_AsyncThreadReceiveCounter);
+				*value = (*it).second;
+				return ROOMBA_OK;
+			}
+		}
 	}
 
-	m_AsyncThreadReceiveCounter++;
+	uint32_t timeout;
+	{
+		WriteGuard guard(m_AsyncThreadLock);
+		std::map<SensorID, uint16_t>::const_iterator it = m_SensorDataMap.find((SensorID)sensorId);
+		if(m_Version != Roomba::VERSION_500_SERIES) {
+			std::map<SensorID, PollEntry>::iterator entry = m_PollSchedule.find((SensorID)sensorId);
+			if(entry == m_PollSchedule.end()) {
+				if(it != m_SensorDataMap.end() && isPolledByGroup(sensorId)) {
+					*value = (*it).second;
+					return ROOMBA_OK;
+				}
+				schedulePoll(sensorId, m_DefaultPollPeriod, false);
+			} else {
+				(*entry).second.lastRead = m_AsyncThreadReceiveCounter;
+				if(it != m_SensorDataMap.end()) {
+					*value = (*it).second;
+					return ROOMBA_OK;
+				}
+			}
+			timeout = 4;
+		} else {
+			std::map<SensorID, StreamSubscription>::iterator subscription = m_StreamSubscription.find((SensorID)sensorId);
+			if(subscription == m_StreamSubscription.end()) {
+				StreamSubscription& s = m_StreamSubscription[(SensorID)sensorId];
+				s.lastRead = m_AsyncThreadReceiveCounter;
+				if(!isStreamed(sensorId)) {
+					m_ResubscribeRequested = true;
+				} else if(it != m_SensorDataMap.end()) {
+					*value = (*it).second;
+					return ROOMBA_OK;
+				}
+			} else {
+				(*subscription).second.lastRead = m_AsyncThreadReceiveCounter;
+				if(it != m_SensorDataMap.end()) {
+					*value = (*it).second;
+					return ROOMBA_OK;
+				}
+			}
+			timeout = m_ResubscribeIntervalFrames + 4;
+		}
+	}
 
-	int counter = 0;
-	do {
-		uint8_t sensorId = buffer[counter];
-		uint16_t dataBuf = 0;
-		counter++;
-		switch(sensorId) {
-		case BUMPS_AND_WHEEL_DROPS:
-		case WALL:
-		case CLIFF_LEFT:
-		case CLIFF_FRONT_LEFT:
-		case CLIFF_FRONT_RIGHT:
-		case CLIFF_RIGHT:
-		case VIRTUAL_WALL:
-		case WHEEL_OVERCURRENTS:
-		case DIRT_DETECT:
-		case UNUSED_BYTE:
-		case INFRARED_CHARACTER_OMNI:
-		case INFRARED_CHARACTER_LEFT:
-		case INFRARED_CHARACTER_RIGHT:
-		case BUTTONS:
-		case CHARGING_STATE:
-		case TEMPERATURE:
-		case CHARGING_SOURCE_AVAILABLE:
-		case OI_MODE:
-		case SONG_NUMBER:
-		case SONG_PLAYING:
-		case NUMBER_OF_STREAM_PACKETS:
-		case LIGHT_BUMPER:
-		case STASIS:
-			dataBuf |= buffer[counter];
-			counter++;
-			m_AsyncThreadMutex.Lock();
-			m_SensorDataMap[(SensorID)sensorId] = dataBuf;
-			m_AsyncThreadMutex.Unlock();
-			break;
-		case DISTANCE:
-		case ANGLE:
-		case VOLTAGE:
-		case CURRENT:
-		case BATTERY_CHARGE:
-		case BATTERY_CAPACITY:
-		case WALL_SIGNAL:
-		case CLIFF_LEFT_SIGNAL:
-		case CLIFF_FRONT_LEFT_SIGNAL:
-		case CLIFF_FRONT_RIGHT_SIGNAL:
-		case CLIFF_RIGHT_SIGNAL:
-			//	UNUSED1,
-			// UNUSED2,
-		case REQUESTED_VELOCITY:
-		case REQUESTED_RADIUS:
-		case REQUESTED_RIGHT_VELOCITY:
-		case REQUESTED_LEFT_VELOCITY:
-		case RIGHT_ENCODER_COUNTS:
-		case LEFT_ENCODER_COUNTS:
-		case LIGHT_BUMP_LEFT_SIGNAL:
-		case LIGHT_BUMP_FRONT_LEFT_SIGNAL:
-		case LIGHT_BUMP_CENTER_LEFT_SIGNAL:
-		case LIGHT_BUMP_CENTER_RIGHT_SIGNAL: 
-		case LIGHT_BUMP_FRONT_RIGHT_SIGNAL:
-		case LEFT_MOTOR_CURRENT:
-		case RIGHT_MOTOR_CURRENT:
-		case MAIN_BRUSH_MOTOR_CURRENT:
-		case SIDE_BRUSH_MOTOR_CURRENT:
-#ifdef __BIG_ENDIAN__
-			dataBuf |= buffer[counter];
-			counter++;
-			dataBuf <<= 8;
-			dataBuf |= buffer[counter];
-			counter++;
-#else
-			dataBuf |= ((uint16_t)buffer[counter] << 8);
-			counter++;
-			dataBuf |= buffer[counter];
-			counter++;
-#endif
-			m_AsyncThreadMutex.Lock();
-			m_SensorDataMap[(SensorID)sensorId] = dataBuf;
-			m_AsyncThreadMutex.Unlock();
-			break;
-		default:
+	for(uint32_t i = 0;i < timeout;i++) {
+		if(!waitPacketReceived()) {
 			break;
 		}
-	} while(counter < header[1]-1);
+		ReadGuard guard(m_AsyncThreadLock);
+		std::map<SensorID, uint16_t>::const_iterator it = m_SensorDataMap.find((SensorID)sensorId);
+		if(it != m_SensorDataMap.end()) {
+			*value = (*it).second;
+			return ROOMBA_OK;
+		}
+	}
+	return SENSOR_UNAVAILABLE;
 }
 
-
-void Roomba::handleBasicData()
+void Roomba::resumeSensorStream()
 {
-	uint8_t opcode, buttons;
-	uint16_t distance, angle;
-	getSensorGroup2(&opcode, &buttons, (int16_t*)&distance, (int16_t*)&angle);
-	m_SensorDataMap[ANGLE] = angle;
-	m_SensorDataMap[DISTANCE] = distance;
+	throwError(tryResumeSensorStream());
+}
 
-	m_AsyncThreadReceiveCounter++;
+Roomba::ReturnCode Roomba::tryResumeSensorStream()
+{
+	if(m_Version == Roomba::VERSION_500_SERIES) {
+		uint8_t buf = 1;
+		return toReturnCode(m_pTransport->TrySendPacket(OP_PAUSE_RESUME_STREAM, &buf, 1));
+	}
+	return ROOMBA_OK;
 }
 
+void Roomba::suspendSensorStream()
+{
+	throwError(trySuspendSensorStream());
+}
 
-void Roomba::Run()
+Roomba::ReturnCode Roomba::trySuspendSensorStream()
 {
+	if(m_Version == Roomba::VERSION_500_SERIES) {
+		uint8_t buf = 0;
+		return toReturnCode(m_pTransport->TrySendPacket(OP_PAUSE_RESUME_STREAM, &buf, 1));
+	}
+	return ROOMBA_OK;
+}
 
-	m_AsyncThreadReceiveCounter = 0;
+uint32_t Roomba::stopSensorStream()
+{
+	return tryStopSensorStream().getValue();
+}
 
-	while(m_isStreamMode) {
-	  Thread::Sleep(100);
-		if(m_Version != Roomba::VERSION_500_SERIES) {
-			handleBasicData();
-		} else {
-			handleStreamData();
-		}
+Roomba::Result<uint32_t> Roomba::tryStopSensorStream()
+{
+	if(!m_isStreamMode) {
+		return Result<uint32_t>(0);
+	}
+	TraceScope trace("stopSensorStream");
+	net::ysuga::Clock* clock = net::ysuga::Clock::getInstance();
+	const uint64_t begin = clock->now();
+	m_StopToken.RequestStop();
+	m_isStreamMode = false;
+	if(m_StreamThreadStarted) {
+		Join();
+		m_StreamThreadStarted = false;
+	}
+	m_StopToken.Reset();
+	m_StreamRecovery.recovering = false;
 
-		processOdometry();
+	ReturnCode result = trySuspendSensorStream();
+	if(m_Version == Roomba::VERSION_500_SERIES) {
+		// the rest of the frame which was being received. the response of a poll (ROI)
+		// stopped in the middle is discarded by Transport before the next request.
+		m_pTransport->FlushRxBuffer();
+		resetStreamParser();
 	}
+	m_pTransport->GetLinkStatistics().restartFrames();
+	if(result != ROOMBA_OK) {
+		return Result<uint32_t>::failure(result);
+	}
+	return Result<uint32_t>((uint32_t)(clock->now() - begin));
+}
 
-	std::cout << "Exiting Sensor Stream" << std::endl;
-	delete buffer;
+
+void Roomba::getSensorGroup(uint8_t groupId, uint16_t* values /* = NULL */)
+{
+	throwError(tryGetSensorGroup(groupId, values));
 }
 
-void Roomba::processOdometry(void)
+Roomba::ReturnCode Roomba::tryGetSensorGroup(uint8_t groupId, uint16_t* values /* = NULL */)
 {
-	double lengthOfShaft = 0.235;
-	double distance;
-	double angle;
-	if(m_Version == Roomba::MODEL_500SERIES) {
+	uint8_t firstId, lastId;
+	if(!getSensorGroupRange(groupId, &firstId, &lastId)) {
+		return PRECONDITION_NOT_MET;
+	}
+	if(m_Version == Roomba::VERSION_ROI && groupId > SENSOR_GROUP_6) {
+		return PRECONDITION_NOT_MET;
+	}
+	if(m_Version == Roomba::VERSION_500_SERIES && m_isStreamMode) {
+		// the response would be mixed into the stream.
+		return PRECONDITION_NOT_MET;
+	}
 
-		if(!m_EncoderInitFlag) {
-			m_EncoderInitFlag = true;
-			m_EncoderRightOld = getRightEncoderCounts();
-			m_EncoderLeftOld  = getLeftEncoderCounts();
-			return;
+	uint8_t data[MAX_SENSOR_GROUP_SIZE];
+	uint16_t buf[MAX_SENSOR_ID + 1];
+	uint32_t readBytes;
+	const uint32_t size = getSensorDataSize(groupId);
+	int32_t result = m_pTransport->TryRequest(OP_SENSORS, &groupId, 1, data, size, &readBytes, REQUEST_TIMEOUT);
+	if(result != 0 || readBytes != size) {
+		return result != 0 ? toReturnCode(result) : SENSOR_UNAVAILABLE;
+	}
+	decodeSensorGroup(groupId, data, buf);
+	{
+		WriteGuard guard(m_AsyncThreadLock);
+		for(uint8_t id = firstId;id <= lastId;id++) {
+			storeSensorValue((SensorID)id, buf[id]);
 		}
+	}
 
-		int32_t encoderRight = getRightEncoderCounts();
-		int32_t encoderLeft  = getLeftEncoderCounts();
-
-		int32_t dR = encoderRight - m_EncoderRightOld;
-		int32_t dL = encoderLeft  - m_EncoderLeftOld;
+	if(values) {
+		for(uint8_t id = firstId;id <= lastId;id++) {
+			values[id] = buf[id];
+		}
+	}
+	return ROOMBA_OK;
+}
 
-		
-#define PULSES_TO_METER 0.000445558279992234
+void Roomba::requestSensorAsync(const uint8_t* sensorIds, const uint32_t count, SensorQuery* query)
+{
+	throwError(tryRequestSensorAsync(sensorIds, count, query));
+}
 
+Roomba::ReturnCode Roomba::tryRequestSensorAsync(const uint8_t* sensorIds, const uint32_t count, SensorQuery* query)
+{
+	if(m_Version == Roomba::VERSION_500_SERIES && m_isStreamMode) {
+		// the response would be mixed into the stream.
+		return PRECONDITION_NOT_MET;
+	}
+	if(query->m_InFlight && !query->isReady()) {
+		return PRECONDITION_NOT_MET;
+	}
 
-		if(dR > 32767) {
-			dR -= 65535;
-		} else if (dR < -32768) {
-			dR += 65535;
+	uint32_t size = 0;
+	for(uint32_t i = 0;i < count;i++) {
+		uint32_t packetSize = getSensorDataSize(sensorIds[i]);
+		if(packetSize == 0 || (m_Version == Roomba::VERSION_ROI && sensorIds[i] > MAX_SENSOR_ID)) {
+			return PRECONDITION_NOT_MET;
 		}
-
+		size += packetSize;
+	}
+	if(count == 0 || size > MAX_SENSOR_QUERY_SIZE) {
+		return PRECONDITION_NOT_MET;
+	}
+
+	uint8_t buf[MAX_SENSOR_QUERY_SIZE + 1];
+	buf[0] = count;
+	for(uint32_t i = 0;i < count;i++) {
+		buf[i+1] = query->m_PacketIds[i] = sensorIds[i];
+	}
+	for(uint32_t i = 0;i <= MAX_SENSOR_ID;i++) {
+		query->m_Contained[i] = false;
+	}
+	query->m_NumPackets = count;
+	query->m_pRoomba = this;
+	query->m_pTransport = m_pTransport;
+	query->m_Received = false;
+	query->m_Request.response = query->m_Data;
+	query->m_Request.responseSize = size;
+	query->m_Request.timeout = REQUEST_TIMEOUT;
+	query->m_Request.stopToken = NULL;
+	query->m_InFlight = true;
+	// the late responses are not waited for. the caller retries.
+	int32_t result = m_pTransport->TrySubmit(OP_QUERY_LIST, buf, count + 1, &query->m_Request, false);
+	if(result != 0) {
+		query->m_InFlight = false;
+	}
+	return toReturnCode(result);
+}
+
+/**
+ * Store the values received by SensorQuery.
+ */
+void Roomba::storeSensorValues(const uint16_t* values, const bool* contained)
+{
+	WriteGuard guard(m_AsyncThreadLock);
+	for(uint8_t id = 0;id <= MAX_SENSOR_ID;id++) {
+		if(contained[id]) {
+			storeSensorValue((SensorID)id, values[id]);
+		}
+	}
+}
+
+void Roomba::getSensorGroup2(uint8_t *remoteOpcode, uint8_t *buttons, int16_t *distance, int16_t *angle)
+{
+	uint16_t values[MAX_SENSOR_ID + 1];
+	getSensorGroup(SENSOR_GROUP_2, values);
+	*remoteOpcode = (uint8_t)values[INFRARED_CHARACTER_OMNI];
+	*buttons = (uint8_t)values[BUTTONS];
+	*distance = (int16_t)values[DISTANCE];
+	*angle = (int16_t)values[ANGLE];
+	ROOMBA_LOG_DEBUG("D=%d A=%d", *distance, *angle);
+}
+
+
+
+Roomba::Result<uint16_t> Roomba::tryGetSensorValue(uint8_t sensorId)
+{
+	uint8_t firstId, lastId;
+	const uint32_t size = getSensorDataSize(sensorId);
+	if(size == 0 || size > 2 || getSensorGroupRange(sensorId, &firstId, &lastId)) {
+		return Result<uint16_t>::failure(PRECONDITION_NOT_MET);
+	}
+
+	if(m_isStreamMode) {
+		uint16_t value;
+		ReturnCode result = getStreamSensorValue(sensorId, &value);
+		if(result != ROOMBA_OK) {
+			return Result<uint16_t>::failure(result);
+		}
+		return Result<uint16_t>(value);
+	}
+
+	uint8_t data[2];
+	uint32_t readBytes;
+	int32_t result = m_pTransport->TryRequest(OP_SENSORS, &sensorId, 1, data, size, &readBytes, REQUEST_TIMEOUT);
+	if(result != 0 || readBytes != size) {
+		return Result<uint16_t>::failure(result != 0 ? toReturnCode(result) : SENSOR_UNAVAILABLE);
+	}
+	// high byte first, same as the stream.
+	return Result<uint16_t>(size == 1 ? data[0] : (uint16_t)(((uint16_t)data[0] << 8) | data[1]));
+}
+
+/**
+ * Receive and decode a stream frame.
+ *
+ * @return false if the frame does not arrive in the watchdog timeout.
+ */
+bool Roomba::handleStreamData() {
+	TraceScope trace("handleStreamData");
+	if(receiveStreamFrame(true) != FRAME_RECEIVED) {
+		return false;
+	}
+	// a frame with the wrong checksum also shows that the robot is streaming.
+	decodeStreamFrame();
+	return true;
+}
+
+/**
+ * Start the next frame from its header. Called when the received bytes are discarded.
+ */
+void Roomba::resetStreamParser()
+{
+	m_StreamParser.state = StreamParser::HEADER;
+	m_StreamParser.skippedBytes = 0;
+}
+
+/**
+ * Receive a stream frame into m_StreamParser.
+ *
+ * @param wait false to read only the bytes already received (pollSensorData).
+ * The rest of the frame is received by the next call then.
+ * @return FRAME_PENDING if the bytes are not received yet without wait, or FRAME_FAILED
+ * if they do not arrive in the watchdog timeout.
+ */
+Roomba::FrameState Roomba::receiveStreamFrame(const bool wait)
+{
+	StreamParser& parser = m_StreamParser;
+	LinkStatistics& linkStatistics = m_pTransport->GetLinkStatistics();
+	// only the stream waits for the watchdog and the stop. the requests of the user have their own.
+	const uint32_t timeout = getWatchdogTimeout();
+
+	while(1) {
+		uint32_t size = parser.state == StreamParser::DATA ? parser.length - parser.received : 1;
+		if(!wait) {
+			uint32_t available = m_pTransport->GetSizeInRxBuffer();
+			if(available == 0) {
+				return FRAME_PENDING;
+			}
+			size = size < available ? size : available;
+		}
+		uint8_t* destination = parser.state == StreamParser::DATA ? parser.data + parser.received : &parser.byte;
+		uint32_t readBytes;
+		if(m_pTransport->ReceiveData(destination, size, &readBytes, timeout, &m_StopToken) != 0 || readBytes != size) {
+			// the robot stopped in the middle of the frame.
+			if(parser.state >= StreamParser::DATA && !m_StopToken.IsStopRequested()) {
+				linkStatistics.countBadFrame();
+				dropControlBaseline();
+			}
+			parser.state = StreamParser::HEADER;
+			return FRAME_FAILED;
+		}
+
+		switch(parser.state) {
+		case StreamParser::HEADER:
+			if(parser.byte != 19) {
+				parser.skippedBytes++;
+				break;
+			}
+			if(parser.skippedBytes > 0) {
+				linkStatistics.countResync(parser.skippedBytes);
+				Tracer::record(Tracer::PHASE_INSTANT, "resync", parser.skippedBytes);
+				dropControlBaseline();
+				parser.skippedBytes = 0;
+			}
+			m_FrameTimer.tick();
+			linkStatistics.recordFrame(STREAM_PERIOD * 1000);
+			parser.state = StreamParser::LENGTH;
+			break;
+		case StreamParser::LENGTH:
+			parser.length = parser.byte;
+			parser.received = 0;
+			parser.state = parser.length > 0 ? StreamParser::DATA : StreamParser::CHECKSUM;
+			break;
+		case StreamParser::DATA:
+			parser.received += readBytes;
+			if(parser.received == parser.length) {
+				parser.state = StreamParser::CHECKSUM;
+			}
+			break;
+		case StreamParser::CHECKSUM:
+			parser.state = StreamParser::HEADER;
+			return FRAME_RECEIVED;
+		}
+	}
+}
+
+/**
+ * Check the checksum of the frame received by receiveStreamFrame, and store its data.
+ */
+void Roomba::decodeStreamFrame()
+{
+	const StreamParser& parser = m_StreamParser;
+	LinkStatistics& linkStatistics = m_pTransport->GetLinkStatistics();
+
+	uint32_t sum = 19 + parser.length + parser.byte;
+	for(uint32_t i = 0;i < parser.length;i++) {
+		sum += parser.data[i];
+	}
+	if((sum & 0xFF) != 0) {
+		linkStatistics.countChecksumError();
+		Tracer::record(Tracer::PHASE_INSTANT, "checksumError", parser.length);
+		dropControlBaseline();
+		return;
+	}
+
+	m_AsyncThreadReceiveCounter++;
+
+	uint32_t counter = 0;
+	{
+		WriteGuard guard(m_AsyncThreadLock);
+		while(counter < parser.length) {
+			uint8_t sensorId = parser.data[counter];
+			counter++;
+			uint32_t size = getSensorDataSize(sensorId);
+			if(size == 0 || counter + size > parser.length) {
+				// Unknown packet. The rest of the frame can not be parsed.
+				linkStatistics.countBadFrame();
+				dropControlBaseline();
+				break;
+			}
+			decodeSensorPacket(sensorId, parser.data + counter);
+			counter += size;
+		}
+	}
+
+	processSafetyReflex();
+}
+
+/**
+ * Store the data of a sensor packet (or a group packet) to m_SensorDataMap.
+ * m_AsyncThreadLock must be locked for writing.
+ */
+void Roomba::decodeSensorPacket(uint8_t packetId, const uint8_t* data)
+{
+	uint16_t values[MAX_SENSOR_ID + 1];
+	uint8_t firstId, lastId;
+	if(getSensorGroupRange(packetId, &firstId, &lastId)) {
+		decodeSensorGroup(packetId, data, values);
+		for(uint8_t id = firstId;id <= lastId;id++) {
+			storeSensorValue((SensorID)id, values[id]);
+		}
+	} else if(getSensorDataSize(packetId) == 1) {
+		storeSensorValue((SensorID)packetId, data[0]);
+	} else {
+		storeSensorValue((SensorID)packetId, ((uint16_t)data[0] << 8) | data[1]);
+	}
+}
+
+/**
+ * Store the received value in the cache. m_AsyncThreadLock must be locked for writing.
+ */
+void Roomba::storeSensorValue(SensorID sensorId, uint16_t value)
+{
+	m_SensorDataMap[sensorId] = value;
+	if(sensorId <= MAX_SENSOR_ID) {
+		atomicStore(&m_PublishedSensorValues[sensorId], PUBLISHED_VALUE_VALID | value);
+	}
+}
+
+bool Roomba::peekSensorValue(uint8_t sensorId, uint16_t* value) const
+{
+	if(sensorId > MAX_SENSOR_ID) {
+		return false;
+	}
+	uint32_t published = atomicLoad((volatile uint32_t*)&m_PublishedSensorValues[sensorId]);
+	if(!(published & PUBLISHED_VALUE_VALID)) {
+		return false;
+	}
+	*value = (uint16_t)published;
+	return true;
+}
+
+typedef std::pair<std::pair<uint32_t, int32_t>, uint8_t> PollDue; // ((period, overdue), sensorId)
+
+/**
+ * Higher rate first (rate monotonic), then the most overdue.
+ */
+static bool comparePollDue(const PollDue& a, const PollDue& b)
+{
+	if(a.first.first != b.first.first) {
+		return a.first.first < b.first.first;
+	}
+	return a.first.second > b.first.second;
+}
+
+/**
+ * Poll the sensors due in this tick with one OP_QUERY_LIST (ROI).
+ *
+ * @return false if the response does not arrive in the watchdog timeout.
+ */
+bool Roomba::handlePolledData()
+{
+	TraceScope trace("handlePolledData");
+	std::vector<uint8_t> sensors;
+	const uint32_t size = schedulePolledSensors(sensors);
+
+	// The cache is not locked during the serial transaction.
+	uint8_t data[256];
+	if(!sensors.empty()) {
+		uint8_t buf[256];
+		buf[0] = sensors.size();
+		for(uint32_t i = 0;i < sensors.size();i++) {
+			buf[i+1] = sensors[i];
+		}
+		uint32_t readBytes = 0;
+		int32_t result = m_pTransport->Request(OP_QUERY_LIST, buf, sensors.size() + 1, data, size, &readBytes, getWatchdogTimeout(), &m_StopToken);
+		if(result == TRANSPORT_TX_FULL && m_pTransport->FlushTxQueue(getWatchdogTimeout())) {
+			// the commands are written first. this thread waits for the response anyway.
+			m_pTransport->Request(OP_QUERY_LIST, buf, sensors.size() + 1, data, size, &readBytes, getWatchdogTimeout(), &m_StopToken);
+		}
+		if(readBytes != size) {
+			return false;
+		}
+	}
+	decodePolledData(sensors, data);
+	return true;
+}
+
+/**
+ * Poll the sensors without blocking (pollSensorData). The poll is submitted when it is due,
+ * and its response is decoded by a later call after it arrives.
+ *
+ * @return FRAME_PENDING if the poll is not due or its response is not received yet.
+ */
+Roomba::FrameState Roomba::progressPolledData()
+{
+	if(!m_PollSubmitted) {
+		if(m_AsyncThreadReceiveCounter > 0 && getFrameElapsedTime() < POLL_PERIOD) {
+			return FRAME_PENDING;
+		}
+		if(m_pTransport->HasLateResponses()) {
+			// the submit would wait for them.
+			m_pTransport->Progress();
+			return FRAME_PENDING;
+		}
+		TraceScope trace("handlePolledData");
+		const uint32_t size = schedulePolledSensors(m_PolledSensors);
+		if(m_PolledSensors.empty()) {
+			decodePolledData(m_PolledSensors, m_PollResponse);
+			return FRAME_RECEIVED;
+		}
+		uint8_t buf[256];
+		buf[0] = m_PolledSensors.size();
+		for(uint32_t i = 0;i < m_PolledSensors.size();i++) {
+			buf[i+1] = m_PolledSensors[i];
+		}
+		m_PollRequest.response = m_PollResponse;
+		m_PollRequest.responseSize = size;
+		m_PollRequest.timeout = getWatchdogTimeout();
+		m_PollRequest.stopToken = NULL;
+		m_PollRequest.onComplete = NULL;
+		m_PollRequest.context = NULL;
+		int32_t result = m_pTransport->TrySubmit(OP_QUERY_LIST, buf, m_PolledSensors.size() + 1, &m_PollRequest, false);
+		if(result == TRANSPORT_ACCESS_FAILED) {
+			throw ComAccessException();
+		} else if(result != 0) {
+			// rejected on the congested port. the sensors are polled at their next ticks.
+			return FRAME_PENDING;
+		}
+		m_PollSubmitted = true;
+	}
+
+	m_pTransport->Progress();
+	if(!m_pTransport->IsDone(&m_PollRequest)) {
+		return FRAME_PENDING;
+	}
+	m_PollSubmitted = false;
+	if(m_PollRequest.result != 0 || m_PollRequest.readBytes != m_PollRequest.responseSize) {
+		return FRAME_FAILED;
+	}
+	decodePolledData(m_PolledSensors, m_PollResponse);
+	return FRAME_RECEIVED;
+}
+
+/**
+ * Choose the sensors due in this tick, and start the tick.
+ *
+ * @param sensors [OUT] Packet ids for OP_QUERY_LIST
+ * @return Bytes of the response
+ */
+uint32_t Roomba::schedulePolledSensors(std::vector<uint8_t>& sensors)
+{
+	const uint32_t tick = m_AsyncThreadReceiveCounter;
+	// bytes which can be received in one tick.
+	const uint32_t budget = m_Baudrate / 10 * POLL_PERIOD / 1000;
+
+	m_FrameTimer.tick();
+	m_pTransport->GetLinkStatistics().recordFrame(POLL_PERIOD * 1000);
+	sensors.clear();
+	WriteGuard guard(m_AsyncThreadLock);
+	if(m_ReflexTriggers) {
+		// bumps, wheel drops, cliffs and over currents are all in group 1.
+		if(m_PollSchedule.find((SensorID)SENSOR_GROUP_1) == m_PollSchedule.end()) {
+			schedulePoll(SENSOR_GROUP_1, 1, true);
+		}
+	}
+
+	std::vector<PollDue> due;
+	std::map<SensorID, PollEntry>::iterator it = m_PollSchedule.begin();
+	while(it != m_PollSchedule.end()) {
+		if(!(*it).second.pinned && tick - (*it).second.lastRead > m_PollIdleTicks) {
+			m_SensorDataMap.erase((*it).first);
+			m_PollSchedule.erase(it++);
+			continue;
+		}
+		int32_t overdue = (int32_t)(tick - (*it).second.nextTick);
+		if(overdue >= 0) {
+			due.push_back(PollDue(std::pair<uint32_t, int32_t>((*it).second.period, overdue), (*it).first));
+		}
+		++it;
+	}
+
+	// The sensors which do not fit in the budget (or the response buffer) are left for the next tick.
+	std::sort(due.begin(), due.end(), comparePollDue);
+	uint32_t bytes = 0;
+	for(uint32_t i = 0;i < due.size();i++) {
+		uint32_t size = getSensorDataSize(due[i].second);
+		if(bytes + size > budget || bytes + size > sizeof(m_PollResponse) || sensors.size() >= 255) {
+			continue;
+		}
+		sensors.push_back(due[i].second);
+		bytes += size;
+		PollEntry& entry = m_PollSchedule[(SensorID)due[i].second];
+		entry.nextTick = tick + entry.period;
+	}
+	compactStreamList(sensors, m_Version);
+
+	uint32_t size = 0;
+	for(uint32_t i = 0;i < sensors.size();i++) {
+		size += getSensorDataSize(sensors[i]);
+	}
+	return size;
+}
+
+/**
+ * Store the response of the poll, and finish the tick.
+ */
+void Roomba::decodePolledData(const std::vector<uint8_t>& sensors, const uint8_t* data)
+{
+	uint32_t counter = 0;
+	{
+		WriteGuard guard(m_AsyncThreadLock);
+		for(uint32_t i = 0;i < sensors.size();i++) {
+			decodeSensorPacket(sensors[i], data + counter);
+			counter += getSensorDataSize(sensors[i]);
+		}
+	}
+
+	processSafetyReflex();
+
+	m_AsyncThreadReceiveCounter++;
+}
+
+void Roomba::setSafetyReflex(uint32_t triggers, ReflexAction action /* = REFLEX_ACTION_STOP */, int16_t backOffVelocity /* = 100 */)
+{
+	throwError(trySetSafetyReflex(triggers, action, backOffVelocity));
+}
+
+Roomba::ReturnCode Roomba::trySetSafetyReflex(uint32_t triggers, ReflexAction action /* = REFLEX_ACTION_STOP */, int16_t backOffVelocity /* = 100 */)
+{
+	if((action != REFLEX_ACTION_STOP && action != REFLEX_ACTION_BACK_OFF) ||
+		backOffVelocity < -500 || backOffVelocity > 500) {
+		return PRECONDITION_NOT_MET;
+	}
+	m_ReflexTriggers = triggers & REFLEX_ALL;
+	m_ReflexAction = action;
+	m_ReflexBackOffVelocity = backOffVelocity;
+	m_ReflexActiveTriggers = 0;
+	return ROOMBA_OK;
+}
+
+void Roomba::getSafetyReflexStatistics(uint32_t* count, uint32_t* lastReactionTime, uint32_t* maxReactionTime)
+{
+	*count = m_ReflexCount;
+	*lastReactionTime = m_ReflexLastReactionTime;
+	*maxReactionTime = m_ReflexMaxReactionTime;
+}
+
+void Roomba::processSafetyReflex()
+{
+	if(!m_ReflexTriggers) {
+		return;
+	}
+	TraceScope trace("processSafetyReflex");
+
+	uint32_t active = 0;
+	std::map<SensorID, uint16_t>::const_iterator it;
+	{
+		ReadGuard guard(m_AsyncThreadLock);
+		it = m_SensorDataMap.find(BUMPS_AND_WHEEL_DROPS);
+		if(it != m_SensorDataMap.end()) {
+			if((*it).second & 0x03) active |= REFLEX_BUMP;
+			if((*it).second & 0x0C) active |= REFLEX_WHEEL_DROP;
+		}
+		for(int id = CLIFF_LEFT;id <= CLIFF_RIGHT;id++) {
+			it = m_SensorDataMap.find((SensorID)id);
+			if(it != m_SensorDataMap.end() && (*it).second) {
+				active |= REFLEX_CLIFF;
+			}
+		}
+		it = m_SensorDataMap.find(WHEEL_OVERCURRENTS);
+		if(it != m_SensorDataMap.end() && ((*it).second & (LeftWheel | RightWheel))) {
+			active |= REFLEX_WHEEL_OVERCURRENT;
+		}
+	}
+
+	active &= m_ReflexTriggers;
+	uint32_t rising = active & ~m_ReflexActiveTriggers;
+	uint32_t previous = m_ReflexActiveTriggers;
+	m_ReflexActiveTriggers = active;
+
+	if(getMode() != MODE_SAFE && getMode() != MODE_FULL) {
+		return;
+	}
+
+	if(rising) {
+		int16_t velocity = 0;
+		if(m_ReflexAction == REFLEX_ACTION_BACK_OFF && !(active & (REFLEX_WHEEL_DROP | REFLEX_WHEEL_OVERCURRENT))) {
+			velocity = -m_ReflexBackOffVelocity;
+		}
+		// never throws on the stream thread (e.g. the mode is changed by another thread now).
+		ReturnCode result = tryDriveDirect(velocity, velocity);
+		overrideVelocityControl(velocity / 1000.0);
+		// the command may be only queued behind a full port. the reaction ends when it is written.
+		if(result == ROOMBA_OK && !m_pTransport->FlushTxQueue(STREAM_PERIOD)) {
+			result = TX_QUEUE_FULL;
+		}
+		if(result != ROOMBA_OK) {
+			ROOMBA_LOG_ERROR("Safety reflex command is not written (%d)", result);
+			// react again at the next frame.
+			m_ReflexActiveTriggers = previous;
+			return;
+		}
+
+		pcwrapper::TimeSpec reactionTime;
+		m_FrameTimer.tack(&reactionTime);
+		m_ReflexLastReactionTime = reactionTime.sec * 1000000 + reactionTime.usec;
+		if(m_ReflexLastReactionTime > m_ReflexMaxReactionTime) {
+			m_ReflexMaxReactionTime = m_ReflexLastReactionTime;
+		}
+		m_ReflexCount++;
+	} else if(previous && !active && m_ReflexAction == REFLEX_ACTION_BACK_OFF) {
+		if(tryDriveDirect(0, 0) != ROOMBA_OK) {
+			ROOMBA_LOG_ERROR("Safety reflex can not stop backing off");
+		}
+		overrideVelocityControl(0);
+	}
+}
+
+
+void Roomba::Run()
+{
+	Tracer::setThreadName("Roomba stream");
+	uint64_t cpuTime = getThreadCpuTime();
+	while(m_isStreamMode && !m_StopToken.IsStopRequested()) {
+		bool idle = m_StreamIdle;
+		if(idle) {
+			// nobody reads the data. check the demand occasionally.
+			sleepUnlessStopped(IDLE_STREAM_PERIOD);
+			m_StreamActivity.wakeupCount++;
+			m_StreamActivity.idleWakeupCount++;
+		} else {
+			bool received = false;
+			try {
+				received = processFrame();
+			} catch (ComException& e) {
+				// the device is gone (e.g. the USB adapter is unplugged).
+				ROOMBA_LOG_ERROR("Error in %s: %s", __FUNCTION__, e.what());
+				if(!m_WatchdogPeriods) {
+					throw;
+				}
+				sleepUnlessStopped(getWatchdogTimeout());
+			}
+			if(m_StopToken.IsStopRequested()) {
+				// the wait for the data is interrupted by stopSensorStream.
+				break;
+			}
+			if(!received && m_WatchdogPeriods && m_isStreamMode) {
+				recoverSensorStream();
+			} else if(m_Version != Roomba::VERSION_500_SERIES) {
+				// wait for the next poll tick.
+				uint32_t elapsedMsec = getFrameElapsedTime();
+				if(elapsedMsec < POLL_PERIOD) {
+					sleepUnlessStopped(POLL_PERIOD - elapsedMsec);
+					m_StreamActivity.wakeupCount++;
+				}
+			}
+		}
+
+		uint64_t now = getThreadCpuTime();
+		m_StreamActivity.cpuTime += now - cpuTime;
+		if(idle) {
+			m_StreamActivity.idleCpuTime += now - cpuTime;
+		}
+		cpuTime = now;
+	}
+
+	ROOMBA_LOG_INFO("Exiting Sensor Stream");
+}
+
+/**
+ * Sleep in the stream thread. Returns early if the stop is requested.
+ */
+void Roomba::sleepUnlessStopped(const uint32_t milliSeconds)
+{
+	net::ysuga::Clock::getInstance()->sleepUnlessStopped(milliSeconds, m_StopToken);
+}
+
+/**
+ * @return false if the frame does not arrive in the watchdog timeout.
+ */
+bool Roomba::processFrame()
+{
+	TraceScope trace("processFrame", m_AsyncThreadReceiveCounter);
+	if(m_Version != Roomba::VERSION_500_SERIES) {
+		if(!handlePolledData()) {
+			return false;
+		}
+	} else {
+		if(!handleStreamData()) {
+			return false;
+		}
+	}
+	completeFrame();
+	return true;
+}
+
+/**
+ * Run the control on the data of the frame just received.
+ */
+void Roomba::completeFrame()
+{
+	if(m_Version == Roomba::VERSION_500_SERIES) {
+		processStreamSubscription();
+	}
+	if(m_StreamRecovery.recovering) {
+		completeStreamRecovery();
+	}
+
+	processOdometry();
+	processTrajectory();
+	processVelocityControl();
+	processStreamDemand();
+
+	ReadGuard guard(m_AsyncThreadLock);
+	if(m_pNotifyEvent) {
+		m_pNotifyEvent->Set();
+	}
+}
+
+/**
+ * Time to wait for a frame before the stream is considered stalled [msec]. 0 if disabled.
+ */
+uint32_t Roomba::getWatchdogTimeout()
+{
+	const uint32_t period = m_Version == Roomba::VERSION_500_SERIES ? STREAM_PERIOD : POLL_PERIOD;
+	return m_WatchdogPeriods * period;
+}
+
+void Roomba::setStreamWatchdog(const uint32_t periods, const uint32_t reopenAttempts /* = DEFAULT_WATCHDOG_REOPEN_ATTEMPTS */)
+{
+	m_WatchdogPeriods = periods;
+	m_WatchdogReopenAttempts = reopenAttempts;
+}
+
+void Roomba::getStreamRecoveryStatistics(StreamRecoveryStatistics* statistics)
+{
+	*statistics = m_StreamRecovery;
+}
+
+/**
+ * Send the commands to restart the stream again. Called when no frame arrives in the watchdog timeout.
+ */
+void Roomba::recoverSensorStream()
+{
+	TraceScope trace("recoverSensorStream", m_StreamRecovery.attemptCount);
+	if(!m_StreamRecovery.recovering) {
+		m_StreamRecovery.recovering = true;
+		m_StreamRecovery.stallCount++;
+		m_StallTime = net::ysuga::Clock::getInstance()->now();
+		ROOMBA_LOG_WARN("Sensor stream stalled. Recovering.");
+	}
+	m_StreamRecovery.attemptCount++;
+	// the frames lost in the stall are not counted. the controller starts again.
+	m_ControlInitFlag = false;
+	forgetScript();
+
+	try {
+		if(m_WatchdogReopenAttempts && m_StreamRecovery.attemptCount % m_WatchdogReopenAttempts == 0) {
+			m_pTransport->Reopen();
+			m_StreamRecovery.reopenCount++;
+		}
+
+		// the robot may have lost the mode and the stream (e.g. a brownout).
+		m_pTransport->FlushRxBuffer();
+		resetStreamParser();
+		BatchGuard batch(*m_pTransport);
+		m_pTransport->SendPacket(OP_START);
+		if(m_CurrentMode == MODE_SAFE) {
+			m_pTransport->SendPacket(OP_SAFE);
+		} else if(m_CurrentMode == MODE_FULL) {
+			m_pTransport->SendPacket(OP_FULL);
+		}
+		if(m_Version == Roomba::VERSION_500_SERIES) {
+			ReturnCode result;
+			{
+				WriteGuard guard(m_AsyncThreadLock);
+				result = sendStreamSubscription();
+			}
+			if(result == ROOMBA_OK) {
+				result = tryResumeSensorStream();
+			}
+			if(result == COM_ACCESS_FAILED) {
+				throw ComAccessException();
+			}
+			// otherwise (e.g. the transmit queue is full) no frame arrives, and the watchdog retries.
+		}
+		batch.End();
+	} catch (ComException& e) {
+		// the device is not back yet. tried again after the next timeout.
+		ROOMBA_LOG_ERROR("Error in %s: %s", __FUNCTION__, e.what());
+		sleepUnlessStopped(getWatchdogTimeout());
+	}
+	m_FrameTimer.tick();
+	m_pTransport->GetLinkStatistics().restartFrames();
+}
+
+/**
+ * Record the recovery time at the first frame after the stall.
+ */
+void Roomba::completeStreamRecovery()
+{
+	uint64_t time = net::ysuga::Clock::getInstance()->now() - m_StallTime;
+	m_StreamRecovery.lastRecoveryTime = (uint32_t)time;
+	if(m_StreamRecovery.lastRecoveryTime > m_StreamRecovery.maxRecoveryTime) {
+		m_StreamRecovery.maxRecoveryTime = m_StreamRecovery.lastRecoveryTime;
+	}
+	m_StreamRecovery.recoveryCount++;
+	m_StreamRecovery.recovering = false;
+	Tracer::record(Tracer::PHASE_INSTANT, "streamRecovered", m_StreamRecovery.lastRecoveryTime);
+	ROOMBA_LOG_INFO("Sensor stream recovered in %u ms.", (uint32_t)(time / 1000));
+}
+
+/**
+ * Suspend the stream if nobody needs the data for m_StreamIdleTimeout.
+ * Never throws. A failed suspension is tried again at the next frame.
+ */
+void Roomba::processStreamDemand()
+{
+	if(m_StreamIdleTimeout == 0 || m_ReflexTriggers || m_VelocityControlEnabled || isTrajectoryRunning()) {
+		return;
+	}
+	const uint32_t period = m_Version == Roomba::VERSION_500_SERIES ? STREAM_PERIOD : POLL_PERIOD;
+	WriteGuard guard(m_AsyncThreadLock);
+	if(m_StreamInterest == 0 && m_AsyncThreadReceiveCounter - m_LastDemandFrame > m_StreamIdleTimeout / period) {
+		if(trySuspendSensorStream() != ROOMBA_OK) {
+			// the stream keeps running.
+			return;
+		}
+		m_StreamIdle = true;
+		m_StreamActivity.suspendCount++;
+	}
+}
+
+/**
+ * Record the demand of the data, and resume the stream if suspended.
+ *
+ * @param waitFreshFrame Wait for the first frame after the resume (see waitPacketReceived).
+ * @return ROOMBA_OK, the error of the resume, or SENSOR_UNAVAILABLE if the frame does not arrive.
+ */
+Roomba::ReturnCode Roomba::demandSensorStream(bool waitFreshFrame)
+{
+	{
+		// the stream is running in the common case. Only the demand is recorded.
+		ReadGuard guard(m_AsyncThreadLock);
+		if(!m_StreamIdle) {
+			atomicStore(&m_LastDemandFrame, m_AsyncThreadReceiveCounter);
+			return ROOMBA_OK;
+		}
+	}
+
+	bool resumed;
+	{
+		WriteGuard guard(m_AsyncThreadLock);
+		m_LastDemandFrame = m_AsyncThreadReceiveCounter;
+		resumed = m_StreamIdle;
+		if(resumed) {
+			if(m_Version == Roomba::VERSION_500_SERIES) {
+				// drop the rest of the frame sent before the suspension.
+				try {
+					m_pTransport->FlushRxBuffer();
+				} catch (ComException& e) {
+					// the port is broken. the resume or the watchdog sees it.
+				}
+			}
+			ReturnCode result = tryResumeSensorStream();
+			if(result != ROOMBA_OK) {
+				// still suspended. resumed by the next demand.
+				return result;
+			}
+			m_pTransport->GetLinkStatistics().restartFrames();
+			// no frame covers the suspension.
+			m_ControlInitFlag = false;
+			m_StreamIdle = false;
+		}
+	}
+
+	if(resumed && waitFreshFrame && !waitPacketReceived()) {
+		// the cached values are as old as the suspension.
+		return SENSOR_UNAVAILABLE;
+	}
+	return ROOMBA_OK;
+}
+
+void Roomba::setStreamIdleTimeout(const uint32_t idleTimeout)
+{
+	WriteGuard guard(m_AsyncThreadLock);
+	m_StreamIdleTimeout = idleTimeout;
+	m_LastDemandFrame = m_AsyncThreadReceiveCounter;
+}
+
+void Roomba::acquireSensorStream()
+{
+	throwError(tryAcquireSensorStream());
+}
+
+Roomba::ReturnCode Roomba::tryAcquireSensorStream()
+{
+	{
+		WriteGuard guard(m_AsyncThreadLock);
+		m_StreamInterest++;
+	}
+	return demandSensorStream(false);
+}
+
+void Roomba::releaseSensorStream()
+{
+	WriteGuard guard(m_AsyncThreadLock);
+	if(m_StreamInterest > 0) {
+		m_StreamInterest--;
+	}
+	m_LastDemandFrame = m_AsyncThreadReceiveCounter;
+}
+
+void Roomba::touchSensorStream()
+{
+	throwError(tryTouchSensorStream());
+}
+
+Roomba::ReturnCode Roomba::tryTouchSensorStream()
+{
+	return demandSensorStream(false);
+}
+
+void Roomba::getStreamActivityStatistics(StreamActivityStatistics* statistics)
+{
+	*statistics = m_StreamActivity;
+	statistics->suspended = m_StreamIdle;
+	statistics->wakeupCount += m_pTransport->GetReceiveWaitCount();
+}
+
+void Roomba::getLinkStats(RoombaLinkStats* stats)
+{
+	m_pTransport->GetLinkStatistics().get(stats);
+}
+
+void Roomba::resetLinkStats()
+{
+	m_pTransport->GetLinkStatistics().reset();
+}
+
+/**
+ * Elapsed time since the last frame started [msec]
+ */
+uint32_t Roomba::getFrameElapsedTime()
+{
+	pcwrapper::TimeSpec elapsed;
+	m_FrameTimer.tack(&elapsed);
+	return elapsed.sec * 1000 + elapsed.usec / 1000;
+}
+
+bool Roomba::pollSensorData()
+{
+	if(!m_isStreamMode || m_StreamThreadStarted) {
+		return false;
+	}
+	m_StreamActivity.wakeupCount++;
+	if(m_StreamIdle) {
+		m_StreamActivity.idleWakeupCount++;
+		return false;
+	}
+	uint64_t cpuTime = getThreadCpuTime();
+	FrameState state;
+	if(m_Version != Roomba::VERSION_500_SERIES) {
+		state = progressPolledData();
+	} else {
+		state = receiveStreamFrame(false);
+		if(state == FRAME_RECEIVED) {
+			decodeStreamFrame();
+		} else if(state == FRAME_PENDING && m_WatchdogPeriods && m_AsyncThreadReceiveCounter > 0 &&
+			getFrameElapsedTime() > getWatchdogTimeout()) {
+			state = FRAME_FAILED;
+		}
+	}
+	if(state == FRAME_RECEIVED) {
+		TraceScope trace("processFrame", m_AsyncThreadReceiveCounter);
+		completeFrame();
+	} else if(state == FRAME_FAILED && m_WatchdogPeriods) {
+		recoverSensorStream();
+	}
+	m_StreamActivity.cpuTime += getThreadCpuTime() - cpuTime;
+	return state == FRAME_RECEIVED;
+}
+
+/**
+ * Time until pollSensorData has something to do without receiving any data [msec]
+ */
+uint32_t Roomba::getPollWaitTime()
+{
+	const uint32_t forever = 0xFFFFFFFF;
+	if(!m_isStreamMode || m_StreamThreadStarted || m_StreamIdle) {
+		return forever;
+	}
+	if(m_Version != Roomba::VERSION_500_SERIES) {
+		if(m_PollSubmitted) {
+			if(!m_PollRequest.timeout) {
+				return forever;
+			}
+			// expired by Transport::Progress.
+			uint64_t waited = (net::ysuga::Clock::getInstance()->now() - m_PollRequest.submitTime) / 1000;
+			return waited < m_PollRequest.timeout ? m_PollRequest.timeout - (uint32_t)waited : 0;
+		}
+		if(m_AsyncThreadReceiveCounter == 0) {
+			return 0;
+		}
+		uint32_t elapsed = getFrameElapsedTime();
+		return elapsed < POLL_PERIOD ? POLL_PERIOD - elapsed : 0;
+	}
+	if(!m_WatchdogPeriods || m_AsyncThreadReceiveCounter == 0) {
+		return forever;
+	}
+	uint32_t elapsed = getFrameElapsedTime();
+	return elapsed <= getWatchdogTimeout() ? getWatchdogTimeout() - elapsed + 1 : 0;
+}
+
+void Roomba::waitSensorData(Roomba* const* roombas, const uint32_t count, const uint32_t timeout,
+							const StopToken* stopToken)
+{
+	std::vector<SerialPort*> ports(count);
+	uint32_t wait = timeout;
+	for(uint32_t i = 0;i < count;i++) {
+		ports[i] = roombas[i]->m_pTransport->GetSerialPort();
+		uint32_t time = roombas[i]->getPollWaitTime();
+		wait = time < wait ? time : wait;
+	}
+	if(wait > 0) {
+		SerialPort::WaitReadable(count ? &ports[0] : NULL, count, wait, stopToken);
+	}
+}
+
+void Roomba::waitReceived(Roomba* const* roombas, const uint32_t count, const uint32_t timeout, Event* event)
+{
+	std::vector<SerialPort*> ports(count);
+	for(uint32_t i = 0;i < count;i++) {
+		ports[i] = roombas[i]->m_pTransport->GetSerialPort();
+	}
+	SerialPort::WaitReadable(count ? &ports[0] : NULL, count, timeout, NULL, event);
+}
+
+void Roomba::setNotifyEvent(Event* event)
+{
+	{
+		WriteGuard guard(m_AsyncThreadLock);
+		m_pNotifyEvent = event;
+	}
+	m_pTransport->SetTxEvent(event);
+}
+
+bool Roomba::getCachedSensorValue(uint8_t sensorId, uint16_t* value)
+{
+	TraceScope trace("getCachedSensorValue", sensorId);
+	// the cached value is returned even if the stream can not be resumed.
+	demandSensorStream(false);
+	ReadGuard guard(m_AsyncThreadLock);
+	std::map<SensorID, uint16_t>::const_iterator it = m_SensorDataMap.find((SensorID)sensorId);
+	bool found = it != m_SensorDataMap.end();
+	if(found) {
+		*value = (*it).second;
+	}
+	return found;
+}
+
+void Roomba::processOdometry(void)
+{
+	TraceScope trace("processOdometry");
+	double lengthOfShaft = 0.235;
+	double distance;
+	double angle;
+
+	// read the cache directly. the accessors would count as a demand of the stream.
+	SensorID first = m_Version == Roomba::VERSION_500_SERIES ? LEFT_ENCODER_COUNTS : DISTANCE;
+	SensorID second = m_Version == Roomba::VERSION_500_SERIES ? RIGHT_ENCODER_COUNTS : ANGLE;
+	uint16_t value1, value2;
+	{
+		ReadGuard guard(m_AsyncThreadLock);
+		std::map<SensorID, uint16_t>::const_iterator it1 = m_SensorDataMap.find(first);
+		std::map<SensorID, uint16_t>::const_iterator it2 = m_SensorDataMap.find(second);
+		if(it1 == m_SensorDataMap.end() || it2 == m_SensorDataMap.end()) {
+			return;
+		}
+		value1 = (*it1).second;
+		value2 = (*it2).second;
+	}
+
+	if(m_Version == Roomba::MODEL_500SERIES) {
+
+		if(!m_EncoderInitFlag) {
+			m_EncoderInitFlag = true;
+			m_EncoderRightOld = value2;
+			m_EncoderLeftOld  = value1;
+			return;
+		}
+
+		int32_t encoderRight = value2;
+		int32_t encoderLeft  = value1;
+
+		int32_t dR = encoderRight - m_EncoderRightOld;
+		int32_t dL = encoderLeft  - m_EncoderLeftOld;
+
+		
+#define PULSES_TO_METER 0.000445558279992234
+
+
+		if(dR > 32767) {
+			dR -= 65535;
+		} else if (dR < -32768) {
+			dR += 65535;
+		}
+
 		if(dL > 32767) {
 			dL -= 65535;
 		} else if (dL < -32768) {
@@ -518,8 +1953,8 @@ void Roomba::processOdometry(void)
 		m_EncoderRightOld = encoderRight;
 		m_EncoderLeftOld = encoderLeft;
 	} else {
-		distance = getDistance();
-		angle = getAngle() * 2 / lengthOfShaft;
+		distance = (int16_t)value1;
+		angle = (int16_t)value2 * 2 / lengthOfShaft;
 		///angle = getAngle() / 180.0 * 3.1415926;
 	}
 	double dX = distance * cos( m_Th + angle/2 );
@@ -534,11 +1969,30 @@ void Roomba::processOdometry(void)
 	}
 }
 
+/**
+ * Scale both wheels with the same ratio so that the curvature is kept
+ * when one of the wheels exceeds the limit.
+ * @return true if saturated.
+ */
+static bool saturateWheelVelocity(double* right, double* left, const double limit)
+{
+	double maxAbs = fabs(*right) > fabs(*left) ? fabs(*right) : fabs(*left);
+	if(maxAbs <= limit) {
+		return false;
+	}
+	*right *= limit / maxAbs;
+	*left  *= limit / maxAbs;
+	return true;
+}
+
 void Roomba::move(const double trans, const double rotate) 
+{
+	throwError(tryMove(trans, rotate));
+}
+
+Roomba::ReturnCode Roomba::tryMove(const double trans, const double rotate) 
 {
 	double lengthOfShaft = 0.235;
-	double distance;
-	double angle;
 	m_TargetVelocityX = trans;
 	m_TargetVelocityTh = rotate;
 	if(m_Version == Roomba::MODEL_500SERIES) {
@@ -547,393 +2001,710 @@ void Roomba::move(const double trans, const double rotate)
 
 		double dR = trans + rotate * lengthOfShaft;
 		double dL = trans - rotate * lengthOfShaft;
-		if(dR < -1.0) dR = -1.0;
-		else if(dR > 1.0) dR = 1.0;
-		if(dL < -1.0) dL = -1.0;
-		else if(dL > 1.0) dL = 1.0;
-		Roomba::driveDirect(dR * 1000, dL * 1000);
+		if(m_VelocityControlEnabled) {
+			{
+				MutexGuard guard(m_ControlMutex);
+				m_TargetVelocityRight = dR;
+				m_TargetVelocityLeft = dL;
+			}
+			return ROOMBA_OK;
+		}
+		// the OI limits each wheel separately, which would change the curvature.
+		saturateWheelVelocity(&dR, &dL, MAX_WHEEL_VELOCITY);
+		return Roomba::tryDriveDirect(dR * 1000, dL * 1000);
 	} else {
 		double dR = trans + rotate * lengthOfShaft;
 		double dL = trans - rotate * lengthOfShaft;
-		if(dR < -1.0) dR = -1.0;
-		else if(dR > 1.0) dR = 1.0;
-		if(dL < -1.0) dL = -1.0;
-		else if(dL > 1.0) dL = 1.0;
-		Roomba::driveDirect(dR * 1000, dL * 1000);
+		saturateWheelVelocity(&dR, &dL, MAX_WHEEL_VELOCITY);
+		return Roomba::tryDriveDirect(dR * 1000, dL * 1000);
 	}
 }
 
-
-void Roomba::waitPacketReceived() {
-	uint32_t buf = m_AsyncThreadReceiveCounter;
-	while(buf == m_AsyncThreadReceiveCounter) {
-		Thread::Sleep(1);
+void Roomba::setVelocityControl(bool enable, double kp /* = 0.5 */, double ki /* = 2.0 */, ControlOutput output /* = CONTROL_OUTPUT_DIRECT */)
+{
+	{
+		MutexGuard guard(m_ControlMutex);
+		m_ControlGainP = kp;
+		m_ControlGainI = ki;
+		m_ControlOutput = output;
+		m_TargetVelocityRight = m_TargetVelocityLeft = 0;
+		m_ControlIntegralRight = m_ControlIntegralLeft = 0;
+		m_ControlInitFlag = false;
 	}
+	m_VelocityControlEnabled = enable && (m_Version == Roomba::VERSION_500_SERIES);
 }
 
-
-void Roomba::runAsync()
+void Roomba::getWheelVelocity(double* right, double* left)
 {
-	if(m_Version == Roomba::VERSION_500_SERIES) {
-	uint8_t defaultSensorId[3] = {RIGHT_ENCODER_COUNTS,
-		LEFT_ENCODER_COUNTS, BUMPS_AND_WHEEL_DROPS};
-	//uint8_t defaultSensorId[3] = {DISTANCE, ANGLE, BUMPS_AND_WHEEL_DROPS};
+	MutexGuard guard(m_ControlMutex);
+	*right = m_MeasuredVelocityRight;
+	*left = m_MeasuredVelocityLeft;
+}
 
-	uint8_t numSensor = 3;
-	this->startSensorStream(defaultSensorId, numSensor);
-	} else if(m_Version == Roomba::VERSION_ROI) {
-		this->startSensorStream(NULL, 0);
-	}
+void Roomba::overrideVelocityControl(const double velocity)
+{
+	MutexGuard guard(m_ControlMutex);
+	m_TargetVelocityRight = m_TargetVelocityLeft = velocity;
+	m_ControlIntegralRight = m_ControlIntegralLeft = 0;
 }
 
-void Roomba::RequestSensor(uint8_t sensorId, uint16_t *value) 
+/**
+ * A frame was dropped. The encoder delta of the next frame covers more than the frames
+ * counted, so the velocity controller takes its baseline again from the next frame.
+ */
+void Roomba::dropControlBaseline()
 {
+	m_ControlInitFlag = false;
+}
 
-	if(m_isStreamMode) {
-		m_AsyncThreadMutex.Lock();
-		std::map<SensorID, uint16_t>::const_iterator it = m_SensorDataMap.find((SensorID)sensorId);
-		if(it != m_SensorDataMap.end()) {
-			*value = 0;
-			*value |= (*it).second;
-			m_AsyncThreadMutex.Unlock();
-			return;
-		} else {
-			if(m_Version == Roomba::VERSION_500_SERIES) {
-				m_SensorDataMap[(SensorID)sensorId] = 0;
-				m_AsyncThreadMutex.Unlock();
-				waitPacketReceived();
-				*value = 0;
-				m_AsyncThreadMutex.Lock();
-				*value |= m_SensorDataMap[(SensorID)sensorId];
-				m_AsyncThreadMutex.Unlock();
-			} else {
-				*value = 0;
-			}
+void Roomba::processVelocityControl()
+{
+	const double maxVelocity = MAX_WHEEL_VELOCITY;
+	if(!m_VelocityControlEnabled) {
+		return;
+	}
+	TraceScope trace("processVelocityControl");
+
+	uint16_t encoderRight, encoderLeft;
+	{
+		ReadGuard guard(m_AsyncThreadLock);
+		std::map<SensorID, uint16_t>::const_iterator right = m_SensorDataMap.find(RIGHT_ENCODER_COUNTS);
+		std::map<SensorID, uint16_t>::const_iterator left = m_SensorDataMap.find(LEFT_ENCODER_COUNTS);
+		if(right == m_SensorDataMap.end() || left == m_SensorDataMap.end()) {
 			return;
 		}
+		encoderRight = (*right).second;
+		encoderLeft = (*left).second;
 	}
 
-	/*
-	if(m_Version != Roomba::VERSION_500_SERIES) {
-		*value = 0;
+	// the robot samples the encoders every STREAM_PERIOD. the arrival time on the host
+	// jitters with the scheduling and the serial buffers, so it is not used.
+	uint32_t frames = m_AsyncThreadReceiveCounter - m_ControlFrame;
+	if(frames == 0) {
+		// no new frame (e.g. it was dropped). the baseline is taken from a valid frame.
+		return;
+	}
+	m_ControlFrame = m_AsyncThreadReceiveCounter;
+
+	if(!m_ControlInitFlag) {
+		m_ControlInitFlag = true;
+		m_ControlEncoderRightOld = encoderRight;
+		m_ControlEncoderLeftOld = encoderLeft;
+		return;
+	}
+
+	double dt = frames * STREAM_PERIOD / 1000.0;
+
+	int16_t dR = (int16_t)(uint16_t)(encoderRight - m_ControlEncoderRightOld);
+	int16_t dL = (int16_t)(uint16_t)(encoderLeft - m_ControlEncoderLeftOld);
+	m_ControlEncoderRightOld = encoderRight;
+	m_ControlEncoderLeftOld = encoderLeft;
+
+	double outputRight, outputLeft;
+	ControlOutput output;
+	{
+		MutexGuard guard(m_ControlMutex);
+		m_MeasuredVelocityRight = dR * PULSES_TO_METER / dt;
+		m_MeasuredVelocityLeft  = dL * PULSES_TO_METER / dt;
+		double errorRight = m_TargetVelocityRight - m_MeasuredVelocityRight;
+		double errorLeft  = m_TargetVelocityLeft  - m_MeasuredVelocityLeft;
+		double integralRight = m_ControlIntegralRight + errorRight * dt;
+		double integralLeft  = m_ControlIntegralLeft  + errorLeft  * dt;
+
+		outputRight = m_TargetVelocityRight + m_ControlGainP * errorRight + m_ControlGainI * integralRight;
+		outputLeft  = m_TargetVelocityLeft  + m_ControlGainP * errorLeft  + m_ControlGainI * integralLeft;
+		if(!saturateWheelVelocity(&outputRight, &outputLeft, maxVelocity)) {
+			// anti-windup: integrate only when not saturated.
+			m_ControlIntegralRight = integralRight;
+			m_ControlIntegralLeft = integralLeft;
+		}
+		output = m_ControlOutput;
+	}
+
+	if(getMode() != MODE_SAFE && getMode() != MODE_FULL) {
 		return;
 	}
-	*/
 
-	getSensorValue(sensorId, value);
+	if(output == CONTROL_OUTPUT_PWM) {
+		drivePWM(outputRight / maxVelocity * 255, outputLeft / maxVelocity * 255);
+	} else {
+		driveDirect(outputRight * 1000, outputLeft * 1000);
+	}
 }
 
-void Roomba::RequestSensor(uint8_t sensorId, int16_t *value)
+
+void Roomba::executeTrajectory(const TrajectorySample* samples, const uint32_t count)
 {
-	if(m_isStreamMode) {
-		m_AsyncThreadMutex.Lock();
-		std::map<SensorID, uint16_t>::const_iterator it = m_SensorDataMap.find((SensorID)sensorId);
-		if(it != m_SensorDataMap.end()) {
-			*value = 0;
-			*value |= (*it).second;
-			m_AsyncThreadMutex.Unlock();
-			return;
-		} else {
-			if(m_Version == Roomba::MODEL_500SERIES) {
-				m_SensorDataMap[(SensorID)sensorId] = 0;
-				m_AsyncThreadMutex.Unlock();
-				waitPacketReceived();
-				*value = 0;
-				m_AsyncThreadMutex.Lock();
-				*value |= m_SensorDataMap[(SensorID)sensorId];
-				m_AsyncThreadMutex.Unlock();
-			} else {
-				*value = 0;
+	throwError(tryExecuteTrajectory(samples, count));
+}
+
+Roomba::ReturnCode Roomba::tryExecuteTrajectory(const TrajectorySample* samples, const uint32_t count)
+{
+	if(!m_isStreamMode || count > MAX_TRAJECTORY_SAMPLES) {
+		return PRECONDITION_NOT_MET;
+	}
+
+	if(count > m_TrajectoryCapacity) {
+		// allocated here in the caller before the trajectory starts, never by the stream thread.
+		// the lock is not held during the allocation, so the running trajectory is not delayed.
+		TrajectorySample* buffer = new TrajectorySample[count];
+		int32_t* timingError = new int32_t[count];
+		{
+			MutexGuard guard(m_TrajectoryMutex);
+			if(count > m_TrajectoryCapacity) {
+				std::swap(buffer, m_TrajectoryBuffer);
+				std::swap(timingError, m_TrajectoryTimingError);
+				m_TrajectoryCapacity = count;
+				m_TrajectoryIndex = 0;
+				m_TrajectoryRunning = false;
 			}
-			return;
 		}
+		// the old buffer, or the new one if another caller has already grown it.
+		delete[] buffer;
+		delete[] timingError;
 	}
 
-	/*
-	if(m_Version != Roomba::VERSION_500_SERIES) {
-		*value = 0;
-		return;
+	MutexGuard guard(m_TrajectoryMutex);
+	for(uint32_t i = 0;i < count;i++) {
+		m_TrajectoryBuffer[i] = samples[i];
 	}
-	*/
+	m_TrajectoryCount = count;
+	m_TrajectoryIndex = 0;
+	m_TrajectoryRunning = count > 0;
+	m_TrajectoryTimer.tick();
+	return ROOMBA_OK;
+}
 
-	getSensorValue(sensorId, value);
+void Roomba::cancelTrajectory()
+{
+	MutexGuard guard(m_TrajectoryMutex);
+	m_TrajectoryRunning = false;
 }
 
-void Roomba::RequestSensor(uint8_t sensorId, uint8_t *value)
+bool Roomba::isTrajectoryRunning()
 {
-	if(m_isStreamMode) {
-		m_AsyncThreadMutex.Lock();
-		std::map<SensorID, uint16_t>::const_iterator it = m_SensorDataMap.find((SensorID)sensorId);
-		if(it != m_SensorDataMap.end()) {
-			*value = 0;
-			*value |= (*it).second;
-			m_AsyncThreadMutex.Unlock();
-			return;
-		} else {
-			if(m_Version == Roomba::MODEL_500SERIES) {
-				m_SensorDataMap[(SensorID)sensorId] = 0;
-				m_AsyncThreadMutex.Unlock();
-				waitPacketReceived();
-				*value = 0;
-				m_AsyncThreadMutex.Lock();
-				*value |= m_SensorDataMap[(SensorID)sensorId];
-				m_AsyncThreadMutex.Unlock();
-			} else {
-				*value = 0;
+	return m_TrajectoryRunning;
+}
+
+uint32_t Roomba::getTrajectoryTimingError(int32_t* errors, const uint32_t maxCount)
+{
+	MutexGuard guard(m_TrajectoryMutex);
+	uint32_t count = m_TrajectoryIndex;
+	for(uint32_t i = 0;i < count && i < maxCount;i++) {
+		errors[i] = m_TrajectoryTimingError[i];
+	}
+	return count;
+}
+
+void Roomba::processTrajectory()
+{
+	if(!m_TrajectoryRunning) {
+		return;
+	}
+
+	// A sample is emitted at the frame nearest to its deadline.
+	const int64_t halfFramePeriod = m_Version == Roomba::VERSION_500_SERIES ? STREAM_PERIOD * 500 : 50000;
+
+	TrajectorySample sample;
+	bool emit = false;
+	{
+		MutexGuard guard(m_TrajectoryMutex);
+		if(m_TrajectoryRunning) {
+			pcwrapper::TimeSpec elapsed;
+			m_TrajectoryTimer.tack(&elapsed);
+			int64_t now = (int64_t)elapsed.sec * 1000000 + elapsed.usec;
+			while(m_TrajectoryIndex < m_TrajectoryCount) {
+				int64_t deadline = (int64_t)(m_TrajectoryBuffer[m_TrajectoryIndex].time * 1000000);
+				if(deadline > now + halfFramePeriod) {
+					break;
+				}
+				m_TrajectoryTimingError[m_TrajectoryIndex] = (int32_t)(now - deadline);
+				sample = m_TrajectoryBuffer[m_TrajectoryIndex];
+				emit = true;
+				m_TrajectoryIndex++;
+			}
+			if(m_TrajectoryIndex >= m_TrajectoryCount) {
+				m_TrajectoryRunning = false;
 			}
-			return;
 		}
 	}
 
-	/*
-	if(m_Version != Roomba::VERSION_500_SERIES) {
-		*value = 0;
-		return;
+	if(emit && (getMode() == MODE_SAFE || getMode() == MODE_FULL)) {
+		move(sample.velocity, sample.angularVelocity);
+	}
+}
+
+
+/**
+ * Wait until the next frame is received.
+ *
+ * @return false if no frame arrives in REQUEST_TIMEOUT, or the stream is stopped.
+ */
+bool Roomba::waitPacketReceived() {
+	// the idle stream must not be suspended while waiting.
+	{
+		WriteGuard guard(m_AsyncThreadLock);
+		m_StreamInterest++;
+	}
+
+	net::ysuga::Clock* clock = net::ysuga::Clock::getInstance();
+	const uint64_t deadline = clock->now() + (uint64_t)REQUEST_TIMEOUT * 1000;
+	uint32_t buf = m_AsyncThreadReceiveCounter;
+	bool received = false;
+	while(m_isStreamMode && !m_StopToken.IsStopRequested()) {
+		if(buf != m_AsyncThreadReceiveCounter) {
+			received = true;
+			break;
+		}
+		if(clock->now() >= deadline) {
+			break;
+		}
+		Thread::Sleep(1);
 	}
-	*/
 
-	getSensorValue(sensorId, value);
+	WriteGuard guard(m_AsyncThreadLock);
+	m_StreamInterest--;
+	m_LastDemandFrame = m_AsyncThreadReceiveCounter;
+	return received;
 }
 
-void Roomba::RequestSensor(uint8_t sensorId, int8_t *value)
+
+void Roomba::runAsync(bool startThread /* = true */)
 {
-	if(m_isStreamMode) {
-		m_AsyncThreadMutex.Lock();
-		std::map<SensorID, uint16_t>::const_iterator it = m_SensorDataMap.find((SensorID)sensorId);
-		if(it != m_SensorDataMap.end()) {
-			*value = 0;
-			*value |= (*it).second;
-			m_AsyncThreadMutex.Unlock();
-			return;
-		} else {
-			if(m_Version == Roomba::MODEL_500SERIES) {
-				m_SensorDataMap[(SensorID)sensorId] = 0;
-				m_AsyncThreadMutex.Unlock();
-				waitPacketReceived();
-				*value = 0;
-				m_AsyncThreadMutex.Lock();
-				*value |= m_SensorDataMap[(SensorID)sensorId];
-				m_AsyncThreadMutex.Unlock();
-			} else {
-				*value = 0;
-			}
-			return;
+	throwError(tryRunAsync(startThread));
+}
+
+Roomba::ReturnCode Roomba::tryRunAsync(bool startThread /* = true */)
+{
+	if(m_Version == Roomba::VERSION_500_SERIES) {
+	uint8_t defaultSensorId[3] = {RIGHT_ENCODER_COUNTS,
+		LEFT_ENCODER_COUNTS, BUMPS_AND_WHEEL_DROPS};
+	//uint8_t defaultSensorId[3] = {DISTANCE, ANGLE, BUMPS_AND_WHEEL_DROPS};
+
+	uint8_t numSensor = 3;
+	return this->tryStartSensorStream(defaultSensorId, numSensor, startThread);
+	} else if(m_Version == Roomba::VERSION_ROI) {
+		return this->tryStartSensorStream(NULL, 0, startThread);
+	}
+	return ROOMBA_OK;
+}
+
+uint32_t Roomba::connect(const Mode mode, const uint32_t timeout, uint8_t* requestingSensors /* = NULL */,
+						 const uint32_t numSensors /* = 0 */, bool startThread /* = true */)
+{
+	return tryConnect(mode, timeout, requestingSensors, numSensors, startThread).getValue();
+}
+
+Roomba::Result<uint32_t> Roomba::tryConnect(const Mode mode, const uint32_t timeout, uint8_t* requestingSensors /* = NULL */,
+						 const uint32_t numSensors /* = 0 */, bool startThread /* = true */)
+{
+	if(m_isStreamMode || (mode != MODE_PASSIVE && mode != MODE_SAFE && mode != MODE_FULL)) {
+		return Result<uint32_t>::failure(PRECONDITION_NOT_MET);
+	}
+	net::ysuga::Clock* clock = net::ysuga::Clock::getInstance();
+	const uint64_t begin = clock->now();
+	const uint64_t deadline = begin + (uint64_t)timeout * 1000;
+
+	forgetScript();
+	// the robot answers the query only after START.
+	// the stream of the previous session is paused, or its bytes would be taken for the answer.
+	m_pTransport->FlushRxBuffer();
+	{
+		BatchGuard batch(*m_pTransport);
+		m_pTransport->TrySendPacket(OP_START);
+		if(m_Version == Roomba::VERSION_500_SERIES) {
+			uint8_t pause = 0;
+			m_pTransport->TrySendPacket(OP_PAUSE_RESUME_STREAM, &pause, 1);
+		}
+		if(batch.TryEnd() != 0) {
+			return Result<uint32_t>::failure(COM_ACCESS_FAILED);
+		}
+	}
+	m_CurrentMode = MODE_PASSIVE;
+	uint8_t oiMode;
+	uint32_t readBytes;
+	int32_t received;
+	while((received = m_pTransport->TryReceiveData(&oiMode, 1, &readBytes, CONNECT_QUIET_TIME)) == 0) {
+		if(timeout && clock->now() >= deadline) {
+			return Result<uint32_t>::failure(CONNECTION_TIMEOUT);
 		}
 	}
+	if(received == TRANSPORT_ACCESS_FAILED) {
+		return Result<uint32_t>::failure(COM_ACCESS_FAILED);
+	}
 
-	/*
-	if(m_Version != Roomba::VERSION_500_SERIES) {
-		*value = 0;
-		return;
+	uint8_t sensorId = OI_MODE;
+	if(m_pTransport->TrySendPacket(OP_SENSORS, &sensorId, 1) == TRANSPORT_ACCESS_FAILED) {
+		return Result<uint32_t>::failure(COM_ACCESS_FAILED);
+	}
+	// 0 waits forever in TryReceiveData.
+	received = m_pTransport->TryReceiveData(&oiMode, 1, &readBytes, timeout > 0 ? timeout : 1);
+	if(received == TRANSPORT_ACCESS_FAILED) {
+		return Result<uint32_t>::failure(COM_ACCESS_FAILED);
+	} else if(received != 0 || readBytes < 1 || oiMode > 3) {
+		// anything but OFF, PASSIVE, SAFE or FULL is not the answer of a Roomba.
+		return Result<uint32_t>::failure(CONNECTION_TIMEOUT);
+	}
+
+	const uint32_t firstFrame = m_AsyncThreadReceiveCounter;
+	uint32_t settleTime = m_ModeSettleTime;
+	m_ModeSettleTime = 0;
+	ReturnCode result = ROOMBA_OK;
+	{
+		BatchGuard batch(*m_pTransport);
+		if(mode != MODE_PASSIVE) {
+			result = trySetMode(mode);
+		}
+		if(result == ROOMBA_OK && requestingSensors) {
+			result = tryStartSensorStream(requestingSensors, numSensors, startThread);
+		} else if(result == ROOMBA_OK) {
+			result = tryRunAsync(startThread);
+		}
+		if(batch.TryEnd() != 0 && result == ROOMBA_OK) {
+			result = COM_ACCESS_FAILED;
+		}
+	}
+	m_ModeSettleTime = settleTime;
+	if(result != ROOMBA_OK) {
+		return Result<uint32_t>::failure(result);
+	}
+
+	// the counter continues if the stream was stopped and is started again.
+	while(m_AsyncThreadReceiveCounter == firstFrame) {
+		if(!startThread && pollSensorData()) {
+			continue;
+		}
+		if(clock->now() >= deadline) {
+			return Result<uint32_t>::failure(CONNECTION_TIMEOUT);
+		}
+		Thread::Sleep(1);
+	}
+	return Result<uint32_t>((uint32_t)(clock->now() - begin));
+}
+
+/**
+ * The accessors of the flags. The sensor is read with the mask.
+ */
+Roomba::Result<bool> Roomba::trySensorFlag(uint8_t sensorId, uint8_t mask)
+{
+	Result<uint8_t> value = trySensorValue<uint8_t>(sensorId);
+	if(!value.isOk()) {
+		return Result<bool>::failure(value.getError());
 	}
-	*/
+	return Result<bool>((value.getValueOr(0) & mask) ? true : false);
+}
+
+bool Roomba::isRightWheelDropped()
+{
+	return valueOf(tryIsRightWheelDropped());
+}
+
+Roomba::Result<bool> Roomba::tryIsRightWheelDropped()
+{
+	return trySensorFlag(BUMPS_AND_WHEEL_DROPS, 0x04);
+}
 
-	getSensorValue(sensorId, value);
+bool Roomba::isLeftWheelDropped()
+{
+	return valueOf(tryIsLeftWheelDropped());
 }
 
+Roomba::Result<bool> Roomba::tryIsLeftWheelDropped()
+{
+	return trySensorFlag(BUMPS_AND_WHEEL_DROPS, 0x08);
+}
 
-bool Roomba::isRightWheelDropped() {
-	uint8_t buf;
-	RequestSensor(BUMPS_AND_WHEEL_DROPS, &buf);
-	return buf & 0x04 ? true : false;
+bool Roomba::isRightBump()
+{
+	return valueOf(tryIsRightBump());
 }
 
-bool Roomba::isLeftWheelDropped() {
-	uint8_t buf;
-	RequestSensor(BUMPS_AND_WHEEL_DROPS, &buf);
-	return buf & 0x08 ? true : false;
+Roomba::Result<bool> Roomba::tryIsRightBump()
+{
+	return trySensorFlag(BUMPS_AND_WHEEL_DROPS, 0x01);
 }
 
-bool Roomba::isRightBump() {
-	uint8_t buf;
-	RequestSensor(BUMPS_AND_WHEEL_DROPS, &buf);
-	return buf & 0x01 ? true : false;
+bool Roomba::isLeftBump()
+{
+	return valueOf(tryIsLeftBump());
 }
 
-bool Roomba::isLeftBump() 
+Roomba::Result<bool> Roomba::tryIsLeftBump()
 {
-	uint8_t buf;
-	RequestSensor(BUMPS_AND_WHEEL_DROPS, &buf);
-	return buf & 0x02 ? true : false;
+	return trySensorFlag(BUMPS_AND_WHEEL_DROPS, 0x02);
 }
 
 bool Roomba::isCliffLeft()
 {
-	uint8_t buf;
-	RequestSensor(CLIFF_LEFT, &buf);
-	return buf > 0 ? true : false;
+	return valueOf(tryIsCliffLeft());
+}
+
+Roomba::Result<bool> Roomba::tryIsCliffLeft()
+{
+	return trySensorFlag(CLIFF_LEFT, 0xFF);
+}
+
+bool Roomba::isCliffFrontLeft()
+{
+	return valueOf(tryIsCliffFrontLeft());
 }
 
-bool Roomba::isCliffFrontLeft() {
-	uint8_t buf;
-	RequestSensor(CLIFF_FRONT_LEFT, &buf);
-	return buf > 0 ? true : false;
+Roomba::Result<bool> Roomba::tryIsCliffFrontLeft()
+{
+	return trySensorFlag(CLIFF_FRONT_LEFT, 0xFF);
+}
+
+bool Roomba::isCliffFrontRight()
+{
+	return valueOf(tryIsCliffFrontRight());
 }
 
-bool Roomba::isCliffFrontRight() {
-	uint8_t buf;
-	RequestSensor(CLIFF_FRONT_RIGHT, &buf);
-	return buf > 0 ? true : false;
+Roomba::Result<bool> Roomba::tryIsCliffFrontRight()
+{
+	return trySensorFlag(CLIFF_FRONT_RIGHT, 0xFF);
+}
+
+bool Roomba::isCliffRight()
+{
+	return valueOf(tryIsCliffRight());
 }
 
-bool Roomba::isCliffRight() {
-	uint8_t buf;
-	RequestSensor(CLIFF_RIGHT, &buf);
-	return buf > 0 ? true : false;
+Roomba::Result<bool> Roomba::tryIsCliffRight()
+{
+	return trySensorFlag(CLIFF_RIGHT, 0xFF);
 }
 
 bool Roomba::isVirtualWall()
 {
-	uint8_t buf;
-	RequestSensor(VIRTUAL_WALL, &buf);
-	return buf > 0 ? true : false;
+	return valueOf(tryIsVirtualWall());
+}
+
+Roomba::Result<bool> Roomba::tryIsVirtualWall()
+{
+	return trySensorFlag(VIRTUAL_WALL, 0xFF);
 }
 
 Roomba::MotorFlag Roomba::isWheelOvercurrents()
 {
-	uint8_t buf;
-	RequestSensor(WHEEL_OVERCURRENTS, &buf);
-	return (MotorFlag)buf;
+	return valueOf(tryIsWheelOvercurrents());
+}
+
+Roomba::Result<Roomba::MotorFlag> Roomba::tryIsWheelOvercurrents()
+{
+	return trySensorValue<MotorFlag>(WHEEL_OVERCURRENTS);
+}
+
+bool Roomba::isRightWheelOvercurrent()
+{
+	return valueOf(tryIsRightWheelOvercurrent());
+}
+
+Roomba::Result<bool> Roomba::tryIsRightWheelOvercurrent()
+{
+	return trySensorFlag(WHEEL_OVERCURRENTS, RightWheel);
+}
+
+bool Roomba::isLeftWheelOvercurrent()
+{
+	return valueOf(tryIsLeftWheelOvercurrent());
 }
 
-bool Roomba::isRightWheelOvercurrent() 
+Roomba::Result<bool> Roomba::tryIsLeftWheelOvercurrent()
 {
-	return isWheelOvercurrents() & RightWheel ? true : false;
+	return trySensorFlag(WHEEL_OVERCURRENTS, LeftWheel);
 }
 
-bool Roomba::isLeftWheelOvercurrent() 
+bool Roomba::isMainBrushOvercurrent()
 {
-	return isWheelOvercurrents() & LeftWheel ? true : false;
+	return valueOf(tryIsMainBrushOvercurrent());
 }
 
-bool Roomba::isMainBrushOvercurrent() 
+Roomba::Result<bool> Roomba::tryIsMainBrushOvercurrent()
 {
-	return isWheelOvercurrents() & MainBrush ? true : false;
+	return trySensorFlag(WHEEL_OVERCURRENTS, MainBrush);
 }
 
-bool Roomba::isSideBrushOvercurrent() 
+bool Roomba::isSideBrushOvercurrent()
 {
-	return isWheelOvercurrents() & SideBrush ? true : false;
+	return valueOf(tryIsSideBrushOvercurrent());
+}
+
+Roomba::Result<bool> Roomba::tryIsSideBrushOvercurrent()
+{
+	return trySensorFlag(WHEEL_OVERCURRENTS, SideBrush);
 }
 
 bool Roomba::dirtDetect()
 {
-	uint8_t buf;
-	RequestSensor(DIRT_DETECT, &buf);
-	return buf ? true : false;
+	return valueOf(tryDirtDetect());
+}
+
+Roomba::Result<bool> Roomba::tryDirtDetect()
+{
+	return trySensorFlag(DIRT_DETECT, 0xFF);
 }
 
 int8_t Roomba::getInfraredCharacterOmni()
 {
-	int8_t buf;
-	RequestSensor(INFRARED_CHARACTER_OMNI, &buf);
-	return buf;
+	return valueOf(tryGetInfraredCharacterOmni());
+}
+
+Roomba::Result<int8_t> Roomba::tryGetInfraredCharacterOmni()
+{
+	return trySensorValue<int8_t>(INFRARED_CHARACTER_OMNI);
 }
 
 int8_t Roomba::getInfraredCharacterRight()
 {
-	int8_t buf;
-	RequestSensor(INFRARED_CHARACTER_RIGHT, &buf);
-	return buf;
+	return valueOf(tryGetInfraredCharacterRight());
+}
+
+Roomba::Result<int8_t> Roomba::tryGetInfraredCharacterRight()
+{
+	return trySensorValue<int8_t>(INFRARED_CHARACTER_RIGHT);
 }
 
 int8_t Roomba::getInfraredCharacterLeft()
 {
-	int8_t buf;
-	RequestSensor(INFRARED_CHARACTER_LEFT, &buf);
-	return buf;
+	return valueOf(tryGetInfraredCharacterLeft());
 }
 
+Roomba::Result<int8_t> Roomba::tryGetInfraredCharacterLeft()
+{
+	return trySensorValue<int8_t>(INFRARED_CHARACTER_LEFT);
+}
 
 Roomba::ButtonFlag Roomba::getButtons()
 {
-	uint8_t buf;
-	RequestSensor(BUTTONS, &buf);
-	return (ButtonFlag)buf;
+	return valueOf(tryGetButtons());
+}
+
+Roomba::Result<Roomba::ButtonFlag> Roomba::tryGetButtons()
+{
+	return trySensorValue<ButtonFlag>(BUTTONS);
 }
 
 int16_t Roomba::getDistance()
 {
-	int16_t buf;
-	RequestSensor(DISTANCE, &buf);
-	return buf;
+	return valueOf(tryGetDistance());
+}
+
+Roomba::Result<int16_t> Roomba::tryGetDistance()
+{
+	return trySensorValue<int16_t>(DISTANCE);
 }
 
 int16_t Roomba::getAngle()
 {
-	int16_t buf;
-	RequestSensor(ANGLE, &buf);
-	return buf;
+	return valueOf(tryGetAngle());
+}
+
+Roomba::Result<int16_t> Roomba::tryGetAngle()
+{
+	return trySensorValue<int16_t>(ANGLE);
 }
 
 Roomba::ChargingState Roomba::getChargingState()
 {
-	uint8_t buf;
-	RequestSensor(CHARGING_STATE, &buf);
-	return (ChargingState)buf;
+	return valueOf(tryGetChargingState());
+}
+
+Roomba::Result<Roomba::ChargingState> Roomba::tryGetChargingState()
+{
+	return trySensorValue<ChargingState>(CHARGING_STATE);
 }
 
-uint16_t Roomba::getVoltage() {
-	uint16_t buf;
-	RequestSensor(VOLTAGE, &buf);
-	return buf;
+uint16_t Roomba::getVoltage()
+{
+	return valueOf(tryGetVoltage());
 }
 
-uint16_t Roomba::getCurrent() {
-	uint16_t buf;
-	RequestSensor(VOLTAGE, &buf);
-	return buf;
+Roomba::Result<uint16_t> Roomba::tryGetVoltage()
+{
+	return trySensorValue<uint16_t>(VOLTAGE);
 }
 
-int8_t Roomba::getTemperature() {
-	int8_t buf;
-	RequestSensor(TEMPERATURE, &buf);
-	return buf;
+uint16_t Roomba::getCurrent()
+{
+	return valueOf(tryGetCurrent());
 }
 
-Roomba::Mode Roomba::getOIMode()
+Roomba::Result<uint16_t> Roomba::tryGetCurrent()
+{
+	return trySensorValue<uint16_t>(CURRENT);
+}
+
+int8_t Roomba::getTemperature()
+{
+	return valueOf(tryGetTemperature());
+}
+
+Roomba::Result<int8_t> Roomba::tryGetTemperature()
 {
-	uint8_t buf;
-	RequestSensor(OI_MODE, &buf);
-	if(buf== 0) 
-		return MODE_OFF;
-	else if(buf == 1)
-		return MODE_PASSIVE;
-	else if(buf == 2)
-		return MODE_SAFE;
-	else if(buf == 3)
-		return MODE_FULL;
+	return trySensorValue<int8_t>(TEMPERATURE);
+}
 
-	return MODE_OFF;
+Roomba::Mode Roomba::getOIMode()
+{
+	return valueOf(tryGetOIMode(), MODE_OFF);
 }
 
+Roomba::Result<Roomba::Mode> Roomba::tryGetOIMode()
+{
+	Result<uint8_t> value = trySensorValue<uint8_t>(OI_MODE);
+	if(!value.isOk()) {
+		return Result<Mode>::failure(value.getError());
+	}
+	switch(value.getValueOr(0)) {
+	case 1:
+		return Result<Mode>(MODE_PASSIVE);
+	case 2:
+		return Result<Mode>(MODE_SAFE);
+	case 3:
+		return Result<Mode>(MODE_FULL);
+	default:
+		return Result<Mode>(MODE_OFF);
+	}
+}
 
-int16_t Roomba::getRequestedVelocity() {
-	int16_t buf;
-	RequestSensor(REQUESTED_VELOCITY, &buf);
-	return buf;
+int16_t Roomba::getRequestedVelocity()
+{
+	return valueOf(tryGetRequestedVelocity());
 }
 
+Roomba::Result<int16_t> Roomba::tryGetRequestedVelocity()
+{
+	return trySensorValue<int16_t>(REQUESTED_VELOCITY);
+}
 
-int16_t Roomba::getRequestedRadius() {
-	int16_t buf;
-	RequestSensor(REQUESTED_RADIUS, &buf);
-	return buf;
+int16_t Roomba::getRequestedRadius()
+{
+	return valueOf(tryGetRequestedRadius());
 }
 
+Roomba::Result<int16_t> Roomba::tryGetRequestedRadius()
+{
+	return trySensorValue<int16_t>(REQUESTED_RADIUS);
+}
 
 uint16_t Roomba::getRightEncoderCounts()
 {
-	uint16_t buf;
-	RequestSensor(LEFT_ENCODER_COUNTS, &buf);
-	return buf;
+	return valueOf(tryGetRightEncoderCounts());
+}
+
+Roomba::Result<uint16_t> Roomba::tryGetRightEncoderCounts()
+{
+	return trySensorValue<uint16_t>(RIGHT_ENCODER_COUNTS);
 }
 
 uint16_t Roomba::getLeftEncoderCounts()
 {
-	uint16_t buf;
-	RequestSensor(RIGHT_ENCODER_COUNTS, &buf);
-	return buf;
+	return valueOf(tryGetLeftEncoderCounts());
+}
+
+Roomba::Result<uint16_t> Roomba::tryGetLeftEncoderCounts()
+{
+	return trySensorValue<uint16_t>(LEFT_ENCODER_COUNTS);
 }
 
 
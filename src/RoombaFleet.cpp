@@ -0,0 +1,326 @@
+#include "RoombaFleet.h"
+#include "Roomba.h"
+#include "Trace.h"
+
+#ifdef WIN32
+#include <stdio.h>
+#else
+#include <glob.h>
+#endif
+
+using namespace net::ysuga;
+using namespace net::ysuga::roomba;
+
+/**
+ * Sensors streamed by the fleet (500 series)
+ */
+static const uint8_t g_FleetSensors[] = {RIGHT_ENCODER_COUNTS, LEFT_ENCODER_COUNTS, BUMPS_AND_WHEEL_DROPS,
+	VOLTAGE, BATTERY_CHARGE, BATTERY_CAPACITY};
+
+/**
+ * Sensors polled every second by the fleet (ROI)
+ */
+static void setFleetPollRates(Roomba* roomba)
+{
+	roomba->setPollRate(VOLTAGE, 1000);
+	roomba->setPollRate(BATTERY_CHARGE, 1000);
+	roomba->setPollRate(BATTERY_CAPACITY, 1000);
+}
+
+void FleetIOThread::Run()
+{
+	m_pFleet->processIO(m_Index);
+}
+
+/**
+ * Thread bringing up a robot in RoombaFleet::connectAll
+ */
+class FleetConnectThread : public Thread {
+public:
+	std::string portName;
+	uint32_t model;
+	uint32_t baudrate;
+	uint32_t timeout;
+	Roomba* roomba; // NULL if failed
+	uint32_t connectTime;
+
+public:
+	FleetConnectThread() : roomba(NULL), connectTime(0) {}
+	virtual ~FleetConnectThread() {}
+
+	void Run() {
+		try {
+			roomba = new Roomba(model, portName.c_str(), baudrate, NULL, false);
+			if(roomba->getVersion() == Roomba::VERSION_500_SERIES) {
+				uint8_t sensors[sizeof(g_FleetSensors)];
+				for(uint32_t i = 0;i < sizeof(g_FleetSensors);i++) {
+					sensors[i] = g_FleetSensors[i];
+				}
+				connectTime = roomba->connect(Roomba::MODE_SAFE, timeout, sensors, sizeof(sensors), false);
+			} else {
+				connectTime = roomba->connect(Roomba::MODE_SAFE, timeout, NULL, 0, false);
+				setFleetPollRates(roomba);
+			}
+		} catch (std::exception& e) {
+			delete roomba;
+			roomba = NULL;
+		}
+	}
+};
+
+RoombaFleet::RoombaFleet(uint32_t numIOThreads /* = 2 */, uint32_t numWorkerThreads /* = 4 */) :
+m_pPool(NULL), m_NumIOThreads(numIOThreads > 0 ? numIOThreads : 1), m_NumWorkerThreads(numWorkerThreads),
+m_Running(false), m_Callback(NULL), m_CallbackContext(NULL)
+{
+}
+
+RoombaFleet::~RoombaFleet()
+{
+	stop();
+	for(uint32_t i = 0;i < m_Members.size();i++) {
+		delete m_Members[i]->roomba;
+		delete m_Members[i];
+	}
+}
+
+uint32_t RoombaFleet::add(const uint32_t model, const char* portName, const uint32_t baudrate)
+{
+	if(m_Running) {
+		throw PreconditionNotMetError();
+	}
+	return add(new Roomba(model, portName, baudrate));
+}
+
+uint32_t RoombaFleet::add(Roomba* roomba)
+{
+	if(m_Running) {
+		throw PreconditionNotMetError();
+	}
+	Member* member = new Member();
+	member->fleet = this;
+	member->roomba = roomba;
+	member->index = m_Members.size();
+	member->callbackPending = false;
+	member->statistics.frameCount = 0;
+	member->statistics.callbackCount = 0;
+	member->statistics.skippedCount = 0;
+	member->statistics.maxLatency = 0;
+	member->statistics.lastLatency = 0;
+	member->statistics.callbackTime = 0;
+	member->statistics.connectTime = 0;
+	m_Members.push_back(member);
+	return member->index;
+}
+
+uint32_t RoombaFleet::connectAll(const std::vector<std::string>& portNames, const uint32_t model,
+								 const uint32_t baudrate /* = 115200 */, const uint32_t timeout /* = 1000 */)
+{
+	if(m_Running) {
+		throw PreconditionNotMetError();
+	}
+
+	std::vector<FleetConnectThread*> threads;
+	for(uint32_t i = 0;i < portNames.size();i++) {
+		FleetConnectThread* thread = new FleetConnectThread();
+		thread->portName = portNames[i];
+		thread->model = model;
+		thread->baudrate = baudrate;
+		thread->timeout = timeout;
+		threads.push_back(thread);
+		thread->Start();
+	}
+
+	uint32_t count = 0;
+	for(uint32_t i = 0;i < threads.size();i++) {
+		threads[i]->Join();
+		if(threads[i]->roomba) {
+			uint32_t index = add(threads[i]->roomba);
+			m_Members[index]->statistics.connectTime = threads[i]->connectTime;
+			count++;
+		}
+		delete threads[i];
+	}
+	return count;
+}
+
+uint32_t RoombaFleet::scanPorts(std::vector<std::string>& portNames)
+{
+	portNames.clear();
+#ifdef WIN32
+	char name[16];
+	char target[256];
+	for(int i = 1;i <= 256;i++) {
+		sprintf(name, "COM%d", i);
+		if(::QueryDosDeviceA(name, target, sizeof(target)) > 0) {
+			portNames.push_back(std::string("\\\\.\\") + name);
+		}
+	}
+#else
+	const char* patterns[] = {"/dev/ttyUSB*", "/dev/ttyACM*"};
+	for(uint32_t p = 0;p < sizeof(patterns) / sizeof(patterns[0]);p++) {
+		glob_t result;
+		if(glob(patterns[p], 0, NULL, &result) == 0) {
+			for(size_t i = 0;i < result.gl_pathc;i++) {
+				portNames.push_back(result.gl_pathv[i]);
+			}
+		}
+		globfree(&result);
+	}
+#endif
+	return portNames.size();
+}
+
+void RoombaFleet::setControlCallback(RoombaControlCallback callback, void* context)
+{
+	m_Callback = callback;
+	m_CallbackContext = context;
+}
+
+void RoombaFleet::start()
+{
+	if(m_Running) {
+		return;
+	}
+
+	for(uint32_t i = 0;i < m_Members.size();i++) {
+		Roomba* roomba = m_Members[i]->roomba;
+		if(roomba->isSensorStreamStarted()) {
+			// brought up by connectAll
+			continue;
+		}
+		if(roomba->getVersion() == Roomba::VERSION_500_SERIES) {
+			uint8_t sensors[sizeof(g_FleetSensors)];
+			for(uint32_t j = 0;j < sizeof(g_FleetSensors);j++) {
+				sensors[j] = g_FleetSensors[j];
+			}
+			roomba->startSensorStream(sensors, sizeof(sensors), false);
+		} else {
+			setFleetPollRates(roomba);
+			roomba->runAsync(false);
+		}
+	}
+
+	m_Running = true;
+	m_StopToken.Reset();
+	m_pPool = new WorkStealingPool(m_NumWorkerThreads);
+	for(uint32_t i = 0;i < m_NumIOThreads;i++) {
+		m_IOThreads.push_back(new FleetIOThread(this, i));
+		m_IOThreads[i]->SetAttributes(m_IOThreadAttributes);
+		m_IOThreads[i]->Start();
+	}
+}
+
+void RoombaFleet::stop()
+{
+	if(!m_Running) {
+		return;
+	}
+
+	m_Running = false;
+	m_StopToken.RequestStop();
+	for(uint32_t i = 0;i < m_IOThreads.size();i++) {
+		m_IOThreads[i]->Join();
+		delete m_IOThreads[i];
+	}
+	m_IOThreads.clear();
+	// The callbacks which are not started yet are discarded.
+	delete m_pPool;
+	m_pPool = NULL;
+	for(uint32_t i = 0;i < m_Members.size();i++) {
+		m_Members[i]->callbackPending = false;
+	}
+}
+
+/**
+ * Process the robots of (index % number of I/O threads == ioIndex).
+ */
+void RoombaFleet::processIO(uint32_t ioIndex)
+{
+	Tracer::setThreadName("RoombaFleet I/O");
+	std::vector<Roomba*> roombas;
+	for(uint32_t i = ioIndex;i < m_Members.size();i += m_NumIOThreads) {
+		roombas.push_back(m_Members[i]->roomba);
+	}
+	while(m_Running) {
+		bool processed = false;
+		for(uint32_t i = ioIndex;i < m_Members.size();i += m_NumIOThreads) {
+			Member* member = m_Members[i];
+			if(!member->roomba->pollSensorData()) {
+				continue;
+			}
+			processed = true;
+
+			member->mutex.Lock();
+			member->statistics.frameCount++;
+			bool submit = m_Callback != NULL && !member->callbackPending;
+			if(submit) {
+				member->callbackPending = true;
+				member->frameTimer.tick();
+			} else if(m_Callback) {
+				member->statistics.skippedCount++;
+			}
+			member->mutex.Unlock();
+
+			if(submit) {
+				Task task;
+				task.function = runCallback;
+				task.argument = member;
+				m_pPool->submit(task, member->index);
+			}
+		}
+		if(!processed) {
+			Roomba::waitSensorData(roombas.empty() ? NULL : &roombas[0], roombas.size(), IDLE_STREAM_PERIOD, &m_StopToken);
+		}
+	}
+}
+
+void RoombaFleet::runCallback(void* argument)
+{
+	Member* member = (Member*)argument;
+	RoombaFleet* fleet = member->fleet;
+
+	TraceScope trace("controlCallback", member->index);
+	pcwrapper::TimeSpec latency;
+	member->frameTimer.tack(&latency);
+	pcwrapper::Timer timer;
+	timer.tick();
+	fleet->m_Callback(member->roomba, member->index, fleet->m_CallbackContext);
+	pcwrapper::TimeSpec duration;
+	timer.tack(&duration);
+
+	member->mutex.Lock();
+	RoombaFleetStatistics& statistics = member->statistics;
+	statistics.callbackCount++;
+	statistics.lastLatency = latency.sec * 1000000 + latency.usec;
+	if(statistics.lastLatency > statistics.maxLatency) {
+		statistics.maxLatency = statistics.lastLatency;
+	}
+	statistics.callbackTime += (uint64_t)duration.sec * 1000000 + duration.usec;
+	member->callbackPending = false;
+	member->mutex.Unlock();
+}
+
+uint32_t RoombaFleet::getSnapshot(RoombaSnapshot* snapshots, const uint32_t maxCount)
+{
+	for(uint32_t i = 0;i < m_Members.size() && i < maxCount;i++) {
+		Roomba* roomba = m_Members[i]->roomba;
+		RoombaSnapshot& snapshot = snapshots[i];
+		snapshot.x = roomba->getX();
+		snapshot.y = roomba->getY();
+		snapshot.th = roomba->getTh();
+		snapshot.voltage = snapshot.batteryCharge = snapshot.batteryCapacity = 0;
+		roomba->getCachedSensorValue(VOLTAGE, &snapshot.voltage);
+		roomba->getCachedSensorValue(BATTERY_CHARGE, &snapshot.batteryCharge);
+		roomba->getCachedSensorValue(BATTERY_CAPACITY, &snapshot.batteryCapacity);
+		snapshot.frameCount = roomba->getFrameCount();
+	}
+	return m_Members.size();
+}
+
+void RoombaFleet::getStatistics(uint32_t index, RoombaFleetStatistics* statistics)
+{
+	Member* member = m_Members[index];
+	member->mutex.Lock();
+	*statistics = member->statistics;
+	member->mutex.Unlock();
+}
@@ -0,0 +1,83 @@
+#include "Script.h"
+#include "RoombaException.h"
+#include "op_code.h"
+
+using namespace net::ysuga::roomba;
+
+Script::Script() : m_Length(0)
+{
+}
+
+Script::~Script()
+{
+}
+
+void Script::append(const uint8_t* data, const uint32_t size)
+{
+	if(m_Length + size > MAX_SCRIPT_LENGTH) {
+		throw ScriptOverflowError();
+	}
+	for(uint32_t i = 0;i < size;i++) {
+		m_Buffer[m_Length++] = data[i];
+	}
+}
+
+void Script::append16(uint8_t opcode, int16_t value)
+{
+	uint8_t data[3] = {opcode, (uint8_t)((value >> 8) & 0xFF), (uint8_t)(value & 0xFF)};
+	append(data, 3);
+}
+
+void Script::drive(int16_t translation, int16_t turnRadius)
+{
+	uint8_t data[5] = {OP_DRIVE, 
+		(uint8_t)((translation >> 8) & 0xFF), (uint8_t)(translation & 0xFF),
+		(uint8_t)((turnRadius >> 8) & 0xFF), (uint8_t)(turnRadius & 0xFF)};
+	append(data, 5);
+}
+
+void Script::driveDirect(int16_t rightWheel, int16_t leftWheel)
+{
+	uint8_t data[5] = {OP_DRIVE_DIRECT,
+		(uint8_t)((rightWheel >> 8) & 0xFF), (uint8_t)(rightWheel & 0xFF),
+		(uint8_t)((leftWheel >> 8) & 0xFF), (uint8_t)(leftWheel & 0xFF)};
+	append(data, 5);
+}
+
+void Script::setLED(uint8_t leds, uint8_t intensity, uint8_t color /* = 127 */)
+{
+	uint8_t data[4] = {OP_LEDS, leds, color, intensity};
+	append(data, 4);
+}
+
+void Script::waitTime(uint8_t time)
+{
+	uint8_t data[2] = {OP_WAIT_TIME, time};
+	append(data, 2);
+}
+
+void Script::waitDistance(int16_t distance)
+{
+	append16(OP_WAIT_DISTANCE, distance);
+}
+
+void Script::waitAngle(int16_t angle)
+{
+	append16(OP_WAIT_ANGLE, angle);
+}
+
+void Script::waitEvent(int8_t event)
+{
+	uint8_t data[2] = {OP_WAIT_EVENT, (uint8_t)event};
+	append(data, 2);
+}
+
+uint32_t Script::getHash() const
+{
+	uint32_t hash = 2166136261U;
+	for(uint32_t i = 0;i < m_Length;i++) {
+		hash ^= m_Buffer[i];
+		hash *= 16777619U;
+	}
+	return hash ^ m_Length;
+}
@@ -0,0 +1,104 @@
+#include "SensorGroup.h"
+
+using namespace net::ysuga::roomba;
+
+/**
+ * Data size of single sensor packets (Open Interface Specification)
+ */
+static const uint8_t s_SensorSize[MAX_SENSOR_ID + 1] = {
+	0, 0, 0, 0, 0, 0, 0,          //  0 -  6 (groups)
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, //  7 - 16
+	1, 1, 2, 2,                   // 17 - 20
+	1, 2, 2, 1, 2, 2,             // 21 - 26
+	2, 2, 2, 2, 2, 1, 2, 1,       // 27 - 34
+	1, 1, 1, 1, 2, 2, 2, 2,       // 35 - 42
+	2, 2, 1, 2, 2, 2, 2, 2, 2,    // 43 - 51
+	1, 1, 2, 2, 2, 2, 1,          // 52 - 58
+};
+
+/**
+ * Sensor group packets and the range of sensors included.
+ */
+static const struct {
+	uint8_t groupId;
+	uint8_t firstId;
+	uint8_t lastId;
+} s_GroupLayout[] = {
+	{SENSOR_GROUP_0,   BUMPS_AND_WHEEL_DROPS, BATTERY_CAPACITY},
+	{SENSOR_GROUP_1,   BUMPS_AND_WHEEL_DROPS, UNUSED_BYTE},
+	{SENSOR_GROUP_2,   INFRARED_CHARACTER_OMNI, ANGLE},
+	{SENSOR_GROUP_3,   CHARGING_STATE, BATTERY_CAPACITY},
+	{SENSOR_GROUP_4,   WALL_SIGNAL, CHARGING_SOURCE_AVAILABLE},
+	{SENSOR_GROUP_5,   OI_MODE, REQUESTED_LEFT_VELOCITY},
+	{SENSOR_GROUP_6,   BUMPS_AND_WHEEL_DROPS, REQUESTED_LEFT_VELOCITY},
+	{SENSOR_GROUP_100, BUMPS_AND_WHEEL_DROPS, STASIS},
+	{SENSOR_GROUP_101, RIGHT_ENCODER_COUNTS, STASIS},
+	{SENSOR_GROUP_106, LIGHT_BUMP_LEFT_SIGNAL, LIGHT_BUMP_RIGHT_SIGNAL},
+	{SENSOR_GROUP_107, LEFT_MOTOR_CURRENT, STASIS},
+};
+
+/**
+ * Offsets and sizes generated from the layout tables above.
+ */
+class SensorLayout {
+public:
+	uint8_t size[MAX_SENSOR_PACKET_ID + 1];
+	uint8_t offset[MAX_SENSOR_ID + 2];
+	uint8_t firstId[MAX_SENSOR_PACKET_ID + 1];
+	uint8_t lastId[MAX_SENSOR_PACKET_ID + 1];
+
+public:
+	SensorLayout() {
+		for(int i = 0;i <= MAX_SENSOR_PACKET_ID;i++) {
+			size[i] = i <= MAX_SENSOR_ID ? s_SensorSize[i] : 0;
+			firstId[i] = lastId[i] = 0;
+		}
+
+		// offset of each sensor from the head of SENSOR_GROUP_100
+		offset[BUMPS_AND_WHEEL_DROPS] = 0;
+		for(int i = BUMPS_AND_WHEEL_DROPS;i <= MAX_SENSOR_ID;i++) {
+			offset[i+1] = offset[i] + s_SensorSize[i];
+		}
+
+		for(unsigned int i = 0;i < sizeof(s_GroupLayout)/sizeof(s_GroupLayout[0]);i++) {
+			uint8_t id = s_GroupLayout[i].groupId;
+			firstId[id] = s_GroupLayout[i].firstId;
+			lastId[id] = s_GroupLayout[i].lastId;
+			size[id] = offset[lastId[id] + 1] - offset[firstId[id]];
+		}
+	}
+};
+
+static const SensorLayout s_Layout;
+
+
+uint32_t net::ysuga::roomba::getSensorDataSize(const uint8_t packetId)
+{
+	if(packetId > MAX_SENSOR_PACKET_ID) {
+		return 0;
+	}
+	return s_Layout.size[packetId];
+}
+
+bool net::ysuga::roomba::getSensorGroupRange(const uint8_t groupId, uint8_t* firstId, uint8_t* lastId)
+{
+	if(groupId > MAX_SENSOR_PACKET_ID || s_Layout.firstId[groupId] == 0) {
+		return false;
+	}
+	*firstId = s_Layout.firstId[groupId];
+	*lastId = s_Layout.lastId[groupId];
+	return true;
+}
+
+void net::ysuga::roomba::decodeSensorGroup(const uint8_t groupId, const uint8_t* data, uint16_t* values)
+{
+	const uint8_t first = s_Layout.firstId[groupId];
+	const uint8_t last = s_Layout.lastId[groupId];
+	const uint8_t* base = data - s_Layout.offset[first];
+	for(uint8_t id = first;id <= last;id++) {
+		// 1 byte sensor: p[0] == p[size-1] and shift is 0, so the high byte is masked out.
+		const uint8_t* p = base + s_Layout.offset[id];
+		const uint32_t shift = (s_Layout.size[id] - 1) * 8;
+		values[id] = (uint16_t)((((uint32_t)p[0] << shift) & 0xFF00) | p[s_Layout.size[id] - 1]);
+	}
+}
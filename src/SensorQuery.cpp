@@ -0,0 +1,110 @@
+#include "SensorQuery.h"
+#include "Roomba.h"
+#include "RoombaException.h"
+#include "Clock.h"
+
+using namespace net::ysuga::roomba;
+
+SensorQuery::SensorQuery() :
+m_pRoomba(NULL), m_pTransport(NULL), m_InFlight(false), m_Received(false), m_NumPackets(0),
+m_Callback(NULL), m_CallbackContext(NULL)
+{
+	m_Request.onComplete = onComplete;
+	m_Request.context = this;
+	for(uint32_t i = 0;i <= MAX_SENSOR_ID;i++) {
+		m_Values[i] = 0;
+		m_Contained[i] = false;
+	}
+}
+
+SensorQuery::~SensorQuery()
+{
+	if(m_InFlight) {
+		wait();
+	}
+}
+
+void SensorQuery::setCallback(SensorQueryCallback callback, void* context)
+{
+	m_Callback = callback;
+	m_CallbackContext = context;
+}
+
+bool SensorQuery::isReady()
+{
+	if(!m_InFlight) {
+		return true;
+	}
+	m_pTransport->Progress();
+	return m_pTransport->IsDone(&m_Request);
+}
+
+void SensorQuery::wait()
+{
+	if(m_InFlight) {
+		m_pTransport->Wait(&m_Request);
+		m_InFlight = false;
+	}
+}
+
+uint32_t SensorQuery::getRemainingTime() const
+{
+	if(!m_InFlight) {
+		return 0;
+	}
+	if(!m_Request.timeout) {
+		return 0xFFFFFFFF;
+	}
+	uint64_t waited = (net::ysuga::Clock::getInstance()->now() - m_Request.submitTime) / 1000;
+	return waited < m_Request.timeout ? m_Request.timeout - (uint32_t)waited : 0;
+}
+
+bool SensorQuery::contains(uint8_t sensorId) const
+{
+	return sensorId <= MAX_SENSOR_ID && m_Contained[sensorId];
+}
+
+uint16_t SensorQuery::getValue(uint8_t sensorId)
+{
+	if(!m_Received || !contains(sensorId)) {
+		throw PreconditionNotMetError();
+	}
+	return m_Values[sensorId];
+}
+
+/**
+ * Decode the response. Called in the thread which receives the response.
+ */
+void SensorQuery::onComplete(void* context)
+{
+	SensorQuery* query = (SensorQuery*)context;
+	if(query->m_Request.readBytes == query->m_Request.responseSize) {
+		uint16_t values[MAX_SENSOR_ID + 1];
+		uint8_t firstId, lastId;
+		uint32_t counter = 0;
+		for(uint32_t i = 0;i < query->m_NumPackets;i++) {
+			uint8_t packetId = query->m_PacketIds[i];
+			const uint8_t* data = query->m_Data + counter;
+			if(getSensorGroupRange(packetId, &firstId, &lastId)) {
+				decodeSensorGroup(packetId, data, values);
+				for(uint8_t id = firstId;id <= lastId;id++) {
+					query->m_Values[id] = values[id];
+					query->m_Contained[id] = true;
+				}
+			} else if(getSensorDataSize(packetId) == 1) {
+				query->m_Values[packetId] = data[0];
+				query->m_Contained[packetId] = true;
+			} else {
+				query->m_Values[packetId] = ((uint16_t)data[0] << 8) | data[1];
+				query->m_Contained[packetId] = true;
+			}
+			counter += getSensorDataSize(packetId);
+		}
+		query->m_Received = true;
+		query->m_pRoomba->storeSensorValues(query->m_Values, query->m_Contained);
+	}
+
+	if(query->m_Callback) {
+		query->m_Callback(query, query->m_CallbackContext);
+	}
+}
@@ -19,6 +19,8 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
+#include <sys/select.h>
+#include <sys/time.h>
 #include <fcntl.h>
 #include <termios.h>
 #include <errno.h>
@@ -29,6 +31,8 @@
 
 #include <iostream>
 #include "SerialPort.h"
+#include "Thread.h"
+#include "Clock.h"
 
 /* Header includeing division
  ************************************************/
@@ -38,8 +42,18 @@ using namespace net::ysuga;
 
 /******************************
  */
-SerialPort::SerialPort(const char* filename, const int baudrate)
+SerialPort::SerialPort(const char* filename, const int baudrate) :
+m_Filename(filename), m_Baudrate(baudrate)
 {
+	Open();
+}
+
+/******************************
+ */
+void SerialPort::Open()
+{
+	const char* filename = m_Filename.c_str();
+	const int baudrate = m_Baudrate;
 #ifdef WIN32
 	DCB dcb;
 	m_hComm = 0;
@@ -77,10 +91,11 @@ SerialPort::SerialPort(const char* filename, const int baudrate)
     }
 
 #else
-  if((m_Fd = open(filename, O_RDWR /*| O_NOCTTY |O_NONBLOCK*/)) < 0) {
+  // non-blocking, so that a full Tx Buffer never blocks the writer (see TryWrite).
+  // the reads are always preceded by the size in the Rx Buffer.
+  if((m_Fd = open(filename, O_RDWR | O_NONBLOCK /*| O_NOCTTY*/)) < 0) {
       throw ComOpenException();
   }
-  std::cout << "fopen ok" << std::endl;
     struct termios tio;
     memset(&tio, 0, sizeof(tio));
     cfsetspeed(&tio, baudrate);
@@ -89,19 +104,53 @@ SerialPort::SerialPort(const char* filename, const int baudrate)
 #endif
 }
 
+/******************************
+ */
+SerialPort::SerialPort() :
+m_Baudrate(0)
+{
+#ifdef WIN32
+	m_hComm = 0;
+#else
+	m_Fd = -1;
+#endif
+}
+
 /******************************
  */
 SerialPort::~SerialPort()
+{
+	Close();
+}
+
+/******************************
+ */
+void SerialPort::Close()
 {
 #ifdef WIN32
 	if(m_hComm) {
 		CloseHandle(m_hComm);
+		m_hComm = 0;
 	}
 #else
-	close(m_Fd);
+	if(m_Fd >= 0) {
+		close(m_Fd);
+		m_Fd = -1;
+	}
 #endif
 }
 
+/******************************
+ */
+void SerialPort::Reopen()
+{
+	if(m_Filename.empty()) {
+		return;
+	}
+	Close();
+	Open();
+}
+
 
 /*******************************
  */
@@ -136,13 +185,24 @@ void SerialPort::FlushTxBuffer()
 /*******************************
  */
 int SerialPort::GetSizeInRxBuffer()
+{
+	int size = TryGetSizeInRxBuffer();
+	if(size < 0) {
+		throw ComAccessException();
+	}
+	return size;
+}
+
+/*******************************
+ */
+int SerialPort::TryGetSizeInRxBuffer()
 {
 #ifdef WIN32
     COMSTAT         stat;
     DWORD           lper;
 
 	if(ClearCommError (m_hComm, &lper, &stat) == 0) {
-		throw ComAccessException();
+		return -1;
 	}
     return stat.cbInQue;
 #else
@@ -158,7 +218,7 @@ int SerialPort::GetSizeInRxBuffer()
 	case 0: //timeout
 		return 0;
 	case -1: //Error
-		throw ComAccessException();
+		return errno == EINTR ? 0 : -1;
 	default:
 		if(FD_ISSET(m_Fd, &fds)) {
 		ioctl(m_Fd, FIONREAD, &nread);
@@ -169,9 +229,186 @@ int SerialPort::GetSizeInRxBuffer()
 #endif
 }
 
+/*******************************
+ */
+void SerialPort::WaitReadable(const unsigned int timeout, const StopToken* stopToken)
+{
+#ifdef WIN32
+	if(!m_hComm || !stopToken) {
+		Thread::Sleep(1);
+		return;
+	}
+	// the comm handle is not waitable without the overlapped I/O. poll it every 1 ms.
+	WaitForSingleObject(stopToken->GetHandle(), 1);
+#else
+	if(m_Fd < 0) {
+		Thread::Sleep(1);
+		return;
+	}
+	// some bytes are already received but not enough (or the port is broken). the port
+	// is always readable then, so wait 1 ms for the rest watching only the token.
+	unsigned int wait = timeout;
+	fd_set fds;
+	FD_ZERO(&fds);
+	int maxFd = -1;
+	if(TryGetSizeInRxBuffer() != 0) {
+		wait = wait < 1 ? wait : 1;
+	} else {
+		FD_SET(m_Fd, &fds);
+		maxFd = m_Fd;
+	}
+	if(stopToken && stopToken->GetFd() >= 0) {
+		FD_SET(stopToken->GetFd(), &fds);
+		if(stopToken->GetFd() > maxFd) {
+			maxFd = stopToken->GetFd();
+		}
+	}
+	struct timeval tv;
+	tv.tv_sec = wait / 1000;
+	tv.tv_usec = (wait % 1000) * 1000;
+	select(maxFd + 1, &fds, NULL, NULL, &tv);
+#endif
+}
+
+void SerialPort::WaitReadable(SerialPort* const* ports, const unsigned int count, const unsigned int timeout,
+							  const StopToken* stopToken, Event* event /* = NULL */)
+{
+	unsigned int wait = timeout;
+	bool device = false;
+#ifdef WIN32
+	for(unsigned int i = 0;i < count;i++) {
+		if(ports[i]->m_hComm) {
+			device = true;
+		}
+	}
+	if(device) {
+		// the comm handles are not waitable without the overlapped I/O. poll them every 1 ms.
+		wait = wait < 1 ? wait : 1;
+		if(stopToken && event) {
+			HANDLE handles[2] = {stopToken->GetHandle(), event->GetHandle()};
+			WaitForMultipleObjects(2, handles, FALSE, wait);
+		} else if(stopToken) {
+			WaitForSingleObject(stopToken->GetHandle(), wait);
+		} else if(event) {
+			event->Wait(wait);
+		} else {
+			::Sleep(wait);
+		}
+		return;
+	}
+#else
+	fd_set fds;
+	FD_ZERO(&fds);
+	int maxFd = -1;
+	for(unsigned int i = 0;i < count;i++) {
+		const int fd = ports[i]->m_Fd;
+		if(fd < 0) {
+			wait = wait < 1 ? wait : 1;
+			continue;
+		}
+		device = true;
+		if(fd >= FD_SETSIZE || ports[i]->TryGetSizeInRxBuffer() != 0) {
+			wait = wait < 1 ? wait : 1;
+			continue;
+		}
+		FD_SET(fd, &fds);
+		if(fd > maxFd) {
+			maxFd = fd;
+		}
+	}
+	if(device) {
+		if(stopToken && stopToken->GetFd() >= 0) {
+			FD_SET(stopToken->GetFd(), &fds);
+			if(stopToken->GetFd() > maxFd) {
+				maxFd = stopToken->GetFd();
+			}
+		}
+		if(event && event->GetFd() >= 0) {
+			FD_SET(event->GetFd(), &fds);
+			if(event->GetFd() > maxFd) {
+				maxFd = event->GetFd();
+			}
+		}
+		struct timeval tv;
+		tv.tv_sec = wait / 1000;
+		tv.tv_usec = (wait % 1000) * 1000;
+		if(select(maxFd + 1, &fds, NULL, NULL, &tv) > 0 && event && event->GetFd() >= 0 &&
+			FD_ISSET(event->GetFd(), &fds)) {
+			// the event stays readable until it is read.
+			event->Wait(0);
+		}
+		return;
+	}
+#endif
+	if(event) {
+		event->Wait(wait);
+	} else if(stopToken) {
+		Clock::getInstance()->sleepUnlessStopped(wait, *stopToken);
+	} else {
+		Thread::Sleep(wait);
+	}
+}
+
+/*******************************
+ */
+void SerialPort::WaitWritable(const unsigned int timeout, Event* event)
+{
+#ifdef WIN32
+	// WriteFile writes all the data. nothing to wait for.
+	if(!m_hComm) {
+		Thread::Sleep(1);
+	}
+#else
+	if(m_Fd < 0) {
+		Thread::Sleep(1);
+		return;
+	}
+	fd_set readFds, writeFds;
+	FD_ZERO(&readFds);
+	FD_ZERO(&writeFds);
+	FD_SET(m_Fd, &writeFds);
+	int maxFd = m_Fd;
+	if(event && event->GetFd() >= 0) {
+		FD_SET(event->GetFd(), &readFds);
+		if(event->GetFd() > maxFd) {
+			maxFd = event->GetFd();
+		}
+	}
+	struct timeval tv;
+	tv.tv_sec = timeout / 1000;
+	tv.tv_usec = (timeout % 1000) * 1000;
+	if(select(maxFd + 1, &readFds, &writeFds, NULL, &tv) > 0 && event && event->GetFd() >= 0 &&
+		FD_ISSET(event->GetFd(), &readFds)) {
+		event->Wait(0);
+	}
+#endif
+}
+
 /*******************************
  */
 int SerialPort::Write(const void* src, const unsigned int size)
+{
+	int ret = TryWrite(src, size);
+	if(ret < 0) {
+		throw ComAccessException();
+	}
+	return ret;
+}
+
+/*******************************
+ */
+int SerialPort::Read(void *dst, const unsigned int size)
+{
+	int ret = TryRead(dst, size);
+	if(ret < 0) {
+		throw ComAccessException();
+	}
+	return ret;
+}
+
+/*******************************
+ */
+int SerialPort::TryWrite(const void* src, const unsigned int size)
 {
 	if(size == 0) {
 		return 0;
@@ -179,35 +416,41 @@ int SerialPort::Write(const void* src, const unsigned int size)
 #ifdef WIN32
 	DWORD WrittenBytes;
 	if(!WriteFile(m_hComm, src, size, &WrittenBytes, NULL)) {
-		throw ComAccessException();
+		return -1;
 	}
 
 	return WrittenBytes;
 #else
-	int ret;
-	if((ret = write(m_Fd, src, size)) < 0) {
-		throw ComAccessException();
+	int ret = write(m_Fd, src, size);
+	if(ret < 0) {
+		if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+			// the Tx Buffer is full. nothing is written.
+			return 0;
+		}
+		return -1;
 	}
 	return ret;
 #endif
-
 }
 
 /*******************************
  */
-int SerialPort::Read(void *dst, const unsigned int size)
+int SerialPort::TryRead(void *dst, const unsigned int size)
 {
 #ifdef WIN32
 	DWORD ReadBytes;
 	if(!ReadFile(m_hComm, dst, size, &ReadBytes, NULL)) {
-		throw ComAccessException();
+		return -1;
 	}
 
 	return ReadBytes;
 #else
-	int ret;
-	if((ret = read(m_Fd, dst, size))< 0) {
-		throw ComAccessException();
+	int ret = read(m_Fd, dst, size);
+	if(ret < 0) {
+		if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+			return 0;
+		}
+		return -1;
 	}
 	return ret;
 #endif
@@ -0,0 +1,359 @@
+#include "SimulatedRobot.h"
+#include "Roomba.h"
+#include "op_code.h"
+#include "Clock.h"
+
+#include <math.h>
+
+using namespace net::ysuga;
+using namespace net::ysuga::roomba;
+
+#define SIMULATED_AXLE_LENGTH 235.0 // [mm]
+#define SIMULATED_MM_PER_COUNT 0.445558279992234 // [mm]
+#define SIMULATED_FRAME_PERIOD (STREAM_PERIOD * 1000) // [usec]
+
+SimulatedRobot::SimulatedRobot(const uint32_t version) :
+m_Version(version), m_Time(0), m_NextFrameTime(SIMULATED_FRAME_PERIOD),
+m_VelocityRight(0), m_VelocityLeft(0), m_EncoderRight(0), m_EncoderLeft(0),
+m_Distance(0), m_Angle(0), m_Streaming(false), m_CommandCount(0), m_FrameCount(0),
+m_FollowClock(false), m_ClockOffset(0)
+{
+	for(uint32_t i = 0;i <= MAX_SENSOR_ID;i++) {
+		m_Values[i] = 0;
+	}
+	m_Values[VOLTAGE] = 14400;
+	m_Values[TEMPERATURE] = 25;
+	m_Values[BATTERY_CHARGE] = 2500;
+	m_Values[BATTERY_CAPACITY] = 3000;
+}
+
+SimulatedRobot::~SimulatedRobot()
+{
+}
+
+void SimulatedRobot::FlushRxBuffer()
+{
+	m_Mutex.Lock();
+	m_RxBuffer.clear();
+	m_Mutex.Unlock();
+}
+
+void SimulatedRobot::FlushTxBuffer()
+{
+}
+
+int SimulatedRobot::TryGetSizeInRxBuffer()
+{
+	m_Mutex.Lock();
+	catchUpClock();
+	int size = m_RxBuffer.size();
+	m_Mutex.Unlock();
+	return size;
+}
+
+int SimulatedRobot::TryRead(void *dst, const unsigned int size)
+{
+	m_Mutex.Lock();
+	unsigned int count = 0;
+	for(;count < size && !m_RxBuffer.empty();count++) {
+		((uint8_t*)dst)[count] = m_RxBuffer.front();
+		m_RxBuffer.pop_front();
+	}
+	m_Mutex.Unlock();
+	return count;
+}
+
+int SimulatedRobot::TryWrite(const void* src, const unsigned int size)
+{
+	m_Mutex.Lock();
+	// the command takes effect at the current time.
+	catchUpClock();
+	for(unsigned int i = 0;i < size;i++) {
+		m_Command.push_back(((const uint8_t*)src)[i]);
+		uint32_t length = getCommandLength(m_Command);
+		if(length == 0) {
+			// unknown opcode
+			m_Command.clear();
+		} else if(m_Command.size() == length) {
+			execute(m_Command);
+			m_Command.clear();
+			m_CommandCount++;
+		}
+	}
+	m_Mutex.Unlock();
+	return size;
+}
+
+/**
+ * Total bytes of the command including the opcode. 0 if the opcode is unknown.
+ * Returns more than the current size while the length is not determined yet.
+ */
+uint32_t SimulatedRobot::getCommandLength(const std::vector<uint8_t>& command)
+{
+	switch(command[0]) {
+	case OP_START: case OP_CONTROL: case OP_SAFE: case OP_FULL: case OP_POWER:
+	case OP_SPOT: case OP_CLEAN: case OP_MAX: case OP_DOCK:
+	case OP_PLAY_SCRIPT: case OP_SHOW_SCRIPT:
+		return 1;
+	case OP_BAUD: case OP_MOTORS: case OP_PLAY: case OP_SENSORS:
+	case OP_PAUSE_RESUME_STREAM: case OP_WAIT_TIME: case OP_WAIT_EVENT:
+		return 2;
+	case OP_WAIT_DISTANCE: case OP_WAIT_ANGLE:
+		return 3;
+	case OP_LEDS:
+		return 4;
+	case OP_DRIVE: case OP_DRIVE_DIRECT: case OP_DRIVE_PWM:
+		return 5;
+	case OP_SONG:
+		return command.size() < 3 ? 3 : 3 + 2 * command[2];
+	case OP_STREAM: case OP_QUERY_LIST: case OP_SCRIPT:
+		return command.size() < 2 ? 2 : 2 + command[1];
+	default:
+		return 0;
+	}
+}
+
+void SimulatedRobot::execute(const std::vector<uint8_t>& command)
+{
+	switch(command[0]) {
+	case OP_START:
+		m_Values[OI_MODE] = 1;
+		break;
+	case OP_CONTROL: case OP_SAFE:
+		m_Values[OI_MODE] = 2;
+		break;
+	case OP_FULL:
+		m_Values[OI_MODE] = 3;
+		break;
+	case OP_POWER:
+		m_Values[OI_MODE] = 0;
+		setWheelVelocity(0, 0);
+		break;
+	case OP_DRIVE:
+		{
+			int16_t velocity = (int16_t)((command[1] << 8) | command[2]);
+			int16_t radius = (int16_t)((command[3] << 8) | command[4]);
+			m_Values[REQUESTED_VELOCITY] = (uint16_t)velocity;
+			m_Values[REQUESTED_RADIUS] = (uint16_t)radius;
+			if(radius == (int16_t)0x8000 || radius == 0x7FFF) {
+				setWheelVelocity(velocity, velocity);
+			} else if(radius == 1) {
+				setWheelVelocity(velocity, -velocity);
+			} else if(radius == -1) {
+				setWheelVelocity(-velocity, velocity);
+			} else {
+				setWheelVelocity(velocity * (radius + SIMULATED_AXLE_LENGTH / 2) / radius,
+					velocity * (radius - SIMULATED_AXLE_LENGTH / 2) / radius);
+			}
+		}
+		break;
+	case OP_DRIVE_DIRECT:
+		setWheelVelocity((int16_t)((command[1] << 8) | command[2]), (int16_t)((command[3] << 8) | command[4]));
+		break;
+	case OP_DRIVE_PWM:
+		// assumes the full PWM (255) drives 500 mm/s without load.
+		setWheelVelocity((int16_t)((command[1] << 8) | command[2]) * 500.0 / 255,
+			(int16_t)((command[3] << 8) | command[4]) * 500.0 / 255);
+		break;
+	case OP_SENSORS:
+		{
+			std::vector<uint8_t> data;
+			updateValues();
+			encode(command[1], data);
+			m_RxBuffer.insert(m_RxBuffer.end(), data.begin(), data.end());
+		}
+		break;
+	case OP_QUERY_LIST:
+		{
+			std::vector<uint8_t> data;
+			updateValues();
+			for(uint32_t i = 0;i < command[1];i++) {
+				encode(command[i+2], data);
+			}
+			m_RxBuffer.insert(m_RxBuffer.end(), data.begin(), data.end());
+		}
+		break;
+	case OP_STREAM:
+		if(m_Version == Roomba::VERSION_500_SERIES) {
+			m_StreamList.assign(command.begin() + 2, command.end());
+			m_Streaming = true;
+		}
+		break;
+	case OP_PAUSE_RESUME_STREAM:
+		if(m_Version == Roomba::VERSION_500_SERIES) {
+			m_Streaming = command[1] != 0;
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+void SimulatedRobot::setWheelVelocity(double right, double left)
+{
+	m_VelocityRight = right > 500 ? 500 : (right < -500 ? -500 : right);
+	m_VelocityLeft = left > 500 ? 500 : (left < -500 ? -500 : left);
+	m_Values[REQUESTED_RIGHT_VELOCITY] = (uint16_t)(int16_t)m_VelocityRight;
+	m_Values[REQUESTED_LEFT_VELOCITY] = (uint16_t)(int16_t)m_VelocityLeft;
+}
+
+/**
+ * Move the wheels for dt [sec]
+ */
+void SimulatedRobot::integrate(const double dt)
+{
+	double right = m_VelocityRight * dt;
+	double left = m_VelocityLeft * dt;
+	m_EncoderRight += right / SIMULATED_MM_PER_COUNT;
+	m_EncoderLeft += left / SIMULATED_MM_PER_COUNT;
+	m_Distance += (right + left) / 2;
+	m_Angle += (right - left) / SIMULATED_AXLE_LENGTH * 180.0 / 3.14159265358979;
+}
+
+void SimulatedRobot::updateValues()
+{
+	m_Values[RIGHT_ENCODER_COUNTS] = (uint16_t)((int64_t)floor(m_EncoderRight) & 0xFFFF);
+	m_Values[LEFT_ENCODER_COUNTS] = (uint16_t)((int64_t)floor(m_EncoderLeft) & 0xFFFF);
+	m_Values[DISTANCE] = (uint16_t)(int16_t)m_Distance;
+	m_Values[ANGLE] = (uint16_t)(int16_t)m_Angle;
+}
+
+/**
+ * Append the bytes of the packet (big endian). Distance and angle are reset when they are sent.
+ */
+void SimulatedRobot::encode(uint8_t packetId, std::vector<uint8_t>& data)
+{
+	uint8_t firstId, lastId;
+	if(!getSensorGroupRange(packetId, &firstId, &lastId)) {
+		firstId = lastId = packetId;
+	}
+	for(uint32_t id = firstId;id <= lastId && id <= MAX_SENSOR_ID;id++) {
+		uint32_t size = getSensorDataSize(id);
+		if(size == 2) {
+			data.push_back((uint8_t)(m_Values[id] >> 8));
+		}
+		if(size >= 1) {
+			data.push_back((uint8_t)(m_Values[id] & 0xFF));
+		}
+		if(id == DISTANCE) {
+			m_Distance -= (int16_t)m_Values[DISTANCE];
+		} else if(id == ANGLE) {
+			m_Angle -= (int16_t)m_Values[ANGLE];
+		}
+	}
+}
+
+void SimulatedRobot::emitFrame()
+{
+	std::vector<uint8_t> data;
+	updateValues();
+	for(uint32_t i = 0;i < m_StreamList.size();i++) {
+		data.push_back(m_StreamList[i]);
+		encode(m_StreamList[i], data);
+	}
+
+	uint8_t sum = 19 + (uint8_t)data.size();
+	m_RxBuffer.push_back(19);
+	m_RxBuffer.push_back((uint8_t)data.size());
+	for(uint32_t i = 0;i < data.size();i++) {
+		m_RxBuffer.push_back(data[i]);
+		sum += data[i];
+	}
+	m_RxBuffer.push_back((uint8_t)(0x100 - sum));
+	m_FrameCount++;
+}
+
+void SimulatedRobot::advance(const uint32_t usec)
+{
+	m_Mutex.Lock();
+	advanceTo(m_Time + usec);
+	m_Mutex.Unlock();
+}
+
+void SimulatedRobot::followClock()
+{
+	m_Mutex.Lock();
+	m_FollowClock = true;
+	m_ClockOffset = Clock::getInstance()->now() - m_Time;
+	m_Mutex.Unlock();
+}
+
+/**
+ * Advance to the library clock if followClock is called. m_Mutex must be locked.
+ */
+void SimulatedRobot::catchUpClock()
+{
+	if(m_FollowClock) {
+		advanceTo(Clock::getInstance()->now() - m_ClockOffset);
+	}
+}
+
+void SimulatedRobot::advanceTo(const uint64_t end)
+{
+	if(end <= m_Time) {
+		return;
+	}
+	while(m_NextFrameTime <= end) {
+		integrate((m_NextFrameTime - m_Time) / 1000000.0);
+		m_Time = m_NextFrameTime;
+		m_NextFrameTime += SIMULATED_FRAME_PERIOD;
+		if(m_Streaming) {
+			emitFrame();
+		}
+	}
+	integrate((end - m_Time) / 1000000.0);
+	m_Time = end;
+}
+
+uint64_t SimulatedRobot::getTime()
+{
+	m_Mutex.Lock();
+	uint64_t time = m_Time;
+	m_Mutex.Unlock();
+	return time;
+}
+
+void SimulatedRobot::setSensorValue(const uint8_t sensorId, const uint16_t value)
+{
+	if(sensorId <= MAX_SENSOR_ID) {
+		m_Mutex.Lock();
+		m_Values[sensorId] = value;
+		m_Mutex.Unlock();
+	}
+}
+
+void SimulatedRobot::getWheelVelocity(double* right, double* left)
+{
+	m_Mutex.Lock();
+	*right = m_VelocityRight;
+	*left = m_VelocityLeft;
+	m_Mutex.Unlock();
+}
+
+uint32_t SimulatedRobot::getCommandCount()
+{
+	m_Mutex.Lock();
+	uint32_t count = m_CommandCount;
+	m_Mutex.Unlock();
+	return count;
+}
+
+uint32_t SimulatedRobot::getFrameCount()
+{
+	m_Mutex.Lock();
+	uint32_t count = m_FrameCount;
+	m_Mutex.Unlock();
+	return count;
+}
+
+void SimulatedRobot::resetInterface()
+{
+	m_Mutex.Lock();
+	m_Values[OI_MODE] = 0;
+	m_Streaming = false;
+	m_StreamList.clear();
+	m_Command.clear();
+	m_RxBuffer.clear();
+	setWheelVelocity(0, 0);
+	m_Mutex.Unlock();
+}
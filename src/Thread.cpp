@@ -1,16 +1,31 @@
 
 #include "Thread.h"
+#include "Clock.h"
 
-#ifndef WIN32
+#ifdef WIN32
+#include <malloc.h>
+#define alloca _alloca
+#else
 #include <time.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <errno.h>
+#include <limits.h>
+#include <alloca.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
 #endif
 
 using namespace net::ysuga;
 
-Thread::Thread(void)
+Thread::Thread(void) :
+m_AttributesApplied(true)
 {
 
 }
@@ -21,55 +36,369 @@ Thread::~Thread(void)
 }
 
 
+/**
+ * Touch the pages of the stack below the caller.
+ */
+static void PrefaultStack(size_t size)
+{
+	volatile char* stack = (volatile char*)alloca(size);
+	for(size_t i = 0;i < size;i += 4096) {
+		stack[i] = 0;
+	}
+}
+
 THREAD_ROUTINE StartRoutine(void* arg)
 {
 	Thread* threadObject = (Thread*)arg;
+	const ThreadAttributes& attributes = threadObject->GetAttributes();
+	if(attributes.prefaultStack) {
+		// leave the room for the frames of Run.
+		PrefaultStack(attributes.stackSize ? attributes.stackSize * 3 / 4 : DEFAULT_PREFAULT_STACK_SIZE);
+	}
 	threadObject->Run();
-	threadObject->Exit(0);
-#ifdef WIN32
-	ExitThread(0);
-#else 
-	pthread_exit(0);
-#endif
+	// return normally so that the stack is unwound.
+	Clock::getInstance()->detachThread();
 	return 0;
 }
 
+#ifdef __linux__
+/**
+ * CPU set of the affinity mask of ThreadAttributes
+ */
+static void GetCpuSet(unsigned long affinityMask, cpu_set_t* cpuSet)
+{
+	CPU_ZERO(cpuSet);
+	for(unsigned int i = 0;i < sizeof(affinityMask) * 8 && i < CPU_SETSIZE;i++) {
+		if(affinityMask & (1UL << i)) {
+			CPU_SET(i, cpuSet);
+		}
+	}
+}
+#endif
+
+#ifndef WIN32
+/**
+ * Initialize the attributes of pthread_create.
+ * The policy and the affinity are set only if they are requested.
+ *
+ * @return false if the affinity can not be set in the attributes (it is set after the creation then).
+ */
+static bool InitAttributes(pthread_attr_t* attr, const ThreadAttributes& attributes, bool policy, bool affinity)
+{
+	pthread_attr_init(attr);
+	if(attributes.stackSize) {
+		size_t stackSize = attributes.stackSize < (size_t)PTHREAD_STACK_MIN ? (size_t)PTHREAD_STACK_MIN : attributes.stackSize;
+		pthread_attr_setstacksize(attr, stackSize);
+	}
+	if(policy) {
+		struct sched_param param;
+		param.sched_priority = attributes.priority;
+		pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(attr, attributes.policy == ThreadAttributes::POLICY_FIFO ? SCHED_FIFO : SCHED_RR);
+		pthread_attr_setschedparam(attr, &param);
+	}
+#if defined(__linux__) && defined(__GLIBC__)
+	if(affinity) {
+		// the thread never runs on the other CPUs, even before its first instruction.
+		cpu_set_t cpuSet;
+		GetCpuSet(attributes.affinityMask, &cpuSet);
+		return pthread_attr_setaffinity_np(attr, sizeof(cpuSet), &cpuSet) == 0;
+	}
+	return true;
+#else
+	return !affinity;
+#endif
+}
+#endif
+
 
 void Thread::Start()
 {	
+	Clock::getInstance()->attachThread();
+	m_AttributesApplied = true;
 #ifdef WIN32
-	m_Handle = CreateThread(NULL, 0, StartRoutine, (LPVOID)this, 0, &m_ThreadId);
+	m_Handle = CreateThread(NULL, m_Attributes.stackSize, StartRoutine, (LPVOID)this, CREATE_SUSPENDED, &m_ThreadId);
+	if(m_Handle == NULL) {
+		// the thread which is not started never detaches itself.
+		Clock::getInstance()->detachThread();
+		return;
+	}
+	if(m_Attributes.policy != ThreadAttributes::POLICY_DEFAULT) {
+		int priority = m_Attributes.policy == ThreadAttributes::POLICY_FIFO ? THREAD_PRIORITY_TIME_CRITICAL : THREAD_PRIORITY_HIGHEST;
+		if(!SetThreadPriority(m_Handle, priority)) {
+			m_AttributesApplied = false;
+		}
+	}
+	if(m_Attributes.affinityMask && !SetThreadAffinityMask(m_Handle, m_Attributes.affinityMask)) {
+		m_AttributesApplied = false;
+	}
+	ResumeThread(m_Handle);
 #else
-	int ret = pthread_create(&m_Handle, NULL, StartRoutine, (void*)this);
+	bool policy = m_Attributes.policy != ThreadAttributes::POLICY_DEFAULT;
+	bool affinity = m_Attributes.affinityMask != 0;
+	int ret;
+	while(1) {
+		pthread_attr_t attr;
+		bool affinityInAttr = InitAttributes(&attr, m_Attributes, policy, affinity);
+		ret = pthread_create(&m_Handle, &attr, StartRoutine, (void*)this);
+		pthread_attr_destroy(&attr);
+		if(ret == 0) {
+			if(affinity && !affinityInAttr) {
+#ifdef __linux__
+				cpu_set_t cpuSet;
+				GetCpuSet(m_Attributes.affinityMask, &cpuSet);
+				if(pthread_setaffinity_np(m_Handle, sizeof(cpuSet), &cpuSet) != 0) {
+					m_AttributesApplied = false;
+				}
+#else
+				// no affinity API (e.g. Mac OS X).
+				m_AttributesApplied = false;
+#endif
+			}
+			break;
+		}
+		// not privileged, or none of the CPUs is available. run with the attributes of the caller.
+		if(policy) {
+			policy = false;
+		} else if(affinity) {
+			affinity = false;
+		} else {
+			break;
+		}
+		m_AttributesApplied = false;
+	}
 	if(ret != 0) {
-	  perror("pthread_create");
+		perror("pthread_create");
+		// the thread which is not started never detaches itself.
+		Clock::getInstance()->detachThread();
+		return;
 	}
 #endif
 }
 
 void Thread::Join()
 {
+	// the thread is waited in real time. it is not a sleeper of the simulation then.
+	Clock::getInstance()->detachThread();
 #ifdef WIN32
 	WaitForSingleObject(m_Handle, INFINITE);
 #else
 	void* retval;
 	pthread_join(m_Handle, &retval);
 #endif
+	Clock::getInstance()->attachThread();
 }
 
 void Thread::Sleep(unsigned long milliSeconds)
+{
+	Clock::getInstance()->sleep(milliSeconds);
+}
+
+ReadWriteLock::ReadWriteLock()
+{
+#ifdef WIN32
+	::InitializeSRWLock(&m_Lock);
+#else
+	pthread_rwlockattr_t attr;
+	pthread_rwlockattr_init(&attr);
+#ifdef __GLIBC__
+	// glibc prefers the readers by default.
+	pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+	pthread_rwlock_init(&m_Lock, &attr);
+	pthread_rwlockattr_destroy(&attr);
+#endif
+}
+
+ReadWriteLock::~ReadWriteLock()
+{
+#ifndef WIN32
+	pthread_rwlock_destroy(&m_Lock);
+#endif
+}
+
+StopToken::StopToken() :
+m_StopRequested(false)
+{
+#ifdef WIN32
+	m_Event = ::CreateEvent(NULL, TRUE, FALSE, NULL);
+#elif defined(__linux__)
+	m_ReadFd = m_WriteFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#else
+	int fds[2];
+	if(pipe(fds) == 0) {
+		fcntl(fds[0], F_SETFL, O_NONBLOCK);
+		fcntl(fds[1], F_SETFL, O_NONBLOCK);
+		m_ReadFd = fds[0];
+		m_WriteFd = fds[1];
+	} else {
+		m_ReadFd = m_WriteFd = -1;
+	}
+#endif
+}
+
+StopToken::~StopToken()
+{
+#ifdef WIN32
+	::CloseHandle(m_Event);
+#else
+	if(m_ReadFd >= 0) {
+		close(m_ReadFd);
+	}
+	if(m_WriteFd != m_ReadFd && m_WriteFd >= 0) {
+		close(m_WriteFd);
+	}
+#endif
+}
+
+void StopToken::RequestStop()
+{
+	m_StopRequested = true;
+#ifdef WIN32
+	::SetEvent(m_Event);
+#else
+	// 8 bytes for eventfd. A full pipe is already readable.
+	uint64_t one = 1;
+	if(write(m_WriteFd, &one, m_WriteFd == m_ReadFd ? sizeof(one) : 1) < 0 && errno != EAGAIN) {
+		perror("StopToken");
+	}
+#endif
+}
+
+void StopToken::Reset()
+{
+#ifdef WIN32
+	::ResetEvent(m_Event);
+#else
+	uint64_t buf;
+	while(read(m_ReadFd, &buf, sizeof(buf)) > 0);
+#endif
+	m_StopRequested = false;
+}
+
+bool StopToken::Wait(const unsigned int timeout) const
+{
+#ifdef WIN32
+	::WaitForSingleObject(m_Event, timeout);
+#else
+	if(m_ReadFd >= 0) {
+		fd_set fds;
+		FD_ZERO(&fds);
+		FD_SET(m_ReadFd, &fds);
+		struct timeval tv;
+		tv.tv_sec = timeout / 1000;
+		tv.tv_usec = (timeout % 1000) * 1000;
+		select(m_ReadFd + 1, &fds, NULL, NULL, &tv);
+	} else if(!m_StopRequested) {
+		// no file descriptor to wait. the caller polls every 1 ms.
+		usleep(1000);
+	}
+#endif
+	return m_StopRequested;
+}
+
+Event::Event()
+{
+#ifdef WIN32
+	m_Event = ::CreateEvent(NULL, FALSE, FALSE, NULL);
+#elif defined(__linux__)
+	m_ReadFd = m_WriteFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#else
+	int fds[2];
+	if(pipe(fds) == 0) {
+		fcntl(fds[0], F_SETFL, O_NONBLOCK);
+		fcntl(fds[1], F_SETFL, O_NONBLOCK);
+		m_ReadFd = fds[0];
+		m_WriteFd = fds[1];
+	} else {
+		m_ReadFd = m_WriteFd = -1;
+	}
+#endif
+}
+
+Event::~Event()
+{
+#ifdef WIN32
+	::CloseHandle(m_Event);
+#else
+	if(m_ReadFd >= 0) {
+		close(m_ReadFd);
+	}
+	if(m_WriteFd != m_ReadFd && m_WriteFd >= 0) {
+		close(m_WriteFd);
+	}
+#endif
+}
+
+void Event::Set()
+{
+#ifdef WIN32
+	::SetEvent(m_Event);
+#else
+	// 8 bytes for eventfd. A full pipe is already readable.
+	uint64_t one = 1;
+	if(write(m_WriteFd, &one, m_WriteFd == m_ReadFd ? sizeof(one) : 1) < 0 && errno != EAGAIN) {
+		perror("Event");
+	}
+#endif
+}
+
+bool Event::Wait(const unsigned int timeout)
+{
+#ifdef WIN32
+	return ::WaitForSingleObject(m_Event, timeout) == WAIT_OBJECT_0;
+#else
+	if(m_ReadFd < 0) {
+		Thread::Sleep(timeout);
+		return false;
+	}
+	fd_set fds;
+	FD_ZERO(&fds);
+	FD_SET(m_ReadFd, &fds);
+	struct timeval tv;
+	tv.tv_sec = timeout / 1000;
+	tv.tv_usec = (timeout % 1000) * 1000;
+	if(select(m_ReadFd + 1, &fds, NULL, NULL, &tv) <= 0) {
+		return false;
+	}
+	uint64_t buf;
+	bool set = false;
+	while(read(m_ReadFd, &buf, sizeof(buf)) > 0) {
+		set = true;
+	}
+	return set;
+#endif
+}
+
+ThreadLocalKey::ThreadLocalKey(Destructor destructor)
+{
+#ifdef WIN32
+	m_Index = ::FlsAlloc(destructor);
+#else
+	pthread_key_create(&m_Key, destructor);
+#endif
+}
+
+void ThreadLocalKey::Set(void* value)
+{
+#ifdef WIN32
+	::FlsSetValue(m_Index, value);
+#else
+	pthread_setspecific(m_Key, value);
+#endif
+}
+
+bool Thread::LockMemory()
 {
 #ifdef WIN32
-	::Sleep(milliSeconds);
+	return false;
 #else
-  struct timespec interval;
-  interval.tv_sec = milliSeconds / 1000;
-  interval.tv_nsec = (milliSeconds % 1000) * 1000000;
-  nanosleep(&interval, NULL);
+	return mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
 #endif
 }
 
 void Thread::Exit(unsigned long exitCode) {
+	Clock::getInstance()->detachThread();
 #ifdef WIN32
 	ExitThread(exitCode);
 #else
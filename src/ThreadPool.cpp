@@ -0,0 +1,119 @@
+#include "ThreadPool.h"
+#include "Atomic.h"
+
+using namespace net::ysuga;
+
+Worker::Worker(WorkStealingPool* pool, uint32_t index) :
+m_pPool(pool), m_Index(index), m_Idle(0)
+{
+}
+
+Worker::~Worker()
+{
+}
+
+bool Worker::pop(Task* task)
+{
+	m_QueueMutex.Lock();
+	bool found = !m_Queue.empty();
+	if(found) {
+		*task = m_Queue.back();
+		m_Queue.pop_back();
+	}
+	m_QueueMutex.Unlock();
+	return found;
+}
+
+bool Worker::steal(Task* task)
+{
+	m_QueueMutex.Lock();
+	bool found = !m_Queue.empty();
+	if(found) {
+		*task = m_Queue.front();
+		m_Queue.pop_front();
+	}
+	m_QueueMutex.Unlock();
+	return found;
+}
+
+void Worker::Run()
+{
+	const uint32_t numWorkers = m_pPool->m_Workers.size();
+	Task task;
+	while(m_pPool->m_Running) {
+		bool found = pop(&task);
+		for(uint32_t i = 1;i < numWorkers && !found;i++) {
+			found = m_pPool->m_Workers[(m_Index + i) % numWorkers]->steal(&task);
+		}
+		if(found) {
+			task.function(task.argument);
+			continue;
+		}
+
+		// announce the wait before looking at the queues again, so that a task submitted
+		// in between either is found here or sets the event.
+		atomicStore(&m_Idle, 1);
+		atomicFence();
+		found = pop(&task);
+		for(uint32_t i = 1;i < numWorkers && !found;i++) {
+			found = m_pPool->m_Workers[(m_Index + i) % numWorkers]->steal(&task);
+		}
+		if(!found && m_pPool->m_Running) {
+			m_Wakeup.Wait(WORKER_IDLE_TIMEOUT);
+		}
+		atomicStore(&m_Idle, 0);
+		if(found) {
+			task.function(task.argument);
+		}
+	}
+}
+
+WorkStealingPool::WorkStealingPool(uint32_t numThreads) :
+m_Running(true)
+{
+	if(numThreads == 0) {
+		numThreads = 1;
+	}
+	for(uint32_t i = 0;i < numThreads;i++) {
+		m_Workers.push_back(new Worker(this, i));
+	}
+	for(uint32_t i = 0;i < numThreads;i++) {
+		m_Workers[i]->Start();
+	}
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+	m_Running = false;
+	for(uint32_t i = 0;i < m_Workers.size();i++) {
+		m_Workers[i]->m_Wakeup.Set();
+	}
+	for(uint32_t i = 0;i < m_Workers.size();i++) {
+		m_Workers[i]->Join();
+	}
+	for(uint32_t i = 0;i < m_Workers.size();i++) {
+		delete m_Workers[i];
+	}
+}
+
+void WorkStealingPool::submit(const Task& task, uint32_t key)
+{
+	Worker* worker = m_Workers[key % m_Workers.size()];
+	worker->m_QueueMutex.Lock();
+	worker->m_Queue.push_back(task);
+	worker->m_QueueMutex.Unlock();
+
+	// wake up the owner, or an idle worker to steal the task from the busy owner.
+	atomicFence();
+	if(atomicLoad(&worker->m_Idle)) {
+		worker->m_Wakeup.Set();
+		return;
+	}
+	for(uint32_t i = 1;i < m_Workers.size();i++) {
+		Worker* thief = m_Workers[(key + i) % m_Workers.size()];
+		if(atomicLoad(&thief->m_Idle)) {
+			thief->m_Wakeup.Set();
+			return;
+		}
+	}
+}
@@ -12,18 +12,14 @@
 #include <string.h>
 
 #include "Timer.h"
+#include "Clock.h"
 
 using namespace pcwrapper;
 
 
-Timer::Timer(void)
+Timer::Timer(void) :
+m_Before(0), m_After(0)
 {
-#ifdef WIN32
-	memset(&m_Frequency, 0, sizeof(LARGE_INTEGER));
-	memset(&m_Before, 0, sizeof(LARGE_INTEGER));
-	memset(&m_After, 0, sizeof(LARGE_INTEGER));
-	QueryPerformanceFrequency(&m_Frequency);
-#endif
 }
 
 Timer::~Timer(void)
@@ -33,21 +29,13 @@ Timer::~Timer(void)
 
 void Timer::tick(void)
 {
-#ifdef WIN32
-	::QueryPerformanceCounter(&m_Before);	
-#else
-
-#endif
+	m_Before = net::ysuga::Clock::getInstance()->now();
 }
 
 void Timer::tack(TimeSpec* pCurrentTime)
 {
-#ifdef WIN32
-	QueryPerformanceCounter(&m_After);
-	DWORD dwTime = (DWORD)((m_After.QuadPart - m_Before.QuadPart) * 1000000 / m_Frequency.QuadPart);
-	pCurrentTime->sec =  dwTime / 1000000;
-	pCurrentTime->usec = dwTime % 1000000;
-#else
-
-#endif
-}
\ No newline at end of file
+	m_After = net::ysuga::Clock::getInstance()->now();
+	uint64_t usec = m_After - m_Before;
+	pCurrentTime->sec = (uint32_t)(usec / 1000000);
+	pCurrentTime->usec = (uint32_t)(usec % 1000000);
+}
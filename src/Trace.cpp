@@ -0,0 +1,223 @@
+#include "Trace.h"
+#include "Atomic.h"
+#include "Clock.h"
+#include "Thread.h"
+
+#include <stdio.h>
+#include <vector>
+#include <algorithm>
+
+#ifdef WIN32
+#define TRACE_THREAD_LOCAL __declspec(thread)
+#else
+#define TRACE_THREAD_LOCAL __thread
+#endif
+
+using namespace net::ysuga;
+using namespace net::ysuga::roomba;
+
+namespace {
+	struct TraceEvent {
+		uint64_t timestamp; // [usec] of net::ysuga::Clock
+		const char* name;
+		uint32_t arg;
+		uint8_t phase;
+	};
+
+	/**
+	 * Ring buffer written only by its thread. head is the number of the recorded events.
+	 */
+	struct TraceBuffer {
+		uint32_t threadId;
+		const char* threadName;
+		TraceEvent* events;
+		uint32_t mask; // capacity - 1
+		volatile uint32_t head;
+	};
+
+	/**
+	 * Events of a thread copied for the export
+	 */
+	struct TraceSnapshot {
+		uint32_t threadId;
+		const char* threadName;
+		std::vector<TraceEvent> events;
+	};
+}
+
+static volatile uint32_t g_TraceEnabled = 0;
+static volatile uint32_t g_TraceCapacity = 16384;
+static Mutex g_TraceMutex; // guards g_pTraceBuffers, g_pTraceBufferKey and the deletion of the buffers
+static std::vector<TraceBuffer*>* g_pTraceBuffers = NULL; // never deleted. the threads may exit after the static objects.
+static ThreadLocalKey* g_pTraceBufferKey = NULL; // created with g_pTraceBuffers
+static uint32_t g_TraceThreadCount = 0; // guarded by g_TraceMutex
+static TRACE_THREAD_LOCAL TraceBuffer* t_pTraceBuffer = NULL;
+static TRACE_THREAD_LOCAL const char* t_pThreadName = NULL;
+
+/**
+ * Called at the exit of the thread which has a buffer.
+ */
+#ifdef WIN32
+static void WINAPI releaseTraceBuffer(void* value)
+#else
+static void releaseTraceBuffer(void* value)
+#endif
+{
+	TraceBuffer* buffer = (TraceBuffer*)value;
+	g_TraceMutex.Lock();
+	g_pTraceBuffers->erase(std::find(g_pTraceBuffers->begin(), g_pTraceBuffers->end(), buffer));
+	g_TraceMutex.Unlock();
+	t_pTraceBuffer = NULL;
+	delete[] buffer->events;
+	delete buffer;
+}
+
+/**
+ * Buffer of the calling thread. Allocated at the first event.
+ */
+static TraceBuffer* getTraceBuffer()
+{
+	TraceBuffer* buffer = t_pTraceBuffer;
+	if(!buffer) {
+		uint32_t capacity = 1;
+		while(capacity < g_TraceCapacity) {
+			capacity <<= 1;
+		}
+		buffer = new TraceBuffer();
+		buffer->threadName = t_pThreadName;
+		buffer->events = new TraceEvent[capacity];
+		buffer->mask = capacity - 1;
+		buffer->head = 0;
+		g_TraceMutex.Lock();
+		if(!g_pTraceBuffers) {
+			g_pTraceBuffers = new std::vector<TraceBuffer*>();
+			g_pTraceBufferKey = new ThreadLocalKey(releaseTraceBuffer);
+		}
+		buffer->threadId = ++g_TraceThreadCount;
+		g_pTraceBuffers->push_back(buffer);
+		g_pTraceBufferKey->Set(buffer);
+		g_TraceMutex.Unlock();
+		t_pTraceBuffer = buffer;
+	}
+	return buffer;
+}
+
+void Tracer::enable(const uint32_t eventsPerThread /* = 16384 */)
+{
+	g_TraceCapacity = eventsPerThread < 1 ? 1 : eventsPerThread > TRACE_MAX_EVENTS_PER_THREAD ? TRACE_MAX_EVENTS_PER_THREAD : eventsPerThread;
+	atomicStore(&g_TraceEnabled, 1);
+}
+
+void Tracer::disable()
+{
+	atomicStore(&g_TraceEnabled, 0);
+}
+
+bool Tracer::isEnabled()
+{
+	return g_TraceEnabled != 0;
+}
+
+void Tracer::clear()
+{
+	g_TraceMutex.Lock();
+	for(uint32_t i = 0;g_pTraceBuffers && i < g_pTraceBuffers->size();i++) {
+		atomicStore(&(*g_pTraceBuffers)[i]->head, 0);
+	}
+	g_TraceMutex.Unlock();
+}
+
+void Tracer::record(const Phase phase, const char* name, const uint32_t arg /* = 0 */)
+{
+	TraceBuffer* buffer = getTraceBuffer();
+	uint32_t head = buffer->head;
+	TraceEvent& event = buffer->events[head & buffer->mask];
+	event.timestamp = Clock::getInstance()->now();
+	event.name = name;
+	event.arg = arg;
+	event.phase = (uint8_t)phase;
+	atomicStore(&buffer->head, head + 1);
+}
+
+void Tracer::setThreadName(const char* name)
+{
+	// the buffer is not allocated until the first event.
+	t_pThreadName = name;
+	if(t_pTraceBuffer) {
+		t_pTraceBuffer->threadName = name;
+	}
+}
+
+static void writeJsonString(FILE* fp, const char* str)
+{
+	fputc('"', fp);
+	for(;*str;str++) {
+		if(*str == '"' || *str == '\\') {
+			fputc('\\', fp);
+		}
+		fputc(*str, fp);
+	}
+	fputc('"', fp);
+}
+
+bool Tracer::writeChromeTrace(const char* filename)
+{
+	FILE* fp = fopen(filename, "w");
+	if(!fp) {
+		return false;
+	}
+
+	// copied under the lock, because an exiting thread deletes its buffer.
+	std::vector<TraceSnapshot> snapshots;
+	g_TraceMutex.Lock();
+	for(uint32_t i = 0;g_pTraceBuffers && i < g_pTraceBuffers->size();i++) {
+		TraceBuffer* buffer = (*g_pTraceBuffers)[i];
+		snapshots.push_back(TraceSnapshot());
+		snapshots.back().threadId = buffer->threadId;
+		snapshots.back().threadName = buffer->threadName;
+		std::vector<TraceEvent>& copied = snapshots.back().events;
+
+		const uint32_t capacity = buffer->mask + 1;
+		uint32_t end = atomicLoad(&buffer->head);
+		uint32_t begin = end > capacity ? end - capacity : 0;
+		for(uint32_t index = begin;index != end;index++) {
+			copied.push_back(buffer->events[index & buffer->mask]);
+		}
+		// the events up to (head - capacity) may be overwritten while copying.
+		// the copies must be complete before head is read again.
+		atomicFence();
+		uint32_t head = atomicLoad(&buffer->head);
+		uint32_t valid = head >= capacity ? head - capacity + 1 : 0;
+		if(valid > begin) {
+			copied.erase(copied.begin(), copied.begin() + (valid - begin < copied.size() ? valid - begin : copied.size()));
+		}
+	}
+	g_TraceMutex.Unlock();
+
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	const char* separator = "";
+	for(uint32_t i = 0;i < snapshots.size();i++) {
+		const TraceSnapshot& snapshot = snapshots[i];
+		if(snapshot.threadName) {
+			fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":",
+				separator, snapshot.threadId);
+			writeJsonString(fp, snapshot.threadName);
+			fprintf(fp, "}}");
+			separator = ",\n";
+		}
+
+		for(uint32_t j = 0;j < snapshot.events.size();j++) {
+			const TraceEvent& event = snapshot.events[j];
+			fprintf(fp, "%s{\"name\":", separator);
+			writeJsonString(fp, event.name);
+			fprintf(fp, ",\"ph\":\"%c\",\"ts\":%llu,\"pid\":1,\"tid\":%u,\"args\":{\"arg\":%u}%s}",
+				event.phase, (unsigned long long)event.timestamp, snapshot.threadId, event.arg,
+				event.phase == PHASE_INSTANT ? ",\"s\":\"t\"" : "");
+			separator = ",\n";
+		}
+	}
+	fprintf(fp, "\n]}\n");
+	bool ok = ferror(fp) == 0;
+	fclose(fp);
+	return ok;
+}
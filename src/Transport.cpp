@@ -1,17 +1,77 @@
 #include "Thread.h"
 #include "Transport.h"
+#include "Trace.h"
+#include "Clock.h"
+#include "Log.h"
+
+#include <string.h>
+
+/**
+ * Packets up to this size are built on the stack in TrySendPacket.
+ */
+#define MAX_STACK_PACKET_SIZE 32
+
+/**
+ * Longest wait of TxFlusher [msec]. The writable port and the queued bytes end it earlier.
+ */
+#define TX_FLUSHER_WAIT 1000
 
 using namespace net::ysuga;
 using namespace net::ysuga::roomba;
 
-Transport::Transport(const char* portName, const uint16_t baudrate)
+namespace net {
+	namespace ysuga {
+		namespace roomba {
+			/**
+			 * Writes the transmit queue when the port becomes writable. Waits for the port
+			 * in real time, so it is not a thread of the simulation.
+			 */
+			class TxFlusher : public Thread {
+			private:
+				Transport* m_pTransport;
+			public:
+				TxFlusher(Transport* pTransport) : m_pTransport(pTransport) {}
+
+				void Run() {
+					Clock::getInstance()->detachThread();
+					m_pTransport->RunTxFlusher();
+					// detached again at the end of the thread.
+					Clock::getInstance()->attachThread();
+				}
+			};
+		}
+	}
+}
+
+Transport::Transport(const char* portName, const uint16_t baudrate) :
+m_ReceiveWaitCount(0), m_LateBytes(0), m_LateDeadline(0), m_RequestsRejecting(false), m_Batching(false),
+m_TxQueueDepth(0), m_TxQueueLimit(DEFAULT_TX_QUEUE_LIMIT), m_pTxFlusher(NULL), m_pTxEvent(NULL), m_TxFlusherStopped(false)
 {
+	memset(m_TxPolicies, TX_POLICY_QUEUE, sizeof(m_TxPolicies));
 	m_pSerialPort = new SerialPort(portName, baudrate);
 }
 
+Transport::Transport(SerialPort* pSerialPort) :
+m_ReceiveWaitCount(0), m_LateBytes(0), m_LateDeadline(0), m_RequestsRejecting(false), m_Batching(false),
+m_TxQueueDepth(0), m_TxQueueLimit(DEFAULT_TX_QUEUE_LIMIT), m_pTxFlusher(NULL), m_pTxEvent(NULL), m_TxFlusherStopped(false)
+{
+	memset(m_TxPolicies, TX_POLICY_QUEUE, sizeof(m_TxPolicies));
+	m_pSerialPort = pSerialPort;
+}
+
 
 Transport::~Transport(void)
 {
+	// the last commands (e.g. of ~Roomba) still go to the robot.
+	FlushTxQueue(TX_CLOSE_TIMEOUT);
+	if(m_pTxFlusher) {
+		m_TxMutex.Lock();
+		m_TxFlusherStopped = true;
+		m_TxWakeup.Set();
+		m_TxMutex.Unlock();
+		m_pTxFlusher->Join();
+		delete m_pTxFlusher;
+	}
 	delete m_pSerialPort;
 }
 
@@ -19,24 +79,565 @@ int32_t Transport::SendPacket(uint8_t opCode,
 						  const uint8_t *dataBytes /*= NULL*/,
 						  const uint32_t dataSize /*= 0*/)
 {
-	uint8_t* buffer = new uint8_t[dataSize + 1];
+	if(TrySendPacket(opCode, dataBytes, dataSize) == TRANSPORT_ACCESS_FAILED) {
+		throw ComAccessException();
+	}
+	return 0;
+}
+
+int32_t Transport::TrySendPacket(uint8_t opCode, 
+						  const uint8_t *dataBytes /*= NULL*/,
+						  const uint32_t dataSize /*= 0*/)
+{
+	TraceScope trace("SendPacket", opCode);
+	uint8_t stackBuffer[MAX_STACK_PACKET_SIZE];
+	uint8_t* buffer = dataSize + 1 <= MAX_STACK_PACKET_SIZE ? stackBuffer : new uint8_t[dataSize + 1];
 	buffer[0] = opCode;
 	for(unsigned int i = 1;i < dataSize + 1;i++) {
 		buffer[i] = dataBytes[i-1];
 	}
-	m_pSerialPort->Write(buffer, dataSize + 1);
-	delete buffer;
+	int32_t result = 0;
+	m_TxMutex.Lock();
+	if(m_Batching) {
+		m_Batch.insert(m_Batch.end(), buffer, buffer + dataSize + 1);
+	} else {
+		result = WriteTxPacket(buffer, dataSize + 1, opCode, (TxPolicy)m_TxPolicies[opCode]);
+	}
+	m_TxMutex.Unlock();
+	if(result == 0) {
+		// queued or written. the rejected and the failed ones are not on the wire.
+		m_LinkStatistics.countTxPacket();
+	}
+	if(buffer != stackBuffer) {
+		delete[] buffer;
+	}
+	return result;
+}
+
+/**
+ * Write the packet, or queue it behind the bytes which are not written yet.
+ * m_TxMutex must be locked.
+ */
+int32_t Transport::WriteTxPacket(const uint8_t* bytes, const uint32_t size, const uint8_t opCode, const TxPolicy policy)
+{
+	// the older bytes go first.
+	if(WriteTxQueue() == TRANSPORT_ACCESS_FAILED) {
+		return TRANSPORT_ACCESS_FAILED;
+	}
+	uint32_t written = 0;
+	if(m_TxQueue.empty()) {
+		int ret = m_pSerialPort->TryWrite(bytes, size);
+		if(ret < 0) {
+			return TRANSPORT_ACCESS_FAILED;
+		}
+		m_LinkStatistics.addTxBytes(ret);
+		if((uint32_t)ret == size) {
+			return 0;
+		}
+		if(ret > 0) {
+			m_LinkStatistics.countTxPartialWrite();
+		}
+		written = ret;
+	} else if(policy == TX_POLICY_LATEST) {
+		// the robot only needs the latest one. it takes the place of the unsent one only if
+		// nothing is queued after it (e.g. a mode change), so that the order on the wire is kept.
+		// the packet being written can not be taken back.
+		TxPacket& last = m_TxQueue.back();
+		if(last.opCode == opCode && last.policy == TX_POLICY_LATEST && last.written == 0) {
+			UpdateTxQueueDepth((int32_t)size - (int32_t)last.bytes.size());
+			last.bytes.assign(bytes, bytes + size);
+			m_LinkStatistics.countTxReplaced();
+			return 0;
+		}
+	} else if(policy == TX_POLICY_REJECT && m_TxQueueDepth + size > m_TxQueueLimit) {
+		m_LinkStatistics.countTxRejected();
+		return TRANSPORT_TX_FULL;
+	}
+
+	bool wasEmpty = m_TxQueue.empty();
+	m_TxQueue.push_back(TxPacket());
+	TxPacket& packet = m_TxQueue.back();
+	packet.bytes.assign(bytes, bytes + size);
+	packet.written = written;
+	packet.opCode = opCode;
+	packet.policy = (uint8_t)policy;
+	UpdateTxQueueDepth(size - written);
+	if(!m_pTxFlusher) {
+		m_pTxFlusher = new TxFlusher(this);
+		m_pTxFlusher->Start();
+	} else if(wasEmpty) {
+		m_TxWakeup.Set();
+	}
+	return 0;
+}
+
+/**
+ * Write the queued bytes as many as the port takes. m_TxMutex must be locked.
+ */
+int32_t Transport::WriteTxQueue()
+{
+	while(!m_TxQueue.empty()) {
+		TxPacket& packet = m_TxQueue.front();
+		uint32_t rest = packet.bytes.size() - packet.written;
+		int ret = m_pSerialPort->TryWrite(&packet.bytes[packet.written], rest);
+		if(ret < 0) {
+			return TRANSPORT_ACCESS_FAILED;
+		}
+		m_LinkStatistics.addTxBytes(ret);
+		UpdateTxQueueDepth(-ret);
+		if((uint32_t)ret < rest) {
+			if(ret > 0) {
+				packet.written += ret;
+				m_LinkStatistics.countTxPartialWrite();
+			}
+			break;
+		}
+		m_TxQueue.pop_front();
+		if(m_TxQueue.empty() && m_pTxEvent) {
+			m_pTxEvent->Set();
+		}
+	}
 	return 0;
 }
 
+/**
+ * m_TxMutex must be locked.
+ */
+void Transport::UpdateTxQueueDepth(const int32_t delta)
+{
+	m_TxQueueDepth += delta;
+	m_LinkStatistics.setTxQueueDepth(m_TxQueueDepth);
+}
+
+/**
+ * Loop of TxFlusher. Writes the queue whenever the port becomes writable.
+ */
+void Transport::RunTxFlusher()
+{
+	while(1) {
+		m_TxMutex.Lock();
+		if(m_TxFlusherStopped) {
+			m_TxMutex.Unlock();
+			break;
+		}
+		// the senders wake it up when they queue the bytes into the empty queue.
+		int32_t result = WriteTxQueue();
+		bool empty = m_TxQueue.empty();
+		m_TxMutex.Unlock();
+		if(empty || result == TRANSPORT_ACCESS_FAILED) {
+			// the senders see the failure of the port, and the queue is discarded by Reopen.
+			m_TxWakeup.Wait(TX_FLUSHER_WAIT);
+		} else {
+			m_pSerialPort->WaitWritable(TX_FLUSHER_WAIT, &m_TxWakeup);
+		}
+	}
+}
+
+void Transport::SetTxPolicy(const uint8_t opCode, const TxPolicy policy)
+{
+	m_TxMutex.Lock();
+	m_TxPolicies[opCode] = (uint8_t)policy;
+	m_TxMutex.Unlock();
+}
+
+uint32_t Transport::GetTxQueueDepth()
+{
+	m_TxMutex.Lock();
+	uint32_t depth = m_TxQueueDepth;
+	m_TxMutex.Unlock();
+	return depth;
+}
+
+void Transport::SetTxEvent(Event* event)
+{
+	m_TxMutex.Lock();
+	m_pTxEvent = event;
+	m_TxMutex.Unlock();
+}
+
+bool Transport::FlushTxQueue(const uint32_t timeout)
+{
+	uint64_t deadline = Clock::getInstance()->now() + (uint64_t)timeout * 1000;
+	while(1) {
+		m_TxMutex.Lock();
+		int32_t result = WriteTxQueue();
+		bool empty = m_TxQueue.empty();
+		m_TxMutex.Unlock();
+		if(empty) {
+			return true;
+		}
+		uint64_t now = Clock::getInstance()->now();
+		if(result == TRANSPORT_ACCESS_FAILED || now >= deadline) {
+			return false;
+		}
+		m_pSerialPort->WaitWritable((uint32_t)((deadline - now + 999) / 1000), NULL);
+	}
+}
+
+void Transport::BeginBatch()
+{
+	m_TxMutex.Lock();
+	m_Batching = true;
+	m_TxMutex.Unlock();
+}
+
+void Transport::EndBatch()
+{
+	if(TryEndBatch() == TRANSPORT_ACCESS_FAILED) {
+		throw ComAccessException();
+	}
+}
+
+int32_t Transport::TryEndBatch()
+{
+	m_TxMutex.Lock();
+	std::vector<uint8_t> batch;
+	batch.swap(m_Batch);
+	m_Batching = false;
+	int32_t result = 0;
+	if(!batch.empty()) {
+		result = WriteTxPacket(&batch[0], batch.size(), batch[0], TX_POLICY_QUEUE);
+	}
+	m_TxMutex.Unlock();
+	return result;
+}
+
+
+int32_t Transport::ReceiveData(uint8_t *buffer, uint32_t requestSize, uint32_t* readBytes, const uint32_t timeout /*= 0*/,
+						   const StopToken* stopToken /*= NULL*/)
+{
+	int32_t result = TryReceiveData(buffer, requestSize, readBytes, timeout, stopToken);
+	if(result == TRANSPORT_ACCESS_FAILED) {
+		throw ComAccessException();
+	}
+	return result;
+}
 
-int32_t Transport::ReceiveData(uint8_t *buffer, uint32_t requestSize, uint32_t* readBytes)
+int32_t Transport::TryReceiveData(uint8_t *buffer, uint32_t requestSize, uint32_t* readBytes, const uint32_t timeout /*= 0*/,
+							  const StopToken* stopToken /*= NULL*/)
 {
-	uint8_t* data = new uint8_t[requestSize];
-	while ((uint32_t)m_pSerialPort->GetSizeInRxBuffer() < requestSize) {
-	  Thread::Sleep(100);
+	TraceScope trace("ReceiveData", requestSize);
+	uint64_t deadline = 0;
+	while (1) {
+	  int size = m_pSerialPort->TryGetSizeInRxBuffer();
+	  if(size < 0) {
+		  *readBytes = 0;
+		  return TRANSPORT_ACCESS_FAILED;
+	  }
+	  if((uint32_t)size >= requestSize) {
+		  break;
+	  }
+	  if(stopToken && stopToken->IsStopRequested()) {
+		  *readBytes = 0;
+		  return RECEIVE_STOPPED;
+	  }
+	  uint32_t wait = 1000;
+	  if(timeout) {
+		  uint64_t now = Clock::getInstance()->now();
+		  if(deadline == 0) {
+			  deadline = now + (uint64_t)timeout * 1000;
+		  } else if(now >= deadline) {
+			  Tracer::record(Tracer::PHASE_INSTANT, "receiveTimeout", requestSize);
+			  *readBytes = 0;
+			  return RECEIVE_TIMEOUT;
+		  }
+		  wait = (uint32_t)((deadline - now + 999) / 1000);
+	  }
+	  m_pSerialPort->WaitReadable(wait, stopToken);
+	  m_ReceiveWaitCount++;
 	}
 
-	*readBytes = m_pSerialPort->Read(buffer, requestSize);
+	int ret = m_pSerialPort->TryRead(buffer, requestSize);
+	if(ret < 0) {
+		*readBytes = 0;
+		return TRANSPORT_ACCESS_FAILED;
+	}
+	*readBytes = ret;
+	m_LinkStatistics.addRxBytes(*readBytes);
 	return 0;
 }
+
+
+int32_t Transport::Request(uint8_t opCode, const uint8_t *dataBytes, const uint32_t dataSize,
+						   uint8_t *response, const uint32_t responseSize, uint32_t* readBytes, const uint32_t timeout /*= 0*/,
+						   const StopToken* stopToken /*= NULL*/)
+{
+	int32_t result = TryRequest(opCode, dataBytes, dataSize, response, responseSize, readBytes, timeout, stopToken);
+	if(result == TRANSPORT_ACCESS_FAILED) {
+		throw ComAccessException();
+	}
+	return result;
+}
+
+int32_t Transport::TryRequest(uint8_t opCode, const uint8_t *dataBytes, const uint32_t dataSize,
+						   uint8_t *response, const uint32_t responseSize, uint32_t* readBytes, const uint32_t timeout /*= 0*/,
+						   const StopToken* stopToken /*= NULL*/)
+{
+	PendingRequest request;
+	request.response = response;
+	request.responseSize = responseSize;
+	request.timeout = timeout;
+	request.stopToken = stopToken;
+	request.onComplete = NULL;
+	request.context = NULL;
+	*readBytes = 0;
+	int32_t result = TrySubmit(opCode, dataBytes, dataSize, &request);
+	if(result != 0) {
+		return result;
+	}
+	Wait(&request);
+	*readBytes = request.readBytes;
+	return request.result;
+}
+
+void Transport::Submit(uint8_t opCode, const uint8_t *dataBytes, const uint32_t dataSize, PendingRequest* request)
+{
+	if(TrySubmit(opCode, dataBytes, dataSize, request) != 0) {
+		throw ComAccessException();
+	}
+}
+
+int32_t Transport::TrySubmit(uint8_t opCode, const uint8_t *dataBytes, const uint32_t dataSize, PendingRequest* request, const bool wait)
+{
+	request->readBytes = 0;
+	request->done = false;
+	request->result = 0;
+
+	// queue and send atomically so that the queue keeps the order on the wire.
+	m_QueueMutex.Lock();
+	while(m_LateBytes > 0) {
+		m_QueueMutex.Unlock();
+		if(wait) {
+			m_RxMutex.Lock();
+		} else if(!m_RxMutex.TryLock()) {
+			// another thread is receiving.
+			return TRANSPORT_BUSY;
+		}
+		SettleLateResponses(wait);
+		m_RxMutex.Unlock();
+		m_QueueMutex.Lock();
+		if(!wait && m_LateBytes > 0) {
+			m_QueueMutex.Unlock();
+			return TRANSPORT_BUSY;
+		}
+	}
+	request->submitTime = Clock::getInstance()->now();
+	m_PendingRequests.push_back(request);
+	int32_t result = TrySendPacket(opCode, dataBytes, dataSize);
+	if(result != 0) {
+		// nothing is on the wire. still the last one, because the queue is locked.
+		m_PendingRequests.pop_back();
+	}
+	if(result == TRANSPORT_TX_FULL) {
+		m_LinkStatistics.countRequestRejected();
+		if(!m_RequestsRejecting) {
+			// once for a congestion. the count is in the link statistics.
+			ROOMBA_LOG_WARN("Request 0x%02X rejected. %u bytes in the transmit queue.", opCode, GetTxQueueDepth());
+		}
+	}
+	m_RequestsRejecting = result == TRANSPORT_TX_FULL;
+	m_QueueMutex.Unlock();
+	return result;
+}
+
+void Transport::Wait(PendingRequest* request)
+{
+	TraceScope trace("Wait");
+	while(1) {
+		m_RxMutex.Lock();
+		if(IsDone(request)) {
+			m_RxMutex.Unlock();
+			break;
+		}
+		// The oldest request is answered first, which may be of another thread.
+		m_QueueMutex.Lock();
+		PendingRequest* head = m_PendingRequests.front();
+		m_PendingRequests.pop_front();
+		m_QueueMutex.Unlock();
+
+		Complete(head);
+		m_RxMutex.Unlock();
+	}
+}
+
+/**
+ * Receive the response of the request. m_RxMutex must be locked.
+ */
+void Transport::Complete(PendingRequest* request)
+{
+	// the failure is handed to the requester, not thrown to the thread receiving for it.
+	request->result = TryReceiveData(request->response, request->responseSize, &request->readBytes, request->timeout, request->stopToken);
+	if(request->result == 0) {
+		m_LinkStatistics.recordRoundTrip((uint32_t)(Clock::getInstance()->now() - request->submitTime));
+		Finish(request);
+		return;
+	}
+	Fail(request, request->result);
+}
+
+/**
+ * Fail the request taken from the queue, and the requests behind it. m_RxMutex must be locked.
+ */
+void Transport::Fail(PendingRequest* request, const int32_t result)
+{
+	request->result = result;
+	request->readBytes = 0;
+
+	// the response may still arrive, followed by the responses of the requests behind it.
+	// they can not be told apart, so all of them fail and their bytes are discarded.
+	std::deque<PendingRequest*> failed;
+	m_QueueMutex.Lock();
+	failed.swap(m_PendingRequests);
+	m_LateBytes += request->responseSize;
+	for(uint32_t i = 0;i < failed.size();i++) {
+		m_LateBytes += failed[i]->responseSize;
+	}
+	m_LateDeadline = Clock::getInstance()->now() + (uint64_t)LATE_RESPONSE_TIMEOUT * 1000;
+	m_QueueMutex.Unlock();
+
+	Finish(request);
+	for(uint32_t i = 0;i < failed.size();i++) {
+		failed[i]->result = result;
+		failed[i]->readBytes = 0;
+		Finish(failed[i]);
+	}
+}
+
+/**
+ * Hand the result to the requester.
+ */
+void Transport::Finish(PendingRequest* request)
+{
+	if(request->onComplete) {
+		request->onComplete(request->context);
+	}
+	m_QueueMutex.Lock();
+	request->done = true;
+	m_QueueMutex.Unlock();
+}
+
+/**
+ * Discard the late responses of the failed requests. Called before the next request is
+ * sent, so that no response can be mixed with them. The bytes which do not arrive until
+ * LATE_RESPONSE_TIMEOUT after the failure are given up, with anything in the Rx Buffer.
+ * m_RxMutex must be locked.
+ *
+ * @param wait false to discard only the bytes already received.
+ */
+void Transport::SettleLateResponses(const bool wait)
+{
+	while(1) {
+		m_QueueMutex.Lock();
+		uint32_t lateBytes = m_LateBytes;
+		uint64_t deadline = m_LateDeadline;
+		m_QueueMutex.Unlock();
+		if(lateBytes == 0) {
+			break;
+		}
+
+		int size = m_pSerialPort->TryGetSizeInRxBuffer();
+		if(size > 0) {
+			uint8_t buffer[64];
+			uint32_t discardSize = (uint32_t)size < lateBytes ? size : lateBytes;
+			int ret = m_pSerialPort->TryRead(buffer, discardSize < sizeof(buffer) ? discardSize : sizeof(buffer));
+			if(ret > 0) {
+				m_LinkStatistics.addRxBytes(ret);
+				m_QueueMutex.Lock();
+				m_LateBytes -= ret;
+				m_QueueMutex.Unlock();
+				continue;
+			}
+		}
+		uint64_t now = Clock::getInstance()->now();
+		if(size < 0 || now >= deadline) {
+			try {
+				m_pSerialPort->FlushRxBuffer();
+			} catch (ComException& e) {
+				// the port is broken. the next request sees it.
+			}
+			m_QueueMutex.Lock();
+			m_LateBytes = 0;
+			m_QueueMutex.Unlock();
+			break;
+		}
+		if(!wait) {
+			break;
+		}
+		m_pSerialPort->WaitReadable((uint32_t)((deadline - now + 999) / 1000), NULL);
+	}
+}
+
+bool Transport::HasLateResponses()
+{
+	MutexGuard guard(m_QueueMutex);
+	return m_LateBytes > 0;
+}
+
+void Transport::Reopen()
+{
+	m_TxMutex.Lock();
+	// the bytes are of the old connection. the partially written packet is lost anyway.
+	m_TxQueue.clear();
+	UpdateTxQueueDepth(-(int32_t)m_TxQueueDepth);
+	if(m_pTxEvent) {
+		m_pTxEvent->Set();
+	}
+	try {
+		m_pSerialPort->Reopen();
+	} catch (...) {
+		m_TxMutex.Unlock();
+		throw;
+	}
+	m_TxMutex.Unlock();
+}
+
+bool Transport::Progress()
+{
+	if(!m_RxMutex.TryLock()) {
+		// another thread is receiving.
+		return false;
+	}
+	SettleLateResponses(false);
+	bool progressed = false;
+	while(1) {
+		m_QueueMutex.Lock();
+		PendingRequest* head = NULL;
+		int32_t expired = 0;
+		if(!m_PendingRequests.empty()) {
+			head = m_PendingRequests.front();
+			if(m_pSerialPort->TryGetSizeInRxBuffer() >= (int)head->responseSize) {
+				m_PendingRequests.pop_front();
+			} else if(head->stopToken && head->stopToken->IsStopRequested()) {
+				expired = RECEIVE_STOPPED;
+			} else if(head->timeout && Clock::getInstance()->now() - head->submitTime >= (uint64_t)head->timeout * 1000) {
+				expired = RECEIVE_TIMEOUT;
+			} else {
+				head = NULL;
+			}
+			if(expired) {
+				m_PendingRequests.pop_front();
+			}
+		}
+		m_QueueMutex.Unlock();
+		if(!head) {
+			break;
+		}
+		if(expired) {
+			Tracer::record(Tracer::PHASE_INSTANT, "receiveTimeout", head->responseSize);
+			Fail(head, expired);
+		} else {
+			Complete(head);
+		}
+		progressed = true;
+	}
+	m_RxMutex.Unlock();
+	return progressed;
+}
+
+bool Transport::IsDone(PendingRequest* request)
+{
+	m_QueueMutex.Lock();
+	bool done = request->done;
+	m_QueueMutex.Unlock();
+	return done;
+}